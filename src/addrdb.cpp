@@ -8,6 +8,7 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "dbwrapper.h"
 #include "fs.h"
 #include "hash.h"
 #include "random.h"
@@ -15,6 +16,13 @@
 #include "tinyformat.h"
 #include "util.h"
 
+static const char DB_ADDR_KEY = 'K';
+static const char DB_ADDR_ENTRY = 'e';
+static const char DB_ADDR_NEW_BUCKET = 'n';
+static const char DB_ADDR_TRIED_BUCKET = 't';
+
+static const size_t ADDR_DB_CACHE_SIZE = 1 << 20;
+
 namespace {
 
 template <typename Stream, typename Data>
@@ -123,16 +131,104 @@ bool CBanDB::Read(banmap_t& banSet)
 CAddrDB::CAddrDB()
 {
     pathAddr = GetDataDir() / "peers.dat";
+    pathDB = GetDataDir() / "peers";
+}
+
+CAddrDB::~CAddrDB()
+{
+}
+
+void CAddrDB::OpenDB()
+{
+    if (!db) {
+        db.reset(new CDBWrapper(pathDB, ADDR_DB_CACHE_SIZE));
+    }
 }
 
-bool CAddrDB::Write(const CAddrMan& addr)
+bool CAddrDB::Write(CAddrMan& addr)
 {
-    return SerializeFileDB("peers", pathAddr, addr);
+    CAddrManChanges changes;
+    addr.GetChanges(changes);
+
+    try {
+        OpenDB();
+        CDBBatch batch(*db);
+        if (changes.fAll) {
+            std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+            for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+                batch.Erase(pcursor->GetKey());
+            }
+            batch.Write(DB_ADDR_KEY, changes.nKey);
+        }
+        for (const CAddrInfo& info : changes.vEntries) {
+            batch.Write(std::make_pair(DB_ADDR_ENTRY, (CService)info), info);
+        }
+        for (const CService& addrErased : changes.vErased) {
+            batch.Erase(std::make_pair(DB_ADDR_ENTRY, addrErased));
+        }
+        for (const auto& bucket : changes.mapNewBuckets) {
+            if (bucket.second.empty()) {
+                batch.Erase(std::make_pair(DB_ADDR_NEW_BUCKET, bucket.first));
+            } else {
+                batch.Write(std::make_pair(DB_ADDR_NEW_BUCKET, bucket.first), bucket.second);
+            }
+        }
+        for (const auto& bucket : changes.mapTriedBuckets) {
+            if (bucket.second.empty()) {
+                batch.Erase(std::make_pair(DB_ADDR_TRIED_BUCKET, bucket.first));
+            } else {
+                batch.Write(std::make_pair(DB_ADDR_TRIED_BUCKET, bucket.first), bucket.second);
+            }
+        }
+        db->WriteBatch(batch, true);
+    } catch (const std::exception& e) {
+        // the changes were taken from addrman, have everything written next time
+        addr.MarkAllDirty();
+        return error("%s: %s", __func__, e.what());
+    }
+
+    LogPrint(BCLog::ADDRMAN, "%s: wrote %d entries, erased %d, wrote %d new and %d tried buckets%s\n", __func__,
+        changes.vEntries.size(), changes.vErased.size(), changes.mapNewBuckets.size(), changes.mapTriedBuckets.size(),
+        changes.fAll ? " (all)" : "");
+    return true;
 }
 
 bool CAddrDB::Read(CAddrMan& addr)
 {
-    return DeserializeFileDB(pathAddr, addr);
+    CAddrManChanges stored;
+    try {
+        OpenDB();
+        if (!db->Read(DB_ADDR_KEY, stored.nKey)) {
+            // nothing written yet, start from the older file
+            return DeserializeFileDB(pathAddr, addr);
+        }
+
+        std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            CDataStream ssKey = pcursor->GetKey();
+            char chType;
+            ssKey >> chType;
+            if (chType == DB_ADDR_ENTRY) {
+                CAddrInfo info;
+                if (!pcursor->GetValue(info))
+                    return error("%s: failed to read an entry", __func__);
+                stored.vEntries.push_back(info);
+            } else if (chType == DB_ADDR_NEW_BUCKET || chType == DB_ADDR_TRIED_BUCKET) {
+                int nBucket;
+                ssKey >> nBucket;
+                std::vector<CService> vAddr;
+                if (!pcursor->GetValue(vAddr))
+                    return error("%s: failed to read bucket %d", __func__, nBucket);
+                (chType == DB_ADDR_NEW_BUCKET ? stored.mapNewBuckets : stored.mapTriedBuckets)[nBucket] = std::move(vAddr);
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    stored.fAll = true;
+    addr.Load(stored);
+    return true;
 }
 
 bool CAddrDB::Read(CAddrMan& addr, CDataStream& ssPeers)
@@ -11,10 +11,12 @@
 
 #include <string>
 #include <map>
+#include <memory>
 
 class CSubNet;
 class CAddrMan;
 class CDataStream;
+class CDBWrapper;
 
 typedef enum BanReason
 {
@@ -76,14 +78,23 @@ public:
 
 typedef std::map<CSubNet, CBanEntry> banmap_t;
 
-/** Access to the (IP) address database (peers.dat) */
+/**
+ * Access to the (IP) address database. Entries and the contents of each bucket are separate records of the
+ * peers leveldb, so that a write only touches what changed since the previous one. peers.dat, which holds
+ * the whole table, is only read if there is no such database yet.
+ */
 class CAddrDB
 {
 private:
     fs::path pathAddr;
+    fs::path pathDB;
+    std::unique_ptr<CDBWrapper> db;
+
+    void OpenDB();
 public:
     CAddrDB();
-    bool Write(const CAddrMan& addr);
+    ~CAddrDB();
+    bool Write(CAddrMan& addr);
     bool Read(CAddrMan& addr);
     static bool Read(CAddrMan& addr, CDataStream& ssPeers);
 };
@@ -65,14 +65,18 @@ double CAddrInfo::GetChance(int64_t nNow) const
     return fChance;
 }
 
-CAddrInfo* CAddrMan::Find(const CService& addr, int* pnId)
+CService CAddrMan::GetMapKey(const CService& addr) const
 {
     CService addr2 = addr;
     if (!discriminatePorts) {
         addr2.SetPort(0);
     }
+    return addr2;
+}
 
-    std::map<CService, int>::iterator it = mapAddr.find(addr2);
+CAddrInfo* CAddrMan::Find(const CService& addr, int* pnId)
+{
+    std::map<CService, int>::iterator it = mapAddr.find(GetMapKey(addr));
     if (it == mapAddr.end())
         return nullptr;
     if (pnId)
@@ -85,16 +89,15 @@ CAddrInfo* CAddrMan::Find(const CService& addr, int* pnId)
 
 CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, int* pnId)
 {
-    CService addr2 = addr;
-    if (!discriminatePorts) {
-        addr2.SetPort(0);
-    }
+    CService addr2 = GetMapKey(addr);
 
     int nId = nIdCount++;
     mapInfo[nId] = CAddrInfo(addr, addrSource);
     mapAddr[addr2] = nId;
+    setDirtyAddr.insert(addr2);
     mapInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    nUpdates++;
     if (pnId)
         *pnId = nId;
     return &mapInfo[nId];
@@ -127,16 +130,15 @@ void CAddrMan::Delete(int nId)
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
-    CService addr = info;
-    if (!discriminatePorts) {
-        addr.SetPort(0);
-    }
+    CService addr = GetMapKey(info);
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
     mapAddr.erase(addr);
+    setDirtyAddr.insert(addr);
     mapInfo.erase(nId);
     nNew--;
+    nUpdates++;
 }
 
 void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
@@ -148,6 +150,8 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
         vvNew[nUBucket][nUBucketPos] = -1;
+        setDirtyNew.insert(nUBucket);
+        nUpdates++;
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
         }
@@ -162,6 +166,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
         if (vvNew[bucket][pos] == nId) {
             vvNew[bucket][pos] = -1;
             info.nRefCount--;
+            setDirtyNew.insert(bucket);
         }
     }
     nNew--;
@@ -193,13 +198,16 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
         vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        setDirtyNew.insert(nUBucket);
         nNew++;
     }
     assert(vvTried[nKBucket][nKBucketPos] == -1);
 
     vvTried[nKBucket][nKBucketPos] = nId;
+    setDirtyTried.insert(nKBucket);
     nTried++;
     info.fInTried = true;
+    nUpdates++;
 }
 
 void CAddrMan::Good_(const CService& addr, int64_t nTime)
@@ -224,6 +232,8 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     info.nLastSuccess = nTime;
     info.nLastTry = nTime;
     info.nAttempts = 0;
+    setDirtyAddr.insert(GetMapKey(info));
+    UpdateSnapshot_(info);
     // nTime is not updated here, to avoid leaking information about
     // currently-connected peers.
 
@@ -274,11 +284,18 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         // periodically update nTime
         bool fCurrentlyOnline = (GetAdjustedTime() - addr.nTime < 24 * 60 * 60);
         int64_t nUpdateInterval = (fCurrentlyOnline ? 60 * 60 : 24 * 60 * 60);
-        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty))
+        if (addr.nTime && (!pinfo->nTime || pinfo->nTime < addr.nTime - nUpdateInterval - nTimePenalty)) {
             pinfo->nTime = std::max((int64_t)0, addr.nTime - nTimePenalty);
+            setDirtyAddr.insert(GetMapKey(*pinfo));
+            UpdateSnapshot_(*pinfo);
+        }
 
         // add services
-        pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+        if ((pinfo->nServices | addr.nServices) != pinfo->nServices) {
+            pinfo->nServices = ServiceFlags(pinfo->nServices | addr.nServices);
+            setDirtyAddr.insert(GetMapKey(*pinfo));
+            UpdateSnapshot_(*pinfo);
+        }
 
         // do not update if no new information is present
         if (!addr.nTime || (pinfo->nTime && addr.nTime <= pinfo->nTime))
@@ -320,6 +337,8 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
             vvNew[nUBucket][nUBucketPos] = nId;
+            setDirtyNew.insert(nUBucket);
+            nUpdates++;
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -348,54 +367,126 @@ void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
     if (fCountFailure && info.nLastCountAttempt < nLastGood) {
         info.nLastCountAttempt = nTime;
         info.nAttempts++;
+        setDirtyAddr.insert(GetMapKey(info));
     }
+    UpdateSnapshot_(info);
 }
 
-CAddrInfo CAddrMan::Select_(bool newOnly)
+CAddrInfo CAddrManSnapshot::GetInfo(int nPos) const
 {
-    if (size() == 0)
-        return CAddrInfo();
+    CAddrInfo info = vInfo[nPos];
+    const CEntryState& state = vState[nPos];
+    info.nTime = state.nTime.load(std::memory_order_relaxed);
+    info.nServices = ServiceFlags(state.nServices.load(std::memory_order_relaxed));
+    info.nLastTry = state.nLastTry.load(std::memory_order_relaxed);
+    info.nLastSuccess = state.nLastSuccess.load(std::memory_order_relaxed);
+    info.nAttempts = state.nAttempts.load(std::memory_order_relaxed);
+    return info;
+}
 
-    if (newOnly && nNew == 0)
-        return CAddrInfo();
+bool CAddrManSnapshot::HasAtPosition(const CAddrInfo& info) const
+{
+    return info.nRandomPos >= 0 && info.nRandomPos < (int)vInfo.size() && (CService)vInfo[info.nRandomPos] == (CService)info;
+}
 
-    // Use a 50% chance for choosing between tried and new table entries.
-    if (!newOnly &&
-       (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) { 
-        // use a tried node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.randbits(ADDRMAN_TRIED_BUCKET_COUNT_LOG2)) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
+void CAddrManSnapshot::SetState(const CAddrInfo& info)
+{
+    CEntryState& state = vState[info.nRandomPos];
+    state.nTime.store(info.nTime, std::memory_order_relaxed);
+    state.nServices.store(info.nServices, std::memory_order_relaxed);
+    state.nLastTry.store(info.nLastTry, std::memory_order_relaxed);
+    state.nLastSuccess.store(info.nLastSuccess, std::memory_order_relaxed);
+    state.nAttempts.store(info.nAttempts, std::memory_order_relaxed);
+}
+
+std::shared_ptr<CAddrManSnapshot> CAddrMan::MakeSnapshot_() const
+{
+    std::shared_ptr<CAddrManSnapshot> snap = std::make_shared<CAddrManSnapshot>();
+    snap->nUpdates = nUpdates;
+    snap->nTimeMade = GetTimeMillis();
+
+    // entries are stored at their position in vRandom, so the buckets can refer to them by nRandomPos
+    snap->vInfo.reserve(vRandom.size());
+    for (int nId : vRandom) {
+        snap->vInfo.push_back(mapInfo.at(nId));
+    }
+    snap->vState = std::vector<CAddrManSnapshot::CEntryState>(snap->vInfo.size());
+    for (const CAddrInfo& info : snap->vInfo) {
+        snap->SetState(info);
+    }
+    snap->vNewSlots.reserve(nNew);
+    for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if (vvNew[bucket][i] != -1) {
+                snap->vNewSlots.push_back(mapInfo.at(vvNew[bucket][i]).nRandomPos);
             }
-            int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
         }
-    } else {
-        // use a new node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.randbits(ADDRMAN_NEW_BUCKET_COUNT_LOG2)) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
+    }
+    snap->vTriedSlots.reserve(nTried);
+    for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if (vvTried[bucket][i] != -1) {
+                snap->vTriedSlots.push_back(mapInfo.at(vvTried[bucket][i]).nRandomPos);
             }
-            int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
         }
     }
+    return snap;
+}
+
+void CAddrMan::UpdateSnapshot_(const CAddrInfo& info)
+{
+    // An outdated copy may still be used for a while, so keep the entries it has at the same position current
+    std::shared_ptr<CAddrManSnapshot> snap = std::atomic_load(&snapshot);
+    if (snap && snap->HasAtPosition(info)) {
+        snap->SetState(info);
+    }
+}
+
+bool CAddrMan::IsSnapshotOutdated(const CAddrManSnapshot& snap) const
+{
+    if (snap.nUpdates == nUpdates) {
+        return false;
+    }
+    // don't let the first addresses wait for the copy to age
+    return snap.vInfo.empty() || GetTimeMillis() - snap.nTimeMade >= nSnapshotMaxAge;
+}
+
+std::shared_ptr<const CAddrManSnapshot> CAddrMan::GetSnapshot()
+{
+    std::shared_ptr<CAddrManSnapshot> snap = std::atomic_load(&snapshot);
+    if (snap && !IsSnapshotOutdated(*snap)) {
+        return snap;
+    }
+
+    LOCK(cs);
+    // another reader may have made the copy while we were waiting for cs
+    snap = std::atomic_load(&snapshot);
+    if (!snap || IsSnapshotOutdated(*snap)) {
+        snap = MakeSnapshot_();
+        std::atomic_store(&snapshot, snap);
+    }
+    return snap;
+}
+
+CAddrInfo CAddrMan::Select_(const CAddrManSnapshot& snap, bool newOnly)
+{
+    if (snap.vInfo.empty())
+        return CAddrInfo();
+
+    if (newOnly && snap.vNewSlots.empty())
+        return CAddrInfo();
+
+    // Use a 50% chance for choosing between tried and new table entries. Every occupied position in the chosen
+    // table is equally likely, so new entries that are in several buckets are picked more often.
+    const std::vector<int>& vSlots = (!newOnly && !snap.vTriedSlots.empty() && (snap.vNewSlots.empty() || RandomInt(2) == 0)) ?
+                                     snap.vTriedSlots : snap.vNewSlots;
+    double fChanceFactor = 1.0;
+    while (1) {
+        CAddrInfo info = snap.GetInfo(vSlots[RandomInt(vSlots.size())]);
+        if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            return info;
+        fChanceFactor *= 1.2;
+    }
 }
 
 #ifdef DEBUG_ADDRMAN
@@ -476,22 +567,25 @@ int CAddrMan::Check_()
 }
 #endif
 
-void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
+void CAddrMan::GetAddr_(const CAddrManSnapshot& snap, std::vector<CAddress>& vAddr)
 {
-    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * vRandom.size() / 100;
+    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * snap.vInfo.size() / 100;
     if (nNodes > ADDRMAN_GETADDR_MAX)
         nNodes = ADDRMAN_GETADDR_MAX;
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
+    // gather a list of random nodes, skipping those of low quality; the snapshot is shared, so shuffle positions
+    std::vector<int> vPos(snap.vInfo.size());
+    for (unsigned int n = 0; n < vPos.size(); n++) {
+        vPos[n] = n;
+    }
+    for (unsigned int n = 0; n < vPos.size(); n++) {
         if (vAddr.size() >= nNodes)
             break;
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+        int nRndPos = RandomInt(vPos.size() - n) + n;
+        std::swap(vPos[n], vPos[nRndPos]);
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
+        CAddrInfo ai = snap.GetInfo(vPos[n]);
         if (!ai.IsTerrible())
             vAddr.push_back(ai);
     }
@@ -513,8 +607,11 @@ void CAddrMan::Connected_(const CService& addr, int64_t nTime)
 
     // update info
     int64_t nUpdateInterval = 20 * 60;
-    if (nTime - info.nTime > nUpdateInterval)
+    if (nTime - info.nTime > nUpdateInterval) {
         info.nTime = nTime;
+        setDirtyAddr.insert(GetMapKey(info));
+        UpdateSnapshot_(info);
+    }
 }
 
 void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
@@ -532,7 +629,11 @@ void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
         return;
 
     // update info
-    info.nServices = nServices;
+    if (info.nServices != nServices) {
+        info.nServices = nServices;
+        setDirtyAddr.insert(GetMapKey(info));
+        UpdateSnapshot_(info);
+    }
 }
 
 CAddrInfo CAddrMan::GetAddressInfo_(const CService& addr)
@@ -552,6 +653,131 @@ CAddrInfo CAddrMan::GetAddressInfo_(const CService& addr)
     return *pinfo;
 }
 
+void CAddrMan::Load(const CAddrManChanges& stored)
+{
+    LOCK(cs);
+
+    Clear();
+    nKey = stored.nKey;
+
+    for (const CAddrInfo& entry : stored.vEntries) {
+        CService addr = GetMapKey(entry);
+        if (mapAddr.count(addr))
+            continue;
+        int nId = nIdCount++;
+        CAddrInfo& info = mapInfo[nId];
+        info = entry;
+        info.nRandomPos = vRandom.size();
+        vRandom.push_back(nId);
+        mapAddr[addr] = nId;
+    }
+
+    // Place entries in the buckets they were stored in, as long as those are still the right ones for them.
+    for (const auto& bucket : stored.mapTriedBuckets) {
+        for (const CService& addr : bucket.second) {
+            int nId;
+            CAddrInfo* pinfo = Find(addr, &nId);
+            if (!pinfo || pinfo->fInTried || pinfo->GetTriedBucket(nKey) != bucket.first)
+                continue;
+            int nKBucketPos = pinfo->GetBucketPosition(nKey, false, bucket.first);
+            if (vvTried[bucket.first][nKBucketPos] != -1)
+                continue;
+            vvTried[bucket.first][nKBucketPos] = nId;
+            pinfo->fInTried = true;
+            nTried++;
+        }
+    }
+    for (const auto& bucket : stored.mapNewBuckets) {
+        if (bucket.first < 0 || bucket.first >= ADDRMAN_NEW_BUCKET_COUNT)
+            continue;
+        for (const CService& addr : bucket.second) {
+            int nId;
+            CAddrInfo* pinfo = Find(addr, &nId);
+            if (!pinfo || pinfo->fInTried || pinfo->nRefCount == ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
+                continue;
+            int nUBucketPos = pinfo->GetBucketPosition(nKey, true, bucket.first);
+            if (vvNew[bucket.first][nUBucketPos] != -1)
+                continue;
+            vvNew[bucket.first][nUBucketPos] = nId;
+            pinfo->nRefCount++;
+        }
+    }
+    nNew = vRandom.size() - nTried;
+    fDirtyAll = false;
+
+    // Delete entries that are in no bucket, which also has them erased from the stored ones.
+    int nLost = 0;
+    for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        if (it->second.fInTried == false && it->second.nRefCount == 0) {
+            std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+            Delete(itCopy->first);
+            nLost++;
+        } else {
+            it++;
+        }
+    }
+    if (nLost > 0) {
+        LogPrint(BCLog::ADDRMAN, "addrman lost %i addresses that were in no bucket\n", nLost);
+    }
+
+    Check();
+}
+
+void CAddrMan::GetChanges(CAddrManChanges& changes)
+{
+    LOCK(cs);
+
+    changes.fAll = fDirtyAll;
+    changes.nKey = nKey;
+    if (fDirtyAll) {
+        for (const auto& entry : mapAddr) {
+            setDirtyAddr.insert(entry.first);
+        }
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+            setDirtyNew.insert(bucket);
+        }
+        for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+            setDirtyTried.insert(bucket);
+        }
+    }
+
+    for (const CService& addr : setDirtyAddr) {
+        std::map<CService, int>::const_iterator it = mapAddr.find(addr);
+        if (it != mapAddr.end()) {
+            changes.vEntries.push_back(mapInfo.at(it->second));
+        } else if (!fDirtyAll) {
+            changes.vErased.push_back(addr);
+        }
+    }
+    for (int bucket : setDirtyNew) {
+        std::vector<CService> vAddr;
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if (vvNew[bucket][i] != -1) {
+                vAddr.push_back(mapInfo.at(vvNew[bucket][i]));
+            }
+        }
+        if (!fDirtyAll || !vAddr.empty()) {
+            changes.mapNewBuckets.emplace(bucket, std::move(vAddr));
+        }
+    }
+    for (int bucket : setDirtyTried) {
+        std::vector<CService> vAddr;
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if (vvTried[bucket][i] != -1) {
+                vAddr.push_back(mapInfo.at(vvTried[bucket][i]));
+            }
+        }
+        if (!fDirtyAll || !vAddr.empty()) {
+            changes.mapTriedBuckets.emplace(bucket, std::move(vAddr));
+        }
+    }
+
+    fDirtyAll = false;
+    setDirtyNew.clear();
+    setDirtyTried.clear();
+    setDirtyAddr.clear();
+}
+
 int CAddrMan::RandomInt(int nMax){
     return GetRandInt(nMax);
 }
\ No newline at end of file
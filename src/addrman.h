@@ -13,7 +13,9 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <vector>
@@ -52,6 +54,7 @@ private:
     int nRandomPos;
 
     friend class CAddrMan;
+    friend struct CAddrManSnapshot;
 
 public:
 
@@ -112,7 +115,7 @@ public:
 /** Stochastic address manager
  *
  * Design goals:
- *  * Keep the address tables in-memory, and asynchronously dump the entire table to peers.dat.
+ *  * Keep the address tables in-memory, and asynchronously persist the entries and buckets that changed.
  *  * Make sure no (localized) attacker can fill the entire table with his nodes/addresses.
  *
  * To that end:
@@ -133,6 +136,9 @@ public:
  *      be observable by adversaries.
  *    * Several indexes are kept for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
  *      consistency checks for the entire data structure.
+ *  * Changes are applied under a single lock, one batch (e.g. all addresses of an addr message) at a time. Select and
+ *    GetAddr, which the connection threads call in loops, work on an immutable copy of the tables instead, which is
+ *    made again by the first reader after a change.
  */
 
 //! total number of buckets for tried addresses
@@ -171,11 +177,69 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+//! how long (in milliseconds) Select and GetAddr keep using a copy of the tables that misses added, removed or moved entries
+#define ADDRMAN_SNAPSHOT_MAX_AGE 5000
+
 //! Convenience
 #define ADDRMAN_TRIED_BUCKET_COUNT (1 << ADDRMAN_TRIED_BUCKET_COUNT_LOG2)
 #define ADDRMAN_NEW_BUCKET_COUNT (1 << ADDRMAN_NEW_BUCKET_COUNT_LOG2)
 #define ADDRMAN_BUCKET_SIZE (1 << ADDRMAN_BUCKET_SIZE_LOG2)
 
+/**
+ * Copy of the address tables that Select and GetAddr read without holding CAddrMan::cs. Changes to an entry that
+ * stays at its position are applied in place. Added, removed or moved entries only show up once the copy is made
+ * again, which happens at most every ADDRMAN_SNAPSHOT_MAX_AGE milliseconds.
+ */
+struct CAddrManSnapshot
+{
+    //! Fields of an entry that change while it stays in its buckets, updated under CAddrMan::cs
+    struct CEntryState
+    {
+        std::atomic<unsigned int> nTime{0};
+        std::atomic<uint64_t> nServices{0};
+        std::atomic<int64_t> nLastTry{0};
+        std::atomic<int64_t> nLastSuccess{0};
+        std::atomic<int> nAttempts{0};
+    };
+
+    //! CAddrMan::nUpdates when the copy was made
+    uint64_t nUpdates;
+    //! GetTimeMillis() when the copy was made
+    int64_t nTimeMade;
+    //! all entries, in the order of CAddrMan::vRandom
+    std::vector<CAddrInfo> vInfo;
+    //! current state of each entry in vInfo
+    std::vector<CEntryState> vState;
+    //! index in vInfo for each occupied position in the "new", respectively "tried" buckets
+    std::vector<int> vNewSlots;
+    std::vector<int> vTriedSlots;
+
+    //! The entry at nPos with its current state.
+    CAddrInfo GetInfo(int nPos) const;
+
+    //! Store the state of an entry, which must be at the same position as when the copy was made.
+    void SetState(const CAddrInfo& info);
+
+    //! Whether an entry is still at the same position as when the copy was made.
+    bool HasAtPosition(const CAddrInfo& info) const;
+};
+
+/** Entries and buckets of a CAddrMan to persist, keyed by full address */
+struct CAddrManChanges
+{
+    //! all entries and non-empty buckets are included, anything stored before has to be replaced
+    bool fAll;
+    uint256 nKey;
+    std::vector<CAddrInfo> vEntries;
+    //! entries deleted since they were last persisted
+    std::vector<CService> vErased;
+    //! contents of the "new", respectively "tried" buckets, empty if the bucket was emptied
+    std::map<int, std::vector<CService>> mapNewBuckets;
+    std::map<int, std::vector<CService>> mapTriedBuckets;
+
+    CAddrManChanges() : fAll(false) {}
+};
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -215,12 +279,31 @@ private:
     // discriminate entries based on port. Should be false on mainnet/testnet and can be true on devnet/regtest
     bool discriminatePorts;
 
+    //! number of times entries were added, removed or moved between buckets, incremented under cs
+    std::atomic<uint64_t> nUpdates;
+
+    //! latest copy of the tables, only replaced or updated under cs and read with std::atomic_load
+    std::shared_ptr<CAddrManSnapshot> snapshot;
+
+    //! everything has to be persisted again, e.g. because nKey changed
+    bool fDirtyAll;
+
+    //! "new" and "tried" buckets whose contents changed since they were last persisted
+    std::set<int> setDirtyNew;
+    std::set<int> setDirtyTried;
+
+    //! entries (keyed as in mapAddr) that changed or were deleted since they were last persisted
+    std::set<CService> setDirtyAddr;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
 
-    //! Source of random numbers for randomization in inner loops
-    FastRandomContext insecure_rand;
+    //! see ADDRMAN_SNAPSHOT_MAX_AGE
+    int64_t nSnapshotMaxAge;
+
+    //! Key of an address in mapAddr.
+    CService GetMapKey(const CService& addr) const;
 
     //! Find an entry.
     CAddrInfo* Find(const CService& addr, int *pnId = nullptr);
@@ -250,8 +333,20 @@ protected:
     //! Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, bool fCountFailure, int64_t nTime);
 
+    //! Copy the tables for Select and GetAddr.
+    std::shared_ptr<CAddrManSnapshot> MakeSnapshot_() const;
+
+    //! Apply a change of an entry that did not move it between buckets to the current copy of the tables.
+    void UpdateSnapshot_(const CAddrInfo& info);
+
+    //! Whether a copy of the tables has to be made again before it is used.
+    bool IsSnapshotOutdated(const CAddrManSnapshot& snap) const;
+
+    //! Get a copy of the tables, which may miss entries added, removed or moved in the last nSnapshotMaxAge milliseconds.
+    std::shared_ptr<const CAddrManSnapshot> GetSnapshot();
+
     //! Select an address to connect to, if newOnly is set to true, only the new table is selected from.
-    CAddrInfo Select_(bool newOnly);
+    CAddrInfo Select_(const CAddrManSnapshot& snap, bool newOnly);
 
     //! Wraps GetRandInt to allow tests to override RandomInt and make it determinismistic.
     virtual int RandomInt(int nMax);
@@ -262,7 +357,7 @@ protected:
 #endif
 
     //! Select several addresses at once.
-    void GetAddr_(std::vector<CAddress> &vAddr);
+    void GetAddr_(const CAddrManSnapshot& snap, std::vector<CAddress> &vAddr);
 
     //! Mark an entry as currently-connected-to.
     void Connected_(const CService &addr, int64_t nTime);
@@ -461,6 +556,8 @@ public:
 
     void Clear()
     {
+        nUpdates++;
+        std::atomic_store(&snapshot, std::shared_ptr<CAddrManSnapshot>());
         std::vector<int>().swap(vRandom);
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
@@ -480,10 +577,29 @@ public:
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
         mapInfo.clear();
         mapAddr.clear();
+        fDirtyAll = true;
+        setDirtyNew.clear();
+        setDirtyTried.clear();
+        setDirtyAddr.clear();
+    }
+
+    //! Replace the tables with persisted ones, as returned by GetChanges with fAll set.
+    void Load(const CAddrManChanges& stored);
+
+    //! Collect the entries and buckets that changed since the last call, they are no longer dirty afterwards.
+    void GetChanges(CAddrManChanges& changes);
+
+    //! Have everything persisted with the next GetChanges, e.g. because persisting the last changes failed.
+    void MarkAllDirty()
+    {
+        LOCK(cs);
+        fDirtyAll = true;
     }
 
     CAddrMan(bool _discriminatePorts = false) :
-        discriminatePorts(_discriminatePorts)
+        discriminatePorts(_discriminatePorts),
+        nUpdates(0),
+        nSnapshotMaxAge(ADDRMAN_SNAPSHOT_MAX_AGE)
     {
         Clear();
     }
@@ -565,26 +681,14 @@ public:
      */
     CAddrInfo Select(bool newOnly = false)
     {
-        CAddrInfo addrRet;
-        {
-            LOCK(cs);
-            Check();
-            addrRet = Select_(newOnly);
-            Check();
-        }
-        return addrRet;
+        return Select_(*GetSnapshot(), newOnly);
     }
 
     //! Return a bunch of addresses, selected at random.
     std::vector<CAddress> GetAddr()
     {
-        Check();
         std::vector<CAddress> vAddr;
-        {
-            LOCK(cs);
-            GetAddr_(vAddr);
-        }
-        Check();
+        GetAddr_(*GetSnapshot(), vAddr);
         return vAddr;
     }
 
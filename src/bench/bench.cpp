@@ -31,11 +31,12 @@ benchmark::BenchRunner::RunAll(double elapsedTimeForOne)
 {
     perf_init();
     std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << ","
-              << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+              << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "," << "counters" << "\n";
 
     for (const auto &p: benchmarks()) {
         State state(p.first, elapsedTimeForOne);
         p.second(state);
+        state.PrintResults();
     }
     perf_fini();
 }
@@ -95,12 +96,22 @@ bool benchmark::State::KeepRunning()
 
     assert(count != 0 && "count == 0 => (now == 0 && beginTime == 0) => return above");
 
-    // Output results
-    double average = (now-beginTime)/count;
-    int64_t averageCycles = (nowCycles-beginCycles)/count;
+    return false;
+}
+
+void benchmark::State::PrintResults() const
+{
+    if (count == 0) {
+        return;
+    }
+    // lastTime and lastCycles were taken by the final KeepRunning call
+    double average = (lastTime-beginTime)/count;
+    int64_t averageCycles = (lastCycles-beginCycles)/count;
     std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << ","
-              << minCycles << "," << maxCycles << "," << averageCycles << "\n";
+              << minCycles << "," << maxCycles << "," << averageCycles << ",";
     std::cout.copyfmt(std::ios(nullptr));
-
-    return false;
+    for (auto it = counters.begin(); it != counters.end(); ++it) {
+        std::cout << (it == counters.begin() ? "" : " ") << it->first << "=" << it->second;
+    }
+    std::cout << "\n";
 }
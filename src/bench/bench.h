@@ -29,6 +29,7 @@ static void CODE_TO_TIME(benchmark::State& state)
        ... do stuff you want to time...
     }
     ... do any cleanup needed...
+    state.counters["name"] = ... optional extra result, printed with the timings...
 }
 
 BENCHMARK(CODE_TO_TIME);
@@ -49,6 +50,9 @@ namespace benchmark {
         uint64_t minCycles;
         uint64_t maxCycles;
     public:
+        //! Extra results (e.g. memory per entry) to report with the timings, set by the benchmark
+        std::map<std::string, double> counters;
+
         State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0) {
             minTime = std::numeric_limits<double>::max();
             maxTime = std::numeric_limits<double>::min();
@@ -58,6 +62,7 @@ namespace benchmark {
             countMaskInv = 1./(countMask + 1);
         }
         bool KeepRunning();
+        void PrintResults() const;
     };
 
     typedef std::function<void(State&)> BenchFunction;
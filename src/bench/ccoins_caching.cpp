@@ -85,3 +85,41 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching);
+
+// Block-connect style traffic: every iteration adds the P2PKH outputs of a block to a per-block cache, spends
+// half of the outputs added in the previous iteration and flushes into the long lived cache, which also drops
+// the coins that were created and spent before reaching it. Reports the memory per entry of the long lived cache.
+static void CCoinsCacheBlockConnect(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coinsTip(&coinsDummy);
+
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 0x42))));
+    std::vector<COutPoint> vPrevOutpoints;
+    uint32_t nBlock = 0;
+    while (state.KeepRunning()) {
+        CCoinsViewCache coinsBlock(&coinsTip);
+        for (size_t i = 0; i < vPrevOutpoints.size(); i += 2) {
+            coinsBlock.SpendCoin(vPrevOutpoints[i]);
+        }
+        vPrevOutpoints.clear();
+        for (uint32_t nTx = 0; nTx < 500; nTx++) {
+            uint256 txid;
+            WriteLE32(txid.begin(), nBlock);
+            WriteLE32(txid.begin() + 4, nTx);
+            for (uint32_t n = 0; n < 2; n++) {
+                COutPoint outpoint(txid, n);
+                coinsBlock.AddCoin(outpoint, Coin(CTxOut(CENT, scriptPubKey), nBlock, false, false), false);
+                vPrevOutpoints.push_back(outpoint);
+            }
+        }
+        coinsBlock.Flush();
+        nBlock++;
+    }
+    if (coinsTip.GetCacheSize() > 0) {
+        state.counters["entries"] = coinsTip.GetCacheSize();
+        state.counters["bytes_per_entry"] = (double)coinsTip.DynamicMemoryUsage() / coinsTip.GetCacheSize();
+    }
+}
+
+BENCHMARK(CCoinsCacheBlockConnect);
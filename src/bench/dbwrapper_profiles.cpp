@@ -0,0 +1,132 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat/endian.h"
+#include "dbwrapper.h"
+#include "hash.h"
+
+#include <tuple>
+
+// Replays the access patterns of the databases against each LevelDB option profile. The databases are kept
+// in memory, so this measures block cache, bloom filter and block size effects rather than disk latency.
+
+static const size_t DB_BENCH_CACHE_SIZE = 4 << 20;
+static const uint32_t DB_BENCH_ENTRIES = 50000;
+
+static uint256 BenchHash(uint32_t n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+static std::unique_ptr<CDBWrapper> MakeBenchDB(const std::string& strProfile)
+{
+    CDBOptions options;
+    GetDBProfile(strProfile, options);
+    return std::unique_ptr<CDBWrapper>(new CDBWrapper("", DB_BENCH_CACHE_SIZE, true, true, false, options));
+}
+
+// Recovered signatures: lookups by random hash, about half of them for signatures we never saw
+static void PointLookup(benchmark::State& state, const std::string& strProfile)
+{
+    std::unique_ptr<CDBWrapper> db = MakeBenchDB(strProfile);
+    std::vector<unsigned char> vchSig(200, 0x01);
+    CDBBatch batch(*db);
+    for (uint32_t i = 0; i < DB_BENCH_ENTRIES; i++) {
+        batch.Write(std::make_pair(std::string("rs_r"), BenchHash(2 * i)), vchSig);
+        if (batch.SizeEstimate() > (1 << 20)) {
+            db->WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+    db->WriteBatch(batch);
+
+    uint32_t n = 0;
+    while (state.KeepRunning()) {
+        // odd numbers were never written
+        db->Exists(std::make_pair(std::string("rs_r"), BenchHash(n++ % (2 * DB_BENCH_ENTRIES))));
+    }
+}
+
+// Address index: a seek to an address followed by a walk over its entries in height order
+static void RangeScan(benchmark::State& state, const std::string& strProfile)
+{
+    std::unique_ptr<CDBWrapper> db = MakeBenchDB(strProfile);
+    const uint32_t nAddresses = DB_BENCH_ENTRIES / 50;
+    CDBBatch batch(*db);
+    for (uint32_t i = 0; i < DB_BENCH_ENTRIES; i++) {
+        uint256 hash = BenchHash(i % nAddresses);
+        uint160 hashAddress = Hash160(hash.begin(), hash.end());
+        batch.Write(std::make_tuple('a', hashAddress, htobe32(i)), (int64_t)i);
+        if (batch.SizeEstimate() > (1 << 20)) {
+            db->WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+    db->WriteBatch(batch);
+
+    uint32_t n = 0;
+    while (state.KeepRunning()) {
+        uint256 hash = BenchHash(n++ % nAddresses);
+        uint160 hashAddress = Hash160(hash.begin(), hash.end());
+        std::unique_ptr<CDBIterator> it(db->NewIterator());
+        std::tuple<char, uint160, uint32_t> key;
+        for (it->Seek(std::make_pair('a', hashAddress)); it->Valid() && it->GetKey(key) && std::get<1>(key) == hashAddress; it->Next()) {
+            int64_t nValue;
+            it->GetValue(nValue);
+        }
+    }
+}
+
+// Chainstate: coins spent from anywhere in the set, with the new coins written in batches like a cache flush
+static void CoinsReadWrite(benchmark::State& state, const std::string& strProfile)
+{
+    std::unique_ptr<CDBWrapper> db = MakeBenchDB(strProfile);
+    std::vector<unsigned char> vchCoin(40, 0x02);
+    CDBBatch batch(*db);
+    for (uint32_t i = 0; i < DB_BENCH_ENTRIES; i++) {
+        batch.Write(std::make_pair('C', BenchHash(i)), vchCoin);
+        if (batch.SizeEstimate() > (1 << 20)) {
+            db->WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+    db->WriteBatch(batch);
+    batch.Clear();
+
+    uint32_t n = 0;
+    uint32_t nNext = DB_BENCH_ENTRIES;
+    while (state.KeepRunning()) {
+        std::vector<unsigned char> vchRead;
+        uint256 hash = BenchHash((n++ * 7919) % nNext);
+        if (db->Read(std::make_pair('C', hash), vchRead)) {
+            batch.Erase(std::make_pair('C', hash));
+        }
+        batch.Write(std::make_pair('C', BenchHash(nNext++)), vchCoin);
+        if (n % 1000 == 0) {
+            db->WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+}
+
+static void DBPointLookupDefault(benchmark::State& state) { PointLookup(state, "default"); }
+static void DBPointLookupLookup(benchmark::State& state) { PointLookup(state, "lookup"); }
+static void DBPointLookupScan(benchmark::State& state) { PointLookup(state, "scan"); }
+static void DBRangeScanDefault(benchmark::State& state) { RangeScan(state, "default"); }
+static void DBRangeScanLookup(benchmark::State& state) { RangeScan(state, "lookup"); }
+static void DBRangeScanScan(benchmark::State& state) { RangeScan(state, "scan"); }
+static void DBCoinsReadWriteDefault(benchmark::State& state) { CoinsReadWrite(state, "default"); }
+static void DBCoinsReadWriteLookup(benchmark::State& state) { CoinsReadWrite(state, "lookup"); }
+static void DBCoinsReadWriteScan(benchmark::State& state) { CoinsReadWrite(state, "scan"); }
+
+BENCHMARK(DBPointLookupDefault);
+BENCHMARK(DBPointLookupLookup);
+BENCHMARK(DBPointLookupScan);
+BENCHMARK(DBRangeScanDefault);
+BENCHMARK(DBRangeScanLookup);
+BENCHMARK(DBRangeScanScan);
+BENCHMARK(DBCoinsReadWriteDefault);
+BENCHMARK(DBCoinsReadWriteLookup);
+BENCHMARK(DBCoinsReadWriteScan);
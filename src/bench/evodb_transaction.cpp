@@ -0,0 +1,76 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat/endian.h"
+#include "evo/evodb.h"
+#include "hash.h"
+
+#include <tuple>
+
+// Mimics the evoDB traffic of connecting blocks: a MN list diff and the best block per block, a quorum commitment
+// and its inversed height index entry every few blocks, plus the reads and range lookups done while validating.
+// Every block is a CurTransaction committed into the RootTransaction, which is flushed every 100 blocks.
+// nStateWrites additional per-MN entries are written per block, to let the RootTransaction grow large.
+static void RunEvoDBBlockConnect(benchmark::State& state, uint32_t nStateWrites)
+{
+    CEvoDB db(1 << 20, true, true);
+    std::vector<unsigned char> vchDiff(1500, 0x01);
+    std::vector<unsigned char> vchCommitment(400, 0x02);
+
+    uint32_t nHeight = 0;
+    uint256 hashPrev;
+    while (state.KeepRunning()) {
+        nHeight++;
+        uint256 hash = Hash(BEGIN(nHeight), END(nHeight));
+        {
+            auto dbTx = db.BeginTransaction();
+
+            std::vector<unsigned char> vchPrevDiff;
+            db.Read(std::make_pair(std::string("dmn_D3"), hashPrev), vchPrevDiff);
+            db.Write(std::make_pair(std::string("dmn_D3"), hash), vchDiff);
+
+            for (uint32_t i = 0; i < nStateWrites; i++) {
+                uint32_t n = nHeight * nStateWrites + i;
+                db.Write(std::make_pair(std::string("dmn_S3"), Hash(BEGIN(n), END(n))), vchCommitment);
+            }
+
+            if (nHeight % 4 == 0) {
+                uint8_t llmqType = nHeight % 8 == 0 ? 1 : 2;
+                db.Write(std::make_pair(std::string("q_mc"), std::make_pair(llmqType, hash)), vchCommitment);
+                db.Write(std::make_tuple(std::string("q_mcih"), llmqType, htobe32(std::numeric_limits<uint32_t>::max() - nHeight)), nHeight);
+
+                // walk the most recent commitments, as GetMinedCommitmentsUntilBlock does
+                auto it = db.GetCurTransaction().NewIteratorUniquePtr();
+                it->Seek(std::make_tuple(std::string("q_mcih"), llmqType, htobe32(std::numeric_limits<uint32_t>::max() - nHeight)));
+                for (int i = 0; i < 4 && it->Valid(); i++) {
+                    uint32_t nQuorumHeight;
+                    it->GetValue(nQuorumHeight);
+                    it->Next();
+                }
+            }
+
+            db.WriteBestBlock(hash);
+            dbTx->Commit();
+        }
+        if (nHeight % 100 == 0) {
+            db.CommitRootTransaction();
+        }
+        hashPrev = hash;
+    }
+}
+
+static void EvoDBBlockConnect(benchmark::State& state)
+{
+    RunEvoDBBlockConnect(state, 0);
+}
+
+// 100 blocks of 1000 writes, so that the RootTransaction holds 100k keys when it is flushed
+static void EvoDBBlockConnectLargeRoot(benchmark::State& state)
+{
+    RunEvoDBBlockConnect(state, 1000);
+}
+
+BENCHMARK(EvoDBBlockConnect);
+BENCHMARK(EvoDBBlockConnectLargeRoot);
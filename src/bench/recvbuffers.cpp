@@ -0,0 +1,103 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "net.h"
+#include "random.h"
+#include "recvbufferpool.h"
+#include "streams.h"
+
+#include "bench/data/block813851.raw.h"
+
+#include <list>
+
+// Replays a message mix modelled on the traffic a masternode receives on mainnet through the receive path of
+// CNode::ReceiveMsgBytes: mostly small inventory, transaction, LLMQ and governance vote messages, a batch of
+// signature shares and headers now and then, and a full block.
+
+static const CMessageHeader::MessageStartChars BENCH_MESSAGE_START = {(unsigned char)0xbf, (unsigned char)0x0c, (unsigned char)0x6b, (unsigned char)0xbd};
+
+static void AddMessage(std::vector<char>& vchStream, const char* pszCommand, const std::vector<char>& vchPayload)
+{
+    CMessageHeader hdr(BENCH_MESSAGE_START, pszCommand, vchPayload.size());
+    uint256 hash = Hash(vchPayload.begin(), vchPayload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    vchStream.insert(vchStream.end(), ss.begin(), ss.end());
+    vchStream.insert(vchStream.end(), vchPayload.begin(), vchPayload.end());
+}
+
+static std::vector<char> MakeMessageMix()
+{
+    FastRandomContext rng(true);
+    auto payload = [&rng](size_t nSize) {
+        std::vector<unsigned char> vch = rng.randbytes(nSize);
+        return std::vector<char>(vch.begin(), vch.end());
+    };
+
+    std::vector<char> vchStream;
+    for (int i = 0; i < 400; i++) {
+        AddMessage(vchStream, NetMsgType::INV, payload(1 + 36 * (1 + rng.randrange(4))));
+        if (i % 4 == 0) {
+            AddMessage(vchStream, NetMsgType::TX, payload(200 + rng.randrange(800)));
+            AddMessage(vchStream, NetMsgType::QSIGSESANN, payload(100));
+            AddMessage(vchStream, NetMsgType::QSIGSHARESINV, payload(20 + rng.randrange(60)));
+            AddMessage(vchStream, NetMsgType::MNGOVERNANCEOBJECTVOTE, payload(230));
+        }
+        if (i % 40 == 0) {
+            AddMessage(vchStream, NetMsgType::QBSIGSHARES, payload(2000 + rng.randrange(30000)));
+            AddMessage(vchStream, NetMsgType::ISLOCK, payload(250));
+            AddMessage(vchStream, NetMsgType::CLSIG, payload(132));
+        }
+    }
+    AddMessage(vchStream, NetMsgType::HEADERS, payload(1 + 2000 * 81));
+    AddMessage(vchStream, NetMsgType::BLOCK, std::vector<char>((const char*)raw_bench::block813851, (const char*)&raw_bench::block813851[sizeof(raw_bench::block813851)]));
+    return vchStream;
+}
+
+static void RecvMessageMix(benchmark::State& state, size_t nPoolSize)
+{
+    const std::vector<char> vchStream = MakeMessageMix();
+    recvBufferPool.SetMaxCachedBytes(nPoolSize);
+    CRecvBufferPoolStats statsStart = recvBufferPool.GetStats();
+
+    uint64_t nMessages = 0;
+    while (state.KeepRunning()) {
+        std::list<CNetMessage> vRecvMsg;
+        // Read in chunks of the socket handler's receive buffer size
+        for (size_t nPos = 0; nPos < vchStream.size(); nPos += 0x10000) {
+            const char* pch = vchStream.data() + nPos;
+            unsigned int nBytes = std::min<size_t>(0x10000, vchStream.size() - nPos);
+            while (nBytes > 0) {
+                if (vRecvMsg.empty() || vRecvMsg.back().complete())
+                    vRecvMsg.push_back(CNetMessage(BENCH_MESSAGE_START, SER_NETWORK, PROTOCOL_VERSION));
+                CNetMessage& msg = vRecvMsg.back();
+                int handled = msg.in_data ? msg.readData(pch, nBytes) : msg.readHeader(pch, nBytes);
+                assert(handled > 0);
+                pch += handled;
+                nBytes -= handled;
+            }
+            // The message handler processes and destroys the complete messages
+            while (!vRecvMsg.empty() && vRecvMsg.front().complete()) {
+                vRecvMsg.front().GetMessageHash();
+                vRecvMsg.pop_front();
+                nMessages++;
+            }
+        }
+    }
+
+    CRecvBufferPoolStats statsEnd = recvBufferPool.GetStats();
+    if (nMessages > 0) {
+        state.counters["allocations_per_message"] = (double)(statsEnd.nAllocations - statsStart.nAllocations) / nMessages;
+    }
+    recvBufferPool.SetMaxCachedBytes(DEFAULT_RECV_BUFFER_POOL_SIZE);
+}
+
+static void RecvMessageMixPooled(benchmark::State& state) { RecvMessageMix(state, DEFAULT_RECV_BUFFER_POOL_SIZE); }
+static void RecvMessageMixUnpooled(benchmark::State& state) { RecvMessageMix(state, 0); }
+
+BENCHMARK(RecvMessageMixPooled);
+BENCHMARK(RecvMessageMixUnpooled);
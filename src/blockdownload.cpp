@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+
+#include <algorithm>
+#include <cmath>
+
+//! Weight of a new measurement in the averages
+static const double BLOCK_DOWNLOAD_SAMPLE_WEIGHT = 0.25;
+
+static void UpdateAverage(double& dAverage, double dSample, bool fFirst)
+{
+    dAverage = fFirst ? dSample : dAverage + BLOCK_DOWNLOAD_SAMPLE_WEIGHT * (dSample - dAverage);
+}
+
+CBlockDownloadStats::CBlockDownloadStats() :
+    nSamples(0),
+    nLastReceived(0),
+    dBlockMicros(0),
+    dLatencyMicros(0),
+    dBytesPerSecond(0)
+{
+}
+
+void CBlockDownloadStats::Received(int64_t nTimeRequested, int64_t nNow, size_t nBytes)
+{
+    const bool fIdle = nTimeRequested >= nLastReceived;
+    const int64_t nMicros = std::max<int64_t>(1, nNow - std::max(nTimeRequested, nLastReceived));
+    if (fIdle || nSamples == 0) {
+        UpdateAverage(dLatencyMicros, nMicros, nSamples == 0);
+    }
+    UpdateAverage(dBlockMicros, nMicros, nSamples == 0);
+    UpdateAverage(dBytesPerSecond, nBytes * 1000000.0 / nMicros, nSamples == 0);
+    nLastReceived = std::max(nLastReceived, nNow);
+    nSamples++;
+}
+
+int CBlockDownloadStats::GetWindow(int nDefault) const
+{
+    if (nSamples == 0) {
+        return nDefault;
+    }
+    const double dWindow = std::ceil((dLatencyMicros + BLOCK_DOWNLOAD_TARGET_QUEUE_TIME) / dBlockMicros);
+    return (int)std::max<double>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<double>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, dWindow));
+}
+
+bool CBlockDownloadStats::IsStraggling(int64_t nTimeRequested, int64_t nNow) const
+{
+    const int64_t nWaiting = nNow - std::max(nTimeRequested, nLastReceived);
+    const double dExpected = nSamples == 0 ? 0 : dLatencyMicros + BLOCK_STRAGGLER_FACTOR * dBlockMicros;
+    return nWaiting > std::max<double>(BLOCK_STRAGGLER_MIN_TIME, dExpected);
+}
+
+bool CBlockDownloadStats::IsFasterThan(int64_t nMicros) const
+{
+    return nSamples > 0 && dLatencyMicros + dBlockMicros < nMicros;
+}
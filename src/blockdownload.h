@@ -0,0 +1,56 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_BLOCKDOWNLOAD_H
+#define LOKAL_BLOCKDOWNLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! Smallest and largest number of blocks requested from a single peer at once, peers without measurements get MAX_BLOCKS_IN_TRANSIT_PER_PEER
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+//! Time (in microseconds) a peer's queue of requested blocks should take to download on top of the round trip
+static const int64_t BLOCK_DOWNLOAD_TARGET_QUEUE_TIME = 4 * 1000000;
+//! A block is a straggler once its peer delivered nothing for this many times its usual time per block (and at least BLOCK_STRAGGLER_MIN_TIME)
+static const int BLOCK_STRAGGLER_FACTOR = 4;
+static const int64_t BLOCK_STRAGGLER_MIN_TIME = 2 * 1000000;
+
+/**
+ * Block download measurements of a single peer.
+ *
+ * Requested blocks are delivered one after the other, so the time a block took is counted from when it was
+ * requested or when the previous block arrived, whichever is later. Blocks requested while nothing was in flight
+ * measure the round trip. Both are averaged, and the window is the number of blocks that keeps the peer busy
+ * for a round trip plus BLOCK_DOWNLOAD_TARGET_QUEUE_TIME: slow peers get few blocks so they don't hold up the
+ * download, fast ones get more.
+ */
+class CBlockDownloadStats
+{
+private:
+    int nSamples;
+    int64_t nLastReceived;
+    double dBlockMicros;
+    double dLatencyMicros;
+    double dBytesPerSecond;
+
+public:
+    CBlockDownloadStats();
+
+    //! Record a block of nBytes requested at nTimeRequested and received at nNow (in microseconds)
+    void Received(int64_t nTimeRequested, int64_t nNow, size_t nBytes);
+    //! Number of blocks to keep in flight from this peer
+    int GetWindow(int nDefault) const;
+    //! Whether a block requested at nTimeRequested is overdue at nNow
+    bool IsStraggling(int64_t nTimeRequested, int64_t nNow) const;
+    //! Whether this peer is expected to deliver a block in less time than nMicros
+    bool IsFasterThan(int64_t nMicros) const;
+
+    int GetSamples() const { return nSamples; }
+    double GetBlockMicros() const { return dBlockMicros; }
+    double GetLatencyMicros() const { return dLatencyMicros; }
+    double GetBytesPerSecond() const { return dBytesPerSecond; }
+};
+
+#endif // LOKAL_BLOCKDOWNLOAD_H
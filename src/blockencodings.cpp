@@ -47,7 +47,76 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
 
 
 
-ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
+CBlockReconstructionTxns::CBlockReconstructionTxns(size_t nMaxRecentIn, size_t nMaxLockedIn) :
+    nMaxRecent(nMaxRecentIn),
+    nRecentIt(0),
+    nMaxLocked(nMaxLockedIn)
+{
+}
+
+void CBlockReconstructionTxns::AddRecent(const CTransactionRef& tx)
+{
+    LOCK(cs);
+    if (nMaxRecent == 0)
+        return;
+    if (vRecent.size() < nMaxRecent) {
+        vRecent.push_back(tx);
+    } else {
+        vRecent[nRecentIt] = tx;
+    }
+    nRecentIt = (nRecentIt + 1) % nMaxRecent;
+}
+
+void CBlockReconstructionTxns::AddLocked(const CTransactionRef& tx)
+{
+    LOCK(cs);
+    if (nMaxLocked == 0)
+        return;
+    if (mapLocked.size() >= nMaxLocked && !mapLocked.count(tx->GetHash())) {
+        // Locked transactions are normally mined within a block or two, drop an arbitrary one
+        mapLocked.erase(mapLocked.begin());
+    }
+    mapLocked.emplace(tx->GetHash(), tx);
+}
+
+void CBlockReconstructionTxns::RemoveLocked(const std::vector<CTransactionRef>& vtx)
+{
+    LOCK(cs);
+    if (mapLocked.empty())
+        return;
+    for (const CTransactionRef& tx : vtx) {
+        mapLocked.erase(tx->GetHash());
+    }
+}
+
+size_t CBlockReconstructionTxns::RecentSize() const
+{
+    LOCK(cs);
+    return vRecent.size();
+}
+
+size_t CBlockReconstructionTxns::LockedSize() const
+{
+    LOCK(cs);
+    return mapLocked.size();
+}
+
+void CBlockReconstructionTxns::GetShortIDs(const CBlockHeaderAndShortTxIDs& cmpctblock, std::vector<std::pair<uint64_t, CTransactionRef>>& vRecentIDs,
+                                           std::vector<std::pair<uint64_t, CTransactionRef>>& vLockedIDs) const
+{
+    LOCK(cs);
+    vRecentIDs.reserve(vRecent.size());
+    for (const CTransactionRef& tx : vRecent) {
+        vRecentIDs.emplace_back(cmpctblock.GetShortID(tx->GetHash()), tx);
+    }
+    vLockedIDs.reserve(mapLocked.size());
+    for (const auto& p : mapLocked) {
+        vLockedIDs.emplace_back(cmpctblock.GetShortID(p.first), p.second);
+    }
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn,
+                                              const CBlockReconstructionTxns* reconstruction_txns) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
         return READ_STATUS_INVALID;
     if (cmpctblock.shorttxids.size() + cmpctblock.prefilledtxn.size() > MaxBlockSize(true) / MIN_TRANSACTION_SIZE)
@@ -134,15 +203,17 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     }
     }
 
-    for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
+    // Sources besides the mempool, a transaction found in several of them is counted in the first one
+    enum { SOURCE_EXTRA = 1, SOURCE_RECENT, SOURCE_LOCKED };
+    std::vector<uint8_t> txn_source(txn_available.size());
+    auto addExtraTx = [&](uint64_t shortid, const CTransactionRef& tx, uint8_t source) {
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
+                txn_available[idit->second] = tx;
+                txn_source[idit->second] = source;
                 have_txn[idit->second]  = true;
                 mempool_count++;
-                extra_count++;
             } else {
                 // If we find two mempool/extra txn that match the short id, just
                 // request it.
@@ -151,18 +222,39 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                 // Note that we don't want duplication between extra_txn and mempool to
                 // trigger this case, so we compare hashes first
                 if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetHash() != extra_txn[i].second->GetHash()) {
+                        txn_available[idit->second]->GetHash() != tx->GetHash()) {
                     txn_available[idit->second].reset();
+                    txn_source[idit->second] = 0;
                     mempool_count--;
-                    extra_count--;
                 }
             }
         }
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
+        return mempool_count == shorttxids.size();
+    };
+
+    bool fComplete = mempool_count == shorttxids.size();
+    for (size_t i = 0; i < extra_txn.size() && !fComplete; i++) {
+        fComplete = addExtraTx(cmpctblock.GetShortID(extra_txn[i].first), extra_txn[i].second, SOURCE_EXTRA);
+    }
+
+    if (reconstruction_txns && !fComplete) {
+        std::vector<std::pair<uint64_t, CTransactionRef>> vRecentIDs, vLockedIDs;
+        reconstruction_txns->GetShortIDs(cmpctblock, vRecentIDs, vLockedIDs);
+        for (size_t i = 0; i < vLockedIDs.size() && !fComplete; i++) {
+            fComplete = addExtraTx(vLockedIDs[i].first, vLockedIDs[i].second, SOURCE_LOCKED);
+        }
+        for (size_t i = 0; i < vRecentIDs.size() && !fComplete; i++) {
+            fComplete = addExtraTx(vRecentIDs[i].first, vRecentIDs[i].second, SOURCE_RECENT);
+        }
+    }
+
+    for (uint8_t source : txn_source) {
+        extra_count += source == SOURCE_EXTRA;
+        recent_count += source == SOURCE_RECENT;
+        locked_count += source == SOURCE_LOCKED;
     }
 
     LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -211,7 +303,7 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
         return READ_STATUS_CHECKBLOCK_FAILED;
     }
 
-    LogPrint(BCLog::CMPCTBLOCK, "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (incl at least %lu from extra pool) and %lu txn requested\n", hash.ToString(), prefilled_count, mempool_count, extra_count, vtx_missing.size());
+    LogPrint(BCLog::CMPCTBLOCK, "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (incl %lu from extra pool, %lu recent and %lu locked txn) and %lu txn requested\n", hash.ToString(), prefilled_count, mempool_count, extra_count, recent_count, locked_count, vtx_missing.size());
     if (vtx_missing.size() < 5) {
         for (const auto& tx : vtx_missing) {
             LogPrint(BCLog::CMPCTBLOCK, "Reconstructed block %s required tx %s\n", hash.ToString(), tx->GetHash().ToString());
@@ -6,8 +6,12 @@
 #define BITCOIN_BLOCK_ENCODINGS_H
 
 #include "primitives/block.h"
+#include "saltedhasher.h"
+#include "sync.h"
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 class CTxMemPool;
 
@@ -192,10 +196,39 @@ public:
     }
 };
 
+/**
+ * Transactions besides the mempool and extra_txn that compact blocks are reconstructed from: a ring of the
+ * transactions most recently removed from the mempool other than by a block (expired, evicted, or removed for
+ * conflicting with an ISLOCK) and the ISLOCKed transactions that were not mined yet.
+ */
+class CBlockReconstructionTxns {
+private:
+    mutable CCriticalSection cs;
+    const size_t nMaxRecent;
+    std::vector<CTransactionRef> vRecent;
+    size_t nRecentIt;
+    const size_t nMaxLocked;
+    std::unordered_map<uint256, CTransactionRef, StaticSaltedHasher> mapLocked;
+
+public:
+    CBlockReconstructionTxns(size_t nMaxRecentIn, size_t nMaxLockedIn);
+
+    void AddRecent(const CTransactionRef& tx);
+    void AddLocked(const CTransactionRef& tx);
+    //! Forget the locked transactions that were mined
+    void RemoveLocked(const std::vector<CTransactionRef>& vtx);
+    size_t RecentSize() const;
+    size_t LockedSize() const;
+
+    //! The short IDs of the recent and the locked transactions under the keys of a compact block, computed in one pass per block
+    void GetShortIDs(const CBlockHeaderAndShortTxIDs& cmpctblock, std::vector<std::pair<uint64_t, CTransactionRef>>& vRecentIDs,
+                     std::vector<std::pair<uint64_t, CTransactionRef>>& vLockedIDs) const;
+};
+
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
-    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
+    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0, recent_count = 0, locked_count = 0;
     CTxMemPool* pool;
 public:
     CBlockHeader header;
@@ -203,8 +236,15 @@ public:
     PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
 
     // extra_txn is a list of extra transactions to look at, in <hash, reference> form
-    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn);
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn,
+                        const CBlockReconstructionTxns* reconstruction_txns = nullptr);
     bool IsTxAvailable(size_t index) const;
+    // Number of transactions InitData found prefilled, in the mempool or any other source (mempool_count), and in the sources besides the mempool
+    size_t GetPrefilledCount() const { return prefilled_count; }
+    size_t GetMempoolCount() const { return mempool_count; }
+    size_t GetExtraCount() const { return extra_count; }
+    size_t GetRecentCount() const { return recent_count; }
+    size_t GetLockedCount() const { return locked_count; }
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing);
 };
 
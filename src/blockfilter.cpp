@@ -0,0 +1,340 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "coins.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+namespace {
+
+/** Writes bits MSB first, as required by BIP 158 */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer{0};
+    int nOffset{0};
+
+public:
+    explicit CBitWriter(std::vector<unsigned char>& _vch) : vch(_vch) {}
+
+    ~CBitWriter()
+    {
+        Flush();
+    }
+
+    void Write(uint64_t data, int nBits)
+    {
+        while (nBits > 0) {
+            int nTake = std::min(8 - nOffset, nBits);
+            nBuffer |= (data << (64 - nBits)) >> (64 - 8 + nOffset);
+            nOffset += nTake;
+            nBits -= nTake;
+            if (nOffset == 8) {
+                Flush();
+            }
+        }
+    }
+
+    void Flush()
+    {
+        if (nOffset == 0) {
+            return;
+        }
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+class CBitReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    uint8_t nBuffer{0};
+    int nOffset{8};
+
+public:
+    CBitReader(const std::vector<unsigned char>& _vch, size_t _nPos) : vch(_vch), nPos(_nPos) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t data = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (nPos >= vch.size()) {
+                    throw std::ios_base::failure("CBitReader::Read(): end of data");
+                }
+                nBuffer = vch[nPos++];
+                nOffset = 0;
+            }
+            int nTake = std::min(8 - nOffset, nBits);
+            data <<= nTake;
+            data |= static_cast<uint8_t>(nBuffer << nOffset) >> (8 - nTake);
+            nOffset += nTake;
+            nBits -= nTake;
+        }
+        return data;
+    }
+};
+
+void GolombRiceEncode(CBitWriter& writer, uint8_t nP, uint64_t x)
+{
+    // Quotient in unary, terminated by a zero bit
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+
+    // Remainder in the lowest nP bits
+    writer.Write(x, nP);
+}
+
+uint64_t GolombRiceDecode(CBitReader& reader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1) {
+        ++q;
+    }
+    uint64_t r = reader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** Map a uniformly distributed 64-bit value into [0, n) as (x * n) >> 64 */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    uint64_t a = x >> 32, b = x & 0xffffffff;
+    uint64_t c = n >> 32, d = n & 0xffffffff;
+    uint64_t ac = a * c, ad = a * d, bc = b * c, bd = b * d;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xffffffff) + (ad & 0xffffffff);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+} // namespace
+
+size_t CGCSFilter::ElementHasher::operator()(const Element& element) const
+{
+    static const uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    static const uint64_t k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    return CSipHasher(k0, k1).Write(element.data(), element.size()).Finalize();
+}
+
+CGCSFilter::CGCSFilter(const Params& _params) :
+    params(_params), nElements(0), nRange(0), vchEncoded(1, 0)
+{
+}
+
+CGCSFilter::CGCSFilter(const Params& _params, std::vector<unsigned char> _vchEncoded) :
+    params(_params), vchEncoded(std::move(_vchEncoded))
+{
+    CDataStream stream(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nN = ReadCompactSize(stream);
+    if (nN > std::numeric_limits<uint32_t>::max()) {
+        throw std::ios_base::failure("N must be < 2^32");
+    }
+    nElements = (uint32_t)nN;
+    nRange = (uint64_t)nElements * params.nM;
+
+    // Verify that the encoded filter contains exactly N elements
+    CBitReader reader(vchEncoded, vchEncoded.size() - stream.size());
+    for (uint64_t i = 0; i < nElements; i++) {
+        GolombRiceDecode(reader, params.nP);
+    }
+}
+
+CGCSFilter::CGCSFilter(const Params& _params, const ElementSet& elements) :
+    params(_params)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("N must be < 2^32");
+    }
+    nElements = (uint32_t)elements.size();
+    nRange = (uint64_t)nElements * params.nM;
+
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, vchEncoded, 0);
+    WriteCompactSize(stream, nElements);
+    if (elements.empty()) {
+        return;
+    }
+
+    CBitWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t value : BuildHashedSet(elements)) {
+        GolombRiceEncode(writer, params.nP, value - nLast);
+        nLast = value;
+    }
+}
+
+uint64_t CGCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(params.nSipHashK0, params.nSipHashK1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(hash, nRange);
+}
+
+std::vector<uint64_t> CGCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(elements.size());
+    for (const Element& element : elements) {
+        vHashed.push_back(HashToRange(element));
+    }
+    std::sort(vHashed.begin(), vHashed.end());
+    return vHashed;
+}
+
+bool CGCSFilter::MatchInternal(const uint64_t* pElementHashes, size_t nSize) const
+{
+    if (nElements == 0 || nSize == 0) {
+        return false;
+    }
+
+    CDataStream stream(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(stream);
+    CBitReader reader(vchEncoded, vchEncoded.size() - stream.size());
+
+    // Walk the sorted filter and the sorted query side by side
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nElements; i++) {
+        nValue += GolombRiceDecode(reader, params.nP);
+        while (true) {
+            if (nQuery == nSize) {
+                return false;
+            } else if (pElementHashes[nQuery] == nValue) {
+                return true;
+            } else if (pElementHashes[nQuery] > nValue) {
+                break;
+            }
+            nQuery++;
+        }
+    }
+    return false;
+}
+
+bool CGCSFilter::Match(const Element& element) const
+{
+    uint64_t nQuery = HashToRange(element);
+    return MatchInternal(&nQuery, 1);
+}
+
+bool CGCSFilter::MatchAny(const ElementSet& elements) const
+{
+    const std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+static const std::map<BlockFilterType, std::string> mapFilterTypeNames = {
+    {BlockFilterType::BASIC, "basic"},
+};
+
+const std::string& BlockFilterTypeName(BlockFilterType filterType)
+{
+    static const std::string strUnknown;
+    auto it = mapFilterTypeNames.find(filterType);
+    return it != mapFilterTypeNames.end() ? it->second : strUnknown;
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType)
+{
+    for (const auto& p : mapFilterTypeNames) {
+        if (p.second == name) {
+            filterType = p.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+static CGCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo)
+{
+    CGCSFilter::ElementSet elements;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& txout : tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& txUndo : blockUndo.vtxundo) {
+        for (const Coin& prevout : txUndo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty()) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+CBlockFilter::CBlockFilter(BlockFilterType _filterType, const uint256& _blockHash, std::vector<unsigned char> vchFilter) :
+    filterType(_filterType), blockHash(_blockHash)
+{
+    CGCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    filter = CGCSFilter(params, std::move(vchFilter));
+}
+
+CBlockFilter::CBlockFilter(BlockFilterType _filterType, const CBlock& block, const CBlockUndo& blockUndo) :
+    filterType(_filterType), blockHash(block.GetHash())
+{
+    CGCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    filter = CGCSFilter(params, BasicFilterElements(block, blockUndo));
+}
+
+bool CBlockFilter::BuildParams(CGCSFilter::Params& params) const
+{
+    switch (filterType) {
+    case BlockFilterType::BASIC:
+        params.nSipHashK0 = blockHash.GetUint64(0);
+        params.nSipHashK1 = blockHash.GetUint64(1);
+        params.nP = BASIC_FILTER_P;
+        params.nM = BASIC_FILTER_M;
+        return true;
+    case BlockFilterType::INVALID:
+        return false;
+    }
+
+    return false;
+}
+
+uint256 CBlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vchEncoded = GetEncodedFilter();
+    return Hash(vchEncoded.begin(), vchEncoded.end());
+}
+
+uint256 CBlockFilter::ComputeHeader(const uint256& prevHeader) const
+{
+    const uint256& filterHash = GetHash();
+    return Hash(filterHash.begin(), filterHash.end(), prevHeader.begin(), prevHeader.end());
+}
@@ -0,0 +1,157 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Golomb-coded set filter, as described in BIP 158.
+ *
+ * Elements are hashed with SipHash into the range [0, N * M), sorted and the
+ * deltas between consecutive values are Golomb-Rice coded with parameter P.
+ * Queries have a false positive rate of roughly 1/M and no false negatives.
+ */
+class CGCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+
+    struct ElementHasher
+    {
+        size_t operator()(const Element& element) const;
+    };
+    typedef std::unordered_set<Element, ElementHasher> ElementSet;
+
+    struct Params
+    {
+        uint64_t nSipHashK0;
+        uint64_t nSipHashK1;
+        uint8_t nP;  //!< Golomb-Rice coding parameter
+        uint32_t nM; //!< inverse false positive rate
+
+        Params(uint64_t _nSipHashK0 = 0, uint64_t _nSipHashK1 = 0, uint8_t _nP = 0, uint32_t _nM = 1) :
+            nSipHashK0(_nSipHashK0), nSipHashK1(_nSipHashK1), nP(_nP), nM(_nM)
+        {}
+    };
+
+private:
+    Params params;
+    uint32_t nElements;
+    uint64_t nRange; //!< range of element hashes, nElements * nM
+    std::vector<unsigned char> vchEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    //! Helper used by Match and MatchAny, queries must be sorted
+    bool MatchInternal(const uint64_t* pElementHashes, size_t nSize) const;
+
+public:
+    /** Constructs an empty filter */
+    explicit CGCSFilter(const Params& _params = Params());
+
+    /** Reconstructs an already-encoded filter, throws std::ios_base::failure if it is malformed */
+    CGCSFilter(const Params& _params, std::vector<unsigned char> _vchEncoded);
+
+    /** Builds a new filter from the params and set of elements */
+    CGCSFilter(const Params& _params, const ElementSet& elements);
+
+    uint32_t GetN() const { return nElements; }
+    const Params& GetParams() const { return params; }
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    /** Checks if the element may be in the set, false positives are possible with probability 1/M */
+    bool Match(const Element& element) const;
+
+    /** Checks if any of the given elements may be in the set */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+enum class BlockFilterType : uint8_t
+{
+    BASIC = 0,
+    INVALID = 255,
+};
+
+/** Get the human-readable name for a filter type, empty for unknown types */
+const std::string& BlockFilterTypeName(BlockFilterType filterType);
+
+/** Find a filter type by its human-readable name */
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType);
+
+/**
+ * Complete block filter struct as defined in BIP 157. Serialization matches
+ * the payload of the "cfilter" message.
+ */
+class CBlockFilter
+{
+private:
+    BlockFilterType filterType;
+    uint256 blockHash;
+    CGCSFilter filter;
+
+    bool BuildParams(CGCSFilter::Params& params) const;
+
+public:
+    CBlockFilter() : filterType(BlockFilterType::INVALID) {}
+
+    //! Reconstruct a filter from the parts, throws std::invalid_argument on unknown types
+    CBlockFilter(BlockFilterType _filterType, const uint256& _blockHash, std::vector<unsigned char> vchFilter);
+
+    //! Construct a new filter for the block, the undo data provides the scripts of spent outputs
+    CBlockFilter(BlockFilterType _filterType, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return blockHash; }
+    const CGCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    //! Compute the filter hash
+    uint256 GetHash() const;
+
+    //! Compute the filter header given the previous one
+    uint256 ComputeHeader(const uint256& prevHeader) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << (uint8_t)filterType;
+        s << blockHash;
+        s << filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        std::vector<unsigned char> vchEncoded;
+        uint8_t nFilterType;
+        s >> nFilterType;
+        s >> blockHash;
+        s >> vchEncoded;
+
+        filterType = static_cast<BlockFilterType>(nFilterType);
+
+        CGCSFilter::Params params;
+        if (!BuildParams(params)) {
+            throw std::ios_base::failure("unknown filter_type");
+        }
+        filter = CGCSFilter(params, std::move(vchEncoded));
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,394 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+static const char DB_FILTER = 'f';
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_FILTER_POS = 'P';
+
+//! Commit at least this often (seconds) while syncing
+static const int64_t SYNC_COMMIT_INTERVAL = 30;
+//! Log sync progress at most this often (seconds)
+static const int64_t SYNC_LOG_INTERVAL = 30;
+
+std::unique_ptr<CBlockFilterIndex> pblockfilterindex;
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType _filterType, size_t nCacheSize, bool fMemory, bool fWipe) :
+    filterType(_filterType),
+    pathIndex(GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(_filterType)),
+    pindexBest(nullptr),
+    fSynced(false)
+{
+    if (BlockFilterTypeName(filterType).empty()) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+
+    // filters are only reachable through the database, so after a wipe the
+    // flat files are simply overwritten from the start
+    fs::create_directories(pathIndex);
+    db.reset(new CDBWrapper(pathIndex / "db", nCacheSize, fMemory, fWipe, false, GetDBOptions("blockfilterindex")));
+
+    if (!db->Read(DB_FILTER_POS, posNext)) {
+        posNext = CDiskBlockPos(0, 0);
+    }
+}
+
+CBlockFilterIndex::~CBlockFilterIndex()
+{
+    Stop();
+}
+
+FILE* CBlockFilterIndex::OpenFilterFile(const CDiskBlockPos& pos, bool fReadOnly) const
+{
+    if (pos.IsNull()) {
+        return nullptr;
+    }
+    fs::path path = pathIndex / strprintf("fltr%05u.dat", pos.nFile);
+    FILE* file = fsbridge::fopen(path, "rb+");
+    if (!file && !fReadOnly) {
+        file = fsbridge::fopen(path, "wb+");
+    }
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return nullptr;
+    }
+    if (pos.nPos && fseek(file, pos.nPos, SEEK_SET)) {
+        LogPrintf("Unable to seek to position %u of %s\n", pos.nPos, path.string());
+        fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+bool CBlockFilterIndex::ReadFilterFromDisk(const CFilterEntry& entry, std::vector<unsigned char>& vchFilter) const
+{
+    CAutoFile filein(OpenFilterFile(entry.pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return error("%s: OpenFilterFile failed", __func__);
+    }
+
+    try {
+        filein >> vchFilter;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    if (Hash(vchFilter.begin(), vchFilter.end()) != entry.hash) {
+        return error("%s: Checksum mismatch in filter at %s", __func__, entry.pos.ToString());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupEntry(const CBlockIndex* pindex, CFilterEntry& entry) const
+{
+    return db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry);
+}
+
+bool CBlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    const uint256& hashBlock = pindex->GetBlockHash();
+    if (db->Exists(std::make_pair(DB_FILTER, hashBlock))) {
+        // already indexed, e.g. by the sync thread before the notification came in
+        return true;
+    }
+
+    CBlockUndo blockUndo;
+    uint256 prevHeader;
+    if (pindex->pprev) {
+        CDiskBlockPos posUndo;
+        {
+            LOCK(cs_main);
+            posUndo = pindex->GetUndoPos();
+        }
+        if (!UndoReadFromDisk(blockUndo, posUndo, pindex->pprev->GetBlockHash())) {
+            return error("%s: failed to read undo data of block %s", __func__, hashBlock.ToString());
+        }
+
+        CFilterEntry prevEntry;
+        if (!LookupEntry(pindex->pprev, prevEntry)) {
+            return error("%s: previous block %s is not indexed", __func__, pindex->pprev->GetBlockHash().ToString());
+        }
+        prevHeader = prevEntry.header;
+    }
+
+    CBlockFilter filter(filterType, block, blockUndo);
+    const std::vector<unsigned char>& vchFilter = filter.GetEncodedFilter();
+
+    CFilterEntry entry;
+    entry.hash = filter.GetHash();
+    entry.header = filter.ComputeHeader(prevHeader);
+
+    LOCK(cs);
+    unsigned int nSize = ::GetSerializeSize(vchFilter, SER_DISK, CLIENT_VERSION);
+    if (posNext.nPos + nSize > MAX_FLTR_FILE_SIZE) {
+        // make sure the previous file is on disk before filters in the next one are referenced
+        FILE* file = OpenFilterFile(posNext, true);
+        if (file) {
+            FileCommit(file);
+            fclose(file);
+        }
+        posNext.nFile++;
+        posNext.nPos = 0;
+    }
+
+    CAutoFile fileout(OpenFilterFile(posNext, false), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        return error("%s: OpenFilterFile failed", __func__);
+    }
+    fileout << vchFilter;
+    if (fflush(fileout.Get()) != 0) {
+        return error("%s: failed to flush %s", __func__, posNext.ToString());
+    }
+
+    entry.pos = posNext;
+    posNext.nPos += nSize;
+
+    CDBBatch batch(*db);
+    batch.Write(std::make_pair(DB_FILTER, hashBlock), entry);
+    batch.Write(DB_FILTER_POS, posNext);
+    return db->WriteBatch(batch);
+}
+
+bool CBlockFilterIndex::Commit()
+{
+    LOCK(cs);
+    if (!pindexBest) {
+        return true;
+    }
+
+    FILE* file = OpenFilterFile(posNext, true);
+    if (file) {
+        FileCommit(file);
+        fclose(file);
+    }
+    return db->Write(DB_BEST_BLOCK, pindexBest->GetBlockHash(), true);
+}
+
+void CBlockFilterIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const std::string strName = BlockFilterTypeName(filterType);
+
+    const CBlockIndex* pindex = GetBestBlockIndex();
+    int64_t nLastLog = 0;
+    int64_t nLastCommit = GetTime();
+
+    while (!interrupt) {
+        const CBlockIndex* pindexNext;
+        {
+            LOCK(cs_main);
+            if (!pindex) {
+                pindexNext = chainActive.Genesis();
+            } else if (chainActive.Contains(pindex)) {
+                pindexNext = chainActive.Next(pindex);
+            } else {
+                // the old best block was reorged out, continue from the fork point
+                pindexNext = chainActive.Next(chainActive.FindFork(pindex));
+            }
+
+            if (!pindexNext) {
+                // from now on the notifications keep the index up to date, blocks
+                // connected before this point are already written
+                {
+                    LOCK(cs);
+                    pindexBest = pindex;
+                }
+                fSynced = true;
+                break;
+            }
+        }
+
+        int64_t nNow = GetTime();
+        if (nNow - nLastLog >= SYNC_LOG_INTERVAL) {
+            LogPrintf("Syncing %s block filter index with block chain from height %d\n", strName, pindexNext->nHeight);
+            nLastLog = nNow;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindexNext, consensusParams) || !WriteBlock(block, pindexNext)) {
+            LogPrintf("%s: failed to index block %s, %s block filter index stopped syncing\n", __func__,
+                      pindexNext->GetBlockHash().ToString(), strName);
+            return;
+        }
+        pindex = pindexNext;
+
+        {
+            LOCK(cs);
+            pindexBest = pindex;
+        }
+        if (nNow - nLastCommit >= SYNC_COMMIT_INTERVAL) {
+            Commit();
+            nLastCommit = nNow;
+        }
+    }
+
+    Commit();
+    if (fSynced) {
+        LogPrintf("%s block filter index is enabled at height %d\n", strName, pindex ? pindex->nHeight : -1);
+    }
+}
+
+void CBlockFilterIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    if (!fSynced) {
+        return;
+    }
+
+    if (!WriteBlock(*block, pindex)) {
+        LogPrintf("%s: failed to index block %s\n", __func__, pindex->GetBlockHash().ToString());
+        return;
+    }
+    {
+        LOCK(cs);
+        // notifications queued before the sync thread finished may be older than the best block
+        if (!pindexBest || pindexBest->GetAncestor(pindex->nHeight) != pindex) {
+            pindexBest = pindex;
+        }
+    }
+    Commit();
+}
+
+void CBlockFilterIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindexDisconnected)
+{
+    if (!fSynced) {
+        return;
+    }
+
+    // the filter itself stays, it is keyed by block hash and still valid if the block is reconnected
+    LOCK(cs);
+    if (pindexBest == pindexDisconnected) {
+        pindexBest = pindexDisconnected->pprev;
+    }
+}
+
+void CBlockFilterIndex::Start()
+{
+    // can't start new thread if we have one running already
+    if (threadSync.joinable()) {
+        assert(false);
+    }
+
+    interrupt.reset();
+    fSynced = false;
+
+    uint256 hashBest;
+    if (db->Read(DB_BEST_BLOCK, hashBest)) {
+        LOCK2(cs_main, cs);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        if (it != mapBlockIndex.end()) {
+            pindexBest = it->second;
+        }
+    }
+
+    RegisterValidationInterface(this);
+    threadSync = std::thread(&TraceThread<std::function<void()> >, "blockfilter", std::function<void()>(std::bind(&CBlockFilterIndex::ThreadSync, this)));
+}
+
+void CBlockFilterIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+
+    interrupt();
+    if (threadSync.joinable()) {
+        threadSync.join();
+    }
+    Commit();
+}
+
+const CBlockIndex* CBlockFilterIndex::GetBestBlockIndex() const
+{
+    LOCK(cs);
+    return pindexBest;
+}
+
+bool CBlockFilterIndex::BlockUntilSyncedToCurrentChain(int64_t nTimeoutMs) const
+{
+    int64_t nStart = GetTimeMillis();
+    while (true) {
+        if (fSynced) {
+            const CBlockIndex* pindexTip;
+            {
+                LOCK(cs_main);
+                pindexTip = chainActive.Tip();
+            }
+            if (GetBestBlockIndex() == pindexTip) {
+                return true;
+            }
+        }
+        if (GetTimeMillis() - nStart >= nTimeoutMs || interrupt) {
+            return false;
+        }
+        MilliSleep(10);
+    }
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter) const
+{
+    CFilterEntry entry;
+    if (!LookupEntry(pindex, entry)) {
+        return false;
+    }
+
+    std::vector<unsigned char> vchFilter;
+    if (!ReadFilterFromDisk(entry, vchFilter)) {
+        return false;
+    }
+
+    filter = CBlockFilter(filterType, pindex->GetBlockHash(), std::move(vchFilter));
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    CFilterEntry entry;
+    if (!LookupEntry(pindex, entry)) {
+        return false;
+    }
+    header = entry.header;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<CBlockFilter>& vFilters) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight) {
+        return false;
+    }
+
+    vFilters.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, vFilters[pindex->nHeight - nStartHeight])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight) {
+        return false;
+    }
+
+    vHashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        CFilterEntry entry;
+        if (!LookupEntry(pindex, entry)) {
+            return false;
+        }
+        vHashes[pindex->nHeight - nStartHeight] = entry.hash;
+    }
+    return true;
+}
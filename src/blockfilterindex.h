@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "chain.h"
+#include "dbwrapper.h"
+#include "sync.h"
+#include "threadinterrupt.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+//! Max memory allocated to the block filter index database cache (MiB)
+static const int64_t nMaxBlockFilterIndexCache = 8;
+//! Maximum size of a fltr?????.dat file
+static const unsigned int MAX_FLTR_FILE_SIZE = 0x1000000; // 16 MiB
+//! Maximum number of filters returned for a single getcfilters request
+static const int MAX_GETCFILTERS_SIZE = 1000;
+//! Maximum number of filter hashes returned for a single getcfheaders request
+static const int MAX_GETCFHEADERS_SIZE = 2000;
+//! Distance between the filter headers in a cfcheckpt message
+static const int CFCHECKPT_INTERVAL = 1000;
+
+/**
+ * Persistent index of compact block filters (BIP 157/158).
+ *
+ * Encoded filters are appended to flat files (indexes/blockfilter/<type>/fltr?????.dat),
+ * a LevelDB database maps block hashes to the filter position, hash and header.
+ * Entries are keyed by block hash, so reorgs only move the best block pointer.
+ *
+ * On Start() a background thread builds filters for all blocks between the last
+ * committed best block and the tip, after that new blocks are indexed from the
+ * BlockConnected callback.
+ */
+class CBlockFilterIndex final : public CValidationInterface
+{
+private:
+    struct CFilterEntry
+    {
+        uint256 hash;
+        uint256 header;
+        CDiskBlockPos pos;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(hash);
+            READWRITE(header);
+            READWRITE(pos);
+        }
+    };
+
+    const BlockFilterType filterType;
+    const fs::path pathIndex;
+    std::unique_ptr<CDBWrapper> db;
+
+    //! Protects the best block and the position of the next filter, serializes flat file writes
+    mutable CCriticalSection cs;
+    const CBlockIndex* pindexBest;
+    CDiskBlockPos posNext;
+
+    //! Set once the sync thread caught up with the tip, BlockConnected is ignored before that
+    std::atomic<bool> fSynced;
+
+    CThreadInterrupt interrupt;
+    std::thread threadSync;
+
+    void ThreadSync();
+
+    FILE* OpenFilterFile(const CDiskBlockPos& pos, bool fReadOnly) const;
+    bool ReadFilterFromDisk(const CFilterEntry& entry, std::vector<unsigned char>& vchFilter) const;
+    bool LookupEntry(const CBlockIndex* pindex, CFilterEntry& entry) const;
+
+    //! Compute and store the filter of a block, the filter of pindex->pprev must already be indexed
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex);
+    //! Flush the flat file and persist the best block
+    bool Commit();
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindexDisconnected) override;
+
+public:
+    CBlockFilterIndex(BlockFilterType _filterType, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CBlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return filterType; }
+
+    //! Register for block notifications and start syncing in the background
+    void Start();
+    //! Stop syncing, unregister and commit the current state
+    void Stop();
+
+    bool IsSynced() const { return fSynced; }
+    const CBlockIndex* GetBestBlockIndex() const;
+
+    //! Wait (at most nTimeoutMs) for the index to catch up with the tip, returns false on timeout
+    bool BlockUntilSyncedToCurrentChain(int64_t nTimeoutMs) const;
+
+    bool LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter) const;
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+
+    //! Filters of the blocks from nStartHeight up to pindexStop (inclusive)
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<CBlockFilter>& vFilters) const;
+    //! Filter hashes of the blocks from nStartHeight up to pindexStop (inclusive)
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const;
+};
+
+/** The global compact filter index, null if -blockfilterindex is disabled */
+extern std::unique_ptr<CBlockFilterIndex> pblockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
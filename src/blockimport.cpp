@@ -0,0 +1,277 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "protocol.h"
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#include <boost/thread/thread.hpp> // boost::thread::interrupt
+
+CBlockFileReader::CBlockFileReader(const CChainParams& chainparamsIn, std::vector<CBlockFileSource> vSourcesIn, int nWorkers) :
+    chainparams(chainparamsIn),
+    vSources(std::move(vSourcesIn)),
+    nBufferedBytes(0),
+    nReadSeq(0),
+    nNextSeq(0),
+    fReaderDone(false),
+    fStop(false)
+{
+    threadReader = std::thread(&TraceThread<std::function<void()> >, "loadblkread", std::function<void()>(std::bind(&CBlockFileReader::ThreadRead, this)));
+    for (int i = 0; i < nWorkers; i++) {
+        vWorkers.emplace_back(&TraceThread<std::function<void()> >, "loadblkwork", std::function<void()>(std::bind(&CBlockFileReader::ThreadWork, this)));
+    }
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    {
+        WaitableLock lock(cs);
+        fStop = true;
+    }
+    condRaw.notify_all();
+    condSpace.notify_all();
+    threadReader.join();
+    for (std::thread& worker : vWorkers) {
+        worker.join();
+    }
+}
+
+bool CBlockFileReader::Queue(const CDiskBlockPos& pos, CDataStream&& data)
+{
+    {
+        WaitableLock lock(cs);
+        condSpace.wait(lock, [this] { return fStop || nBufferedBytes < BLOCK_IMPORT_PREFETCH_SIZE; });
+        if (fStop) {
+            return false;
+        }
+        nBufferedBytes += data.size();
+        queueRaw.emplace_back(nReadSeq++, pos, std::move(data));
+    }
+    condRaw.notify_one();
+    return true;
+}
+
+bool CBlockFileReader::ReadFile(FILE* file, int nFile)
+{
+    const unsigned int nMaxBlockSize = MaxBlockSize(true);
+    const unsigned char* pchMessageStart = chainparams.MessageStart();
+
+    // This takes over file and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(file, std::max(BLOCK_IMPORT_READ_SIZE, (size_t)2 * nMaxBlockSize), nMaxBlockSize + 8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(pchMessageStart[0]);
+            nRewind = blkdat.GetPos() + 1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, pchMessageStart, CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > nMaxBlockSize)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+
+        const uint64_t nBlockPos = blkdat.GetPos();
+        CDataStream data(SER_DISK, CLIENT_VERSION);
+        data.resize(nSize);
+        try {
+            blkdat.read((char*)&data[0], nSize);
+        } catch (const std::exception&) {
+            // truncated block at the end of the file
+            break;
+        }
+
+        // Deserialization happens later on a worker, so the usual retry one byte after the header if it fails is
+        // not possible. Only continue after the block if another block or the zeroed preallocated space of the
+        // file follows, otherwise the block may be a partially written one that overlaps valid blocks.
+        try {
+            unsigned char next[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat >> FLATDATA(next);
+            static const unsigned char zero[CMessageHeader::MESSAGE_START_SIZE] = {};
+            if (!memcmp(next, pchMessageStart, sizeof(next)) || !memcmp(next, zero, sizeof(next))) {
+                nRewind = nBlockPos + nSize;
+            }
+        } catch (const std::exception&) {
+            // end of the file
+            nRewind = nBlockPos + nSize;
+        }
+
+        if (!Queue(nFile >= 0 ? CDiskBlockPos(nFile, nBlockPos) : CDiskBlockPos(), std::move(data))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CBlockFileReader::ThreadRead()
+{
+    try {
+        for (CBlockFileSource& source : vSources) {
+            FILE* file = source.file;
+            source.file = nullptr;
+            if (source.nFile >= 0) {
+                CDiskBlockPos pos(source.nFile, 0);
+                file = OpenBlockFile(pos, true);
+                if (!file)
+                    break; // This error is logged in OpenBlockFile
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)source.nFile);
+            }
+            if (!ReadFile(file, source.nFile))
+                break;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: I/O error - %s\n", __func__, e.what());
+    }
+
+    // close the external files that were not reached
+    for (CBlockFileSource& source : vSources) {
+        if (source.file) {
+            fclose(source.file);
+            source.file = nullptr;
+        }
+    }
+
+    {
+        WaitableLock lock(cs);
+        fReaderDone = true;
+    }
+    condRaw.notify_all();
+    condDone.notify_all();
+}
+
+void CBlockFileReader::ThreadWork()
+{
+    while (true) {
+        WaitableLock lock(cs);
+        condRaw.wait(lock, [this] { return fStop || fReaderDone || !queueRaw.empty(); });
+        if (fStop || queueRaw.empty()) {
+            break;
+        }
+        CRawBlock raw(std::move(queueRaw.front()));
+        queueRaw.pop_front();
+        lock.unlock();
+
+        CImportedBlock imported;
+        imported.pos = raw.pos;
+        imported.nSize = raw.data.size();
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            raw.data >> *pblock;
+            imported.hash = pblock->GetHash();
+            imported.block = std::move(pblock);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+
+        lock.lock();
+        mapDone.emplace(raw.nSeq, std::move(imported));
+        lock.unlock();
+        condDone.notify_all();
+    }
+}
+
+bool CBlockFileReader::Next(CImportedBlock& block)
+{
+    while (true) {
+        {
+            WaitableLock lock(cs);
+            std::map<uint64_t, CImportedBlock>::iterator it;
+            while ((it = mapDone.find(nNextSeq)) == mapDone.end()) {
+                if (fReaderDone && nNextSeq == nReadSeq) {
+                    return false;
+                }
+                condDone.wait_for(lock, std::chrono::milliseconds(100));
+                lock.unlock();
+                boost::this_thread::interruption_point();
+                lock.lock();
+            }
+            block = std::move(it->second);
+            mapDone.erase(it);
+            nNextSeq++;
+            nBufferedBytes -= block.nSize;
+        }
+        condSpace.notify_one();
+        if (block.block) {
+            return true;
+        }
+    }
+}
+
+void CUnknownParentBlocks::Evict()
+{
+    while (!queueInMemory.empty()) {
+        const uint64_t nSeq = queueInMemory.front().first;
+        auto range = mapEntries.equal_range(queueInMemory.front().second);
+        auto it = std::find_if(range.first, range.second, [nSeq](const std::pair<const uint256, CEntry>& entry) { return entry.second.nSeq == nSeq; });
+        const bool fStale = it == range.second;
+        if (!fStale && nInMemorySize <= nMaxSize) {
+            break;
+        }
+        queueInMemory.pop_front();
+        if (fStale) {
+            // already taken
+            continue;
+        }
+        nInMemorySize -= it->second.nSize;
+        if (it->second.pos.IsNull()) {
+            mapEntries.erase(it);
+        } else {
+            it->second.block.reset();
+        }
+    }
+}
+
+void CUnknownParentBlocks::Add(const CImportedBlock& block)
+{
+    CEntry entry;
+    entry.nSeq = nNextSeq++;
+    entry.hash = block.hash;
+    entry.block = block.block;
+    entry.pos = block.pos;
+    entry.nSize = block.nSize;
+
+    const uint256& hashParent = block.block->hashPrevBlock;
+    queueInMemory.emplace_back(entry.nSeq, hashParent);
+    nInMemorySize += entry.nSize;
+    mapEntries.emplace(hashParent, std::move(entry));
+    Evict();
+}
+
+std::vector<CImportedBlock> CUnknownParentBlocks::Take(const uint256& hashParent)
+{
+    std::vector<CImportedBlock> vBlocks;
+    auto range = mapEntries.equal_range(hashParent);
+    for (auto it = range.first; it != range.second; ++it) {
+        CImportedBlock block;
+        block.block = it->second.block;
+        block.hash = it->second.hash;
+        block.pos = it->second.pos;
+        block.nSize = it->second.nSize;
+        if (block.block) {
+            nInMemorySize -= block.nSize;
+        }
+        vBlocks.push_back(std::move(block));
+    }
+    mapEntries.erase(range.first, range.second);
+    return vBlocks;
+}
@@ -0,0 +1,158 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_BLOCKIMPORT_H
+#define LOKAL_BLOCKIMPORT_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class CChainParams;
+
+//! Maximum number of threads deserializing and hashing blocks during an import
+static const int MAX_BLOCK_IMPORT_WORKERS = 8;
+//! Serialized size of the blocks that may be read ahead of validation
+static const size_t BLOCK_IMPORT_PREFETCH_SIZE = 64 << 20;
+//! Minimum size of the sequential reads from a block file
+static const size_t BLOCK_IMPORT_READ_SIZE = 16 << 20;
+//! Serialized size of the blocks with unknown parent that are kept in memory
+static const size_t BLOCK_IMPORT_UNKNOWN_PARENT_SIZE = 64 << 20;
+
+/** A file to import blocks from: one of our own block files (-reindex) or an external file (-loadblock, bootstrap.dat) */
+struct CBlockFileSource
+{
+    //! External file, owned by the reader from now on
+    FILE* file;
+    //! Number of the blk?????.dat file to open, -1 for external files
+    int nFile;
+
+    explicit CBlockFileSource(FILE* fileIn) : file(fileIn), nFile(-1) {}
+    explicit CBlockFileSource(int nFileIn) : file(nullptr), nFile(nFileIn) {}
+};
+
+/** A block read from a file, pos is null for external files */
+struct CImportedBlock
+{
+    std::shared_ptr<const CBlock> block;
+    uint256 hash;
+    CDiskBlockPos pos;
+    size_t nSize;
+
+    CImportedBlock() : nSize(0) {}
+};
+
+/**
+ * Reads the blocks of a sequence of files ahead of validation.
+ *
+ * A reader thread locates the blocks in each file with large sequential reads and queues their raw bytes, worker
+ * threads deserialize and hash them, and Next() hands them out again in file order. At most
+ * BLOCK_IMPORT_PREFETCH_SIZE bytes of blocks are in flight, so the reader runs ahead of validation by a bounded
+ * amount and already reads the next file while the blocks of the current one are being connected.
+ */
+class CBlockFileReader
+{
+private:
+    struct CRawBlock
+    {
+        uint64_t nSeq;
+        CDiskBlockPos pos;
+        CDataStream data;
+
+        CRawBlock(uint64_t nSeqIn, const CDiskBlockPos& posIn, CDataStream&& dataIn) : nSeq(nSeqIn), pos(posIn), data(std::move(dataIn)) {}
+    };
+
+    const CChainParams& chainparams;
+    std::vector<CBlockFileSource> vSources;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable condRaw;   //!< raw blocks were queued or the reader finished
+    CConditionVariable condDone;  //!< a block was deserialized or the reader finished
+    CConditionVariable condSpace; //!< Next() released buffer space
+    std::deque<CRawBlock> queueRaw;
+    //! Deserialized blocks by sequence number, a null block marks one that failed to deserialize
+    std::map<uint64_t, CImportedBlock> mapDone;
+    size_t nBufferedBytes;
+    uint64_t nReadSeq;
+    uint64_t nNextSeq;
+    bool fReaderDone;
+    bool fStop;
+
+    std::thread threadReader;
+    std::vector<std::thread> vWorkers;
+
+    void ThreadRead();
+    void ThreadWork();
+    //! Locate the blocks in one file and queue them, returns false if the reader was stopped
+    bool ReadFile(FILE* file, int nFile);
+    bool Queue(const CDiskBlockPos& pos, CDataStream&& data);
+
+public:
+    CBlockFileReader(const CChainParams& chainparams, std::vector<CBlockFileSource> vSources, int nWorkers);
+    ~CBlockFileReader();
+
+    CBlockFileReader(const CBlockFileReader&) = delete;
+    CBlockFileReader& operator=(const CBlockFileReader&) = delete;
+
+    /**
+     * Wait for the next block in file order, false once all files are read. Blocks that fail to deserialize are
+     * skipped. Interruptible like the rest of the import thread.
+     */
+    bool Next(CImportedBlock& block);
+};
+
+/**
+ * Blocks whose parent is not known yet, by the hash of their parent.
+ *
+ * The most recently added blocks are kept in memory up to nMaxSize serialized bytes. Older ones only keep their
+ * position, to be read from disk again once their parent shows up, or are dropped if they have none.
+ */
+class CUnknownParentBlocks
+{
+private:
+    struct CEntry
+    {
+        uint64_t nSeq;
+        uint256 hash;
+        std::shared_ptr<const CBlock> block;
+        CDiskBlockPos pos;
+        size_t nSize;
+    };
+
+    const size_t nMaxSize;
+    std::multimap<uint256, CEntry> mapEntries;
+    //! Entries with the block in memory, oldest first, by sequence number and parent hash
+    std::deque<std::pair<uint64_t, uint256>> queueInMemory;
+    size_t nInMemorySize;
+    uint64_t nNextSeq;
+
+    void Evict();
+
+public:
+    explicit CUnknownParentBlocks(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn), nInMemorySize(0), nNextSeq(0) {}
+
+    void Add(const CImportedBlock& block);
+
+    /**
+     * Remove and return the blocks with the given parent, either in memory or as a position to read them from
+     * (with a null block).
+     */
+    std::vector<CImportedBlock> Take(const uint256& hashParent);
+
+    size_t size() const { return mapEntries.size(); }
+    size_t InMemorySize() const { return nInMemorySize; }
+};
+
+#endif // LOKAL_BLOCKIMPORT_H
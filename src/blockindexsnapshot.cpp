@@ -0,0 +1,314 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexsnapshot.h"
+
+#include "crypto/sha256.h"
+#include "fs.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <unordered_map>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char SNAPSHOT_MAGIC[8] = {'L', 'K', 'B', 'I', 'D', 'X', 0, 0};
+static const uint32_t SNAPSHOT_VERSION = 1;
+//! Number of records written per fwrite call
+static const size_t SNAPSHOT_WRITE_BATCH = 4096;
+
+struct CBlockIndexSnapshotHeader {
+    char magic[8];
+    uint32_t nVersion;
+    uint32_t nRecordSize;
+    uint64_t nRecords;
+    uint256 hashBestBlock;
+    uint256 checksum; //!< SHA256 of all records
+};
+static_assert(sizeof(CBlockIndexSnapshotHeader) % 8 == 0, "records following the header must stay aligned");
+
+static fs::path GetSnapshotPath()
+{
+    return GetDataDir() / BLOCK_INDEX_SNAPSHOT_FILENAME;
+}
+
+static CBlockIndexSnapshotRecord RecordFromIndex(const CBlockIndex* pindex, int32_t nPrev)
+{
+    CBlockIndexSnapshotRecord record{};
+    record.hash = pindex->GetBlockHash();
+    record.hashMerkleRoot = pindex->hashMerkleRoot;
+    record.hashProofOfStake = pindex->hashProofOfStake;
+    record.hashPrevoutStake = pindex->prevoutStake.hash;
+    record.nMint = pindex->nMint;
+    record.nMoneySupply = pindex->nMoneySupply;
+    record.nStakeModifier = pindex->nStakeModifier;
+    record.nPrev = nPrev;
+    record.nHeight = pindex->nHeight;
+    record.nFile = pindex->nFile;
+    record.nDataPos = pindex->nDataPos;
+    record.nUndoPos = pindex->nUndoPos;
+    record.nVersion = pindex->nVersion;
+    record.nTime = pindex->nTime;
+    record.nBits = pindex->nBits;
+    record.nNonce = pindex->nNonce;
+    record.nStatus = pindex->nStatus;
+    record.nTx = pindex->nTx;
+    record.nFlags = pindex->nFlags;
+    record.nPrevoutStake = pindex->prevoutStake.n;
+    record.nStakeTime = pindex->nStakeTime;
+    return record;
+}
+
+static void IndexFromRecord(const CBlockIndexSnapshotRecord& record, CBlockIndex* pindex)
+{
+    pindex->hashMerkleRoot = record.hashMerkleRoot;
+    pindex->hashProofOfStake = record.hashProofOfStake;
+    pindex->prevoutStake = COutPoint(record.hashPrevoutStake, record.nPrevoutStake);
+    pindex->nMint = record.nMint;
+    pindex->nMoneySupply = record.nMoneySupply;
+    pindex->nStakeModifier = record.nStakeModifier;
+    pindex->nHeight = record.nHeight;
+    pindex->nFile = record.nFile;
+    pindex->nDataPos = record.nDataPos;
+    pindex->nUndoPos = record.nUndoPos;
+    pindex->nVersion = record.nVersion;
+    pindex->nTime = record.nTime;
+    pindex->nBits = record.nBits;
+    pindex->nNonce = record.nNonce;
+    pindex->nStatus = record.nStatus;
+    pindex->nTx = record.nTx;
+    pindex->nFlags = record.nFlags;
+    pindex->nStakeTime = record.nStakeTime;
+}
+
+bool DumpBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+
+    if (!chainActive.Tip()) {
+        return false;
+    }
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::vector<const CBlockIndex*> vIndexes;
+    vIndexes.reserve(mapBlockIndex.size());
+    for (const auto& item : mapBlockIndex) {
+        vIndexes.emplace_back(item.second);
+    }
+    std::sort(vIndexes.begin(), vIndexes.end(), [](const CBlockIndex* a, const CBlockIndex* b) {
+        return a->nHeight < b->nHeight;
+    });
+    std::unordered_map<const CBlockIndex*, int32_t> mapRecordIndex;
+    mapRecordIndex.reserve(vIndexes.size());
+
+    CBlockIndexSnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.nVersion = SNAPSHOT_VERSION;
+    header.nRecordSize = sizeof(CBlockIndexSnapshotRecord);
+    header.nRecords = vIndexes.size();
+    header.hashBestBlock = chainActive.Tip()->GetBlockHash();
+
+    fs::path path = GetSnapshotPath();
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fsbridge::fopen(pathTmp, "wb");
+    if (!file) {
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    }
+
+    // The header is written again with the checksum once all records are out
+    bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+    CSHA256 hasher;
+    std::vector<CBlockIndexSnapshotRecord> vBatch;
+    vBatch.reserve(SNAPSHOT_WRITE_BATCH);
+    for (size_t i = 0; i < vIndexes.size() && fOk; i++) {
+        const CBlockIndex* pindex = vIndexes[i];
+        int32_t nPrev = -1;
+        if (pindex->pprev) {
+            auto it = mapRecordIndex.find(pindex->pprev);
+            if (it == mapRecordIndex.end()) {
+                fclose(file);
+                fs::remove(pathTmp);
+                return error("%s: predecessor of %s not in block index", __func__, pindex->GetBlockHash().ToString());
+            }
+            nPrev = it->second;
+        }
+        mapRecordIndex.emplace(pindex, (int32_t)i);
+        vBatch.push_back(RecordFromIndex(pindex, nPrev));
+
+        if (vBatch.size() == SNAPSHOT_WRITE_BATCH || i + 1 == vIndexes.size()) {
+            size_t nBytes = vBatch.size() * sizeof(CBlockIndexSnapshotRecord);
+            hasher.Write((const unsigned char*)vBatch.data(), nBytes);
+            fOk = fwrite(vBatch.data(), sizeof(CBlockIndexSnapshotRecord), vBatch.size(), file) == vBatch.size();
+            vBatch.clear();
+        }
+    }
+    hasher.Finalize(header.checksum.begin());
+    fOk = fOk && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fOk) {
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, path)) {
+        fs::remove(pathTmp);
+        return error("%s: failed to write %s", __func__, path.string());
+    }
+
+    if (!pblocktree->WriteBlockIndexSnapshotInfo(header.hashBestBlock, header.checksum)) {
+        return error("%s: failed to record snapshot in block tree DB", __func__);
+    }
+
+    LogPrintf("%s: wrote %u block index entries to %s in %.2fms\n", __func__, vIndexes.size(), path.filename().string(), 0.001 * (GetTimeMicros() - nTimeStart));
+    return true;
+}
+
+/** Read-only view of the snapshot file, mapped where supported, read into memory otherwise */
+class CSnapshotFile
+{
+private:
+    const unsigned char* pData{nullptr};
+    size_t nSize{0};
+#ifndef WIN32
+    void* pMapped{MAP_FAILED};
+#endif
+    std::vector<unsigned char> vData;
+
+public:
+    explicit CSnapshotFile(const fs::path& path)
+    {
+#ifndef WIN32
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd == -1) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            pMapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (pMapped != MAP_FAILED) {
+                pData = (const unsigned char*)pMapped;
+                nSize = st.st_size;
+            }
+        }
+        close(fd);
+#else
+        FILE* file = fsbridge::fopen(path, "rb");
+        if (!file) {
+            return;
+        }
+        fseek(file, 0, SEEK_END);
+        long nFileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (nFileSize > 0) {
+            vData.resize(nFileSize);
+            if (fread(vData.data(), 1, vData.size(), file) == vData.size()) {
+                pData = vData.data();
+                nSize = vData.size();
+            }
+        }
+        fclose(file);
+#endif
+    }
+
+    ~CSnapshotFile()
+    {
+#ifndef WIN32
+        if (pMapped != MAP_FAILED) {
+            munmap(pMapped, nSize);
+        }
+#endif
+    }
+
+    CSnapshotFile(const CSnapshotFile&) = delete;
+    CSnapshotFile& operator=(const CSnapshotFile&) = delete;
+
+    const unsigned char* data() const { return pData; }
+    size_t size() const { return nSize; }
+};
+
+bool LoadBlockIndexSnapshot(std::unique_ptr<CBlockIndex[]>& arenaRet, size_t& nEntriesRet)
+{
+    assert(mapBlockIndex.empty());
+
+    uint256 hashBestBlock, checksum;
+    if (!pblocktree->ReadBlockIndexSnapshotInfo(hashBestBlock, checksum)) {
+        return false;
+    }
+    // From here on the block index may change, which makes the snapshot stale even if we crash later
+    if (!pblocktree->EraseBlockIndexSnapshotInfo()) {
+        return false;
+    }
+    if (!gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT)) {
+        fs::remove(GetSnapshotPath());
+        return false;
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    CSnapshotFile file(GetSnapshotPath());
+
+    CBlockIndexSnapshotHeader header{};
+    if (file.size() < sizeof(header)) {
+        LogPrintf("%s: %s missing or truncated\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.nVersion != SNAPSHOT_VERSION ||
+        header.nRecordSize != sizeof(CBlockIndexSnapshotRecord) || header.nRecords > std::numeric_limits<int32_t>::max() ||
+        file.size() != sizeof(header) + header.nRecords * sizeof(CBlockIndexSnapshotRecord)) {
+        LogPrintf("%s: %s has an unexpected format\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return false;
+    }
+    if (header.hashBestBlock != hashBestBlock || header.checksum != checksum) {
+        LogPrintf("%s: %s does not match the block tree DB\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return false;
+    }
+    // The snapshot is written after the final flush, so the coins must still be at its best block. Anything else,
+    // including a coins DB in the middle of a write, means the chainstate moved on without the snapshot.
+    if (!pcoinsdbview || header.hashBestBlock != pcoinsdbview->GetBestBlock()) {
+        LogPrintf("%s: %s does not match the best block of the coins database\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return false;
+    }
+
+    const CBlockIndexSnapshotRecord* records = (const CBlockIndexSnapshotRecord*)(file.data() + sizeof(header));
+    size_t nRecords = header.nRecords;
+    uint256 hashRecords;
+    CSHA256().Write((const unsigned char*)records, nRecords * sizeof(CBlockIndexSnapshotRecord)).Finalize(hashRecords.begin());
+    if (hashRecords != checksum) {
+        LogPrintf("%s: %s checksum mismatch\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return false;
+    }
+    int64_t nTimeRead = GetTimeMicros();
+
+    std::unique_ptr<CBlockIndex[]> arena(new CBlockIndex[nRecords]);
+    mapBlockIndex.reserve(nRecords);
+    for (size_t i = 0; i < nRecords; i++) {
+        const CBlockIndexSnapshotRecord& record = records[i];
+        CBlockIndex* pindex = &arena[i];
+        // Records are ordered by height, so the predecessor has already been restored
+        if (record.nPrev >= (int32_t)i) {
+            mapBlockIndex.clear();
+            return error("%s: invalid predecessor of record %u", __func__, i);
+        }
+        auto inserted = mapBlockIndex.emplace(record.hash, pindex);
+        if (!inserted.second) {
+            mapBlockIndex.clear();
+            return error("%s: duplicate record %s", __func__, record.hash.ToString());
+        }
+        IndexFromRecord(record, pindex);
+        pindex->phashBlock = &inserted.first->first;
+        pindex->pprev = record.nPrev >= 0 ? &arena[record.nPrev] : nullptr;
+    }
+
+    LogPrint(BCLog::BENCHMARK, "%s: loaded %u block index entries in %.2fms (verify %.2fms, restore %.2fms)\n", __func__,
+        nRecords, 0.001 * (GetTimeMicros() - nTimeStart), 0.001 * (nTimeRead - nTimeStart), 0.001 * (GetTimeMicros() - nTimeRead));
+    arenaRet = std::move(arena);
+    nEntriesRet = nRecords;
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_BLOCKINDEXSNAPSHOT_H
+#define LOKAL_BLOCKINDEXSNAPSHOT_H
+
+#include "chain.h"
+#include "uint256.h"
+
+#include <memory>
+
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = false;
+static const char* const BLOCK_INDEX_SNAPSHOT_FILENAME = "blockindex.snapshot";
+
+/**
+ * On disk image of one block index entry. The snapshot file is a header followed by one of these per
+ * entry, ordered by height so that a predecessor always comes before its successors.
+ */
+struct CBlockIndexSnapshotRecord {
+    uint256 hash;
+    uint256 hashMerkleRoot;
+    uint256 hashProofOfStake;
+    uint256 hashPrevoutStake;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    uint64_t nStakeModifier;
+    int32_t nPrev; //!< index of the predecessor's record, -1 if none
+    int32_t nHeight;
+    int32_t nFile;
+    uint32_t nDataPos;
+    uint32_t nUndoPos;
+    int32_t nVersion;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+    uint32_t nStatus;
+    uint32_t nTx;
+    uint32_t nFlags;
+    uint32_t nPrevoutStake;
+    uint32_t nStakeTime;
+};
+static_assert(sizeof(CBlockIndexSnapshotRecord) == 208, "unexpected CBlockIndexSnapshotRecord padding");
+
+/**
+ * Write all block index entries to the snapshot file and record its best block and checksum in the block
+ * tree DB. Only valid at shutdown, after the final state flush. Requires cs_main.
+ */
+bool DumpBlockIndexSnapshot();
+
+/**
+ * Fill mapBlockIndex from the snapshot file, if -blockindexsnapshot is set, the file matches the best block
+ * and checksum recorded in the block tree DB and its best block is still the one of pcoinsdbview. The record in the DB is always erased, so that a snapshot is used
+ * at most once and never after the block index was modified. On success arenaRet owns the nEntriesRet loaded
+ * entries. Like the rest of the block index loading, this runs at startup and requires an empty mapBlockIndex.
+ */
+bool LoadBlockIndexSnapshot(std::unique_ptr<CBlockIndex[]>& arenaRet, size_t& nEntriesRet);
+
+#endif // LOKAL_BLOCKINDEXSNAPSHOT_H
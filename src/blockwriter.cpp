@@ -0,0 +1,223 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockwriter.h"
+
+#include "clientversion.h"
+#include "fs.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <functional>
+
+CBlockFileWriter::CBlockFileWriter() :
+    nQueuedBytes(0),
+    nNextSeq(0),
+    nWrittenSeq(0),
+    nSyncedSeq(0),
+    nSyncRequestSeq(0),
+    fFailed(false),
+    fStop(false),
+    nUnsyncedBytes(0)
+{
+    threadWriter = std::thread(&TraceThread<std::function<void()> >, "blkwrite", std::function<void()>(std::bind(&CBlockFileWriter::ThreadWrite, this)));
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    {
+        WaitableLock lock(cs);
+        fStop = true;
+    }
+    condWork.notify_all();
+    threadWriter.join();
+}
+
+void CBlockFileWriter::Queue(const std::string& strPrefix, const CDiskBlockPos& pos, CDataStream&& data, bool fTruncate)
+{
+    {
+        WaitableLock lock(cs);
+        condDone.wait(lock, [this] { return fFailed || nQueuedBytes < BLOCK_WRITER_QUEUE_SIZE; });
+        nQueuedBytes += data.size();
+        queue.emplace_back(nNextSeq++, strPrefix, pos, std::move(data), fTruncate);
+    }
+    condWork.notify_one();
+}
+
+bool CBlockFileWriter::Write(const std::string& strPrefix, const CDiskBlockPos& pos, CDataStream&& data)
+{
+    {
+        WaitableLock lock(cs);
+        if (fFailed) {
+            return false;
+        }
+    }
+    Queue(strPrefix, pos, std::move(data), false);
+    return true;
+}
+
+void CBlockFileWriter::Truncate(const std::string& strPrefix, int nFile, unsigned int nSize)
+{
+    Queue(strPrefix, CDiskBlockPos(nFile, nSize), CDataStream(SER_DISK, CLIENT_VERSION), true);
+}
+
+void CBlockFileWriter::RequestSync()
+{
+    {
+        WaitableLock lock(cs);
+        nSyncRequestSeq = nNextSeq;
+    }
+    condWork.notify_one();
+}
+
+bool CBlockFileWriter::Flush()
+{
+    int64_t nStart = GetTimeMicros();
+    WaitableLock lock(cs);
+    const uint64_t nTarget = nNextSeq;
+    nSyncRequestSeq = nTarget;
+    condWork.notify_one();
+    condDone.wait(lock, [this, nTarget] { return fFailed || nSyncedSeq >= nTarget; });
+    LogPrint(BCLog::BENCHMARK, "%s: waited %.2fms for block and undo files\n", __func__, (GetTimeMicros() - nStart) * 0.001);
+    return !fFailed;
+}
+
+void CBlockFileWriter::WaitForWrites(const std::string& strPrefix, int nFile)
+{
+    WaitableLock lock(cs);
+    uint64_t nSeq = 0;
+    bool fPending = false;
+    auto it = mapInFlight.find(std::make_pair(strPrefix, nFile));
+    if (it != mapInFlight.end()) {
+        nSeq = it->second;
+        fPending = true;
+    }
+    for (const CWrite& write : queue) {
+        if (write.strPrefix == strPrefix && write.pos.nFile == nFile) {
+            nSeq = write.nSeq;
+            fPending = true;
+        }
+    }
+    if (fPending) {
+        condDone.wait(lock, [this, nSeq] { return fFailed || nWrittenSeq > nSeq; });
+    }
+}
+
+bool CBlockFileWriter::WriteOne(CWrite& write)
+{
+    std::pair<std::string, int> key(write.strPrefix, write.pos.nFile);
+    auto it = mapFiles.find(key);
+    if (it == mapFiles.end()) {
+        fs::path path = GetBlockPosFilename(write.pos, write.strPrefix.c_str());
+        fs::create_directories(path.parent_path());
+        FILE* file = fsbridge::fopen(path, "rb+");
+        if (!file)
+            file = fsbridge::fopen(path, "wb+");
+        if (!file)
+            return error("%s: Unable to open file %s", __func__, path.string());
+        it = mapFiles.emplace(key, std::make_pair(file, false)).first;
+    }
+    FILE* file = it->second.first;
+    it->second.second = true;
+
+    if (write.fTruncate) {
+        if (fflush(file) != 0 || !TruncateFile(file, write.pos.nPos))
+            return error("%s: Unable to truncate %s%05u.dat to %u", __func__, write.strPrefix, write.pos.nFile, write.pos.nPos);
+        return true;
+    }
+    if (fseek(file, write.pos.nPos, SEEK_SET) != 0 || fwrite(write.data.data(), 1, write.data.size(), file) != write.data.size())
+        return error("%s: Unable to write %u bytes at %s to %s%05u.dat", __func__, write.data.size(), write.pos.ToString(), write.strPrefix, write.pos.nFile);
+    return true;
+}
+
+bool CBlockFileWriter::SyncFiles()
+{
+    bool fOk = true;
+    for (auto& entry : mapFiles) {
+        if (entry.second.second) {
+            FileCommit(entry.second.first);
+        }
+        if (fclose(entry.second.first) != 0) {
+            fOk = error("%s: Unable to close %s%05u.dat", __func__, entry.first.first, entry.first.second);
+        }
+    }
+    mapFiles.clear();
+    nUnsyncedBytes = 0;
+    return fOk;
+}
+
+void CBlockFileWriter::ThreadWrite()
+{
+    while (true) {
+        std::deque<CWrite> batch;
+        bool fSync;
+        bool fStopping;
+        {
+            WaitableLock lock(cs);
+            condWork.wait(lock, [this] { return fStop || !queue.empty() || nSyncRequestSeq > nSyncedSeq; });
+            batch.swap(queue);
+            for (const CWrite& write : batch) {
+                mapInFlight[std::make_pair(write.strPrefix, write.pos.nFile)] = write.nSeq;
+            }
+            fStopping = fStop;
+        }
+
+        // Writes are not reordered, so a truncation always applies to what was queued before it
+        int64_t nStart = GetTimeMicros();
+        size_t nBytes = 0;
+        bool fOk = true;
+        for (CWrite& write : batch) {
+            nBytes += write.data.size();
+            if (fOk && !WriteOne(write)) {
+                fOk = false;
+            }
+        }
+        for (auto& entry : mapFiles) {
+            if (entry.second.second && fflush(entry.second.first) != 0) {
+                fOk = error("%s: Unable to flush %s%05u.dat", __func__, entry.first.first, entry.first.second);
+            }
+        }
+        nUnsyncedBytes += nBytes;
+        if (!batch.empty()) {
+            LogPrint(BCLog::BENCHMARK, "%s: wrote %u items (%u bytes) in %.2fms\n", __func__, batch.size(), nBytes, (GetTimeMicros() - nStart) * 0.001);
+        }
+
+        uint64_t nSeq;
+        {
+            WaitableLock lock(cs);
+            if (!batch.empty()) {
+                nWrittenSeq = batch.back().nSeq + 1;
+            }
+            nSeq = nWrittenSeq;
+            nQueuedBytes -= nBytes;
+            mapInFlight.clear();
+            if (!fOk && !fFailed) {
+                fFailed = true;
+                LogPrintf("%s: failed to write block or undo data, the node will shut down at the next flush\n", __func__);
+            }
+            fSync = fStopping || nSyncRequestSeq > nSyncedSeq || nUnsyncedBytes >= BLOCK_WRITER_SYNC_SIZE;
+        }
+        condDone.notify_all();
+
+        if (fSync) {
+            nStart = GetTimeMicros();
+            fOk = SyncFiles();
+            LogPrint(BCLog::BENCHMARK, "%s: synced block and undo files in %.2fms\n", __func__, (GetTimeMicros() - nStart) * 0.001);
+            {
+                WaitableLock lock(cs);
+                nSyncedSeq = nSeq;
+                fFailed |= !fOk;
+            }
+            condDone.notify_all();
+        }
+
+        if (fStopping) {
+            WaitableLock lock(cs);
+            if (queue.empty()) {
+                return;
+            }
+        }
+    }
+}
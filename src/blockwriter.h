@@ -0,0 +1,104 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_BLOCKWRITER_H
+#define LOKAL_BLOCKWRITER_H
+
+#include "chain.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+
+static const bool DEFAULT_ASYNC_BLOCK_WRITES = false;
+//! Serialized size of the writes that may be queued before Write() waits for the writer
+static const size_t BLOCK_WRITER_QUEUE_SIZE = 64 << 20;
+//! Bytes written after which the writer syncs the files in the background
+static const size_t BLOCK_WRITER_SYNC_SIZE = 16 << 20;
+
+/**
+ * Writes block (blk?????.dat) and undo (rev?????.dat) data on a background thread.
+ *
+ * The caller serializes the data and gets on with validation while the writer thread writes it. Writes queued
+ * while the writer is busy are written together and the files are flushed to the OS once per batch; they are
+ * synced in the background every BLOCK_WRITER_SYNC_SIZE bytes and when a file is finished, so that Flush(), which
+ * has to happen before the block index and the chainstate that refer to the data are written, usually has little
+ * left to sync.
+ *
+ * Readers of a file with pending writes wait for them in OpenBlockFile(), so the data is readable as soon as
+ * the position is handed out.
+ */
+class CBlockFileWriter
+{
+private:
+    struct CWrite
+    {
+        uint64_t nSeq;
+        std::string strPrefix;
+        CDiskBlockPos pos;
+        //! data to write at pos, or nothing to truncate the file at pos
+        CDataStream data;
+        bool fTruncate;
+
+        CWrite(uint64_t nSeqIn, const std::string& strPrefixIn, const CDiskBlockPos& posIn, CDataStream&& dataIn, bool fTruncateIn) :
+            nSeq(nSeqIn), strPrefix(strPrefixIn), pos(posIn), data(std::move(dataIn)), fTruncate(fTruncateIn) {}
+    };
+
+    CWaitableCriticalSection cs;
+    CConditionVariable condWork; //!< writes were queued, a sync was requested or the writer is stopping
+    CConditionVariable condDone; //!< writes were written or synced
+    std::deque<CWrite> queue;
+    //! Files written by the batch in progress, with the sequence number of their last write
+    std::map<std::pair<std::string, int>, uint64_t> mapInFlight;
+    size_t nQueuedBytes;
+    uint64_t nNextSeq;
+    //! Writes before these sequence numbers are written, respectively synced
+    uint64_t nWrittenSeq;
+    uint64_t nSyncedSeq;
+    uint64_t nSyncRequestSeq;
+    bool fFailed;
+    bool fStop;
+
+    //! Open files and whether they were written since they were last synced, only used by the writer thread
+    std::map<std::pair<std::string, int>, std::pair<FILE*, bool>> mapFiles;
+    size_t nUnsyncedBytes;
+
+    std::thread threadWriter;
+
+    void ThreadWrite();
+    bool WriteOne(CWrite& write);
+    //! Sync all files written since the last sync and close them
+    bool SyncFiles();
+    void Queue(const std::string& strPrefix, const CDiskBlockPos& pos, CDataStream&& data, bool fTruncate);
+
+public:
+    CBlockFileWriter();
+    //! Writes and syncs everything that is queued
+    ~CBlockFileWriter();
+
+    CBlockFileWriter(const CBlockFileWriter&) = delete;
+    CBlockFileWriter& operator=(const CBlockFileWriter&) = delete;
+
+    //! Queue data to be written at pos of a file ("blk" or "rev"), false if an earlier write failed
+    bool Write(const std::string& strPrefix, const CDiskBlockPos& pos, CDataStream&& data);
+    //! Queue truncating a file to nSize once the writes queued before are done
+    void Truncate(const std::string& strPrefix, int nFile, unsigned int nSize);
+
+    //! Start syncing everything queued so far without waiting for it
+    void RequestSync();
+    //! Wait until everything queued so far is written and synced, false if a write failed
+    bool Flush();
+
+    //! Wait until the pending writes to a file are written
+    void WaitForWrites(const std::string& strPrefix, int nFile);
+};
+
+#endif // LOKAL_BLOCKWRITER_H
@@ -0,0 +1,247 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "crypto/muhash.h"
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+#include <boost/thread/thread.hpp> // boost::thread::interrupt
+
+uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+//! Append the data a coin contributes to the MuHash of the UTXO set
+static void SerializeCoin(std::vector<unsigned char>& vch, const COutPoint& outpoint, const Coin& coin)
+{
+    uint32_t nCode = coin.nHeight * 2 + coin.fCoinBase;
+    CVectorWriter(SER_DISK, PROTOCOL_VERSION, vch, vch.size(), outpoint, nCode, coin.out);
+}
+
+void MuHashAddCoin(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    std::vector<unsigned char> vch;
+    SerializeCoin(vch, outpoint, coin);
+    muhash.Insert(vch.data(), vch.size());
+}
+
+void MuHashRemoveCoin(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    std::vector<unsigned char> vch;
+    SerializeCoin(vch, outpoint, coin);
+    muhash.Remove(vch.data(), vch.size());
+}
+
+/**
+ * Computes a MuHash over coins on a set of worker threads. Since the hash does not depend on the order of the
+ * elements, each worker keeps its own partial hash and the partial hashes are multiplied in Finish().
+ */
+class CParallelMuHash
+{
+private:
+    //! Serialized coins, vEnds holds the end offset of each in vData
+    struct Batch {
+        std::vector<unsigned char> vData;
+        std::vector<size_t> vEnds;
+    };
+    static const size_t BATCH_COINS = 1024;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable condWork;
+    CConditionVariable condSpace;
+    std::deque<Batch> queue;
+    bool fDone;
+
+    Batch current;
+    std::vector<MuHash3072> vPartial;
+    std::vector<std::thread> vThreads;
+
+    void Worker(size_t nIndex)
+    {
+        MuHash3072 partial;
+        while (true) {
+            Batch batch;
+            {
+                WaitableLock lock(cs);
+                condWork.wait(lock, [this] { return fDone || !queue.empty(); });
+                if (queue.empty()) {
+                    break;
+                }
+                batch = std::move(queue.front());
+                queue.pop_front();
+            }
+            condSpace.notify_one();
+
+            size_t nBegin = 0;
+            for (size_t nEnd : batch.vEnds) {
+                partial.Insert(batch.vData.data() + nBegin, nEnd - nBegin);
+                nBegin = nEnd;
+            }
+        }
+        // only read after the thread was joined
+        vPartial[nIndex] = partial;
+    }
+
+    void PushCurrent()
+    {
+        {
+            WaitableLock lock(cs);
+            // bound the memory used by serialized coins nobody is hashing yet
+            condSpace.wait(lock, [this] { return queue.size() < 2 * vThreads.size(); });
+            queue.push_back(std::move(current));
+        }
+        condWork.notify_one();
+        current = Batch();
+    }
+
+    void Join()
+    {
+        {
+            WaitableLock lock(cs);
+            fDone = true;
+        }
+        condWork.notify_all();
+        for (std::thread& thread : vThreads) {
+            thread.join();
+        }
+        vThreads.clear();
+    }
+
+public:
+    explicit CParallelMuHash(int nThreads) : fDone(false), vPartial(nThreads)
+    {
+        for (int i = 0; i < nThreads; i++) {
+            vThreads.emplace_back(&CParallelMuHash::Worker, this, i);
+        }
+    }
+
+    ~CParallelMuHash()
+    {
+        if (!vThreads.empty()) {
+            Join();
+        }
+    }
+
+    void Add(const COutPoint& outpoint, const Coin& coin)
+    {
+        SerializeCoin(current.vData, outpoint, coin);
+        current.vEnds.push_back(current.vData.size());
+        if (current.vEnds.size() >= BATCH_COINS) {
+            PushCurrent();
+        }
+    }
+
+    //! Wait for all coins to be hashed and return the hash of the whole set
+    MuHash3072 Finish()
+    {
+        if (!current.vEnds.empty()) {
+            PushCurrent();
+        }
+        Join();
+        MuHash3072 result;
+        for (const MuHash3072& partial : vPartial) {
+            result *= partial;
+        }
+        return result;
+    }
+};
+
+CCoinsStatsBuilder::CCoinsStatsBuilder(const uint256& hashBlock, CoinStatsHashType hashType) : ss(SER_GETHASH, PROTOCOL_VERSION)
+{
+    stats.hashType = hashType;
+    stats.hashBlock = hashBlock;
+    if (hashType == CoinStatsHashType::HASH_SERIALIZED) {
+        ss << hashBlock;
+    } else if (hashType == CoinStatsHashType::MUHASH) {
+        muhash.reset(new CParallelMuHash(std::max(1, std::min(GetNumCores() - 1, MAX_COINSTATS_HASH_THREADS))));
+    }
+}
+
+CCoinsStatsBuilder::~CCoinsStatsBuilder() {}
+
+void CCoinsStatsBuilder::ApplyOutputs()
+{
+    assert(!outputs.empty());
+    const bool fHashSerialized = stats.hashType == CoinStatsHashType::HASH_SERIALIZED;
+    if (fHashSerialized) {
+        ss << prevkey;
+        ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    }
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        if (fHashSerialized) {
+            ss << VARINT(output.first + 1);
+            ss << output.second.out.scriptPubKey;
+            ss << VARINT(output.second.out.nValue);
+        } else if (muhash) {
+            muhash->Add(COutPoint(prevkey, output.first), output.second);
+        }
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    if (fHashSerialized) {
+        ss << VARINT(0);
+    }
+    outputs.clear();
+}
+
+void CCoinsStatsBuilder::Add(const COutPoint& key, Coin&& coin)
+{
+    if (!outputs.empty() && key.hash != prevkey) {
+        ApplyOutputs();
+    }
+    prevkey = key.hash;
+    outputs[key.n] = std::move(coin);
+}
+
+const CCoinsStats& CCoinsStatsBuilder::Finalize()
+{
+    if (!outputs.empty()) {
+        ApplyOutputs();
+    }
+    if (stats.hashType == CoinStatsHashType::HASH_SERIALIZED) {
+        stats.hashSerialized = ss.GetHash();
+    } else if (muhash) {
+        muhash->Finish().Finalize(stats.hashSerialized.begin());
+        muhash.reset();
+    }
+    return stats;
+}
+
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+
+    CCoinsStatsBuilder builder(pcursor->GetBestBlock(), stats.hashType);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            builder.Add(key, std::move(coin));
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    stats = builder.Finalize();
+    {
+        LOCK(cs_main);
+        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    }
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
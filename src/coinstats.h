@@ -0,0 +1,88 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_COINSTATS_H
+#define LOKAL_COINSTATS_H
+
+#include "amount.h"
+#include "coins.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+
+class MuHash3072;
+
+//! Maximum number of threads hashing coins for a MuHash UTXO set scan
+static const int MAX_COINSTATS_HASH_THREADS = 8;
+
+enum class CoinStatsHashType {
+    HASH_SERIALIZED, //!< hash_serialized_2, a SHA256d over the set in chainstate order
+    MUHASH,          //!< MuHash3072 of the set, independent of order and so maintainable incrementally
+    NONE,
+};
+
+struct CCoinsStats
+{
+    CoinStatsHashType hashType;
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    //! Outputs that never entered the UTXO set, only known to the coinstats index, which in turn does not count
+    //! transactions or the disk size
+    CAmount nTotalUnspendable;
+
+    CCoinsStats() : hashType(CoinStatsHashType::HASH_SERIALIZED), nHeight(0), nTransactions(0), nTransactionOutputs(0),
+                    nBogoSize(0), nDiskSize(0), nTotalAmount(0), nTotalUnspendable(0) {}
+};
+
+//! Contribution of one unspent output to nBogoSize
+uint64_t GetBogoSize(const CScript& scriptPubKey);
+
+/**
+ * Add or remove a coin in a MuHash of the UTXO set. fCoinStake is not part of the hashed data, since the undo
+ * data a coin is restored from on disconnect does not keep it.
+ */
+void MuHashAddCoin(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+void MuHashRemoveCoin(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+class CParallelMuHash;
+
+/**
+ * Accumulates CCoinsStats, including hash_serialized, from coins fed in the order of a CCoinsViewDB cursor,
+ * i.e. with the outputs of a transaction next to each other.
+ */
+class CCoinsStatsBuilder
+{
+private:
+    CCoinsStats stats;
+    CHashWriter ss;
+    //! Worker threads computing the MuHash, so that the cursor walk is not bound by the modular multiplications
+    std::unique_ptr<CParallelMuHash> muhash;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+
+    void ApplyOutputs();
+
+public:
+    explicit CCoinsStatsBuilder(const uint256& hashBlock, CoinStatsHashType hashType = CoinStatsHashType::HASH_SERIALIZED);
+    ~CCoinsStatsBuilder();
+
+    void Add(const COutPoint& key, Coin&& coin);
+    //! Finish the last transaction and return the stats, nHeight and nDiskSize are left to the caller
+    const CCoinsStats& Finalize();
+};
+
+//! Calculate statistics about the unspent transaction output set, stats.hashType selects the hash
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
+
+#endif // LOKAL_COINSTATS_H
@@ -0,0 +1,373 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstatsindex.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "utiltime.h"
+#include "validation.h"
+
+static const char DB_STATS = 's';
+static const char DB_MUHASH = 'M';
+static const char DB_BEST_BLOCK = 'B';
+
+//! Log sync progress at most this often (seconds)
+static const int64_t SYNC_LOG_INTERVAL = 30;
+
+std::unique_ptr<CCoinStatsIndex> pcoinstatsindex;
+
+CCoinStatsIndex::CCoinStatsIndex(size_t nCacheSize, bool fMemory, bool fWipe) :
+    pindexBest(nullptr),
+    fSynced(false)
+{
+    fs::path pathIndex = GetDataDir() / "indexes" / "coinstats";
+    fs::create_directories(pathIndex);
+    db.reset(new CDBWrapper(pathIndex / "db", nCacheSize, fMemory, fWipe, false, GetDBOptions("coinstatsindex")));
+}
+
+CCoinStatsIndex::~CCoinStatsIndex()
+{
+    Stop();
+}
+
+bool CCoinStatsIndex::LookupEntry(const CBlockIndex* pindex, CStatsEntry& entry) const
+{
+    return db->Read(std::make_pair(DB_STATS, pindex->GetBlockHash()), entry);
+}
+
+bool CCoinStatsIndex::ReadUndo(const CBlockIndex* pindex, CBlockUndo& blockUndo, CAmount& nMoneySupply) const
+{
+    CDiskBlockPos posUndo;
+    {
+        LOCK(cs_main);
+        posUndo = pindex->GetUndoPos();
+        nMoneySupply = pindex->nMoneySupply;
+    }
+    if (!pindex->pprev) {
+        // the outputs of the genesis block are not part of the UTXO set and there is nothing to undo
+        return true;
+    }
+    if (!UndoReadFromDisk(blockUndo, posUndo, pindex->pprev->GetBlockHash())) {
+        return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    return true;
+}
+
+bool CCoinStatsIndex::ConnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockUndo, CAmount nMoneySupply)
+{
+    AssertLockHeld(cs);
+    assert(pindex->pprev == pindexBest);
+
+    MuHash3072 muhashNext = muhash;
+    CStatsEntry entry = entryBest;
+    if (pindex->pprev) {
+        if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+        }
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            const uint256& txid = tx.GetHash();
+            for (size_t j = 0; j < tx.vout.size(); j++) {
+                const CTxOut& out = tx.vout[j];
+                if (out.scriptPubKey.IsUnspendable()) {
+                    entry.nTotalUnspendable += out.nValue;
+                    continue;
+                }
+                MuHashAddCoin(muhashNext, COutPoint(txid, j), Coin(out, pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+                entry.nTransactionOutputs++;
+                entry.nTotalAmount += out.nValue;
+                entry.nBogoSize += GetBogoSize(out.scriptPubKey);
+            }
+            if (i == 0) {
+                continue;
+            }
+
+            const CTxUndo& txUndo = blockUndo.vtxundo[i - 1];
+            if (txUndo.vprevout.size() != tx.vin.size()) {
+                return error("%s: undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+            }
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin& coin = txUndo.vprevout[j];
+                MuHashRemoveCoin(muhashNext, tx.vin[j].prevout, coin);
+                entry.nTransactionOutputs--;
+                entry.nTotalAmount -= coin.out.nValue;
+                entry.nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+            }
+        }
+    }
+    muhashNext.Finalize(entry.hashMuHash.begin());
+
+    // every amount created by a block is either unspent or was sent to an unspendable output
+    if (entry.nTotalAmount + entry.nTotalUnspendable != nMoneySupply) {
+        LogPrintf("WARNING: %s: money supply of block %s at height %d is %s, but the coinstats index accounts for %s\n", __func__,
+                  pindex->GetBlockHash().ToString(), pindex->nHeight, FormatMoney(nMoneySupply), FormatMoney(entry.nTotalAmount + entry.nTotalUnspendable));
+    }
+
+    muhash = muhashNext;
+    entryBest = entry;
+    pindexBest = pindex;
+    return WriteBest(true);
+}
+
+bool CCoinStatsIndex::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockUndo)
+{
+    AssertLockHeld(cs);
+    assert(pindex == pindexBest && pindex->pprev);
+
+    CStatsEntry entryPrev;
+    if (!LookupEntry(pindex->pprev, entryPrev)) {
+        return error("%s: previous block %s is not indexed", __func__, pindex->pprev->GetBlockHash().ToString());
+    }
+    if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    MuHash3072 muhashPrev = muhash;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut& out = tx.vout[j];
+            if (!out.scriptPubKey.IsUnspendable()) {
+                MuHashRemoveCoin(muhashPrev, COutPoint(txid, j), Coin(out, pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+            }
+        }
+        if (i == 0) {
+            continue;
+        }
+
+        const CTxUndo& txUndo = blockUndo.vtxundo[i - 1];
+        if (txUndo.vprevout.size() != tx.vin.size()) {
+            return error("%s: undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+        }
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            MuHashAddCoin(muhashPrev, tx.vin[j].prevout, txUndo.vprevout[j]);
+        }
+    }
+
+    uint256 hashMuHash;
+    muhashPrev.Finalize(hashMuHash.begin());
+    if (hashMuHash != entryPrev.hashMuHash) {
+        return error("%s: reverting block %s does not lead back to the UTXO set hash of %s", __func__,
+                     pindex->GetBlockHash().ToString(), pindex->pprev->GetBlockHash().ToString());
+    }
+
+    muhash = muhashPrev;
+    entryBest = entryPrev;
+    pindexBest = pindex->pprev;
+    return WriteBest(false);
+}
+
+bool CCoinStatsIndex::WriteBest(bool fWriteEntry)
+{
+    AssertLockHeld(cs);
+
+    // the running hash is only valid together with the best block, so both go into the same batch
+    CDBBatch batch(*db);
+    if (fWriteEntry) {
+        batch.Write(std::make_pair(DB_STATS, pindexBest->GetBlockHash()), entryBest);
+    }
+    batch.Write(DB_MUHASH, muhash);
+    batch.Write(DB_BEST_BLOCK, pindexBest->GetBlockHash());
+    return db->WriteBatch(batch);
+}
+
+void CCoinStatsIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    const CBlockIndex* pindex = GetBestBlockIndex();
+    int64_t nLastLog = 0;
+
+    while (!interrupt) {
+        const CBlockIndex* pindexNext = nullptr;
+        bool fRewind = false;
+        {
+            LOCK(cs_main);
+            if (!pindex) {
+                pindexNext = chainActive.Genesis();
+            } else if (chainActive.Contains(pindex)) {
+                pindexNext = chainActive.Next(pindex);
+            } else {
+                // the old best block was reorged out, revert it first
+                fRewind = true;
+            }
+
+            if (!pindexNext && !fRewind) {
+                // from now on the notifications keep the index up to date
+                fSynced = true;
+                break;
+            }
+        }
+
+        const CBlockIndex* pindexBlock = fRewind ? pindex : pindexNext;
+        int64_t nNow = GetTime();
+        if (nNow - nLastLog >= SYNC_LOG_INTERVAL) {
+            LogPrintf("Syncing coinstats index with block chain from height %d\n", pindexBlock->nHeight);
+            nLastLog = nNow;
+        }
+
+        CBlock block;
+        CBlockUndo blockUndo;
+        CAmount nMoneySupply;
+        bool fOk = ReadBlockFromDisk(block, pindexBlock, consensusParams) && ReadUndo(pindexBlock, blockUndo, nMoneySupply);
+        if (fOk) {
+            LOCK(cs);
+            fOk = fRewind ? DisconnectBlock(block, pindexBlock, blockUndo) : ConnectBlock(block, pindexBlock, blockUndo, nMoneySupply);
+        }
+        if (!fOk) {
+            LogPrintf("%s: failed to %s block %s, coinstats index stopped syncing\n", __func__,
+                      fRewind ? "revert" : "index", pindexBlock->GetBlockHash().ToString());
+            return;
+        }
+        pindex = fRewind ? pindexBlock->pprev : pindexBlock;
+    }
+
+    if (fSynced) {
+        LogPrintf("coinstats index is enabled at height %d\n", pindex ? pindex->nHeight : -1);
+    }
+}
+
+void CCoinStatsIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted)
+{
+    if (!fSynced) {
+        return;
+    }
+
+    CBlockUndo blockUndo;
+    CAmount nMoneySupply;
+    if (!ReadUndo(pindex, blockUndo, nMoneySupply)) {
+        LogPrintf("%s: failed to index block %s\n", __func__, pindex->GetBlockHash().ToString());
+        return;
+    }
+
+    LOCK(cs);
+    if (pindexBest && pindexBest->GetAncestor(pindex->nHeight) == pindex) {
+        // queued before the sync thread finished, which already indexed it
+        return;
+    }
+    if (pindex->pprev != pindexBest) {
+        LogPrintf("%s: block %s does not connect to the best block of the coinstats index\n", __func__, pindex->GetBlockHash().ToString());
+        return;
+    }
+    if (!ConnectBlock(*block, pindex, blockUndo, nMoneySupply)) {
+        LogPrintf("%s: failed to index block %s\n", __func__, pindex->GetBlockHash().ToString());
+    }
+}
+
+void CCoinStatsIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindexDisconnected)
+{
+    if (!fSynced) {
+        return;
+    }
+
+    CBlockUndo blockUndo;
+    CAmount nMoneySupply;
+    if (!ReadUndo(pindexDisconnected, blockUndo, nMoneySupply)) {
+        LogPrintf("%s: failed to revert block %s\n", __func__, pindexDisconnected->GetBlockHash().ToString());
+        return;
+    }
+
+    LOCK(cs);
+    if (pindexBest != pindexDisconnected) {
+        return;
+    }
+    if (!DisconnectBlock(*block, pindexDisconnected, blockUndo)) {
+        LogPrintf("%s: failed to revert block %s\n", __func__, pindexDisconnected->GetBlockHash().ToString());
+    }
+}
+
+void CCoinStatsIndex::Start()
+{
+    // can't start new thread if we have one running already
+    if (threadSync.joinable()) {
+        assert(false);
+    }
+
+    interrupt.reset();
+    fSynced = false;
+
+    uint256 hashBest;
+    if (db->Read(DB_BEST_BLOCK, hashBest)) {
+        LOCK2(cs_main, cs);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        if (it != mapBlockIndex.end() && db->Read(DB_MUHASH, muhash) && LookupEntry(it->second, entryBest)) {
+            pindexBest = it->second;
+        } else {
+            LogPrintf("%s: best block of the coinstats index not found, rebuilding it\n", __func__);
+            pindexBest = nullptr;
+            muhash = MuHash3072();
+            entryBest = CStatsEntry();
+        }
+    }
+
+    RegisterValidationInterface(this);
+    threadSync = std::thread(&TraceThread<std::function<void()> >, "coinstats", std::function<void()>(std::bind(&CCoinStatsIndex::ThreadSync, this)));
+}
+
+void CCoinStatsIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+
+    interrupt();
+    if (threadSync.joinable()) {
+        threadSync.join();
+    }
+
+    LOCK(cs);
+    if (pindexBest) {
+        db->Write(DB_BEST_BLOCK, pindexBest->GetBlockHash(), true);
+    }
+}
+
+const CBlockIndex* CCoinStatsIndex::GetBestBlockIndex() const
+{
+    LOCK(cs);
+    return pindexBest;
+}
+
+bool CCoinStatsIndex::BlockUntilSyncedToCurrentChain(int64_t nTimeoutMs) const
+{
+    int64_t nStart = GetTimeMillis();
+    while (true) {
+        if (fSynced) {
+            const CBlockIndex* pindexTip;
+            {
+                LOCK(cs_main);
+                pindexTip = chainActive.Tip();
+            }
+            if (GetBestBlockIndex() == pindexTip) {
+                return true;
+            }
+        }
+        if (GetTimeMillis() - nStart >= nTimeoutMs || interrupt) {
+            return false;
+        }
+        MilliSleep(10);
+    }
+}
+
+bool CCoinStatsIndex::LookupStats(const CBlockIndex* pindex, CCoinsStats& stats) const
+{
+    CStatsEntry entry;
+    if (!LookupEntry(pindex, entry)) {
+        return false;
+    }
+
+    stats = CCoinsStats();
+    stats.hashType = CoinStatsHashType::MUHASH;
+    stats.nHeight = pindex->nHeight;
+    stats.hashBlock = pindex->GetBlockHash();
+    stats.nTransactionOutputs = entry.nTransactionOutputs;
+    stats.nBogoSize = entry.nBogoSize;
+    stats.hashSerialized = entry.hashMuHash;
+    stats.nTotalAmount = entry.nTotalAmount;
+    stats.nTotalUnspendable = entry.nTotalUnspendable;
+    return true;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_COINSTATSINDEX_H
+#define LOKAL_COINSTATSINDEX_H
+
+#include "amount.h"
+#include "chain.h"
+#include "coinstats.h"
+#include "crypto/muhash.h"
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "sync.h"
+#include "threadinterrupt.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+class CBlockUndo;
+
+static const bool DEFAULT_COINSTATSINDEX = false;
+//! Max memory allocated to the coinstats index database cache (MiB)
+static const int64_t nMaxCoinStatsIndexCache = 8;
+
+/**
+ * Persistent index of UTXO set statistics at every block of the active chain.
+ *
+ * The index keeps a MuHash3072 of the UTXO set, which is updated with the outputs created and spent by each
+ * block instead of being recomputed from the chainstate, so gettxoutsetinfo can answer for any height without
+ * walking the coins database. Spent coins are taken from the undo data, and blocks are reverted the same way
+ * on a reorg. Like the block filter index, entries are keyed by block hash.
+ *
+ * Every block's totals are cross-checked against the nMoneySupply recorded in its block index entry: all value
+ * ever created is either unspent or went to unspendable outputs.
+ */
+class CCoinStatsIndex final : public CValidationInterface
+{
+private:
+    struct CStatsEntry
+    {
+        uint256 hashMuHash;
+        uint64_t nTransactionOutputs;
+        uint64_t nBogoSize;
+        CAmount nTotalAmount;
+        CAmount nTotalUnspendable;
+
+        CStatsEntry() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0), nTotalUnspendable(0) {}
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(hashMuHash);
+            READWRITE(nTransactionOutputs);
+            READWRITE(nBogoSize);
+            READWRITE(nTotalAmount);
+            READWRITE(nTotalUnspendable);
+        }
+    };
+
+    std::unique_ptr<CDBWrapper> db;
+
+    //! Protects the best block and the running state, serializes writes
+    mutable CCriticalSection cs;
+    const CBlockIndex* pindexBest;
+    //! Hash of the UTXO set at pindexBest, not finalized
+    MuHash3072 muhash;
+    CStatsEntry entryBest;
+
+    //! Set once the sync thread caught up with the tip, notifications are ignored before that
+    std::atomic<bool> fSynced;
+
+    CThreadInterrupt interrupt;
+    std::thread threadSync;
+
+    void ThreadSync();
+
+    bool LookupEntry(const CBlockIndex* pindex, CStatsEntry& entry) const;
+
+    //! Read the undo data of a block and the nMoneySupply of its block index entry
+    bool ReadUndo(const CBlockIndex* pindex, CBlockUndo& blockUndo, CAmount& nMoneySupply) const;
+    //! Apply a block on top of pindexBest, which must be pindex->pprev. Requires cs.
+    bool ConnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockUndo, CAmount nMoneySupply);
+    //! Revert pindexBest, which must be pindex, to its predecessor. Requires cs.
+    bool DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockUndo);
+    //! Persist the running state of pindexBest, optionally together with its stats entry. Requires cs.
+    bool WriteBest(bool fWriteEntry);
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex, const std::vector<CTransactionRef>& txnConflicted) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindexDisconnected) override;
+
+public:
+    CCoinStatsIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinStatsIndex();
+
+    //! Register for block notifications and start syncing in the background
+    void Start();
+    //! Stop syncing, unregister and flush the database
+    void Stop();
+
+    bool IsSynced() const { return fSynced; }
+    const CBlockIndex* GetBestBlockIndex() const;
+
+    //! Wait (at most nTimeoutMs) for the index to catch up with the tip, returns false on timeout
+    bool BlockUntilSyncedToCurrentChain(int64_t nTimeoutMs) const;
+
+    //! Stats of the UTXO set after pindex, with the MuHash in hashSerialized
+    bool LookupStats(const CBlockIndex* pindex, CCoinsStats& stats) const;
+};
+
+/** The global coinstats index, null if -coinstatsindex is disabled */
+extern std::unique_ptr<CCoinStatsIndex> pcoinstatsindex;
+
+#endif // LOKAL_COINSTATSINDEX_H
@@ -0,0 +1,250 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/chacha20.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+const int LIMBS = Num3072::LIMBS;
+const uint32_t MAX_PRIME_DIFF = Num3072::MAX_PRIME_DIFF;
+
+/* Helpers for the binary inversion, which works on LIMBS + 1 limbs so that x + p fits. */
+
+bool IsZero(const uint32_t* a, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (a[i]) return false;
+    }
+    return true;
+}
+
+bool IsOne(const uint32_t* a, int n)
+{
+    return a[0] == 1 && IsZero(a + 1, n - 1);
+}
+
+int Compare(const uint32_t* a, const uint32_t* b, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+void Add(uint32_t* a, const uint32_t* b, int n)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < n; i++) {
+        c += (uint64_t)a[i] + b[i];
+        a[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+void Sub(uint32_t* a, const uint32_t* b, int n)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t d = (uint64_t)a[i] - b[i] - borrow;
+        a[i] = (uint32_t)d;
+        borrow = (d >> 32) & 1;
+    }
+}
+
+void ShiftRight(uint32_t* a, int n)
+{
+    for (int i = 0; i < n - 1; i++) {
+        a[i] = (a[i] >> 1) | (a[i + 1] << 31);
+    }
+    a[n - 1] >>= 1;
+}
+
+//! x = x / 2 mod p, for x < p
+void HalveMod(uint32_t* x, const uint32_t* p)
+{
+    if (x[0] & 1) Add(x, p, LIMBS + 1);
+    ShiftRight(x, LIMBS + 1);
+}
+
+//! x = x - y mod p, for x, y < p
+void SubMod(uint32_t* x, const uint32_t* y, const uint32_t* p)
+{
+    if (Compare(x, y, LIMBS + 1) < 0) Add(x, p, LIMBS + 1);
+    Sub(x, y, LIMBS + 1);
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; i++) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++) {
+        limbs[i] = 0;
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < (uint32_t)(0 - MAX_PRIME_DIFF)) return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != 0xffffffff) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // x - p = x + MAX_PRIME_DIFF - 2^3072, and the carry out of the top limb is the 2^3072
+    uint64_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; i++) {
+        c += limbs[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t prod[2 * LIMBS] = {};
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t c = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            c += (uint64_t)limbs[i] * a.limbs[j] + prod[i + j];
+            prod[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        prod[i + LIMBS] = (uint32_t)c;
+    }
+
+    // hi * 2^3072 + lo = hi * MAX_PRIME_DIFF + lo (mod p)
+    uint64_t c = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        c += (uint64_t)prod[i + LIMBS] * MAX_PRIME_DIFF + prod[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    // fold the remaining carry back in the same way, this converges after at most two rounds
+    while (c) {
+        uint64_t d = c * MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && d; i++) {
+            d += limbs[i];
+            limbs[i] = (uint32_t)d;
+            d >>= 32;
+        }
+        c = d;
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::Invert()
+{
+    // Binary extended Euclid: keep u = x1 * a and v = x2 * a (mod p) while reducing (u, v) from (a, p) to a 1
+    uint32_t p[LIMBS + 1], u[LIMBS + 1], v[LIMBS + 1], x1[LIMBS + 1] = {1}, x2[LIMBS + 1] = {};
+    if (IsOverflow()) FullReduce();
+    for (int i = 0; i < LIMBS; i++) {
+        p[i] = 0xffffffff;
+        u[i] = limbs[i];
+    }
+    p[0] = 0 - MAX_PRIME_DIFF;
+    p[LIMBS] = u[LIMBS] = 0;
+    memcpy(v, p, sizeof(p));
+    assert(!IsZero(u, LIMBS + 1));
+
+    while (!IsOne(u, LIMBS + 1) && !IsOne(v, LIMBS + 1)) {
+        while (!(u[0] & 1)) {
+            ShiftRight(u, LIMBS + 1);
+            HalveMod(x1, p);
+        }
+        while (!(v[0] & 1)) {
+            ShiftRight(v, LIMBS + 1);
+            HalveMod(x2, p);
+        }
+        if (Compare(u, v, LIMBS + 1) >= 0) {
+            Sub(u, v, LIMBS + 1);
+            SubMod(x1, x2, p);
+        } else {
+            Sub(v, u, LIMBS + 1);
+            SubMod(x2, x1, p);
+        }
+    }
+    memcpy(limbs, IsOne(u, LIMBS + 1) ? x1 : x2, sizeof(limbs));
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Num3072 inv(a);
+    inv.Invert();
+    Multiply(inv);
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hashed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hashed);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(hashed, sizeof(hashed)).Keystream(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : numerator(ToNum3072(data, len))
+{
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[32])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include "serialize.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Integer modulo the prime 2^3072 - 1103717, stored as little endian 32-bit limbs. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 96;
+    static const uint32_t MAX_PRIME_DIFF = 1103717;
+
+private:
+    uint32_t limbs[LIMBS];
+
+    //! Whether the value is >= the prime, i.e. not fully reduced
+    bool IsOverflow() const;
+    //! Subtract the prime once, only valid if IsOverflow()
+    void FullReduce();
+    //! Replace the value with its multiplicative inverse, the value must not be 0
+    void Invert();
+
+public:
+    Num3072() { SetToOne(); }
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+};
+
+/**
+ * A rolling hash of a multiset of byte strings (MuHash, https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf).
+ *
+ * Every element is hashed to a number modulo a 3072-bit prime, the hash of the set is the product of those
+ * numbers. Since multiplication is commutative, the result does not depend on the order elements are added in,
+ * and removing an element is a division. To keep updates cheap, removals are multiplied into a separate
+ * denominator and the single modular inversion happens in Finalize().
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    //! The hash of the empty set
+    MuHash3072() {}
+    //! The hash of the set holding one element
+    MuHash3072(const unsigned char* data, size_t len);
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Union and difference of the underlying sets
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the 32 byte SHA256 of the normalized value to out, which also normalizes the state
+    void Finalize(unsigned char out[32]);
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        numerator.ToBytes(buf);
+        s << FLATDATA(buf);
+        denominator.ToBytes(buf);
+        s << FLATDATA(buf);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char buf[Num3072::BYTE_SIZE];
+        s >> FLATDATA(buf);
+        numerator = Num3072(buf);
+        s >> FLATDATA(buf);
+        denominator = Num3072(buf);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
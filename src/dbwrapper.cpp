@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "util.h"
 #include "random.h"
+#include "sync.h"
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -73,14 +74,132 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static const char* const DB_NAMES[] = {"blockindex", "chainstate", "evodb", "llmq", "blockfilterindex", "coinstatsindex"};
+
+bool GetDBProfile(const std::string& strProfile, CDBOptions& options)
+{
+    CDBOptions profile;
+    profile.strName = options.strName;
+    profile.strProfile = strProfile;
+    if (strProfile == "default") {
+    } else if (strProfile == "lookup") {
+        profile.nBlockCachePercent = 75;
+        profile.nBloomBits = 16;
+        profile.nBlockSize = 2048;
+    } else if (strProfile == "scan") {
+        profile.nBloomBits = 0;
+        profile.nBlockSize = 64 * 1024;
+        profile.fCompression = true;
+    } else {
+        return false;
+    }
+    options = profile;
+    return true;
+}
+
+//! Apply one -dboption setting, false if the option is unknown or the value out of range
+static bool SetDBOption(const std::string& strOption, const std::string& strValue, CDBOptions& options)
+{
+    int64_t nValue;
+    if (!ParseInt64(strValue, &nValue)) {
+        return false;
+    }
+    if (strOption == "blockcache" && nValue >= 10 && nValue <= 90) {
+        options.nBlockCachePercent = nValue;
+    } else if (strOption == "bloombits" && nValue >= 0 && nValue <= 32) {
+        options.nBloomBits = nValue;
+    } else if (strOption == "blocksize" && nValue >= 1024 && nValue <= (4 << 20)) {
+        options.nBlockSize = nValue;
+    } else if (strOption == "compression" && (nValue == 0 || nValue == 1)) {
+        options.fCompression = nValue;
+    } else if (strOption == "maxopenfiles" && nValue >= 16 && nValue <= 1000) {
+        options.nMaxOpenFiles = nValue;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//! Split "<db>:<setting>", false if there is no database name
+static bool SplitDBArg(const std::string& strArg, std::string& strName, std::string& strSetting)
+{
+    size_t nPos = strArg.find(':');
+    if (nPos == std::string::npos || nPos == 0) {
+        return false;
+    }
+    strName = strArg.substr(0, nPos);
+    strSetting = strArg.substr(nPos + 1);
+    return true;
+}
+
+//! Split "<option>=<value>"
+static bool SplitDBOption(const std::string& strSetting, std::string& strOption, std::string& strValue)
+{
+    size_t nPos = strSetting.find('=');
+    if (nPos == std::string::npos) {
+        return false;
+    }
+    strOption = strSetting.substr(0, nPos);
+    strValue = strSetting.substr(nPos + 1);
+    return true;
+}
+
+CDBOptions GetDBOptions(const std::string& strName, const std::string& strDefaultProfile)
+{
+    CDBOptions options;
+    options.strName = strName;
+    GetDBProfile(strDefaultProfile, options);
+
+    // Invalid arguments were rejected by CheckDBOptions() at startup
+    std::string strArgName, strSetting, strOption, strValue;
+    for (const std::string& strArg : gArgs.GetArgs("-dbprofile")) {
+        if (SplitDBArg(strArg, strArgName, strSetting) && strArgName == strName) {
+            GetDBProfile(strSetting, options);
+        }
+    }
+    for (const std::string& strArg : gArgs.GetArgs("-dboption")) {
+        if (SplitDBArg(strArg, strArgName, strSetting) && strArgName == strName && SplitDBOption(strSetting, strOption, strValue)) {
+            SetDBOption(strOption, strValue, options);
+        }
+    }
+    return options;
+}
+
+bool CheckDBOptions(std::string& strError)
+{
+    std::string strName, strSetting, strOption, strValue;
+    auto fnKnownName = [&strName] { return std::find(std::begin(DB_NAMES), std::end(DB_NAMES), strName) != std::end(DB_NAMES); };
+    std::string strNames;
+    for (const char* pszName : DB_NAMES) {
+        strNames += (strNames.empty() ? "" : ", ") + std::string(pszName);
+    }
+    for (const std::string& strArg : gArgs.GetArgs("-dbprofile")) {
+        CDBOptions options;
+        if (!SplitDBArg(strArg, strName, strSetting) || !fnKnownName() || !GetDBProfile(strSetting, options)) {
+            strError = strprintf("Invalid -dbprofile=%s, expected <db>:<profile> with <db> one of %s and <profile> one of default, lookup, scan", strArg, strNames);
+            return false;
+        }
+    }
+    for (const std::string& strArg : gArgs.GetArgs("-dboption")) {
+        CDBOptions options;
+        if (!SplitDBArg(strArg, strName, strSetting) || !fnKnownName() || !SplitDBOption(strSetting, strOption, strValue) || !SetDBOption(strOption, strValue, options)) {
+            strError = strprintf("Invalid -dboption=%s, expected <db>:<option>=<value> with <db> one of %s, see -help-debug for the options", strArg, strNames);
+            return false;
+        }
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    size_t nBlockCacheSize = nCacheSize * dbOptions.nBlockCachePercent / 100;
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
+    options.write_buffer_size = (nCacheSize - nBlockCacheSize) / 2; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : nullptr;
+    options.block_size = dbOptions.nBlockSize;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -90,14 +209,36 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+//! Open databases, for GetDBStats()
+static CCriticalSection cs_dbwrappers;
+static std::vector<CDBWrapper*> vDBWrappers;
+
+std::vector<CDBStats> GetDBStats()
+{
+    std::vector<CDBStats> vStats;
+    LOCK(cs_dbwrappers);
+    for (const CDBWrapper* pwrapper : vDBWrappers) {
+        CDBStats stats;
+        stats.strPath = pwrapper->strPath;
+        stats.options = pwrapper->dbOptions;
+        stats.nCacheSize = pwrapper->nDBCacheSize;
+        std::string strValue;
+        stats.nMemoryUsage = pwrapper->pdb->GetProperty("leveldb.approximate-memory-usage", &strValue) ? atoi64(strValue) : 0;
+        pwrapper->pdb->GetProperty("leveldb.stats", &stats.strStats);
+        vStats.push_back(std::move(stats));
+    }
+    return vStats;
+}
+
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, const CDBOptions& dbOptionsIn) :
+    dbOptions(dbOptionsIn), nDBCacheSize(nCacheSize), strPath(fMemory ? "" : path.string())
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -114,6 +255,10 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    if (!dbOptions.strName.empty()) {
+        LogPrint(BCLog::LEVELDB, "LevelDB %s uses profile %s: block cache %d%%, %d bloom bits, block size %u, compression %d, max open files %d\n",
+            dbOptions.strName, dbOptions.strProfile, dbOptions.nBlockCachePercent, dbOptions.nBloomBits, dbOptions.nBlockSize, dbOptions.fCompression, dbOptions.nMaxOpenFiles);
+    }
 
     if (gArgs.GetBoolArg("-forcecompactdb", false)) {
         LogPrintf("Starting database compaction of %s\n", path.string());
@@ -139,10 +284,17 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    LOCK(cs_dbwrappers);
+    vDBWrappers.push_back(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        LOCK(cs_dbwrappers);
+        vDBWrappers.erase(std::remove(vDBWrappers.begin(), vDBWrappers.end(), this), vDBWrappers.end());
+    }
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
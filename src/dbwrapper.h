@@ -7,12 +7,16 @@
 
 #include "clientversion.h"
 #include "fs.h"
+#include "memusage.h"
+#include "saltedhasher.h"
 #include "serialize.h"
 #include "streams.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <algorithm>
+#include <limits>
 #include <typeindex>
 
 #include <leveldb/db.h>
@@ -29,6 +33,57 @@ public:
 
 class CDBWrapper;
 
+/**
+ * LevelDB settings of a database apart from its cache size.
+ *
+ * Every database starts from a built-in profile, which can be replaced with -dbprofile=<db>:<profile> and
+ * adjusted with -dboption=<db>:<option>=<value>:
+ *  - default: the settings all databases used so far
+ *  - lookup:  point lookups of mostly random keys, more of the cache for data blocks, small blocks and more
+ *             bloom filter bits to avoid reading tables that do not have the key
+ *  - scan:    range scans, large blocks and compression, no bloom filters as iterators do not use them
+ */
+struct CDBOptions
+{
+    //! Name of the database in -dbprofile, -dboption and getdbstats, empty for databases that are not configurable
+    std::string strName;
+    std::string strProfile;
+    //! Share of the cache size used for the block cache, the rest is split between two write buffers
+    int nBlockCachePercent;
+    //! Bloom filter bits per key, 0 for none
+    int nBloomBits;
+    size_t nBlockSize;
+    //! Snappy compression, only effective if LevelDB was built with Snappy
+    bool fCompression;
+    int nMaxOpenFiles;
+
+    CDBOptions() : strProfile("default"), nBlockCachePercent(50), nBloomBits(10), nBlockSize(4096), fCompression(false), nMaxOpenFiles(64) {}
+};
+
+//! Settings of a built-in profile, false if there is no such profile
+bool GetDBProfile(const std::string& strProfile, CDBOptions& options);
+
+//! Settings of a database, from its built-in profile and the -dbprofile and -dboption arguments
+CDBOptions GetDBOptions(const std::string& strName, const std::string& strDefaultProfile = "default");
+
+//! Check the -dbprofile and -dboption arguments
+bool CheckDBOptions(std::string& strError);
+
+/** Configuration and LevelDB statistics of an open database, see GetDBStats() */
+struct CDBStats
+{
+    std::string strPath;
+    CDBOptions options;
+    size_t nCacheSize;
+    //! LevelDB's approximate-memory-usage property
+    uint64_t nMemoryUsage;
+    //! LevelDB's stats property: files, size and compaction time per level
+    std::string strStats;
+};
+
+//! Statistics of all open databases
+std::vector<CDBStats> GetDBStats();
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -87,17 +142,16 @@ public:
 
         ssValue.reserve(DBWRAPPER_PREALLOC_VALUE_SIZE);
         ssValue << value;
-        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
-        leveldb::Slice slValue(ssValue.data(), ssValue.size());
+        PutValue(slKey);
+    }
 
-        batch.Put(slKey, slValue);
-        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
-        // - byte[]: key
-        // - varint: value length
-        // - byte[]: value
-        // The formula below assumes the key and value are both less than 16k.
-        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
-        ssValue.clear();
+    /** Write an already serialized key/value pair, as buffered by CDBTransaction */
+    void WriteSerialized(const char* pKey, size_t nKeySize, const char* pValue, size_t nValueSize)
+    {
+        leveldb::Slice slKey(pKey, nKeySize);
+
+        ssValue.write(pValue, nValueSize);
+        PutValue(slKey);
     }
 
     template <typename K>
@@ -110,7 +164,11 @@ public:
     }
 
     void Erase(const CDataStream& _ssKey) {
-        leveldb::Slice slKey(_ssKey.data(), _ssKey.size());
+        EraseSerialized(_ssKey.data(), _ssKey.size());
+    }
+
+    void EraseSerialized(const char* pKey, size_t nKeySize) {
+        leveldb::Slice slKey(pKey, nKeySize);
 
         batch.Delete(slKey);
         // - byte: header
@@ -121,6 +179,22 @@ public:
     }
 
     size_t SizeEstimate() const { return size_estimate; }
+
+private:
+    void PutValue(const leveldb::Slice& slKey)
+    {
+        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+        leveldb::Slice slValue(ssValue.data(), ssValue.size());
+
+        batch.Put(slKey, slValue);
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
+        ssValue.clear();
+    }
 };
 
 class CDBIterator
@@ -188,6 +262,14 @@ public:
         return true;
     }
 
+    //! Value bytes as written by CDBBatch::Write, with the obfuscation removed
+    CDataStream GetValue() {
+        leveldb::Slice slValue = piter->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+        return ssValue;
+    }
+
     unsigned int GetValueSize() {
         return piter->value().size();
     }
@@ -204,6 +286,11 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! settings the options were derived from, and the path, for GetDBStats()
+    CDBOptions dbOptions;
+    size_t nDBCacheSize;
+    std::string strPath;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -230,6 +317,8 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    friend std::vector<CDBStats> GetDBStats();
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -238,8 +327,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] dbOptions   LevelDB settings, usually from GetDBOptions().
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const CDBOptions& dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K>
@@ -397,10 +487,77 @@ public:
 
 };
 
+/** Bump allocator holding the keys and serialized values buffered by a CDBTransaction.
+ * Allocations are never freed individually, all memory is released at once by Clear().
+ */
+class CDBTransactionArena
+{
+private:
+    static const size_t CHUNK_SIZE = 32 * 1024;
+
+    std::vector<std::pair<std::unique_ptr<char[]>, size_t>> chunks;
+    char* pCur{nullptr};
+    size_t nCurLeft{0};
+    size_t nMemoryUsage{0};
+
+    char* NewChunk(size_t nSize)
+    {
+        chunks.emplace_back(std::unique_ptr<char[]>(new char[nSize]), nSize);
+        nMemoryUsage += memusage::MallocUsage(nSize);
+        return chunks.back().first.get();
+    }
+
+public:
+    char* Allocate(size_t nSize)
+    {
+        if (nSize > CHUNK_SIZE / 4) {
+            // big values (e.g. full MN list snapshots) get their own chunk so that the current one is not wasted
+            return NewChunk(nSize);
+        }
+        if (nSize > nCurLeft) {
+            pCur = NewChunk(CHUNK_SIZE);
+            nCurLeft = CHUNK_SIZE;
+        }
+        char* p = pCur;
+        pCur += nSize;
+        nCurLeft -= nSize;
+        return p;
+    }
+
+    void Clear()
+    {
+        // keep one regular chunk, so that the next transaction does not start with an allocation
+        std::unique_ptr<char[]> keep;
+        for (auto& c : chunks) {
+            if (c.second == CHUNK_SIZE) {
+                keep = std::move(c.first);
+                break;
+            }
+        }
+        chunks.clear();
+        pCur = nullptr;
+        nCurLeft = 0;
+        nMemoryUsage = 0;
+        if (keep) {
+            chunks.emplace_back(std::move(keep), (size_t)CHUNK_SIZE);
+            nMemoryUsage = memusage::MallocUsage(CHUNK_SIZE);
+            pCur = chunks.back().first.get();
+            nCurLeft = CHUNK_SIZE;
+        }
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return nMemoryUsage + memusage::DynamicUsage(chunks);
+    }
+};
+
 template<typename CDBTransaction>
 class CDBTransactionIterator
 {
 private:
+    typedef typename CDBTransaction::Entry Entry;
+
     CDBTransaction& transaction;
 
     typedef typename std::remove_pointer<decltype(transaction.parent.NewIterator())>::type ParentIterator;
@@ -409,7 +566,10 @@ private:
     // At all times, only one of both provides the current value. The decision is made by comparing the current keys
     // of both iterators, so that always the smaller key is the current one. On Next(), the previously chosen iterator
     // is advanced.
-    typename CDBTransaction::WritesMap::iterator transactionIt;
+    // The transaction side walks the sorted index of the transaction, which is brought up to date on each seek.
+    // Writing to the transaction invalidates the iterator.
+    size_t sortedPos{0};
+    size_t sortedEnd{0};
     std::unique_ptr<ParentIterator> parentIt;
     CDataStream parentKey;
     bool curIsParent{false};
@@ -419,13 +579,14 @@ public:
             transaction(_transaction),
             parentKey(SER_DISK, CLIENT_VERSION)
     {
-        transactionIt = transaction.writes.end();
         parentIt = std::unique_ptr<ParentIterator>(transaction.parent.NewIterator());
     }
 
     void SeekToFirst() {
-        transactionIt = transaction.writes.begin();
+        sortedEnd = transaction.GetSorted().size();
+        sortedPos = 0;
         parentIt->SeekToFirst();
+        SkipErased();
         SkipDeletedAndOverwritten();
         DecideCur();
     }
@@ -436,18 +597,25 @@ public:
     }
 
     void Seek(const CDataStream& ssKey) {
-        transactionIt = transaction.writes.lower_bound(ssKey);
+        const auto& sorted = transaction.GetSorted();
+        Entry key;
+        key.SetKey(ssKey.data(), ssKey.size(), nullptr);
+        sortedEnd = sorted.size();
+        sortedPos = std::lower_bound(sorted.begin(), sorted.end(), key, [&](uint32_t i, const Entry& k) {
+            return CDBTransaction::EntryCmp::less(transaction.entries[i], k);
+        }) - sorted.begin();
         parentIt->Seek(ssKey);
+        SkipErased();
         SkipDeletedAndOverwritten();
         DecideCur();
     }
 
     bool Valid() {
-        return transactionIt != transaction.writes.end() || parentIt->Valid();
+        return CurTransactionEntry() != nullptr || parentIt->Valid();
     }
 
     void Next() {
-        if (transactionIt == transaction.writes.end() && !parentIt->Valid()) {
+        if (CurTransactionEntry() == nullptr && !parentIt->Valid()) {
             return;
         }
         if (curIsParent) {
@@ -455,8 +623,9 @@ public:
             parentIt->Next();
             SkipDeletedAndOverwritten();
         } else {
-            assert(transactionIt != transaction.writes.end());
-            ++transactionIt;
+            assert(CurTransactionEntry() != nullptr);
+            NextTransactionEntry();
+            SkipErased();
         }
         DecideCur();
     }
@@ -467,25 +636,14 @@ public:
             return false;
         }
 
-        if (curIsParent) {
-            try {
-                // TODO try to avoid this copy (we need a stream that allows reading from external buffers)
-                CDataStream ssKey = parentKey;
-                ssKey >> key;
-            } catch (const std::exception&) {
-                return false;
-            }
-            return true;
-        } else {
-            try {
-                // TODO try to avoid this copy (we need a stream that allows reading from external buffers)
-                CDataStream ssKey = transactionIt->first;
-                ssKey >> key;
-            } catch (const std::exception&) {
-                return false;
-            }
-            return true;
+        try {
+            // TODO try to avoid this copy (we need a stream that allows reading from external buffers)
+            CDataStream ssKey = GetKey();
+            ssKey >> key;
+        } catch (const std::exception&) {
+            return false;
         }
+        return true;
     }
 
     CDataStream GetKey() {
@@ -495,7 +653,8 @@ public:
         if (curIsParent) {
             return parentKey;
         } else {
-            return transactionIt->first;
+            const Entry* e = CurTransactionEntry();
+            return CDataStream(e->KeyData(), e->KeyData() + e->nKeySize, SER_DISK, CLIENT_VERSION);
         }
     }
 
@@ -506,7 +665,7 @@ public:
         if (curIsParent) {
             return parentIt->GetKeySize();
         } else {
-            return transactionIt->first.vKey.size();
+            return CurTransactionEntry()->nKeySize;
         }
     }
 
@@ -516,17 +675,32 @@ public:
             return false;
         }
         if (curIsParent) {
-            return transaction.Read(parentKey, value);
+            return parentIt->GetValue(value);
         } else {
-            return transaction.Read(transactionIt->first, value);
+            return CDBTransaction::DeserializeValue(*CurTransactionEntry(), value);
         }
     };
 
 private:
+    const Entry* CurTransactionEntry() const {
+        return sortedPos < sortedEnd ? &transaction.entries[transaction.sorted[sortedPos]] : nullptr;
+    }
+
+    void NextTransactionEntry() {
+        sortedPos++;
+    }
+
+    void SkipErased() {
+        const Entry* e;
+        while ((e = CurTransactionEntry()) != nullptr && e->IsErased()) {
+            NextTransactionEntry();
+        }
+    }
+
     void SkipDeletedAndOverwritten() {
         while (parentIt->Valid()) {
             parentKey = parentIt->GetKey();
-            if (!transaction.deletes.count(parentKey) && !transaction.writes.count(parentKey)) {
+            if (!transaction.Find(parentKey.data(), parentKey.size())) {
                 break;
             }
             parentIt->Next();
@@ -534,58 +708,80 @@ private:
     }
 
     void DecideCur() {
-        if (transactionIt != transaction.writes.end() && !parentIt->Valid()) {
+        const Entry* e = CurTransactionEntry();
+        if (e && !parentIt->Valid()) {
             curIsParent = false;
-        } else if (transactionIt == transaction.writes.end() && parentIt->Valid()) {
+        } else if (!e && parentIt->Valid()) {
             curIsParent = true;
-        } else if (transactionIt != transaction.writes.end() && parentIt->Valid()) {
-            if (CDBTransaction::DataStreamCmp::less(transactionIt->first, parentKey)) {
-                curIsParent = false;
-            } else {
-                curIsParent = true;
-            }
+        } else if (e && parentIt->Valid()) {
+            curIsParent = CDBTransaction::CompareKeys(e->KeyData(), e->nKeySize, parentKey.data(), parentKey.size()) >= 0;
         }
     }
 };
 
+/**
+ * Buffers writes and erases on top of a parent (a CDBWrapper or another CDBTransaction) until Commit() hands
+ * them to commitTarget.
+ *
+ * Keys and values are stored serialized in a bump arena. Keys of up to INLINE_KEY_SIZE bytes (which covers all
+ * evoDB keys) are stored inline in the entries, which are kept in insertion order and looked up through a hash
+ * index. The sorted order is only needed for iteration, so it is built lazily by the iterators: new entries are
+ * sorted and merged into it on the next seek. Commit() hands the entries over in insertion order.
+ */
 template<typename Parent, typename CommitTarget>
 class CDBTransaction {
     friend class CDBTransactionIterator<CDBTransaction>;
 
 protected:
-    Parent &parent;
-    CommitTarget &commitTarget;
-    ssize_t memoryUsage{0}; // signed, just in case we made an error in the calculations so that we don't get an overflow
-
-    struct DataStreamCmp {
-        static bool less(const CDataStream& a, const CDataStream& b) {
-            return std::lexicographical_compare(
-                    (const uint8_t*)a.data(), (const uint8_t*)a.data() + a.size(),
-                    (const uint8_t*)b.data(), (const uint8_t*)b.data() + b.size());
-        }
-        bool operator()(const CDataStream& a, const CDataStream& b) const {
-            return less(a, b);
+    static const size_t INLINE_KEY_SIZE = 48;
+    static const uint32_t ERASED = std::numeric_limits<uint32_t>::max();
+    static const uint32_t NO_ENTRY = std::numeric_limits<uint32_t>::max();
+
+    struct Entry {
+        uint32_t nKeySize;
+        uint32_t nValueSize; // ERASED if this is a pending erase
+        const char* pValue;
+        uint32_t nNextSameHash; // older entry with the same key hash, or NO_ENTRY
+        union {
+            char vchKey[INLINE_KEY_SIZE];
+            const char* pKey;
+        };
+
+        void SetKey(const char* _pKey, size_t _nKeySize, CDBTransactionArena* arena) {
+            nKeySize = _nKeySize;
+            nValueSize = ERASED;
+            pValue = nullptr;
+            nNextSameHash = NO_ENTRY;
+            if (nKeySize <= INLINE_KEY_SIZE) {
+                memcpy(vchKey, _pKey, nKeySize);
+            } else if (arena) {
+                char* p = arena->Allocate(nKeySize);
+                memcpy(p, _pKey, nKeySize);
+                pKey = p;
+            } else {
+                // only a search key, points to the caller's buffer
+                pKey = _pKey;
+            }
         }
+        const char* KeyData() const { return nKeySize <= INLINE_KEY_SIZE ? vchKey : pKey; }
+        bool IsErased() const { return nValueSize == ERASED; }
     };
 
-    struct ValueHolder {
-        size_t memoryUsage;
-        ValueHolder(size_t _memoryUsage) : memoryUsage(_memoryUsage) {}
-        virtual ~ValueHolder() = default;
-        virtual void Write(const CDataStream& ssKey, CommitTarget &parent) = 0;
-    };
-    typedef std::unique_ptr<ValueHolder> ValueHolderPtr;
-
-    template <typename V>
-    struct ValueHolderImpl : ValueHolder {
-        ValueHolderImpl(const V &_value, size_t _memoryUsage) : ValueHolder(_memoryUsage), value(_value) {}
+    static int CompareKeys(const char* a, size_t aSize, const char* b, size_t bSize) {
+        int r = memcmp(a, b, std::min(aSize, bSize));
+        if (r != 0) {
+            return r;
+        }
+        return aSize < bSize ? -1 : (aSize > bSize ? 1 : 0);
+    }
 
-        virtual void Write(const CDataStream& ssKey, CommitTarget &commitTarget) {
-            // we're moving the value instead of copying it. This means that Write() can only be called once per
-            // ValueHolderImpl instance. Commit() clears the write maps, so this ok.
-            commitTarget.Write(ssKey, std::move(value));
+    struct EntryCmp {
+        static bool less(const Entry& a, const Entry& b) {
+            return CompareKeys(a.KeyData(), a.nKeySize, b.KeyData(), b.nKeySize) < 0;
+        }
+        bool operator()(const Entry& a, const Entry& b) const {
+            return less(a, b);
         }
-        V value;
     };
 
     template<typename K>
@@ -596,14 +792,98 @@ protected:
         return ssKey;
     }
 
-    typedef std::map<CDataStream, ValueHolderPtr, DataStreamCmp> WritesMap;
-    typedef std::set<CDataStream, DataStreamCmp> DeletesSet;
+    template <typename V>
+    static bool DeserializeValue(const Entry& e, V& value) {
+        try {
+            CDataStream ssValue(e.pValue, e.pValue + e.nValueSize, SER_DISK, CLIENT_VERSION);
+            ssValue >> value;
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    Parent &parent;
+    CommitTarget &commitTarget;
+
+    CDBTransactionArena arena;
+    // all buffered keys in insertion order
+    std::vector<Entry> entries;
+    // key hash -> newest entry with that hash, older ones are chained through Entry::nNextSameHash
+    std::unordered_map<uint64_t, uint32_t> index;
+    // entries sorted by key, covers the first sorted.size() entries. Only maintained for iterators, see GetSorted()
+    std::vector<uint32_t> sorted;
+    CDataStream ssValue;
+
+    static uint64_t HashKey(const char* pKey, size_t nKeySize) {
+        return CSipHasher(StaticSaltedHasher::s.k0, StaticSaltedHasher::s.k1).Write((const unsigned char*)pKey, nKeySize).Finalize();
+    }
+
+    uint32_t FindIndex(const char* pKey, size_t nKeySize, uint64_t nHash) const {
+        auto it = index.find(nHash);
+        for (uint32_t i = it != index.end() ? it->second : NO_ENTRY; i != NO_ENTRY; i = entries[i].nNextSameHash) {
+            const Entry& e = entries[i];
+            if (e.nKeySize == nKeySize && memcmp(e.KeyData(), pKey, nKeySize) == 0) {
+                return i;
+            }
+        }
+        return NO_ENTRY;
+    }
 
-    WritesMap writes;
-    DeletesSet deletes;
+    const Entry* Find(const char* pKey, size_t nKeySize) const {
+        uint32_t i = FindIndex(pKey, nKeySize, HashKey(pKey, nKeySize));
+        return i != NO_ENTRY ? &entries[i] : nullptr;
+    }
+
+    // Sorts the entries added since the last call and merges them into the sorted index, so that a series of
+    // seeks without writes in between only sorts once
+    const std::vector<uint32_t>& GetSorted() {
+        size_t nOldSize = sorted.size();
+        if (nOldSize == entries.size()) {
+            return sorted;
+        }
+        for (size_t i = nOldSize; i < entries.size(); i++) {
+            sorted.emplace_back((uint32_t)i);
+        }
+        auto cmp = [this](uint32_t a, uint32_t b) { return EntryCmp::less(entries[a], entries[b]); };
+        std::sort(sorted.begin() + nOldSize, sorted.end(), cmp);
+        std::inplace_merge(sorted.begin(), sorted.begin() + nOldSize, sorted.end(), cmp);
+        return sorted;
+    }
+
+    void Put(const char* pKey, size_t nKeySize, const char* pValue, size_t nValueSize, bool fErase) {
+        uint64_t nHash = HashKey(pKey, nKeySize);
+        uint32_t i = FindIndex(pKey, nKeySize, nHash);
+        if (i == NO_ENTRY) {
+            i = (uint32_t)entries.size();
+            entries.emplace_back();
+            entries.back().SetKey(pKey, nKeySize, &arena);
+            auto r = index.emplace(nHash, i);
+            if (!r.second) {
+                entries.back().nNextSameHash = r.first->second;
+                r.first->second = i;
+            }
+        }
+        Entry* e = &entries[i];
+        if (fErase) {
+            e->nValueSize = ERASED;
+            e->pValue = nullptr;
+        } else {
+            // overwriting with a value that fits into the old one reuses its space
+            char* p = (!e->IsErased() && e->nValueSize >= nValueSize) ? const_cast<char*>(e->pValue) : nullptr;
+            if (!p && nValueSize) {
+                p = arena.Allocate(nValueSize);
+            }
+            if (nValueSize) {
+                memcpy(p, pValue, nValueSize);
+            }
+            e->pValue = p;
+            e->nValueSize = nValueSize;
+        }
+    }
 
 public:
-    CDBTransaction(Parent &_parent, CommitTarget &_commitTarget) : parent(_parent), commitTarget(_commitTarget) {}
+    CDBTransaction(Parent &_parent, CommitTarget &_commitTarget) : parent(_parent), commitTarget(_commitTarget), ssValue(SER_DISK, CLIENT_VERSION) {}
 
     template <typename K, typename V>
     void Write(const K& key, const V& v) {
@@ -612,18 +892,13 @@ public:
 
     template <typename V>
     void Write(const CDataStream& ssKey, const V& v) {
-        auto valueMemoryUsage = ::GetSerializeSize(v, SER_DISK, CLIENT_VERSION);
-
-        if (deletes.erase(ssKey)) {
-            memoryUsage -= ssKey.size();
-        }
-        auto it = writes.emplace(ssKey, nullptr).first;
-        if (it->second) {
-            memoryUsage -= ssKey.size() + it->second->memoryUsage;
-        }
-        it->second = std::make_unique<ValueHolderImpl<V>>(v, valueMemoryUsage);
+        ssValue << v;
+        Put(ssKey.data(), ssKey.size(), ssValue.data(), ssValue.size(), false);
+        ssValue.clear();
+    }
 
-        memoryUsage += ssKey.size() + valueMemoryUsage;
+    void WriteSerialized(const char* pKey, size_t nKeySize, const char* pValue, size_t nValueSize) {
+        Put(pKey, nKeySize, pValue, nValueSize, false);
     }
 
     template <typename K, typename V>
@@ -633,18 +908,9 @@ public:
 
     template <typename V>
     bool Read(const CDataStream& ssKey, V& value) {
-        if (deletes.count(ssKey)) {
-            return false;
-        }
-
-        auto it = writes.find(ssKey);
-        if (it != writes.end()) {
-            auto *impl = dynamic_cast<ValueHolderImpl<V> *>(it->second.get());
-            if (!impl) {
-                throw std::runtime_error("Read called with V != previously written type");
-            }
-            value = impl->value;
-            return true;
+        const Entry* e = Find(ssKey.data(), ssKey.size());
+        if (e) {
+            return !e->IsErased() && DeserializeValue(*e, value);
         }
 
         return parent.Read(ssKey, value);
@@ -656,12 +922,9 @@ public:
     }
 
     bool Exists(const CDataStream& ssKey) {
-        if (deletes.count(ssKey)) {
-            return false;
-        }
-
-        if (writes.count(ssKey)) {
-            return true;
+        const Entry* e = Find(ssKey.data(), ssKey.size());
+        if (e) {
+            return !e->IsErased();
         }
 
         return parent.Exists(ssKey);
@@ -673,47 +936,37 @@ public:
     }
 
     void Erase(const CDataStream& ssKey) {
-        auto it = writes.find(ssKey);
-        if (it != writes.end()) {
-            memoryUsage -= ssKey.size() + it->second->memoryUsage;
-            writes.erase(it);
-        }
-        if (deletes.emplace(ssKey).second) {
-            memoryUsage += ssKey.size();
-        }
+        EraseSerialized(ssKey.data(), ssKey.size());
+    }
+
+    void EraseSerialized(const char* pKey, size_t nKeySize) {
+        Put(pKey, nKeySize, nullptr, 0, true);
     }
 
     void Clear() {
-        writes.clear();
-        deletes.clear();
-        memoryUsage = 0;
+        entries.clear();
+        index.clear();
+        sorted.clear();
+        arena.Clear();
     }
 
     void Commit() {
-        for (const auto &k : deletes) {
-            commitTarget.Erase(k);
-        }
-        for (auto &p : writes) {
-            p.second->Write(p.first, commitTarget);
+        for (const auto& e : entries) {
+            if (e.IsErased()) {
+                commitTarget.EraseSerialized(e.KeyData(), e.nKeySize);
+            } else {
+                commitTarget.WriteSerialized(e.KeyData(), e.nKeySize, e.pValue, e.nValueSize);
+            }
         }
         Clear();
     }
 
     bool IsClean() {
-        return writes.empty() && deletes.empty();
+        return entries.empty();
     }
 
     size_t GetMemoryUsage() const {
-        if (memoryUsage < 0) {
-            // something went wrong when we accounted/calculated used memory...
-            static volatile bool didPrint = false;
-            if (!didPrint) {
-                LogPrintf("CDBTransaction::%s -- negative memoryUsage (%d)", __func__, memoryUsage);
-                didPrint = true;
-            }
-            return 0;
-        }
-        return (size_t)memoryUsage;
+        return arena.DynamicMemoryUsage() + memusage::DynamicUsage(entries) + memusage::DynamicUsage(index) + memusage::DynamicUsage(sorted);
     }
 
     CDBTransactionIterator<CDBTransaction>* NewIterator() {
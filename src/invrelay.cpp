@@ -0,0 +1,102 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "invrelay.h"
+
+#include "bloom.h"
+#include "net.h"
+#include "util.h"
+
+#include <assert.h>
+
+CInvRelayLog::CInvRelayLog(size_t nCapacity) :
+    vEntries(nCapacity),
+    nNextSeq(0)
+{
+    assert(nCapacity > 0);
+}
+
+void CInvRelayLog::Append(CInvRelayEntry&& entry)
+{
+    LOCK(cs);
+    vEntries[nNextSeq % vEntries.size()] = std::move(entry);
+    nNextSeq++;
+}
+
+uint64_t CInvRelayLog::GetNextSeq() const
+{
+    LOCK(cs);
+    return nNextSeq;
+}
+
+uint64_t CInvRelayLog::Read(uint64_t& nSeq, std::vector<CInvRelayEntry>& vRead) const
+{
+    LOCK(cs);
+    uint64_t nMissed = 0;
+    if (nNextSeq - nSeq > vEntries.size()) {
+        nMissed = nNextSeq - vEntries.size() - nSeq;
+        nSeq = nNextSeq - vEntries.size();
+    }
+    vRead.reserve(vRead.size() + (nNextSeq - nSeq));
+    for (; nSeq < nNextSeq; nSeq++) {
+        vRead.push_back(vEntries[nSeq % vEntries.size()]);
+    }
+    return nMissed;
+}
+
+CInvRelay::CInvRelay() :
+    logTx(INV_RELAY_LOG_TX_SIZE),
+    logOther(INV_RELAY_LOG_OTHER_SIZE)
+{
+}
+
+void CInvRelay::Relay(CInvRelayEntry&& entry)
+{
+    if (entry.inv.type == MSG_TX || entry.inv.type == MSG_DSTX) {
+        logTx.Append(std::move(entry));
+    } else {
+        logOther.Append(std::move(entry));
+    }
+}
+
+void CInvRelay::InitPeer(CNode* pnode) const
+{
+    LOCK(pnode->cs_inventory);
+    pnode->nRelayTxSeq = logTx.GetNextSeq();
+    pnode->nRelayOtherSeq = logOther.GetNextSeq();
+}
+
+void CInvRelay::Collect(CNode* pnode, bool fTxs) const
+{
+    AssertLockHeld(pnode->cs_inventory);
+
+    std::vector<CInvRelayEntry> vEntries;
+    uint64_t nMissed = logOther.Read(pnode->nRelayOtherSeq, vEntries);
+    if (fTxs) {
+        nMissed += logTx.Read(pnode->nRelayTxSeq, vEntries);
+    }
+    if (nMissed) {
+        LogPrint(BCLog::NET, "%s -- missed %d relayed inventory items peer=%d\n", __func__, nMissed, pnode->GetId());
+    }
+    if (vEntries.empty()) {
+        return;
+    }
+
+    const int nVersion = pnode->nVersion;
+    LOCK(pnode->cs_filter);
+    for (const CInvRelayEntry& entry : vEntries) {
+        if (nVersion < entry.nMinProtoVersion) {
+            continue;
+        }
+        if (pnode->pfilter) {
+            if (entry.relatedTx && !pnode->pfilter->IsRelevantAndUpdate(*entry.relatedTx)) {
+                continue;
+            }
+            if (!entry.relatedTxHash.IsNull() && !pnode->pfilter->contains(entry.relatedTxHash)) {
+                continue;
+            }
+        }
+        pnode->PushInventory(entry.inv);
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_INVRELAY_H
+#define LOKAL_INVRELAY_H
+
+#include "primitives/transaction.h"
+#include "protocol.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+class CNode;
+
+//! Number of transaction, respectively other announcements kept for peers that did not collect them yet
+static const size_t INV_RELAY_LOG_TX_SIZE = 1 << 16;
+static const size_t INV_RELAY_LOG_OTHER_SIZE = 1 << 14;
+
+/** An inventory announcement for all peers */
+struct CInvRelayEntry
+{
+    CInv inv;
+    int nMinProtoVersion;
+    //! Peers with a bloom filter only get the announcement if their filter matches this transaction or hash
+    CTransactionRef relatedTx;
+    uint256 relatedTxHash;
+
+    CInvRelayEntry() : nMinProtoVersion(0) {}
+    CInvRelayEntry(const CInv& invIn, int nMinProtoVersionIn) : inv(invIn), nMinProtoVersion(nMinProtoVersionIn) {}
+};
+
+/**
+ * Append-only ring of announcements. Every entry has a sequence number and readers keep the sequence number of
+ * the next entry they want; a reader that falls more than the capacity behind misses the oldest entries.
+ */
+class CInvRelayLog
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<CInvRelayEntry> vEntries;
+    uint64_t nNextSeq;
+
+public:
+    explicit CInvRelayLog(size_t nCapacity);
+
+    void Append(CInvRelayEntry&& entry);
+    //! Sequence number the next entry gets
+    uint64_t GetNextSeq() const;
+    //! Append the entries from nSeq on to vRead and move nSeq past them, returns the number of entries missed
+    uint64_t Read(uint64_t& nSeq, std::vector<CInvRelayEntry>& vRead) const;
+};
+
+/**
+ * Inventory relayed to all peers.
+ *
+ * Relaying appends the announcement to a log once instead of visiting every peer under its locks. Each peer keeps
+ * a cursor per log and collects what was appended since when it is about to send inventory: other announcements
+ * (locks, governance objects, ...) every time, transactions when their trickle is due, so that they only wait in
+ * the peer's setInventoryTxToSend if more were relayed than may be announced at once. The peer's protocol version
+ * and bloom filter are checked for the whole batch under a single cs_filter lock.
+ */
+class CInvRelay
+{
+private:
+    CInvRelayLog logTx;
+    CInvRelayLog logOther;
+
+public:
+    CInvRelay();
+
+    void Relay(CInvRelayEntry&& entry);
+    //! Start a new peer's cursors at the end of the logs, it is not told about what was relayed before
+    void InitPeer(CNode* pnode) const;
+    //! Queue the inventory relayed since the last call for the peer, transactions only if fTxs (requires cs_inventory)
+    void Collect(CNode* pnode, bool fTxs) const;
+};
+
+#endif // LOKAL_INVRELAY_H
@@ -285,7 +285,7 @@ bool StakeKernelMode(const CBlockIndex* pindexPrev)
     return true;
 }
 
-bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fMinting, bool fValidate)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTxOut& txoutPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fMinting, bool fValidate)
 {
     // sanity checks
     auto txPrevTime = blockFrom.GetBlockTime();
@@ -303,7 +303,7 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexPrev, con
     // old algorithm parameters
     arith_uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(nBits);
-    CAmount nValueIn = txPrev->vout[prevout.n].nValue;
+    CAmount nValueIn = txoutPrev.nValue;
     int64_t nTimeWeight = std::min<int64_t>(nTimeTx - txPrevTime, nStakeMaxAge - nStakeMinAge);
     arith_uint256 bnCoinDayWeight = nValueIn * nTimeWeight / COIN / 200;
 
@@ -379,15 +379,25 @@ bool CheckKernelScript(CScript scriptVin, CScript scriptVout)
     return extractKeyID(scriptVin) == extractKeyID(scriptVout);
 }
 
-// Check kernel hash target and coinstake signature
-bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake, const CBlockIndex* pindexPrev)
+// Find the output staked by a coinstake kernel and the header of the block it was created in.
+// A node whose chainstate was loaded from a UTXO snapshot has neither block files nor a
+// transaction index below the snapshot base, so coins created there are resolved from the
+// coins view and the header chain instead. Only the header's time and hash and the output's
+// value and script enter the kernel check, so both paths give the same result.
+static bool GetKernelPrevout(const COutPoint& prevout, const CBlockIndex* pindexPrev, CBlockHeader& header, CTxOut& txoutPrev)
 {
-    const CTransactionRef &tx = block.vtx[1];
-    if (!tx->IsCoinStake())
-        return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString().c_str());
-
-    // Kernel (input 0) must match the stake hash target per coin age (nBits)
-    const CTxIn& txin = tx->vin[0];
+    if (pindexUTXOSnapshotBase) {
+        LOCK(cs_main);
+        Coin coin;
+        if (pcoinsTip->GetCoin(prevout, coin) && coin.nHeight <= pindexUTXOSnapshotBase->nHeight) {
+            const CBlockIndex* pindexFrom = pindexPrev->GetAncestor(coin.nHeight);
+            if (!pindexFrom)
+                return error("GetKernelPrevout() : no header at height %d for %s", coin.nHeight, prevout.ToString());
+            header = pindexFrom->GetBlockHeader();
+            txoutPrev = coin.out;
+            return true;
+        }
+    }
 
     // Transaction index is required to get to block header
     if (!fTxIndex)
@@ -395,11 +405,10 @@ bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake, const CBl
 
     // Get transaction index for the previous transaction
     CDiskTxPos postx;
-    if (!pblocktree->ReadTxIndex(txin.prevout.hash, postx))
+    if (!pblocktree->ReadTxIndex(prevout.hash, postx))
         return error("CheckProofOfStake() : tx index not found");  // tx index not found
 
     // Read txPrev and header of its block
-    CBlockHeader header;
     CTransactionRef txPrev;
     {
         CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
@@ -410,17 +419,35 @@ bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake, const CBl
         } catch (std::exception &e) {
             return error("%s() : deserialize or I/O error in CheckProofOfStake()", __PRETTY_FUNCTION__);
         }
-        if (txPrev->GetHash() != txin.prevout.hash)
+        if (txPrev->GetHash() != prevout.hash)
             return error("%s() : txid mismatch in CheckProofOfStake()", __PRETTY_FUNCTION__);
     }
+    if (prevout.n >= txPrev->vout.size())
+        return error("%s() : prevout index out of range in CheckProofOfStake()", __PRETTY_FUNCTION__);
+
+    txoutPrev = txPrev->vout[prevout.n];
+    return true;
+}
 
-    int nIn = 0;
-    const CTxOut& prevOut = txPrev->vout[tx->vin[nIn].prevout.n];
+// Check kernel hash target and coinstake signature
+bool CheckProofOfStake(const CBlock &block, uint256& hashProofOfStake, const CBlockIndex* pindexPrev)
+{
+    const CTransactionRef &tx = block.vtx[1];
+    if (!tx->IsCoinStake())
+        return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString().c_str());
+
+    // Kernel (input 0) must match the stake hash target per coin age (nBits)
+    const CTxIn& txin = tx->vin[0];
+
+    CBlockHeader header;
+    CTxOut prevOut;
+    if (!GetKernelPrevout(txin.prevout, pindexPrev, header, prevOut))
+        return false;
 
     if(!CheckKernelScript(prevOut.scriptPubKey, tx->vout[1].scriptPubKey))
         return error("CheckProofOfStake() : INFO: check kernel script failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str());
 
-    if (!CheckStakeKernelHash(block.nBits, pindexPrev, header, sizeof(CBlock), txPrev, txin.prevout, block.nTime, hashProofOfStake, false, true))
+    if (!CheckStakeKernelHash(block.nBits, pindexPrev, header, sizeof(CBlock), prevOut, txin.prevout, block.nTime, hashProofOfStake, false, true))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx->GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str());
 
     return true;
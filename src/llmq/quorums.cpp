@@ -169,9 +169,17 @@ void CQuorumManager::UpdatedBlockTip(const CBlockIndex* pindexNew, bool fInitial
         return;
     }
 
+    // the members of the next quorum are only known once its block is, but pooled links to members of earlier
+    // quorums are likely to be needed again, so bring those up shortly before
+    bool fPrewarm = false;
     for (auto& p : Params().GetConsensus().llmqs) {
         EnsureQuorumConnections(p.first, pindexNew);
+        int nBlocksToNextDkg = p.second.dkgInterval - pindexNew->nHeight % p.second.dkgInterval;
+        if (nBlocksToNextDkg <= LLMQ_CONNECTION_PREWARM_BLOCKS) {
+            fPrewarm = true;
+        }
     }
+    g_connman->SetMasternodePoolPrewarm(fPrewarm);
 }
 
 void CQuorumManager::EnsureQuorumConnections(Consensus::LLMQType llmqType, const CBlockIndex* pindexNew)
@@ -188,6 +196,15 @@ void CQuorumManager::EnsureQuorumConnections(Consensus::LLMQType llmqType, const
     auto curDkgBlock = pindexNew->GetAncestor(curDkgHeight)->GetBlockHash();
     connmanQuorumsToDelete.erase(curDkgBlock);
 
+    // connect to the members of a DKG that just started right away, instead of when its session gets to it
+    if (!myProTxHash.IsNull() && pindexNew->nHeight - curDkgHeight < params.dkgPhaseBlocks && !g_connman->HasMasternodeQuorumNodes(llmqType, curDkgBlock)) {
+        auto connections = CLLMQUtils::GetQuorumConnections(llmqType, pindexNew->GetAncestor(curDkgHeight), myProTxHash);
+        if (!connections.empty()) {
+            LogPrint(BCLog::LLMQ, "CQuorumManager::%s -- adding %d masternodes quorum connections for DKG %s\n", __func__, connections.size(), curDkgBlock.ToString());
+            g_connman->AddMasternodeQuorumNodes(llmqType, curDkgBlock, connections);
+        }
+    }
+
     for (auto& quorum : lastQuorums) {
         if (!quorum->IsMember(myProTxHash) && !gArgs.GetBoolArg("-watchquorums", DEFAULT_WATCH_QUORUMS)) {
             continue;
@@ -79,6 +79,9 @@ typedef std::shared_ptr<const CQuorum> CQuorumCPtr;
  *
  * It is also responsible for initialization of the inter-quorum connections for new quorums.
  */
+// Number of blocks before a DKG starts during which pooled masternodes are connected to again
+static const int LLMQ_CONNECTION_PREWARM_BLOCKS = 3;
+
 class CQuorumManager
 {
 private:
@@ -1214,7 +1214,7 @@ void CInstantSendManager::RemoveMempoolConflictsForLock(const uint256& hash, con
         }
 
         for (auto& p : toDelete) {
-            mempool.removeRecursive(*p.second, MemPoolRemovalReason::CONFLICT);
+            mempool.removeRecursive(*p.second, MemPoolRemovalReason::ISLOCK);
         }
     }
 
@@ -6,6 +6,8 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "pooledhashmap.h"
+#include "prevector.h"
 
 #include <stdlib.h>
 
@@ -130,6 +132,14 @@ static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
 }
 
+// pooledhashmap allocates its nodes in chunks, plus one slot table
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const pooledhashmap<X, Y, Z>& m)
+{
+    return m.DynamicMemoryUsage(MallocUsage);
+}
+
 template<typename X>
 static inline size_t DynamicUsage(const std::unique_ptr<X>& p)
 {
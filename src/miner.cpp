@@ -46,6 +46,9 @@
 #include <boost/tuple/tuple.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <queue>
 #include <utility>
 
@@ -76,6 +79,79 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+CBlockTemplateCache::CBlockTemplateCache(CTxMemPool& _pool) :
+    pool(_pool), fValid(false), nTimeBuilt(0), nBlockSize(0), nBlockTx(0), nBlockSigOps(0), nFees(0),
+    fCbTxValid(false), nHits(0), nRebuilds(0), nAppended(0)
+{
+    pool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateCache::TransactionAddedToMempool, this, _1));
+    pool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateCache::TransactionRemovedFromMempool, this, _1, _2));
+}
+
+CBlockTemplateCache::~CBlockTemplateCache()
+{
+    // The mempool signals are sent with pool.cs held, no handler runs once we own it
+    LOCK(pool.cs);
+    pool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateCache::TransactionAddedToMempool, this, _1));
+    pool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateCache::TransactionRemovedFromMempool, this, _1, _2));
+
+    LogPrint(BCLog::BENCHMARK, "CBlockTemplateCache: %u hits, %u rebuilds, %u appended txs\n", nHits, nRebuilds, nAppended);
+}
+
+void CBlockTemplateCache::TransactionAddedToMempool(CTransactionRef tx)
+{
+    LOCK(cs);
+    if (!fValid) {
+        return;
+    }
+    if (GetTime() - nTimeBuilt > BLOCK_TEMPLATE_CACHE_MAX_AGE) {
+        // Rebuilt on next use anyway, don't queue up transactions while nobody asks for templates
+        Invalidate();
+        return;
+    }
+    vPending.emplace_back(std::move(tx));
+}
+
+void CBlockTemplateCache::TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    if (fValid && setTxHashes.count(tx->GetHash())) {
+        Invalidate();
+    }
+}
+
+void CBlockTemplateCache::Invalidate()
+{
+    LOCK(cs);
+    fValid = false;
+    fCbTxValid = false;
+    vPending.clear();
+}
+
+static std::vector<CTransactionRef> GetMinableCommitmentTxs(const CChainParams& chainparams, int nHeight)
+{
+    std::vector<CTransactionRef> vqcTx;
+    if (nHeight < chainparams.GetConsensus().DIP0003Height) {
+        return vqcTx;
+    }
+    for (auto& p : chainparams.GetConsensus().llmqs) {
+        CTransactionRef qcTx;
+        if (llmq::quorumBlockProcessor->GetMinableCommitmentTx(p.first, nHeight, qcTx)) {
+            vqcTx.emplace_back(qcTx);
+        }
+    }
+    return vqcTx;
+}
+
+static bool SpendsMasternodeCollateral(const CTransaction& tx, const CDeterministicMNList& mnList)
+{
+    for (const CTxIn& txin : tx.vin) {
+        if (mnList.HasMNByCollateral(txin.prevout)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxSize = DEFAULT_BLOCK_MAX_SIZE;
@@ -109,7 +185,6 @@ static BlockAssembler::Options DefaultOptions(const CChainParams& params)
 BlockAssembler::BlockAssembler(const CChainParams& params) :
     BlockAssembler(params, DefaultOptions(params))
 {
-    nLastCoinStakeSearchInterval = GetAdjustedTime();
 }
 
 void BlockAssembler::resetBlock()
@@ -125,7 +200,7 @@ void BlockAssembler::resetBlock()
     nFees = 0;
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet, const CScript &scriptPubKeyIn, bool fProofOfStake)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, const CStakeKernel* pkernel, CBlockTemplateCache* pcache)
 {
     int64_t nTimeStart = GetTimeMicros();
 
@@ -145,6 +220,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
     LOCK2(cs_main, mempool.cs);
 
     CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pkernel && pkernel->pindexPrev != pindexPrev) {
+        // The kernel was found at a tip that is gone by now
+        return nullptr;
+    }
     nHeight = pindexPrev->nHeight + 1;
 
     bool fDIP0003Active_context = nHeight >= chainparams.GetConsensus().DIP0003Height;
@@ -163,6 +242,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
                        ? nMedianTimePast
                        : pblock->GetBlockTime();
 
+    if (pcache) {
+        // Usually up to date already, the stake minter refreshes it between kernel searches
+        UpdateTemplateCache(*pcache, pindexPrev);
+    }
+
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
     coinbaseTx.vin.resize(1);
@@ -170,50 +254,27 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
     coinbaseTx.vout.resize(1);
     coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
     CAmount blockReward = GetBlockSubsidy(pindexPrev->nHeight, Params().GetConsensus());
-    std::vector<const CWalletTx*> vwtxPrev;
 
-    if(fProofOfStake) {
-        assert(wallet);
-        boost::this_thread::interruption_point();
-        pblock->nBits = GetNextWorkRequired(pindexPrev, chainparams.GetConsensus());
-        CMutableTransaction coinstakeTx;
-        int64_t nSearchTime = pblock->nTime; // search to current time
-        bool fStakeFound = false;
-        if (nSearchTime >= nLastCoinStakeSearchTime) {
-            unsigned int nTxNewTime = 0;
-            if (wallet->CreateCoinStake(*wallet, pblock->nBits, blockReward, coinstakeTx, nTxNewTime, vwtxPrev)) {
-                pblock->nTime = nTxNewTime;
-                coinbaseTx.vout[0].SetEmpty();
-                FillBlockPayments(coinstakeTx, nHeight, blockReward, pblocktemplate->voutMasternodePayments, pblocktemplate->voutSuperblockPayments);
-                pblock->vtx.emplace_back(MakeTransactionRef(coinstakeTx));
-                fStakeFound = true;
-            }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
-        }
-        if (!fStakeFound)
-            return nullptr;
+    if (pkernel) {
+        pblock->nTime = pkernel->nTime;
+        coinbaseTx.vout[0].SetEmpty();
+        CMutableTransaction coinstakeTx(pkernel->coinstakeTx);
+        FillBlockPayments(coinstakeTx, nHeight, blockReward, pblocktemplate->voutMasternodePayments, pblocktemplate->voutSuperblockPayments);
+        pblock->vtx.emplace_back(MakeTransactionRef(std::move(coinstakeTx)));
     }
     else {
         coinbaseTx.vout[0].nValue = blockReward;
     }
 
-    if (fDIP0003Active_context) {
-        for (auto& p : chainparams.GetConsensus().llmqs) {
-            CTransactionRef qcTx;
-            if (llmq::quorumBlockProcessor->GetMinableCommitmentTx(p.first, nHeight, qcTx)) {
-                pblock->vtx.emplace_back(qcTx);
-                pblocktemplate->vTxFees.emplace_back(0);
-                pblocktemplate->vTxSigOps.emplace_back(0);
-                nBlockSize += qcTx->GetTotalSize();
-                ++nBlockTx;
-            }
-        }
-    }
-
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    const size_t nCachedTxsStart = pblock->vtx.size();
+    if (pcache) {
+        AddCachedTxs(*pcache);
+    } else {
+        addQuorumCommitmentTxs();
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+    }
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -239,13 +300,30 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
 
         cbTx.nHeight = nHeight;
 
-        CValidationState state;
-        if (!CalcCbTxMerkleRootMNList(*pblock, pindexPrev, cbTx.merkleRootMNList, state)) {
-            throw std::runtime_error(strprintf("%s: CalcCbTxMerkleRootMNList failed: %s", __func__, FormatStateMessage(state)));
+        bool fCachedMerkleRoots = false;
+        if (pcache) {
+            // The cached roots hold as long as the coinstake doesn't spend a masternode collateral
+            CDeterministicMNList mnList = deterministicMNManager->GetListForBlock(pindexPrev);
+            LOCK(pcache->cs);
+            fCachedMerkleRoots = pcache->fCbTxValid;
+            for (size_t i = 1; i < nCachedTxsStart && fCachedMerkleRoots; i++) {
+                fCachedMerkleRoots = !SpendsMasternodeCollateral(*pblock->vtx[i], mnList);
+            }
+            if (fCachedMerkleRoots) {
+                cbTx.merkleRootMNList = pcache->merkleRootMNList;
+                cbTx.merkleRootQuorums = pcache->merkleRootQuorums;
+            }
         }
-        if (fDIP0008Active_context) {
-            if (!CalcCbTxMerkleRootQuorums(*pblock, pindexPrev, cbTx.merkleRootQuorums, state)) {
-                throw std::runtime_error(strprintf("%s: CalcCbTxMerkleRootQuorums failed: %s", __func__, FormatStateMessage(state)));
+
+        if (!fCachedMerkleRoots) {
+            CValidationState state;
+            if (!CalcCbTxMerkleRootMNList(*pblock, pindexPrev, cbTx.merkleRootMNList, state)) {
+                throw std::runtime_error(strprintf("%s: CalcCbTxMerkleRootMNList failed: %s", __func__, FormatStateMessage(state)));
+            }
+            if (fDIP0008Active_context) {
+                if (!CalcCbTxMerkleRootQuorums(*pblock, pindexPrev, cbTx.merkleRootQuorums, state)) {
+                    throw std::runtime_error(strprintf("%s: CalcCbTxMerkleRootQuorums failed: %s", __func__, FormatStateMessage(state)));
+                }
             }
         }
 
@@ -257,7 +335,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
 
     // Fill in header
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    if(!fProofOfStake)
+    if (!pkernel)
         UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, chainparams.GetConsensus());
     pblock->nNonce         = 0;
@@ -266,6 +344,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        if (pcache) {
+            // Don't hand out the same broken selection again
+            pcache->Invalidate();
+        }
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
     int64_t nTime2 = GetTimeMicros();
@@ -275,6 +357,198 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(CWallet *wallet,
     return std::move(pblocktemplate);
 }
 
+void BlockAssembler::addQuorumCommitmentTxs()
+{
+    for (const CTransactionRef& qcTx : GetMinableCommitmentTxs(chainparams, nHeight)) {
+        pblock->vtx.emplace_back(qcTx);
+        pblocktemplate->vTxFees.emplace_back(0);
+        pblocktemplate->vTxSigOps.emplace_back(0);
+        nBlockSize += qcTx->GetTotalSize();
+        ++nBlockTx;
+    }
+}
+
+void BlockAssembler::UpdateTemplateCache(CBlockTemplateCache& cache, const CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    LOCK(cache.cs);
+
+    std::vector<uint256> vQuorumTxHashes;
+    for (const CTransactionRef& qcTx : GetMinableCommitmentTxs(chainparams, nHeight)) {
+        vQuorumTxHashes.emplace_back(qcTx->GetHash());
+    }
+
+    bool fRebuild = !cache.fValid ||
+                    cache.hashPrevBlock != pindexPrev->GetBlockHash() ||
+                    cache.vQuorumTxHashes != vQuorumTxHashes ||
+                    GetTime() - cache.nTimeBuilt > BLOCK_TEMPLATE_CACHE_MAX_AGE;
+
+    if (!fRebuild && !cache.vPending.empty()) {
+        CDeterministicMNList mnList = deterministicMNManager->GetListForBlock(pindexPrev);
+        for (const CTransactionRef& tx : cache.vPending) {
+            if (!AppendToTemplateCache(cache, tx, mnList)) {
+                fRebuild = true;
+                break;
+            }
+        }
+        cache.vPending.clear();
+    }
+
+    if (fRebuild) {
+        RebuildTemplateCache(cache, pindexPrev);
+        cache.vQuorumTxHashes = std::move(vQuorumTxHashes);
+    } else {
+        ++cache.nHits;
+    }
+
+    if (!cache.fCbTxValid && nHeight >= chainparams.GetConsensus().DIP0003Height) {
+        // Compute the CbTx merkle roots now instead of after a kernel hit. The coinbase
+        // is skipped by both calculations, a placeholder is enough.
+        CBlock block;
+        block.vtx.reserve(cache.vtx.size() + 1);
+        block.vtx.emplace_back();
+        block.vtx.insert(block.vtx.end(), cache.vtx.begin(), cache.vtx.end());
+
+        bool fDIP0008Active = VersionBitsState(pindexPrev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_DIP0008, versionbitscache) == THRESHOLD_ACTIVE;
+        CValidationState state;
+        cache.merkleRootQuorums.SetNull();
+        cache.fCbTxValid = CalcCbTxMerkleRootMNList(block, pindexPrev, cache.merkleRootMNList, state) &&
+                           (!fDIP0008Active || CalcCbTxMerkleRootQuorums(block, pindexPrev, cache.merkleRootQuorums, state));
+    }
+}
+
+void BlockAssembler::RebuildTemplateCache(CBlockTemplateCache& cache, const CBlockIndex* pindexPrev)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Select into the template, which holds nothing but the coinbase placeholder yet,
+    // then move the selection over to the cache
+    assert(pblock->vtx.size() == 1);
+
+    int nPackagesSelected = 0;
+    int nDescendantsUpdated = 0;
+    addQuorumCommitmentTxs();
+    addPackageTxs(nPackagesSelected, nDescendantsUpdated);
+
+    cache.vtx.assign(pblock->vtx.begin() + 1, pblock->vtx.end());
+    cache.vTxFees.assign(pblocktemplate->vTxFees.begin() + 1, pblocktemplate->vTxFees.end());
+    cache.vTxSigOps.assign(pblocktemplate->vTxSigOps.begin() + 1, pblocktemplate->vTxSigOps.end());
+    cache.setTxHashes.clear();
+    for (const CTransactionRef& tx : cache.vtx) {
+        cache.setTxHashes.insert(tx->GetHash());
+    }
+    cache.nBlockSize = nBlockSize;
+    cache.nBlockTx = nBlockTx;
+    cache.nBlockSigOps = nBlockSigOps;
+    cache.nFees = nFees;
+
+    cache.fValid = true;
+    cache.fCbTxValid = false;
+    cache.hashPrevBlock = pindexPrev->GetBlockHash();
+    cache.nTimeBuilt = GetTime();
+    cache.vPending.clear();
+    ++cache.nRebuilds;
+
+    pblock->vtx.resize(1);
+    pblocktemplate->vTxFees.resize(1);
+    pblocktemplate->vTxSigOps.resize(1);
+    resetBlock();
+
+    LogPrint(BCLog::BENCHMARK, "%s: %.2fms (%d packages, %d updated descendants, %u txs)\n", __func__,
+             0.001 * (GetTimeMicros() - nTimeStart), nPackagesSelected, nDescendantsUpdated, cache.nBlockTx);
+}
+
+bool BlockAssembler::AppendToTemplateCache(CBlockTemplateCache& cache, const CTransactionRef& tx, const CDeterministicMNList& mnList)
+{
+    // Special transactions change the masternode list and with it the CbTx
+    if (tx->nVersion == 3 && tx->nType != TRANSACTION_NORMAL) {
+        return false;
+    }
+
+    // Already removed again, or already part of the selection
+    CTxMemPool::txiter it = mempool.mapTx.find(tx->GetHash());
+    if (it == mempool.mapTx.end() || cache.setTxHashes.count(tx->GetHash())) {
+        return true;
+    }
+
+    // Only append transactions whose unconfirmed parents are selected already, that
+    // keeps the block order valid. Anything else waits for the next rebuild.
+    CTxMemPool::setEntries ancestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    mempool.CalculateMemPoolAncestors(*it, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+    for (const CTxMemPool::txiter ancestor : ancestors) {
+        if (!cache.setTxHashes.count(ancestor->GetTx().GetHash())) {
+            return true;
+        }
+    }
+
+    if (it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize())) {
+        return true;
+    }
+    if (cache.nBlockSize + it->GetTxSize() >= nBlockMaxSize ||
+        cache.nBlockSigOps + it->GetSigOpCount() >= MaxBlockSigOps(fDIP0001ActiveAtTip)) {
+        return true;
+    }
+    if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff) ||
+        !llmq::chainLocksHandler->IsTxSafeForMining(tx->GetHash())) {
+        return true;
+    }
+
+    if (SpendsMasternodeCollateral(*tx, mnList)) {
+        cache.fCbTxValid = false;
+    }
+
+    cache.vtx.emplace_back(it->GetSharedTx());
+    cache.vTxFees.emplace_back(it->GetFee());
+    cache.vTxSigOps.emplace_back(it->GetSigOpCount());
+    cache.setTxHashes.insert(tx->GetHash());
+    cache.nBlockSize += it->GetTxSize();
+    ++cache.nBlockTx;
+    cache.nBlockSigOps += it->GetSigOpCount();
+    cache.nFees += it->GetFee();
+    ++cache.nAppended;
+    return true;
+}
+
+void BlockAssembler::AddCachedTxs(const CBlockTemplateCache& cache)
+{
+    LOCK(cache.cs);
+    pblock->vtx.insert(pblock->vtx.end(), cache.vtx.begin(), cache.vtx.end());
+    pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), cache.vTxFees.begin(), cache.vTxFees.end());
+    pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), cache.vTxSigOps.begin(), cache.vTxSigOps.end());
+    nBlockSize = cache.nBlockSize;
+    nBlockTx = cache.nBlockTx;
+    nBlockSigOps = cache.nBlockSigOps;
+    nFees = cache.nFees;
+}
+
+void BlockAssembler::PrepareTemplateCache(CBlockTemplateCache& cache)
+{
+    resetBlock();
+
+    pblocktemplate.reset(new CBlockTemplate());
+    pblock = &pblocktemplate->block;
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.push_back(-1);
+    pblocktemplate->vTxSigOps.push_back(-1);
+
+    LOCK2(cs_main, mempool.cs);
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    nHeight = pindexPrev->nHeight + 1;
+    pblock->nTime = GetAdjustedTime();
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : pblock->GetBlockTime();
+
+    UpdateTemplateCache(cache, pindexPrev);
+
+    pblocktemplate.reset();
+    pblock = nullptr;
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -560,7 +834,7 @@ static bool ProcessBlockFound(const std::shared_ptr<const CBlock> &pblock, const
     return true;
 }
 
-void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWallet* pwallet, bool fProofOfStake)
+void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWallet* pwallet)
 {
     LogPrintf("LOKALminer -- started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
@@ -571,6 +845,9 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
     std::shared_ptr<CReserveScript> coinbaseScript;
     pwallet->GetScriptForMining(coinbaseScript);
 
+    // Transaction selection shared by all attempts at the same tip
+    CBlockTemplateCache templateCache(mempool);
+
     while (IsStakingEnabled())
     {
         try {
@@ -590,15 +867,7 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
                 MilliSleep(5000);
             } while (true);
 
-            if(fProofOfStake) {
-                if (chainActive.Tip()->nHeight < chainparams.GetConsensus().nLastPoWBlock || pwallet->IsLocked() || !masternodeSync.IsSynced()) {
-                    nLastCoinStakeSearchInterval = 0;
-                    MilliSleep(5000);
-                    continue;
-                }
-            }
-
-            if(!fProofOfStake && chainActive.Tip()->nHeight >= chainparams.GetConsensus().nLastPoWBlock)
+            if (chainActive.Tip()->nHeight >= chainparams.GetConsensus().nLastPoWBlock)
                 return;
 
             //
@@ -609,7 +878,7 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
             if(!pindexPrev) break;
 
             BlockAssembler assembler(chainparams);
-            auto pblocktemplate = assembler.CreateNewBlock(pwallet, coinbaseScript->reserveScript, fProofOfStake);
+            auto pblocktemplate = assembler.CreateNewBlock(coinbaseScript->reserveScript, nullptr, &templateCache);
             if (!pblocktemplate.get()) {
                 MilliSleep(5000);
                 continue;
@@ -621,31 +890,12 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, CWa
             LogPrintf("LOKALminer -- Running miner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                       ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
-            //Sign block
-            if (fProofOfStake) {
-                LogPrintf("CPUMiner : proof-of-stake block found %s \n", pblock->GetHash().ToString().c_str());
-                if (!SignBlock(*pblock, *pwallet)) {
-                    LogPrintf("BitcoinMiner(): Signing new block failed \n");
-                    throw std::runtime_error(strprintf("%s: SignBlock failed", __func__));
-                }
-                LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
-            }
-
             // check if block is valid
             CValidationState state;
             if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
                 throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
             }
 
-            // process proof of stake block
-            if(fProofOfStake) {
-                SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                ProcessBlockFound(pblock, chainparams);
-                SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                MilliSleep(10000);
-                continue;
-            }
-
             //
             // Search
             //
@@ -723,7 +973,193 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
 
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), boost::ref(connman), GetWallets().front(), false));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), boost::ref(connman), GetWallets().front()));
+}
+
+CStakeMinterStats stakeMinterStats;
+
+/**
+ * Wakes the stake minter when a new kernel timestamp becomes searchable or the tip changes.
+ *
+ * A kernel search covers all timestamps within the hash drift window that weren't searched
+ * at the current tip yet, so there is nothing to do until the adjusted time moves on to the
+ * next second or a new tip changes the target.
+ */
+class CStakeScheduler final : public CValidationInterface
+{
+private:
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool fTipChanged{false};
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fTipChanged = true;
+        }
+        cond.notify_all();
+    }
+
+public:
+    /** Wait for the first slot after nLastSlot or a new tip, for at most a second */
+    void WaitForNextSlot(int64_t nLastSlot)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!fTipChanged && GetAdjustedTime() <= nLastSlot) {
+            // The network time offset is a whole number of seconds, so slots start on
+            // second boundaries of the system clock
+            cond.wait_for(lock, std::chrono::milliseconds(1000 - GetTimeMillis() % 1000), [this] { return fTipChanged; });
+        }
+        fTipChanged = false;
+    }
+};
+
+static CStakeScheduler stakeScheduler;
+
+static bool SearchStakeKernel(CWallet* pwallet, const CChainParams& chainparams, unsigned int nSearchFrom, unsigned int nSearchTime, CStakeKernel& kernel)
+{
+    AssertLockHeld(cs_main);
+
+    const CBlockIndex* pindexPrev = kernel.pindexPrev;
+    unsigned int nBits = GetNextWorkRequired(pindexPrev, chainparams.GetConsensus());
+    CAmount blockReward = GetBlockSubsidy(pindexPrev->nHeight, chainparams.GetConsensus());
+    std::vector<const CWalletTx*> vwtxPrev;
+
+    uint64_t nKernelChecks = 0;
+    int64_t nTimeStart = GetTimeMicros();
+    kernel.nTime = nSearchTime;
+    bool fFound = pwallet->CreateCoinStake(*pwallet, nBits, blockReward, kernel.coinstakeTx, kernel.nTime, vwtxPrev, nSearchFrom, &nKernelChecks);
+
+    ++stakeMinterStats.nAttempts;
+    stakeMinterStats.nKernelChecks += nKernelChecks;
+    stakeMinterStats.nSearchMicros += GetTimeMicros() - nTimeStart;
+    stakeMinterStats.nSlotsCovered += nSearchTime - nSearchFrom;
+    if (fFound) {
+        ++stakeMinterStats.nKernelsFound;
+    }
+    return fFound;
+}
+
+static void StakeMinter(const CChainParams& chainparams, CConnman& connman, CWallet* pwallet)
+{
+    LogPrintf("StakeMinter -- started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("lokal-staker");
+
+    unsigned int nExtraNonce = 0;
+
+    std::shared_ptr<CReserveScript> coinbaseScript;
+    pwallet->GetScriptForMining(coinbaseScript);
+
+    // Transaction selection shared by all blocks built at the same tip
+    CBlockTemplateCache templateCache(mempool);
+
+    // Tip and newest timestamp of the last kernel search, earlier timestamps are not
+    // searched again at the same tip
+    const CBlockIndex* pindexLastSearch = nullptr;
+    unsigned int nLastSearchTime = 0;
+
+    while (IsStakingEnabled())
+    {
+        try {
+            stakeScheduler.WaitForNextSlot(nLastSearchTime);
+            boost::this_thread::interruption_point();
+
+            if (!coinbaseScript || coinbaseScript->reserveScript.empty())
+                throw std::runtime_error("No coinbase script available (staking requires a wallet)");
+
+            if (connman.GetNodeCount(CConnman::CONNECTIONS_ALL) == 0 || IsInitialBlockDownload() ||
+                !masternodeSync.IsSynced() || pwallet->IsLocked() ||
+                chainActive.Tip()->nHeight < chainparams.GetConsensus().nLastPoWBlock) {
+                nLastCoinStakeSearchInterval = 0;
+                MilliSleep(5000);
+                continue;
+            }
+
+            //
+            // Search the new slots for a kernel before doing anything else
+            //
+            CStakeKernel kernel;
+            bool fKernelFound;
+            {
+                LOCK(cs_main);
+                kernel.pindexPrev = chainActive.Tip();
+                unsigned int nSearchTime = GetAdjustedTime();
+                // Kernels at or before the median time past are invalid anyway
+                unsigned int nSearchFrom = kernel.pindexPrev->GetMedianTimePast();
+                if (kernel.pindexPrev == pindexLastSearch) {
+                    if (nSearchTime <= nLastSearchTime)
+                        continue;
+                    nSearchFrom = std::max(nSearchFrom, nLastSearchTime);
+                }
+                nSearchFrom = std::min(nSearchFrom, nSearchTime);
+
+                fKernelFound = SearchStakeKernel(pwallet, chainparams, nSearchFrom, nSearchTime, kernel);
+
+                nLastCoinStakeSearchInterval = nSearchTime - nLastSearchTime;
+                pindexLastSearch = kernel.pindexPrev;
+                nLastSearchTime = nSearchTime;
+            }
+
+            if (!fKernelFound) {
+                // Use the time until the next slot to keep the template current
+                BlockAssembler(chainparams).PrepareTemplateCache(templateCache);
+                continue;
+            }
+
+            //
+            // Create and sign the block
+            //
+            SetThreadPriority(THREAD_PRIORITY_NORMAL);
+            BlockAssembler assembler(chainparams);
+            auto pblocktemplate = assembler.CreateNewBlock(coinbaseScript->reserveScript, &kernel, &templateCache);
+            if (!pblocktemplate.get()) {
+                LogPrintf("StakeMinter -- tip changed since the kernel was found\n");
+                ++stakeMinterStats.nStaleKernels;
+                SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                continue;
+            }
+
+            auto pblock = std::make_shared<CBlock>(pblocktemplate->block);
+            IncrementExtraNonce(pblock.get(), kernel.pindexPrev, nExtraNonce);
+
+            LogPrintf("StakeMinter -- proof-of-stake block found %s with %u transactions (%u bytes)\n", pblock->GetHash().ToString(),
+                      pblock->vtx.size(), ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+
+            if (!SignBlock(*pblock, *pwallet)) {
+                SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                throw std::runtime_error(strprintf("%s: SignBlock failed", __func__));
+            }
+
+            // check if block is valid
+            CValidationState state;
+            if (!TestBlockValidity(state, chainparams, *pblock, kernel.pindexPrev, false, false)) {
+                SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+            }
+
+            ProcessBlockFound(pblock, chainparams);
+            {
+                LOCK(cs_main);
+                if (chainActive.Tip()->GetBlockHash() != pblock->GetHash()) {
+                    LogPrintf("StakeMinter -- block %s did not become the new tip\n", pblock->GetHash().ToString());
+                    ++stakeMinterStats.nStaleKernels;
+                }
+            }
+            SetThreadPriority(THREAD_PRIORITY_LOWEST);
+        }
+        catch (const boost::thread_interrupted&)
+        {
+            LogPrintf("StakeMinter -- terminated\n");
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            LogPrintf("StakeMinter -- runtime error: %s\n", e.what());
+        }
+    }
 }
 
 void RunStakeMinter(const CChainParams &chainparams, CConnman &connman, CWallet *pwallet)
@@ -731,7 +1167,7 @@ void RunStakeMinter(const CChainParams &chainparams, CConnman &connman, CWallet
     boost::this_thread::interruption_point();
     LogPrintf("ThreadStakeMinter started\n");
     try {
-        BitcoinMiner(chainparams, connman, pwallet, true);
+        StakeMinter(chainparams, connman, pwallet);
         boost::this_thread::interruption_point();
     } catch (std::exception& e) {
         LogPrintf("ThreadStakeMinter() exception %s\n", e.what());
@@ -742,6 +1178,8 @@ void RunStakeMinter(const CChainParams &chainparams, CConnman &connman, CWallet
 
 void ThreadStakeMinter(const CChainParams &chainparams, CConnman &connman, CWallet *pwallet)
 {
+    RegisterValidationInterface(&stakeScheduler);
+
     while (true)
     {
         bool fStaking = IsStakingEnabled();
@@ -753,4 +1191,6 @@ void ThreadStakeMinter(const CChainParams &chainparams, CConnman &connman, CWall
 
         sleep(1.5);
     }
+
+    UnregisterValidationInterface(&stakeScheduler);
 }
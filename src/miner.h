@@ -7,24 +7,58 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
+#include <set>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
 class CBlockIndex;
 class CChainParams;
 class CConnman;
+class CDeterministicMNList;
 class CScript;
 class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+//! Rebuild a cached block template at least this often (in seconds) to pick up packages it skipped
+static const int64_t BLOCK_TEMPLATE_CACHE_MAX_AGE = 30;
 extern int64_t nLastCoinStakeSearchInterval;
 
+/** A proof-of-stake kernel found by the stake minter, ready to be put into a block */
+struct CStakeKernel
+{
+    //! Tip the kernel was found at, the block must build on it
+    CBlockIndex* pindexPrev;
+    //! Coinstake spending the kernel, without the masternode and superblock payments
+    CMutableTransaction coinstakeTx;
+    //! Kernel timestamp, becomes the block time
+    unsigned int nTime;
+};
+
+/** Counters of the stake minter, reported by getstakingstatus */
+struct CStakeMinterStats
+{
+    //! Kernel searches, one per new tip or timestamp slot
+    std::atomic<uint64_t> nAttempts{0};
+    //! Kernel hashes computed and the time spent computing them
+    std::atomic<uint64_t> nKernelChecks{0};
+    std::atomic<int64_t> nSearchMicros{0};
+    //! Timestamps searched, each one at most once per tip
+    std::atomic<uint64_t> nSlotsCovered{0};
+    std::atomic<uint64_t> nKernelsFound{0};
+    //! Kernels whose block was not accepted as the new tip
+    std::atomic<uint64_t> nStaleKernels{0};
+};
+
+extern CStakeMinterStats stakeMinterStats;
+
 struct CBlockTemplate
 {
     CBlock block;
@@ -35,6 +69,69 @@ struct CBlockTemplate
     std::vector<CTxOut> voutSuperblockPayments; // superblock payment
 };
 
+/**
+ * Transaction selection of the last block template, reused across CreateNewBlock calls.
+ *
+ * The stake minter asks for a new template every time it searches for a kernel, but the
+ * package selection and the CbTx payload only change when the tip or the mempool does.
+ * The cache listens to the mempool's synchronous add/remove signals: new transactions
+ * are appended to the selection when their ancestors are already in it, and the
+ * selection is rebuilt from scratch when the tip changes, an included transaction leaves
+ * the mempool, a special transaction arrives, the minable quorum commitments change or
+ * the selection is older than BLOCK_TEMPLATE_CACHE_MAX_AGE.
+ *
+ * Only BlockAssembler reads and updates the selection, with cs_main and mempool.cs held.
+ */
+class CBlockTemplateCache
+{
+    friend class BlockAssembler;
+
+private:
+    CTxMemPool& pool;
+
+    mutable CCriticalSection cs;
+
+    //! False if the selection must be rebuilt before it is used again
+    bool fValid;
+    uint256 hashPrevBlock;
+    int64_t nTimeBuilt;
+
+    //! Quorum commitments and mempool transactions following the coinbase/coinstake, in block order
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    std::set<uint256> setTxHashes;
+    std::vector<uint256> vQuorumTxHashes;
+
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+
+    //! Transactions added to the mempool since the selection was last updated
+    std::vector<CTransactionRef> vPending;
+
+    //! CbTx merkle roots for the selection, valid as long as no other transaction in the block
+    //! spends a masternode collateral
+    bool fCbTxValid;
+    uint256 merkleRootMNList;
+    uint256 merkleRootQuorums;
+
+    uint64_t nHits;
+    uint64_t nRebuilds;
+    uint64_t nAppended;
+
+    void TransactionAddedToMempool(CTransactionRef tx);
+    void TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason);
+
+public:
+    explicit CBlockTemplateCache(CTxMemPool& _pool);
+    ~CBlockTemplateCache();
+
+    //! Force a rebuild on the next use
+    void Invalidate();
+};
+
 // Container for tracking updates to ancestor feerate as we include (parent)
 // transactions in a block
 struct CTxMemPoolModifiedEntry {
@@ -158,9 +255,6 @@ private:
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
 
-    // Stake info
-    int64_t nLastCoinStakeSearchTime = 0;
-
 public:
     struct Options {
         Options();
@@ -171,8 +265,12 @@ public:
     BlockAssembler(const CChainParams& params);
     BlockAssembler(const CChainParams& params, const Options& options);
 
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(CWallet *wallet, const CScript &scriptPubKeyIn, bool fProofOfStake);
+    /** Construct a new block template with coinbase to scriptPubKeyIn, or a proof-of-stake block
+      * around pkernel if given. Reuses and updates the transaction selection in pcache if given.
+      * Returns nullptr if the kernel was found at another tip. */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, const CStakeKernel* pkernel = nullptr, CBlockTemplateCache* pcache = nullptr);
+    /** Bring the selection in cache up to date with the current tip and mempool */
+    void PrepareTemplateCache(CBlockTemplateCache& cache);
 
 private:
     // utility functions
@@ -180,6 +278,19 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Add the minable quorum commitments to the block */
+    void addQuorumCommitmentTxs();
+
+    // Methods for maintaining a CBlockTemplateCache
+    /** Bring the cached selection up to date with the tip and the mempool */
+    void UpdateTemplateCache(CBlockTemplateCache& cache, const CBlockIndex* pindexPrev);
+    /** Select transactions from scratch and store them in the cache */
+    void RebuildTemplateCache(CBlockTemplateCache& cache, const CBlockIndex* pindexPrev);
+    /** Append a transaction that entered the mempool after the selection was built, returns
+      * false if the selection has to be rebuilt instead */
+    bool AppendToTemplateCache(CBlockTemplateCache& cache, const CTransactionRef& tx, const CDeterministicMNList& mnList);
+    /** Add the cached selection to the block */
+    void AddCachedTxs(const CBlockTemplateCache& cache);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
@@ -214,6 +325,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams, CConnman &connman);
+/** Search for stake kernels at every new tip and timestamp slot and mint blocks for them */
 void ThreadStakeMinter(const CChainParams& chainparams, CConnman &connman, CWallet *pwallet);
 
 #endif // BITCOIN_MINER_H
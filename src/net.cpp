@@ -20,6 +20,7 @@
 #include "crypto/sha256.h"
 #include "hash.h"
 #include "primitives/transaction.h"
+#include "recvbufferpool.h"
 #include "netbase.h"
 #include "scheduler.h"
 #include "ui_interface.h"
@@ -34,6 +35,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -46,7 +48,7 @@
 
 #include <math.h>
 
-// Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
+// Dump addresses to the peers database and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
@@ -61,6 +63,9 @@
 #define MSG_DONTWAIT 0
 #endif
 
+// Maximum number of queued buffers handed to a single sendmsg() call
+static const size_t MAX_SEND_IOVECS = 64;
+
 // Fix for ancient MinGW versions, that don't have defined these in ws2tcpip.h.
 // Todo: Can be removed when our pull-tester is upgraded to a modern MinGW version.
 #ifdef WIN32
@@ -868,19 +873,19 @@ int CNode::GetSendVersion() const
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CBufferReader(vRecv.GetType(), vRecv.GetVersion(), hdrbuf, sizeof(hdrbuf)) >> hdr;
     }
     catch (const std::exception&) {
         return -1;
@@ -890,6 +895,8 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     if (hdr.nMessageSize > MAX_SIZE)
         return -1;
 
+    nTypeId = GetNetMsgTypeId(hdr.GetCommand());
+
     // switch state to reading message data
     in_data = true;
 
@@ -903,7 +910,9 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        unsigned int nSize = std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024);
+        recvBufferPool.Grow(vRecv, nSize);
+        vRecv.resize(nSize);
     }
 
     hasher.Write((const unsigned char*)pch, nCopy);
@@ -913,6 +922,11 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+CNetMessage::~CNetMessage()
+{
+    recvBufferPool.Release(vRecv);
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -932,31 +946,57 @@ const uint256& CNetMessage::GetMessageHash() const
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
-    auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
-    while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+    while (!pnode->vSendMsg.empty()) {
+        assert(pnode->vSendMsg.front()->size() > pnode->nSendOffset);
         int nBytes = 0;
+        size_t nQueued = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            const auto& data = *pnode->vSendMsg.front();
+            nQueued = data.size() - pnode->nSendOffset;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, nQueued, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Hand the queued headers and payloads to the kernel together instead of one send() per buffer
+            struct iovec iov[MAX_SEND_IOVECS];
+            size_t nIov = 0;
+            for (auto it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++it, ++nIov) {
+                size_t nOffset = nIov == 0 ? pnode->nSendOffset : 0;
+                iov[nIov].iov_base = const_cast<unsigned char*>((*it)->data()) + nOffset;
+                iov[nIov].iov_len = (*it)->size() - nOffset;
+                nQueued += iov[nIov].iov_len;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // drop the buffers that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nSize = pnode->vSendMsg.front()->size();
+                if (nLeft < nSize - pnode->nSendOffset) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nSize - pnode->nSendOffset;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+                pnode->nSendSize -= nSize;
+                pnode->vSendMsg.pop_front();
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nQueued) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -974,11 +1014,10 @@ size_t CConnman::SocketSendData(CNode *pnode) const
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
     return nSentSize;
 }
 
@@ -1244,6 +1283,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         LogPrint(BCLog::NET, "connection accepted\n");
     }
 
+    invRelay.InitPeer(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -1803,10 +1843,9 @@ void CConnman::DumpAddresses()
 {
     int64_t nStart = GetTimeMillis();
 
-    CAddrDB adb;
-    adb.Write(addrman);
+    addrdb->Write(addrman);
 
-    LogPrint(BCLog::NET, "Flushed %d addresses to peers.dat  %dms\n",
+    LogPrint(BCLog::NET, "Flushed %d addresses to peers database  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
 }
 
@@ -2126,10 +2165,15 @@ void CConnman::ThreadOpenMasternodeConnections()
     if (gArgs.IsArgSet("-connect") && gArgs.GetArgs("-connect").size() > 0)
         return;
 
+    // addresses not in addrman have no nLastTry, so back off from them here
+    std::map<CService, int64_t> mapLastTry;
+    bool fMorePending = false;
     while (!interruptNet)
     {
-        if (!interruptNet.sleep_for(std::chrono::milliseconds(1000)))
+        // don't wait long while there are more masternodes to connect to, e.g. right after a quorum's connections were added
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(fMorePending ? 100 : 1000)))
             return;
+        fMorePending = false;
 
         std::set<CService> connectedNodes;
         std::set<uint256> connectedProRegTxHashes;
@@ -2155,20 +2199,38 @@ void CConnman::ThreadOpenMasternodeConnections()
             LOCK2(cs_vNodes, cs_vPendingMasternodes);
 
             std::vector<CService> pending;
+            auto addPending = [&](const CDeterministicMNCPtr& dmn) {
+                const auto& addr2 = dmn->pdmnState->addr;
+                if (!connectedNodes.count(addr2) && !IsMasternodeOrDisconnectRequested(addr2) && !connectedProRegTxHashes.count(dmn->proTxHash)) {
+                    auto addrInfo = addrman.GetAddressInfo(addr2);
+                    // back off trying connecting to an address if we already tried recently
+                    if (addrInfo.IsValid() && nANow - addrInfo.nLastTry < 60) {
+                        return;
+                    }
+                    auto it = mapLastTry.find(addr2);
+                    if (it != mapLastTry.end() && nANow - it->second < 60) {
+                        return;
+                    }
+                    pending.emplace_back(addr2);
+                }
+            };
             for (const auto& group : masternodeQuorumNodes) {
                 for (const auto& proRegTxHash : group.second) {
                     auto dmn = mnList.GetMN(proRegTxHash);
                     if (!dmn) {
                         continue;
                     }
-                    const auto& addr2 = dmn->pdmnState->addr;
-                    if (!connectedNodes.count(addr2) && !IsMasternodeOrDisconnectRequested(addr2) && !connectedProRegTxHashes.count(proRegTxHash)) {
-                        auto addrInfo = addrman.GetAddressInfo(addr2);
-                        // back off trying connecting to an address if we already tried recently
-                        if (addrInfo.IsValid() && nANow - addrInfo.nLastTry < 60) {
-                            continue;
-                        }
-                        pending.emplace_back(addr2);
+                    addPending(dmn);
+                }
+            }
+
+            ExpireMasternodePool();
+            if (fMasternodePoolPrewarm) {
+                for (const auto& p : masternodePoolNodes) {
+                    // PoSe-banned or removed masternodes can't be in the next quorum
+                    auto dmn = mnList.GetValidMN(p.first);
+                    if (dmn) {
+                        addPending(dmn);
                     }
                 }
             }
@@ -2188,6 +2250,16 @@ void CConnman::ThreadOpenMasternodeConnections()
 
             std::random_shuffle(pending.begin(), pending.end());
             addr = pending.front();
+            fMorePending = pending.size() > 1;
+        }
+
+        mapLastTry[addr] = nANow;
+        for (auto it = mapLastTry.begin(); it != mapLastTry.end(); ) {
+            if (nANow - it->second >= 60) {
+                it = mapLastTry.erase(it);
+            } else {
+                ++it;
+            }
         }
 
         OpenMasternodeConnection(CAddress(addr, NODE_NETWORK));
@@ -2245,6 +2317,7 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->fMasternode = true;
 
     m_msgproc->InitializeNode(pnode);
+    invRelay.InitPeer(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -2294,6 +2367,125 @@ void CConnman::ThreadMessageHandler()
     }
 }
 
+const char* GetMessageQueueName(MessageQueue queue)
+{
+    switch (queue) {
+    case MSG_QUEUE_CORE: return "core";
+    case MSG_QUEUE_LLMQ: return "llmq";
+    case MSG_QUEUE_GOVERNANCE: return "governance";
+    default: return "unknown";
+    }
+}
+
+bool CConnman::QueueMessage(MessageQueue queue, CNode* pnode, NetMsgTypeId nTypeId, const std::string& strCommand, CDataStream&& vRecv, int64_t nTimeReceived)
+{
+    if (!fMessageQueues || queue == MSG_QUEUE_CORE)
+        return false;
+
+    // Released by the queue's thread once the message is processed
+    pnode->AddRef();
+    size_t nSize = vRecv.size() + CMessageHeader::HEADER_SIZE;
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        pnode->nProcessQueueSize += nSize;
+        pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+    }
+
+    CMessageQueueState& state = messageQueues[queue];
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.queue.emplace_back(pnode, nTypeId, strCommand, std::move(vRecv), nTimeReceived, nSize);
+    }
+    state.cond.notify_one();
+    return true;
+}
+
+void CConnman::RecordMessageProcessed(MessageQueue queue, NetMsgTypeId nTypeId, size_t nBytes, int64_t nTimeReceived, int64_t nTimeStart)
+{
+    int64_t nWait = std::max<int64_t>(0, nTimeStart - nTimeReceived);
+    int64_t nProcess = std::max<int64_t>(0, GetTimeMicros() - nTimeStart);
+
+    CNetMsgTypeCounters& counters = vNetMsgTypeCounters[std::min<size_t>(nTypeId, vNetMsgTypeCounters.size() - 1)];
+    counters.nCount++;
+    counters.nBytes += nBytes;
+    counters.nProcessMicros += nProcess;
+
+    CMessageQueueState& state = messageQueues[queue];
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stats.nProcessed++;
+    state.stats.nTotalWaitMicros += nWait;
+    state.stats.nMaxWaitMicros = std::max(state.stats.nMaxWaitMicros, nWait);
+    state.stats.nTotalProcessMicros += nProcess;
+    state.stats.nMaxProcessMicros = std::max(state.stats.nMaxProcessMicros, nProcess);
+}
+
+std::vector<CMessageQueueStats> CConnman::GetMessageQueueStats() const
+{
+    size_t nCoreDepth = 0;
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            LOCK(pnode->cs_vProcessMsg);
+            nCoreDepth += pnode->vProcessMsg.size();
+        }
+    }
+
+    std::vector<CMessageQueueStats> vStats;
+    for (int i = 0; i < MSG_QUEUE_MAX; i++) {
+        const CMessageQueueState& state = messageQueues[i];
+        std::lock_guard<std::mutex> lock(state.mutex);
+        vStats.push_back(state.stats);
+        vStats.back().strName = GetMessageQueueName((MessageQueue)i);
+        vStats.back().nDepth = i == MSG_QUEUE_CORE ? nCoreDepth : state.queue.size();
+    }
+    return vStats;
+}
+
+std::vector<CNetMsgTypeStats> CConnman::GetNetMsgTypeStats() const
+{
+    const std::vector<std::string>& vTypes = getAllNetMessageTypes();
+    std::vector<CNetMsgTypeStats> vStats;
+    for (size_t i = 0; i < vNetMsgTypeCounters.size(); i++) {
+        CNetMsgTypeStats stats;
+        stats.strCommand = i < vTypes.size() ? vTypes[i] : NET_MESSAGE_COMMAND_OTHER;
+        stats.nCount = vNetMsgTypeCounters[i].nCount;
+        stats.nBytes = vNetMsgTypeCounters[i].nBytes;
+        stats.nProcessMicros = vNetMsgTypeCounters[i].nProcessMicros;
+        vStats.push_back(stats);
+    }
+    return vStats;
+}
+
+void CConnman::ThreadMessageQueue(MessageQueue queue)
+{
+    CMessageQueueState& state = messageQueues[queue];
+    while (!flagInterruptMsgProc)
+    {
+        std::deque<CQueuedMessage> batch;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.cond.wait(lock, [this, &state] { return flagInterruptMsgProc || !state.queue.empty(); });
+            batch.swap(state.queue);
+        }
+
+        for (CQueuedMessage& msg : batch) {
+            // Messages left over when interrupted are only released
+            if (!flagInterruptMsgProc && !msg.pnode->fDisconnect) {
+                int64_t nTimeStart = GetTimeMicros();
+                m_msgproc->ProcessQueuedMessage(msg.pnode, msg.nTypeId, msg.strCommand, msg.vRecv, flagInterruptMsgProc);
+                RecordMessageProcessed(queue, msg.nTypeId, msg.nSize - CMessageHeader::HEADER_SIZE, msg.nTimeReceived, nTimeStart);
+            }
+            recvBufferPool.Release(msg.vRecv);
+            {
+                LOCK(msg.pnode->cs_vProcessMsg);
+                msg.pnode->nProcessQueueSize -= msg.nSize;
+                msg.pnode->fPauseRecv = msg.pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            msg.pnode->Release();
+        }
+    }
+}
+
 
 
 
@@ -2442,7 +2634,8 @@ void CConnman::SetNetworkActive(bool active)
 
 CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) :
         addrman(Params().AllowMultiplePorts()),
-        nSeed0(nSeed0In), nSeed1(nSeed1In)
+        nSeed0(nSeed0In), nSeed1(nSeed1In),
+        vNetMsgTypeCounters(getAllNetMessageTypes().size() + 1)
 {
     fNetworkActive = true;
     setBannedIsDirty = false;
@@ -2451,6 +2644,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) :
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
+    fMasternodePoolPrewarm = false;
     SetTryNewOutboundPeer(false);
 
     Options connOptions;
@@ -2524,15 +2718,15 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     if (clientInterface) {
         clientInterface->InitMessage(_("Loading P2P addresses..."));
     }
-    // Load addresses from peers.dat
+    // Load addresses from the peers database
     int64_t nStart = GetTimeMillis();
+    addrdb.reset(new CAddrDB());
     {
-        CAddrDB adb;
-        if (adb.Read(addrman))
-            LogPrintf("Loaded %i addresses from peers.dat  %dms\n", addrman.size(), GetTimeMillis() - nStart);
+        if (addrdb->Read(addrman))
+            LogPrintf("Loaded %i addresses from peers database  %dms\n", addrman.size(), GetTimeMillis() - nStart);
         else {
             addrman.Clear(); // Addrman can be in an inconsistent state after failure, reset it
-            LogPrintf("Invalid or missing peers.dat; recreating\n");
+            LogPrintf("Invalid or missing peers database; recreating\n");
             DumpAddresses();
         }
     }
@@ -2630,6 +2824,11 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     // Process messages
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    if (fMessageQueues) {
+        for (int i = MSG_QUEUE_CORE + 1; i < MSG_QUEUE_MAX; i++) {
+            threadMessageQueues[i] = std::thread(&TraceThread<std::function<void()> >, GetMessageQueueName((MessageQueue)i), std::function<void()>(std::bind(&CConnman::ThreadMessageQueue, this, (MessageQueue)i)));
+        }
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2667,6 +2866,11 @@ void CConnman::Interrupt()
         flagInterruptMsgProc = true;
     }
     condMsgProc.notify_all();
+    for (CMessageQueueState& state : messageQueues) {
+        // Taking the mutex makes sure a queue thread is either waiting or sees the flag
+        { std::lock_guard<std::mutex> lock(state.mutex); }
+        state.cond.notify_all();
+    }
 
     interruptNet();
     InterruptSocks5(true);
@@ -2695,6 +2899,17 @@ void CConnman::Stop()
 {
     if (threadMessageHandler.joinable())
         threadMessageHandler.join();
+    for (std::thread& thread : threadMessageQueues) {
+        if (thread.joinable())
+            thread.join();
+    }
+    for (CMessageQueueState& state : messageQueues) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (CQueuedMessage& msg : state.queue) {
+            msg.pnode->Release();
+        }
+        state.queue.clear();
+    }
     if (threadOpenMasternodeConnections.joinable())
         threadOpenMasternodeConnections.join();
     if (threadOpenConnections.joinable())
@@ -2711,6 +2926,7 @@ void CConnman::Stop()
         DumpData();
         fAddressesInitialized = false;
     }
+    addrdb.reset();
 
     // Close sockets
     for (CNode* pnode : vNodes)
@@ -2873,7 +3089,97 @@ std::set<NodeId> CConnman::GetMasternodeQuorumNodes(Consensus::LLMQType llmqType
 void CConnman::RemoveMasternodeQuorumNodes(Consensus::LLMQType llmqType, const uint256& quorumHash)
 {
     LOCK(cs_vPendingMasternodes);
-    masternodeQuorumNodes.erase(std::make_pair(llmqType, quorumHash));
+    auto it = masternodeQuorumNodes.find(std::make_pair(llmqType, quorumHash));
+    if (it == masternodeQuorumNodes.end()) {
+        return;
+    }
+    int64_t nKeepUntil = GetTime() + MASTERNODE_POOL_KEEP_TIME;
+    for (const auto& proRegTxHash : it->second) {
+        masternodePoolNodes[proRegTxHash] = nKeepUntil;
+    }
+    masternodeQuorumNodes.erase(it);
+
+    // drop the members that were pooled the longest ago
+    while (masternodePoolNodes.size() > MAX_MASTERNODE_POOL_SIZE) {
+        auto itOldest = masternodePoolNodes.begin();
+        for (auto it2 = masternodePoolNodes.begin(); it2 != masternodePoolNodes.end(); ++it2) {
+            if (it2->second < itOldest->second) {
+                itOldest = it2;
+            }
+        }
+        masternodePoolNodes.erase(itOldest);
+    }
+}
+
+void CConnman::ExpireMasternodePool()
+{
+    AssertLockHeld(cs_vPendingMasternodes);
+    int64_t nNow = GetTime();
+    for (auto it = masternodePoolNodes.begin(); it != masternodePoolNodes.end(); ) {
+        if (it->second < nNow) {
+            it = masternodePoolNodes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CConnman::SetMasternodePoolPrewarm(bool fPrewarm)
+{
+    LOCK(cs_vPendingMasternodes);
+    fMasternodePoolPrewarm = fPrewarm;
+}
+
+size_t CConnman::GetMasternodePoolSize()
+{
+    LOCK(cs_vPendingMasternodes);
+    ExpireMasternodePool();
+    return masternodePoolNodes.size();
+}
+
+std::vector<CMasternodeQuorumConnStats> CConnman::GetMasternodeQuorumConnStats() const
+{
+    auto mnList = deterministicMNManager->GetListAtChainTip();
+
+    std::set<CService> connectedNodes;
+    std::set<uint256> verifiedProRegTxHashes;
+    {
+        LOCK(cs_vNodes);
+        for (const auto pnode : vNodes) {
+            if (pnode->fDisconnect) {
+                continue;
+            }
+            connectedNodes.emplace(pnode->addr);
+            if (!pnode->verifiedProRegTxHash.IsNull()) {
+                verifiedProRegTxHashes.emplace(pnode->verifiedProRegTxHash);
+            }
+        }
+    }
+
+    LOCK(cs_vPendingMasternodes);
+    std::vector<CMasternodeQuorumConnStats> vStats;
+    for (const auto& p : masternodeQuorumNodes) {
+        CMasternodeQuorumConnStats stats;
+        stats.llmqType = p.first.first;
+        stats.quorumHash = p.first.second;
+        stats.nWanted = p.second.size();
+        stats.nConnected = 0;
+        stats.nVerified = 0;
+        for (const auto& proRegTxHash : p.second) {
+            // inbound connections have a different port, but authenticate with MNAUTH
+            if (verifiedProRegTxHashes.count(proRegTxHash)) {
+                stats.nConnected++;
+                stats.nVerified++;
+                continue;
+            }
+            auto dmn = mnList.GetMN(proRegTxHash);
+            if (dmn && connectedNodes.count(dmn->pdmnState->addr)) {
+                stats.nConnected++;
+            }
+        }
+        vStats.push_back(stats);
+    }
+    return vStats;
 }
 
 bool CConnman::IsMasternodeQuorumNode(const CNode* pnode)
@@ -2892,18 +3198,18 @@ bool CConnman::IsMasternodeQuorumNode(const CNode* pnode)
     }
 
     LOCK(cs_vPendingMasternodes);
+    const uint256& proTxHash = !pnode->verifiedProRegTxHash.IsNull() ? pnode->verifiedProRegTxHash : assumedProTxHash;
+    if (proTxHash.IsNull()) {
+        return false;
+    }
     for (const auto& p : masternodeQuorumNodes) {
-        if (!pnode->verifiedProRegTxHash.IsNull()) {
-            if (p.second.count(pnode->verifiedProRegTxHash)) {
-                return true;
-            }
-        } else if (!assumedProTxHash.IsNull()) {
-            if (p.second.count(assumedProTxHash)) {
-                return true;
-            }
+        if (p.second.count(proTxHash)) {
+            return true;
         }
     }
-    return false;
+    // don't wait for the connection thread to drop expired members
+    ExpireMasternodePool();
+    return masternodePoolNodes.count(proTxHash) != 0;
 }
 
 size_t CConnman::GetNodeCount(NumConnections flags)
@@ -2985,47 +3291,25 @@ void CConnman::RelayTransaction(const CTransaction& tx)
     if (CPrivateSend::GetDSTX(hash)) {
         nInv = MSG_DSTX;
     }
-    CInv inv(nInv, hash);
-    LOCK(cs_vNodes);
-    for (CNode* pnode : vNodes)
-    {
-        pnode->PushInventory(inv);
-    }
+    invRelay.Relay(CInvRelayEntry(CInv(nInv, hash), 0));
 }
 
 void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
-    LOCK(cs_vNodes);
-    for (const auto& pnode : vNodes)
-        if(pnode->nVersion >= minProtoVersion)
-            pnode->PushInventory(inv);
+    invRelay.Relay(CInvRelayEntry(inv, minProtoVersion));
 }
 
 void CConnman::RelayInvFiltered(CInv &inv, const CTransaction& relatedTx, const int minProtoVersion)
 {
-    LOCK(cs_vNodes);
-    for (const auto& pnode : vNodes) {
-        if(pnode->nVersion < minProtoVersion)
-            continue;
-        {
-            LOCK(pnode->cs_filter);
-            if(pnode->pfilter && !pnode->pfilter->IsRelevantAndUpdate(relatedTx))
-                continue;
-        }
-        pnode->PushInventory(inv);
-    }
+    CInvRelayEntry entry(inv, minProtoVersion);
+    entry.relatedTx = MakeTransactionRef(relatedTx);
+    invRelay.Relay(std::move(entry));
 }
 
 void CConnman::RelayInvFiltered(CInv &inv, const uint256& relatedTxHash, const int minProtoVersion)
 {
-    LOCK(cs_vNodes);
-    for (const auto& pnode : vNodes) {
-        if(pnode->nVersion < minProtoVersion) continue;
-        {
-            LOCK(pnode->cs_filter);
-            if(pnode->pfilter && !pnode->pfilter->contains(relatedTxHash)) continue;
-        }
-        pnode->PushInventory(inv);
-    }
+    CInvRelayEntry entry(inv, minProtoVersion);
+    entry.relatedTxHash = relatedTxHash;
+    invRelay.Relay(std::move(entry));
 }
 
 void CConnman::RemoveAskFor(const uint256& hash)
@@ -3151,6 +3435,11 @@ ServiceFlags CConnman::GetLocalServices() const
     return nLocalServices;
 }
 
+void CConnman::RemoveLocalServices(ServiceFlags services)
+{
+    nLocalServices = ServiceFlags(nLocalServices & ~services);
+}
+
 void CConnman::SetBestHeight(int height)
 {
     nBestHeight.store(height, std::memory_order_release);
@@ -3202,6 +3491,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nRelayTxSeq = 0;
+    nRelayOtherSeq = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -3303,19 +3594,45 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg, bool allowOptimisticSend)
+static SharedNetMsgBuffer MakeNetMsgHeader(const std::string& strCommand, const std::vector<unsigned char>& data)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
-
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(data.data(), data.data() + data.size());
+    CMessageHeader hdr(Params().MessageStart(), strCommand.c_str(), data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    return std::make_shared<const std::vector<unsigned char>>(std::move(serializedHeader));
+}
+
+CSharedNetMsg::CSharedNetMsg(CSerializedNetMsg&& msg) :
+    command(std::move(msg.command))
+{
+    header = MakeNetMsgHeader(command, msg.data);
+    if (!msg.data.empty())
+        data = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg, bool allowOptimisticSend)
+{
+    SharedNetMsgBuffer header = MakeNetMsgHeader(msg.command, msg.data);
+    SharedNetMsgBuffer data;
+    if (!msg.data.empty())
+        data = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+    PushSendBuffers(pnode, msg.command, std::move(header), std::move(data), allowOptimisticSend);
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsg& msg, bool allowOptimisticSend)
+{
+    PushSendBuffers(pnode, msg.command, msg.header, msg.data, allowOptimisticSend);
+}
+
+void CConnman::PushSendBuffers(CNode* pnode, const std::string& strCommand, SharedNetMsgBuffer header, SharedNetMsgBuffer data, bool allowOptimisticSend)
+{
+    size_t nMessageSize = data ? data->size() : 0;
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(strCommand.c_str()), nMessageSize, pnode->GetId());
 
     size_t nBytesSent = 0;
     {
@@ -3324,14 +3641,15 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg, bool allowOpti
         bool optimisticSend(allowOptimisticSend && pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[strCommand] += nTotalSize;
+        // shared buffers count for every peer they are queued for, so the limit still bounds what a peer holds on to
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
+        pnode->vSendMsg.push_back(std::move(header));
         if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+            pnode->vSendMsg.push_back(std::move(data));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
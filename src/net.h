@@ -12,6 +12,7 @@
 #include "compat.h"
 #include "fs.h"
 #include "hash.h"
+#include "invrelay.h"
 #include "limitedmap.h"
 #include "netaddress.h"
 #include "policy/feerate.h"
@@ -82,6 +83,10 @@ static const int MAX_ADDNODE_CONNECTIONS = 8;
 /** Maximum number if outgoing masternodes */
 static const int MAX_OUTBOUND_MASTERNODE_CONNECTIONS = 30;
 static const int MAX_OUTBOUND_MASTERNODE_CONNECTIONS_ON_MN = 250;
+/** How long members of quorums whose connections are no longer needed are kept connected for later quorums */
+static const int64_t MASTERNODE_POOL_KEEP_TIME = 2 * 60 * 60;
+/** Maximum number of such pooled masternodes */
+static const size_t MAX_MASTERNODE_POOL_SIZE = 64;
 /** Eviction protection time for incoming connections  */
 static const int INBOUND_EVICTION_PROTECTION_TIME = 1;
 /** -listen default */
@@ -107,6 +112,9 @@ static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
 
+/** Default for -messagequeues */
+static const bool DEFAULT_MESSAGE_QUEUES = true;
+
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
@@ -140,6 +148,72 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** Serialized message data in a send queue, possibly shared with the send queues of other peers */
+typedef std::shared_ptr<const std::vector<unsigned char>> SharedNetMsgBuffer;
+
+/**
+ * A serialized message that is sent to several peers. The header (and its checksum) and the payload are built
+ * once and the send queues of all peers refer to the same buffers, so relaying a block or a lock to many peers
+ * neither copies nor hashes it again per peer.
+ */
+struct CSharedNetMsg
+{
+    CSharedNetMsg() = default;
+    explicit CSharedNetMsg(CSerializedNetMsg&& msg);
+
+    std::string command;
+    SharedNetMsgBuffer header;
+    //! nullptr if the message has no payload
+    SharedNetMsgBuffer data;
+};
+
+/**
+ * Queues received messages are processed from. Core messages (blocks, transactions, headers, ...) are processed
+ * by the message handler thread, the others by a thread per queue so that a slow subsystem does not hold up
+ * block and transaction relay. Messages of a queue are processed in the order they were received.
+ */
+enum MessageQueue
+{
+    MSG_QUEUE_CORE,
+    MSG_QUEUE_LLMQ,         //!< MNAUTH, quorum commitments, DKG, signing sessions, ChainLocks and InstantSend locks
+    MSG_QUEUE_GOVERNANCE,   //!< governance, masternode sync and PrivateSend
+
+    MSG_QUEUE_MAX
+};
+
+const char* GetMessageQueueName(MessageQueue queue);
+
+struct CMessageQueueStats
+{
+    std::string strName;
+    size_t nDepth;
+    uint64_t nProcessed;
+    //! Time from receiving a message until its processing started
+    int64_t nTotalWaitMicros;
+    int64_t nMaxWaitMicros;
+    int64_t nTotalProcessMicros;
+    int64_t nMaxProcessMicros;
+};
+
+struct CMasternodeQuorumConnStats
+{
+    Consensus::LLMQType llmqType;
+    uint256 quorumHash;
+    //! Members we want to be connected to
+    size_t nWanted;
+    //! Of those, connected to (inbound or outbound), respectively authenticated with MNAUTH
+    size_t nConnected;
+    size_t nVerified;
+};
+
+struct CNetMsgTypeStats
+{
+    std::string strCommand;
+    uint64_t nCount;
+    uint64_t nBytes;
+    int64_t nProcessMicros;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -172,6 +246,7 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        bool fMessageQueues = false;
     };
 
     void Init(const Options& connOptions) {
@@ -185,6 +260,7 @@ public:
         m_msgproc = connOptions.m_msgproc;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
+        fMessageQueues = connOptions.fMessageQueues;
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -247,6 +323,8 @@ public:
     bool IsMasternodeOrDisconnectRequested(const CService& addr);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg, bool allowOptimisticSend = DEFAULT_ALLOW_OPTIMISTIC_SEND);
+    //! Queue a message whose buffers are shared with the send queues of other peers
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg, bool allowOptimisticSend = DEFAULT_ALLOW_OPTIMISTIC_SEND);
 
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func)
@@ -357,6 +435,8 @@ public:
     void RelayInvFiltered(CInv &inv, const CTransaction &relatedTx, const int minProtoVersion = PROTOCOL_VERSION);
     // This overload will not update node filters,  so use it only for the cases when other messages will update related transaction data in filters
     void RelayInvFiltered(CInv &inv, const uint256 &relatedTxHash, const int minProtoVersion = PROTOCOL_VERSION);
+    //! Queue the inventory relayed since the last call for a peer, see CInvRelay::Collect
+    void CollectRelayedInventory(CNode* pnode, bool fTxs) const { invRelay.Collect(pnode, fTxs); }
     void RemoveAskFor(const uint256& hash);
 
     // Addrman functions
@@ -413,8 +493,13 @@ public:
     std::set<uint256> GetMasternodeQuorums(Consensus::LLMQType llmqType);
     // also returns QWATCH nodes
     std::set<NodeId> GetMasternodeQuorumNodes(Consensus::LLMQType llmqType, const uint256& quorumHash) const;
+    // the members stay pooled for MASTERNODE_POOL_KEEP_TIME, so that links shared with later quorums are kept
     void RemoveMasternodeQuorumNodes(Consensus::LLMQType llmqType, const uint256& quorumHash);
     bool IsMasternodeQuorumNode(const CNode* pnode);
+    // connect to pooled masternodes that are still valid, ahead of a DKG
+    void SetMasternodePoolPrewarm(bool fPrewarm);
+    size_t GetMasternodePoolSize();
+    std::vector<CMasternodeQuorumConnStats> GetMasternodeQuorumConnStats() const;
 
     size_t GetNodeCount(NumConnections num);
     size_t GetMaxOutboundNodeCount();
@@ -425,6 +510,8 @@ public:
     bool DisconnectNode(NodeId id);
 
     ServiceFlags GetLocalServices() const;
+    //! Stop offering services to peers that connect from now on
+    void RemoveLocalServices(ServiceFlags services);
 
     //!set the max outbound target in bytes
     void SetMaxOutboundTarget(uint64_t limit);
@@ -461,6 +548,17 @@ public:
     void WakeMessageHandler();
     void WakeSelect();
 
+    /**
+     * Hand a message of a non-core queue to the queue's thread, false if message queues are disabled and the
+     * caller has to process it. The message counts against the peer's receive buffer until it is processed.
+     */
+    bool QueueMessage(MessageQueue queue, CNode* pnode, NetMsgTypeId nTypeId, const std::string& strCommand, CDataStream&& vRecv, int64_t nTimeReceived);
+    //! Account for a message of a queue that was received at nTimeReceived and processed from nTimeStart until now
+    void RecordMessageProcessed(MessageQueue queue, NetMsgTypeId nTypeId, size_t nBytes, int64_t nTimeReceived, int64_t nTimeStart);
+    std::vector<CMessageQueueStats> GetMessageQueueStats() const;
+    //! Processed messages per command, commands that are not valid message types are counted together
+    std::vector<CNetMsgTypeStats> GetNetMsgTypeStats() const;
+
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -477,10 +575,13 @@ private:
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
     void ThreadMessageHandler();
+    void ThreadMessageQueue(MessageQueue queue);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
     void ThreadOpenMasternodeConnections();
+    // drop pooled masternodes whose MASTERNODE_POOL_KEEP_TIME is over, requires cs_vPendingMasternodes
+    void ExpireMasternodePool();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
 
@@ -498,6 +599,7 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    void PushSendBuffers(CNode* pnode, const std::string& strCommand, SharedNetMsgBuffer header, SharedNetMsgBuffer data, bool allowOptimisticSend);
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -541,12 +643,15 @@ private:
     bool setBannedIsDirty;
     bool fAddressesInitialized;
     CAddrMan addrman;
+    std::unique_ptr<CAddrDB> addrdb;
     std::deque<std::string> vOneShots;
     CCriticalSection cs_vOneShots;
     std::vector<std::string> vAddedNodes GUARDED_BY(cs_vAddedNodes);
     CCriticalSection cs_vAddedNodes;
     std::vector<CService> vPendingMasternodes;
     std::map<std::pair<Consensus::LLMQType, uint256>, std::set<uint256>> masternodeQuorumNodes; // protected by cs_vPendingMasternodes
+    std::map<uint256, int64_t> masternodePoolNodes; // proTxHash -> time until kept, protected by cs_vPendingMasternodes
+    bool fMasternodePoolPrewarm; // protected by cs_vPendingMasternodes
     mutable CCriticalSection cs_vPendingMasternodes;
     std::vector<CNode*> vNodes;
     std::list<CNode*> vNodesDisconnected;
@@ -554,7 +659,7 @@ private:
     std::atomic<NodeId> nLastNodeId;
 
     /** Services this instance offers */
-    ServiceFlags nLocalServices;
+    std::atomic<ServiceFlags> nLocalServices;
 
     std::unique_ptr<CSemaphore> semOutbound;
     std::unique_ptr<CSemaphore> semAddnode;
@@ -577,6 +682,43 @@ private:
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    struct CQueuedMessage
+    {
+        CNode* pnode;
+        NetMsgTypeId nTypeId;
+        std::string strCommand;
+        CDataStream vRecv;
+        int64_t nTimeReceived;
+        size_t nSize;
+
+        CQueuedMessage(CNode* pnodeIn, NetMsgTypeId nTypeIdIn, const std::string& strCommandIn, CDataStream&& vRecvIn, int64_t nTimeReceivedIn, size_t nSizeIn) :
+            pnode(pnodeIn), nTypeId(nTypeIdIn), strCommand(strCommandIn), vRecv(std::move(vRecvIn)), nTimeReceived(nTimeReceivedIn), nSize(nSizeIn) {}
+    };
+
+    /** Messages waiting for a queue's thread and the queue's stats. The core queue only has stats, its messages
+     *  are in the nodes' vProcessMsg. */
+    struct CMessageQueueState
+    {
+        mutable std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<CQueuedMessage> queue;
+        CMessageQueueStats stats{};
+    };
+
+    bool fMessageQueues;
+    CMessageQueueState messageQueues[MSG_QUEUE_MAX];
+
+    struct CNetMsgTypeCounters
+    {
+        std::atomic<uint64_t> nCount{0};
+        std::atomic<uint64_t> nBytes{0};
+        std::atomic<int64_t> nProcessMicros{0};
+    };
+    //! Indexed by message type id, the last entry counts the unknown commands
+    std::vector<CNetMsgTypeCounters> vNetMsgTypeCounters;
+
+    CInvRelay invRelay;
+
     CThreadInterrupt interruptNet;
 
 #ifndef WIN32
@@ -591,6 +733,7 @@ private:
     std::thread threadOpenConnections;
     std::thread threadOpenMasternodeConnections;
     std::thread threadMessageHandler;
+    std::thread threadMessageQueues[MSG_QUEUE_MAX];
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -628,6 +771,7 @@ class NetEventsInterface
 public:
     virtual bool ProcessMessages(CNode* pnode, std::atomic<bool>& interrupt) = 0;
     virtual bool SendMessages(CNode* pnode, std::atomic<bool>& interrupt) = 0;
+    virtual void ProcessQueuedMessage(CNode* pnode, NetMsgTypeId nTypeId, const std::string& strCommand, CDataStream& vRecv, std::atomic<bool>& interrupt) = 0;
     virtual void InitializeNode(CNode* pnode) = 0;
     virtual void FinalizeNode(NodeId id, bool& update_connection_time) = 0;
 };
@@ -722,22 +866,26 @@ private:
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CDataStream vRecv;              // received message data, in a buffer from recvBufferPool
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
+    NetMsgTypeId nTypeId;           // id of the command, set once the header is complete
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        nTypeId = NET_MSG_TYPE_UNKNOWN;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -750,7 +898,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -767,10 +914,10 @@ public:
     // socket
     std::atomic<ServiceFlags> nServices;
     SOCKET hSocket;
-    size_t nSendSize; // total size of all vSendMsg entries
+    size_t nSendSize; // total size of all vSendMsg entries, shared buffers included
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<SharedNetMsgBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -858,6 +1005,9 @@ public:
     std::vector<uint256> vInventoryBlockToSend;
     // List of non-tx/non-block inventory items
     std::vector<CInv> vInventoryOtherToSend;
+    // Positions in the connman's relay logs up to which relayed inventory was collected
+    uint64_t nRelayTxSeq;
+    uint64_t nRelayOtherSeq;
     CCriticalSection cs_inventory;
     std::unordered_set<uint256, StaticSaltedHasher> setAskFor;
     std::unordered_set<uint256, StaticSaltedHasher> setAskForInQueue;
@@ -7,7 +7,9 @@
 
 #include "addrman.h"
 #include "arith_uint256.h"
+#include "blockdownload.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
@@ -23,11 +25,13 @@
 #include "primitives/transaction.h"
 #include "random.h"
 #include "reverse_iterator.h"
+#include "saltedhasher.h"
 #include "scheduler.h"
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
+#include "unordered_lru_cache.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
@@ -85,6 +89,10 @@ void EraseOrphansFor(NodeId peer);
 
 static size_t vExtraTxnForCompactIt GUARDED_BY(g_cs_orphans) = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(g_cs_orphans);
+/** Recently removed and ISLOCKed transactions for compact block reconstruction */
+static std::unique_ptr<CBlockReconstructionTxns> blockReconstructionTxns;
+/** Totals of the transactions compact blocks were reconstructed from, protected by cs_main */
+static CCompactBlockStats compactBlockStats;
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
@@ -100,6 +108,18 @@ static const int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 namespace {
     /** Number of nodes with fSyncStarted. */
     int nSyncStarted = 0;
+    /** Peers kept ready for initial headers sync (-headerssyncpeers) */
+    int nMaxHeadersSyncPeers = DEFAULT_HEADERS_SYNC_PEERS;
+    /**
+     * The sync peer headers are requested from during initial headers sync, -1 if none.
+     * The other sync peers are on standby, so that each range is downloaded once, and
+     * one of them takes over when this one stalls or disconnects. Protected by cs_main
+     */
+    NodeId nHeadersSyncPeer = -1;
+    /** Headers received in headers messages and the time spent hashing, respectively accepting them. Protected by cs_main */
+    uint64_t nHeadersReceived = 0;
+    int64_t nHeadersHashMicros = 0;
+    int64_t nHeadersAcceptMicros = 0;
 
     /**
      * Sources of received blocks, saved to be able to send them reject
@@ -139,6 +159,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -212,6 +233,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Block download speed measurements, used to size the number of blocks in flight from this peer.
+    CBlockDownloadStats blockDownload;
+    //! Number of blocks requested from this peer after another peer was too slow to deliver them.
+    int nBlocksReRequested;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -271,6 +296,7 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksReRequested = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -356,6 +382,18 @@ bool MarkBlockAsReceived(const uint256& hash) {
     return false;
 }
 
+// Requires cs_main.
+// Measure the download of a block of nBytes received from nodeid, if it was requested from that peer.
+void RecordBlockDownload(NodeId nodeid, const uint256& hash, size_t nBytes) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid) {
+        return;
+    }
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    state->blockDownload.Received(itInFlight->second.second->nTimeRequested, GetTimeMicros(), nBytes);
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
@@ -376,7 +414,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex *
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -484,8 +522,9 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+ *  at most count entries. pindexWaitingFor is set to the first block on the way that is in flight
+ *  from another peer, the one closest to the validation frontier. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexWaitingFor, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
 
@@ -562,6 +601,9 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                if (waitingfor != nodeid) {
+                    pindexWaitingFor = pindex;
+                }
             }
         }
     }
@@ -605,6 +647,8 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
 
     if (state->fSyncStarted)
         nSyncStarted--;
+    if (nHeadersSyncPeer == nodeid)
+        nHeadersSyncPeer = -1;
 
     if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
         fUpdateConnectionTime = true;
@@ -640,6 +684,12 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlockWindow = state->blockDownload.GetWindow(MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    stats.nBlockSamples = state->blockDownload.GetSamples();
+    stats.dBlockLatency = state->blockDownload.GetLatencyMicros() * 0.000001;
+    stats.dBlockTime = state->blockDownload.GetBlockMicros() * 0.000001;
+    stats.dBlockBytesPerSecond = state->blockDownload.GetBytesPerSecond();
+    stats.nBlocksReRequested = state->nBlocksReRequested;
     for (const QueuedBlock& queue : state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -647,6 +697,35 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     return true;
 }
 
+void GetHeadersSyncStats(CHeadersSyncStats& stats) {
+    LOCK(cs_main);
+    stats.nSyncPeers = nSyncStarted;
+    stats.nMaxSyncPeers = nMaxHeadersSyncPeers;
+    stats.nActiveSyncPeer = nHeadersSyncPeer;
+    stats.nHeadersReceived = nHeadersReceived;
+    stats.nHashMicros = nHeadersHashMicros;
+    stats.nAcceptMicros = nHeadersAcceptMicros;
+}
+
+// Requires cs_main.
+void RecordCompactBlockReconstruction(const PartiallyDownloadedBlock& partialBlock, size_t nMissing) {
+    compactBlockStats.nBlocks++;
+    compactBlockStats.nBlocksComplete += nMissing == 0;
+    compactBlockStats.nTxPrefilled += partialBlock.GetPrefilledCount();
+    compactBlockStats.nTxMempool += partialBlock.GetMempoolCount() - partialBlock.GetExtraCount() - partialBlock.GetRecentCount() - partialBlock.GetLockedCount();
+    compactBlockStats.nTxExtra += partialBlock.GetExtraCount();
+    compactBlockStats.nTxRecent += partialBlock.GetRecentCount();
+    compactBlockStats.nTxLocked += partialBlock.GetLockedCount();
+    compactBlockStats.nTxMissing += nMissing;
+}
+
+void GetCompactBlockStats(CCompactBlockStats& stats) {
+    LOCK(cs_main);
+    stats = compactBlockStats;
+    stats.nRecentTxn = blockReconstructionTxns ? blockReconstructionTxns->RecentSize() : 0;
+    stats.nLockedTxn = blockReconstructionTxns ? blockReconstructionTxns->LockedSize() : 0;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // mapOrphanTransactions
@@ -834,6 +913,9 @@ static bool BlockRequestAllowed(const CBlockIndex* pindex, const Consensus::Para
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &scheduler) : connman(connmanIn), m_stale_tip_check_time(0) {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    const size_t nRecentTxn = std::max<int64_t>(0, gArgs.GetArg("-blockreconstructionrecenttxn", DEFAULT_BLOCK_RECONSTRUCTION_RECENT_TXN));
+    blockReconstructionTxns.reset(new CBlockReconstructionTxns(nRecentTxn, nRecentTxn));
+    nMaxHeadersSyncPeers = std::max(1, (int)gArgs.GetArg("-headerssyncpeers", DEFAULT_HEADERS_SYNC_PEERS));
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     // Stale tip checking and peer eviction are on two different timers, but we
@@ -845,6 +927,8 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &schedu
 }
 
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const std::vector<CTransactionRef>& vtxConflicted) {
+    blockReconstructionTxns->RemoveLocked(pblock->vtx);
+
     LOCK2(cs_main, g_cs_orphans);
 
     std::vector<uint256> vOrphanErase;
@@ -896,10 +980,23 @@ static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
+// Serialized messages for the recent block, shared by the send queues of the peers they are sent to
+static std::shared_ptr<const CSharedNetMsg> most_recent_compact_block_msg;
+static std::shared_ptr<const CSharedNetMsg> most_recent_block_msg; // built on first request
+
+void PeerLogicValidation::TransactionRemovedFromMempool(const CTransactionRef& ptx) {
+    blockReconstructionTxns->AddRecent(ptx);
+}
+
+void PeerLogicValidation::NotifyTransactionLock(const CTransaction& tx, const llmq::CInstantSendLock& islock) {
+    CTransactionRef ptx = mempool.get(tx.GetHash());
+    blockReconstructionTxns->AddLocked(ptx ? ptx : MakeTransactionRef(tx));
+}
 
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::shared_ptr<const CSharedNetMsg> pcmpctblockmsg = std::make_shared<const CSharedNetMsg>(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
 
     LOCK(cs_main);
 
@@ -915,10 +1012,11 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_compact_block_msg = pcmpctblockmsg;
+        most_recent_block_msg.reset();
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    connman->ForEachNode([this, &pcmpctblockmsg, pindex, &hashBlock](CNode* pnode) {
         if (pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -930,7 +1028,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, *pcmpctblockmsg);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1128,15 +1226,47 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman* connma
     connman->ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+// The BLOCK message for a block, shared with the other peers that ask for it if it is the recent block
+static std::shared_ptr<const CSharedNetMsg> GetSharedBlockMsg(const std::shared_ptr<const CBlock>& pblock)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    LOCK(cs_most_recent_block);
+    if (pblock != most_recent_block) {
+        return std::make_shared<const CSharedNetMsg>(msgMaker.Make(NetMsgType::BLOCK, *pblock));
+    }
+    if (!most_recent_block_msg) {
+        most_recent_block_msg = std::make_shared<const CSharedNetMsg>(msgMaker.Make(NetMsgType::BLOCK, *pblock));
+    }
+    return most_recent_block_msg;
+}
+
+// Serialized lock messages recently requested by a peer, shared with the other peers that request them
+static CCriticalSection cs_recent_lock_msgs;
+static unordered_lru_cache<std::pair<int, uint256>, std::shared_ptr<const CSharedNetMsg>, StaticSaltedHasher, 1000> recent_lock_msgs;
+
+template<typename T>
+static std::shared_ptr<const CSharedNetMsg> GetSharedLockMsg(const CInv& inv, const char* strCommand, const T& lock)
+{
+    LOCK(cs_recent_lock_msgs);
+    std::shared_ptr<const CSharedNetMsg> msg;
+    if (!recent_lock_msgs.get(std::make_pair(inv.type, inv.hash), msg)) {
+        msg = std::make_shared<const CSharedNetMsg>(CNetMsgMaker(PROTOCOL_VERSION).Make(strCommand, lock));
+        recent_lock_msgs.insert(std::make_pair(inv.type, inv.hash), msg);
+    }
+    return msg;
+}
+
 void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensusParams, const CInv& inv, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     bool send = false;
     std::shared_ptr<const CBlock> a_recent_block;
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> a_recent_compact_block;
+    std::shared_ptr<const CSharedNetMsg> a_recent_compact_block_msg;
     {
         LOCK(cs_most_recent_block);
         a_recent_block = most_recent_block;
         a_recent_compact_block = most_recent_compact_block;
+        a_recent_compact_block_msg = most_recent_compact_block_msg;
     }
 
     bool need_activate_chain = false;
@@ -1197,7 +1327,7 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         }
         if (pblock) {
             if (inv.type == MSG_BLOCK)
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+                connman->PushMessage(pfrom, *GetSharedBlockMsg(pblock));
             else if (inv.type == MSG_FILTERED_BLOCK)
             {
                 bool sendMerkleBlock = false;
@@ -1230,9 +1360,9 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
                 // instead we respond with the full, non-compact block.
                 if (CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
                     if (a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash())
-                        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                        connman->PushMessage(pfrom, *a_recent_compact_block_msg);
                 } else {
-                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+                    connman->PushMessage(pfrom, *GetSharedBlockMsg(pblock));
                 }
             }
         }
@@ -1396,7 +1526,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             if (!push && (inv.type == MSG_CLSIG)) {
                 llmq::CChainLockSig o;
                 if (llmq::chainLocksHandler->GetChainLockByHash(inv.hash, o)) {
-                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CLSIG, o));
+                    connman->PushMessage(pfrom, *GetSharedLockMsg(inv, NetMsgType::CLSIG, o));
                     push = true;
                 }
             }
@@ -1404,7 +1534,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             if (!push && (inv.type == MSG_ISLOCK)) {
                 llmq::CInstantSendLock o;
                 if (llmq::quorumInstantSendManager->GetInstantSendLockByHash(inv.hash, o)) {
-                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::ISLOCK, o));
+                    connman->PushMessage(pfrom, *GetSharedLockMsg(inv, NetMsgType::ISLOCK, o));
                     push = true;
                 }
             }
@@ -1454,6 +1584,144 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Validate a getcfilters/getcfheaders/getcfcheckpt request. Peers asking for
+ * unsupported filter types, blocks off the active chain or too large ranges are
+ * disconnected.
+ *
+ * @return true if the request can be served, pindexStop is set to the stop block
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop,
+                                      uint32_t nMaxHeightDiff, const CBlockIndex*& pindexStop)
+{
+    bool fSupported = nFilterType == static_cast<uint8_t>(BlockFilterType::BASIC) &&
+                      (pfrom->GetLocalServices() & NODE_COMPACT_FILTERS);
+    if (!fSupported) {
+        LogPrint(BCLog::NET, "peer %d requested unsupported block filter type: %d\n", pfrom->GetId(), nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashStop);
+        // Check that the stop block exists and the peer would be allowed to fetch it
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+            LogPrint(BCLog::NET, "peer %d requested invalid block hash: %s\n", pfrom->GetId(), hashStop.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        pindexStop = it->second;
+    }
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight) {
+        LogPrint(BCLog::NET, "peer %d sent invalid getcfilters/getcfheaders with start height %d and stop height %d\n",
+                 pfrom->GetId(), nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (nStopHeight - nStartHeight >= nMaxHeightDiff) {
+        LogPrint(BCLog::NET, "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), nStopHeight - nStartHeight + 1, nMaxHeightDiff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    if (!pblockfilterindex || pblockfilterindex->GetFilterType() != static_cast<BlockFilterType>(nFilterType)) {
+        LogPrint(BCLog::NET, "Filter index for supported type %s not found\n", BlockFilterTypeName(static_cast<BlockFilterType>(nFilterType)));
+        return false;
+    }
+    return true;
+}
+
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman* connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 hashStop;
+    vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop)) {
+        return;
+    }
+
+    std::vector<CBlockFilter> vFilters;
+    if (!pblockfilterindex->LookupFilterRange(nStartHeight, pindexStop, vFilters)) {
+        LogPrint(BCLog::NET, "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(pblockfilterindex->GetFilterType()), nStartHeight, hashStop.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const CBlockFilter& filter : vFilters) {
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman* connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 hashStop;
+    vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop)) {
+        return;
+    }
+
+    uint256 prevHeader;
+    if (nStartHeight > 0) {
+        const CBlockIndex* pindexPrev = pindexStop->GetAncestor(nStartHeight - 1);
+        if (!pblockfilterindex->LookupFilterHeader(pindexPrev, prevHeader)) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(pblockfilterindex->GetFilterType()), pindexPrev->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> vFilterHashes;
+    if (!pblockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, vFilterHashes)) {
+        LogPrint(BCLog::NET, "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(pblockfilterindex->GetFilterType()), nStartHeight, hashStop.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, nFilterType, pindexStop->GetBlockHash(), prevHeader, vFilterHashes));
+}
+
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman* connman)
+{
+    uint8_t nFilterType;
+    uint256 hashStop;
+    vRecv >> nFilterType >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, /*nStartHeight=*/0, hashStop,
+                                   /*nMaxHeightDiff=*/std::numeric_limits<uint32_t>::max(), pindexStop)) {
+        return;
+    }
+
+    std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+
+    // Populate headers from the tip of the requested chain backwards
+    const CBlockIndex* pindex = pindexStop;
+    for (int i = vHeaders.size() - 1; i >= 0; i--) {
+        pindex = pindex->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+        if (!pblockfilterindex->LookupFilterHeader(pindex, vHeaders[i])) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(pblockfilterindex->GetFilterType()), pindex->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType, pindexStop->GetBlockHash(), vHeaders));
+}
+
 bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::vector<CBlockHeader>& headers, const CChainParams& chainparams, bool punish_duplicate_invalid)
 {
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
@@ -1464,11 +1732,25 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         return true;
     }
 
+    // Hash the headers and check that they connect to each other before taking cs_main
+    int64_t nTimeStart = GetTimeMicros();
+    const std::vector<uint256> hashes = GetBlockHeaderHashes(headers);
+    bool fContinuous = true;
+    for (size_t i = 1; i < nCount; i++) {
+        if (headers[i].hashPrevBlock != hashes[i - 1]) {
+            fContinuous = false;
+            break;
+        }
+    }
+    int64_t nTimeHashed = GetTimeMicros();
+
     bool received_new_header = false;
     const CBlockIndex *pindexLast = nullptr;
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom->GetId());
+        nHeadersReceived += nCount;
+        nHeadersHashMicros += nTimeHashed - nTimeStart;
 
         // If this looks like it could be a block announcement (nCount <
         // MAX_BLOCKS_TO_ANNOUNCE), use special logic for handling headers that
@@ -1482,14 +1764,14 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
             nodestate->nUnconnectingHeaders++;
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256()));
             LogPrint(BCLog::NET, "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
-                    headers[0].GetHash().ToString(),
+                    hashes[0].ToString(),
                     headers[0].hashPrevBlock.ToString(),
                     pindexBestHeader->nHeight,
                     pfrom->GetId(), nodestate->nUnconnectingHeaders);
             // Set hashLastUnknownBlock for this peer, so that if we
             // eventually get the headers - even from a different peer -
             // we can use this peer to download.
-            UpdateBlockAvailability(pfrom->GetId(), headers.back().GetHash());
+            UpdateBlockAvailability(pfrom->GetId(), hashes.back());
 
             if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
                 Misbehaving(pfrom->GetId(), 20);
@@ -1497,25 +1779,30 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
             return true;
         }
 
-        uint256 hashLastBlock;
-        for (const CBlockHeader& header : headers) {
-            if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
-                Misbehaving(pfrom->GetId(), 20, "non-continuous headers sequence");
-                return false;
-            }
-            hashLastBlock = header.GetHash();
+        if (!fContinuous) {
+            Misbehaving(pfrom->GetId(), 20, "non-continuous headers sequence");
+            return false;
         }
 
         // If we don't have the last header, then they'll have given us
         // something new (if these headers are valid).
-        if (mapBlockIndex.find(hashLastBlock) == mapBlockIndex.end()) {
+        if (mapBlockIndex.find(hashes.back()) == mapBlockIndex.end()) {
             received_new_header = true;
         }
     }
 
     CValidationState state;
     CBlockHeader first_invalid_header;
-    if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header)) {
+    int64_t nTimeAcceptStart = GetTimeMicros();
+    bool fAccepted = ProcessNewBlockHeaders(headers, hashes, state, chainparams, &pindexLast, &first_invalid_header);
+    int64_t nTimeAccepted = GetTimeMicros();
+    {
+        LOCK(cs_main);
+        nHeadersAcceptMicros += nTimeAccepted - nTimeAcceptStart;
+    }
+    LogPrint(BCLog::BENCHMARK, "%s: %u headers hashed in %.2fms, accepted in %.2fms (peer=%d)\n", __func__, nCount,
+             (nTimeHashed - nTimeStart) * 0.001, (nTimeAccepted - nTimeAcceptStart) * 0.001, pfrom->GetId());
+    if (!fAccepted) {
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             LOCK(cs_main);
@@ -1583,10 +1870,17 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
 
         if (nCount == MAX_HEADERS_RESULTS) {
             // Headers message had its maximum size; the peer may have more headers.
-            // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
-            // from there instead.
-            LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), uint256()));
+            if (nodestate->fSyncStarted && nHeadersSyncPeer != -1 && nHeadersSyncPeer != pfrom->GetId() &&
+                pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - nMaxTipAge) {
+                // A standby sync peer would only download the range the active one is
+                // already on, it is asked again if it takes over
+                LogPrint(BCLog::NET, "not continuing headers from standby sync peer=%d, active sync peer=%d\n", pfrom->GetId(), nHeadersSyncPeer);
+            } else {
+                // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
+                // from there instead.
+                LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), uint256()));
+            }
         }
 
         bool fCanDirectFetch = CanDirectFetch(chainparams.GetConsensus());
@@ -1616,7 +1910,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nodestate->blockDownload.GetWindow(MAX_BLOCKS_IN_TRANSIT_PER_PEER)) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -1753,7 +2047,97 @@ inline bool versionSchedule(int nVersion)
     return false;
 }
 
-bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
+namespace {
+/**
+ * The message types the extensions (sporks, masternode sync, governance, PrivateSend, LLMQ) process, indexed by
+ * message type id. Each extension registers its commands and the queue they are processed from. Messages of the
+ * non-core queues are only handled by extensions, which do their own locking, so they can be processed
+ * concurrently with the core messages.
+ */
+class CNetMsgHandlers
+{
+public:
+    typedef void (*Handler)(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman);
+
+    struct Entry
+    {
+        MessageQueue queue = MSG_QUEUE_CORE;
+        std::vector<Handler> vHandlers;
+
+        void Process(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) const
+        {
+            for (Handler handler : vHandlers) {
+                handler(pfrom, strCommand, vRecv, connman);
+            }
+        }
+    };
+
+private:
+    std::vector<Entry> vEntries;
+
+    void Register(std::initializer_list<const char*> commands, MessageQueue queue, Handler handler)
+    {
+        for (const char* pszCommand : commands) {
+            NetMsgTypeId nTypeId = GetNetMsgTypeId(pszCommand);
+            assert(nTypeId != NET_MSG_TYPE_UNKNOWN);
+            Entry& entry = vEntries[nTypeId];
+            assert(entry.vHandlers.empty() || entry.queue == queue);
+            entry.queue = queue;
+            entry.vHandlers.push_back(handler);
+        }
+    }
+
+public:
+    CNetMsgHandlers() : vEntries(getAllNetMessageTypes().size())
+    {
+        Register({NetMsgType::SPORK, NetMsgType::GETSPORKS}, MSG_QUEUE_CORE,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { sporkManager.ProcessSpork(pfrom, strCommand, vRecv, connman); });
+
+        Register({NetMsgType::SYNCSTATUSCOUNT}, MSG_QUEUE_GOVERNANCE,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { masternodeSync.ProcessMessage(pfrom, strCommand, vRecv); });
+        Register({NetMsgType::MNGOVERNANCESYNC, NetMsgType::MNGOVERNANCEOBJECT, NetMsgType::MNGOVERNANCEOBJECTVOTE}, MSG_QUEUE_GOVERNANCE,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { governance.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::DSACCEPT, NetMsgType::DSVIN, NetMsgType::DSSIGNFINALTX, NetMsgType::DSQUEUE}, MSG_QUEUE_GOVERNANCE,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+#ifdef ENABLE_WALLET
+        Register({NetMsgType::DSQUEUE, NetMsgType::DSSTATUSUPDATE, NetMsgType::DSFINALTX, NetMsgType::DSCOMPLETE}, MSG_QUEUE_GOVERNANCE,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman); });
+#endif // ENABLE_WALLET
+
+        Register({NetMsgType::MNAUTH}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { CMNAuth::ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::QFCOMMITMENT}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::quorumBlockProcessor->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::QCONTRIB, NetMsgType::QCOMPLAINT, NetMsgType::QJUSTIFICATION, NetMsgType::QPCOMMITMENT, NetMsgType::QWATCH}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::quorumDKGSessionManager->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::QSIGSESANN, NetMsgType::QSIGSHARESINV, NetMsgType::QGETSIGSHARES, NetMsgType::QBSIGSHARES}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::quorumSigSharesManager->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::QSIGREC}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::quorumSigningManager->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::CLSIG}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::chainLocksHandler->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+        Register({NetMsgType::ISLOCK}, MSG_QUEUE_LLMQ,
+            [](CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, CConnman& connman) { llmq::quorumInstantSendManager->ProcessMessage(pfrom, strCommand, vRecv, connman); });
+    }
+
+    //! The extensions processing a message type, nullptr for core messages
+    const Entry* Get(NetMsgTypeId nTypeId) const
+    {
+        if (nTypeId >= vEntries.size() || vEntries[nTypeId].vHandlers.empty())
+            return nullptr;
+        return &vEntries[nTypeId];
+    }
+};
+
+const CNetMsgHandlers& GetNetMsgHandlers()
+{
+    // Not a global, the message types are initialized in another translation unit
+    static const CNetMsgHandlers handlers;
+    return handlers;
+}
+} // namespace
+
+bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, NetMsgTypeId nTypeId, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
     if (gArgs.IsArgSet("-dropmessagestest") && GetRand(gArgs.GetArg("-dropmessagestest", 0)) == 0)
@@ -2072,6 +2456,12 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // Note: do not break the flow here
     }
 
+    // Messages of the extensions skip the core messages below
+    if (const CNetMsgHandlers::Entry* pentry = GetNetMsgHandlers().Get(nTypeId)) {
+        pentry->Process(pfrom, strCommand, vRecv, *connman);
+        return true;
+    }
+
     if (strCommand == NetMsgType::ADDR) {
         std::vector<CAddress> vAddr;
         vRecv >> vAddr;
@@ -2202,12 +2592,22 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
                 // Download if this is a nice peer, or we have no nice peers and this one might do.
                 bool fFetch = state->fPreferredDownload || (nPreferredDownload == 0 && !pfrom->fOneShot);
-                // Only actively request headers from a single peer, unless we're close to end of initial download.
-                if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - nMaxTipAge) {
+                // Only actively request headers from -headerssyncpeers peers, unless we're close to end of initial download.
+                const bool fInitialHeadersSync = pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - nMaxTipAge;
+                if ((nSyncStarted < nMaxHeadersSyncPeers && fFetch) || !fInitialHeadersSync) {
                     // Make sure to mark this peer as the one we are currently syncing with etc.
                     state->fSyncStarted = true;
-                    state->nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime())/(chainparams.GetConsensus().nPowTargetSpacing);
                     nSyncStarted++;
+                    if (fInitialHeadersSync && nHeadersSyncPeer != -1) {
+                        // Another peer is serving the headers, keep this one on standby
+                        state->nHeadersSyncTimeout = std::numeric_limits<int64_t>::max();
+                        LogPrint(BCLog::NET, "headers sync standby peer=%d\n", pfrom->GetId());
+                        continue;
+                    }
+                    if (fInitialHeadersSync) {
+                        nHeadersSyncPeer = pfrom->GetId();
+                    }
+                    state->nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime())/(chainparams.GetConsensus().nPowTargetSpacing);
                     // We used to request the full block here, but since headers-announcements are now the
                     // primary method of announcement on the network, and since, in the case that a node
                     // fell back to inv we probably have a reorg which we should get the headers for first,
@@ -2384,6 +2784,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return true;
     }
 
+    if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+        return true;
+    }
+
+    if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+        return true;
+    }
+
+    if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+        return true;
+    }
+
     if (strCommand == NetMsgType::GETHEADERS) {
         CBlockLocator locator;
         uint256 hashStop;
@@ -2744,7 +3159,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 }
 
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
-                ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact, blockReconstructionTxns.get());
                 if (status == READ_STATUS_INVALID) {
                     MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
                     Misbehaving(pfrom->GetId(), 100, strprintf("Peer %d sent us invalid compact block", pfrom->GetId()));
@@ -2762,6 +3177,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     if (!partialBlock.IsTxAvailable(i))
                         req.indexes.push_back(i);
                 }
+                RecordCompactBlockReconstruction(partialBlock, req.indexes.size());
                 if (req.indexes.empty()) {
                     // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
                     BlockTransactions txn;
@@ -2779,11 +3195,16 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // Optimistically try to reconstruct anyway since we might be
                 // able to without any round trips.
                 PartiallyDownloadedBlock tempBlock(&mempool);
-                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact, blockReconstructionTxns.get());
                 if (status != READ_STATUS_OK) {
                     // TODO: don't ignore failures
                     return true;
                 }
+                size_t nMissing = 0;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    nMissing += !tempBlock.IsTxAvailable(i);
+                }
+                RecordCompactBlockReconstruction(tempBlock, nMissing);
                 std::vector<CTransactionRef> dummy;
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
@@ -2806,7 +3227,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         } // cs_main
 
         if (fProcessBLOCKTXN)
-            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
+            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, GetNetMsgTypeId(NetMsgType::BLOCKTXN), blockTxnMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
 
         if (fRevertToHeaderProcessing) {
             // Headers received from HB compact block peers are permitted to be
@@ -2956,6 +3377,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        const size_t nBlockBytes = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
@@ -2964,6 +3386,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            RecordBlockDownload(pfrom->GetId(), hash, nBlockBytes);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -3192,32 +3615,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         return true;
     }
 
-    bool found = false;
-    const std::vector<std::string> &allMessages = getAllNetMessageTypes();
-    for (const std::string msg : allMessages) {
-        if(msg == strCommand) {
-            found = true;
-            break;
-        }
-    }
-
-    if (found)
-    {
-        //probably one the extensions
-#ifdef ENABLE_WALLET
-        privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, *connman);
-#endif // ENABLE_WALLET
-        privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        sporkManager.ProcessSpork(pfrom, strCommand, vRecv, *connman);
-        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
-        governance.ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        CMNAuth::ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::quorumBlockProcessor->ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::quorumDKGSessionManager->ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::quorumSigSharesManager->ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::quorumSigningManager->ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::chainLocksHandler->ProcessMessage(pfrom, strCommand, vRecv, *connman);
-        llmq::quorumInstantSendManager->ProcessMessage(pfrom, strCommand, vRecv, *connman);
+    if (nTypeId != NET_MSG_TYPE_UNKNOWN) {
+        // A known message we have nothing to do with, e.g. a block received while importing
         return true;
     }
 
@@ -3336,11 +3735,23 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         return fMoreWork;
     }
 
+    // Messages of the other queues are handed to their thread once the peer finished the handshake and sent
+    // its first message, which ProcessMessage needs to see
+    const CNetMsgHandlers::Entry* pentry = GetNetMsgHandlers().Get(msg.nTypeId);
+    MessageQueue queue = pentry ? pentry->queue : MSG_QUEUE_CORE;
+    if (queue != MSG_QUEUE_CORE && pfrom->fSuccessfullyConnected && pfrom->nTimeFirstMessageReceived != 0) {
+        if (connman->QueueMessage(queue, pfrom, msg.nTypeId, strCommand, std::move(vRecv), msg.nTime)) {
+            LogPrint(BCLog::NET, "queued: %s (%u bytes) for %s peer=%d\n", SanitizeString(strCommand), nMessageSize, GetMessageQueueName(queue), pfrom->GetId());
+            return fMoreWork;
+        }
+    }
+
     // Process message
     bool fRet = false;
+    int64_t nTimeStart = GetTimeMicros();
     try
     {
-        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
+        fRet = ProcessMessage(pfrom, strCommand, msg.nTypeId, vRecv, msg.nTime, chainparams, connman, interruptMsgProc);
         if (interruptMsgProc)
             return false;
         if (!pfrom->vRecvGetData.empty())
@@ -3371,6 +3782,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         } catch (...) {
         PrintExceptionContinue(std::current_exception(), "ProcessMessages()");
     }
+    connman->RecordMessageProcessed(queue, msg.nTypeId, nMessageSize, msg.nTime, nTimeStart);
 
     if (!fRet) {
         LogPrint(BCLog::NET, "%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->GetId());
@@ -3382,6 +3794,21 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     return fMoreWork;
 }
 
+void PeerLogicValidation::ProcessQueuedMessage(CNode* pfrom, NetMsgTypeId nTypeId, const std::string& strCommand, CDataStream& vRecv, std::atomic<bool>& interruptMsgProc)
+{
+    LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
+    try {
+        if (const CNetMsgHandlers::Entry* pentry = GetNetMsgHandlers().Get(nTypeId)) {
+            pentry->Process(pfrom, strCommand, vRecv, *connman);
+        }
+    } catch (const std::ios_base::failure& e) {
+        connman->PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::REJECT, strCommand, REJECT_MALFORMED, std::string("error parsing message")));
+        LogPrint(BCLog::NET, "%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(strCommand), vRecv.size(), e.what());
+    } catch (...) {
+        PrintExceptionContinue(std::current_exception(), "ProcessQueuedMessage()");
+    }
+}
+
 void PeerLogicValidation::ConsiderEviction(CNode *pto, int64_t time_in_seconds)
 {
     AssertLockHeld(cs_main);
@@ -3619,25 +4046,43 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         if (pindexBestHeader == nullptr)
             pindexBestHeader = chainActive.Tip();
         bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
+        const bool fInitialHeadersSync = pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - nMaxTipAge;
+        bool fRequestHeaders = false;
         if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
-            // Only actively request headers from a single peer, unless we're close to end of initial download.
-            if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - nMaxTipAge) {
+            // Only sync headers with -headerssyncpeers peers, unless we're close to end of initial download.
+            if ((nSyncStarted < nMaxHeadersSyncPeers && fFetch) || !fInitialHeadersSync) {
                 state.fSyncStarted = true;
-                state.nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime())/(consensusParams.nPowTargetSpacing);
                 nSyncStarted++;
-                const CBlockIndex *pindexStart = pindexBestHeader;
-                /* If possible, start at the block preceding the currently
-                   best known header.  This ensures that we always get a
-                   non-empty list of headers back as long as the peer
-                   is up-to-date.  With a non-empty response, we can initialise
-                   the peer's known best block.  This wouldn't be possible
-                   if we requested starting at pindexBestHeader and
-                   got back an empty response.  */
-                if (pindexStart->pprev)
-                    pindexStart = pindexStart->pprev;
-                LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->GetId(), pto->nStartingHeight);
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256()));
+                if (fInitialHeadersSync && nHeadersSyncPeer != -1) {
+                    // Another peer is serving the headers, keep this one on standby
+                    state.nHeadersSyncTimeout = std::numeric_limits<int64_t>::max();
+                    LogPrint(BCLog::NET, "headers sync standby peer=%d (startheight:%d)\n", pto->GetId(), pto->nStartingHeight);
+                } else {
+                    fRequestHeaders = true;
+                }
+            }
+        } else if (state.fSyncStarted && fInitialHeadersSync && nHeadersSyncPeer == -1 && !pto->fClient && !fImporting && !fReindex) {
+            // The active sync peer stalled or disconnected, take over from the best header
+            LogPrint(BCLog::NET, "headers sync standby peer=%d takes over\n", pto->GetId());
+            fRequestHeaders = true;
+        }
+        if (fRequestHeaders) {
+            if (fInitialHeadersSync) {
+                nHeadersSyncPeer = pto->GetId();
             }
+            state.nHeadersSyncTimeout = GetTimeMicros() + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER * (GetAdjustedTime() - pindexBestHeader->GetBlockTime())/(consensusParams.nPowTargetSpacing);
+            const CBlockIndex *pindexStart = pindexBestHeader;
+            /* If possible, start at the block preceding the currently
+               best known header.  This ensures that we always get a
+               non-empty list of headers back as long as the peer
+               is up-to-date.  With a non-empty response, we can initialise
+               the peer's known best block.  This wouldn't be possible
+               if we requested starting at pindexBestHeader and
+               got back an empty response.  */
+            if (pindexStart->pprev)
+                pindexStart = pindexStart->pprev;
+            LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->GetId(), pto->nStartingHeight);
+            connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), uint256()));
         }
 
         // Resend wallet transactions that haven't gotten in a block yet
@@ -3735,7 +4180,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            connman->PushMessage(pto, msgMaker.Make(NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                            connman->PushMessage(pto, *most_recent_compact_block_msg);
                             fGotBlockFromCache = true;
                         }
                     }
@@ -3820,6 +4265,9 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                 pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound >> pto->fMasternode);
             }
 
+            // Pick up what was relayed to all peers, transactions only when they are about to be announced
+            connman->CollectRelayedInventory(pto, fSendTrickle);
+
             // Time to send but the peer has requested we not relay transactions.
             if (fSendTrickle) {
                 LOCK(pto->cs_filter);
@@ -3977,8 +4425,8 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         if (state.fSyncStarted && state.nHeadersSyncTimeout < std::numeric_limits<int64_t>::max()) {
             // Detect whether this is a stalling initial-headers-sync peer
             if (pindexBestHeader->GetBlockTime() <= GetAdjustedTime() - nMaxTipAge) {
-                if (nNow > state.nHeadersSyncTimeout && nSyncStarted == 1 && (nPreferredDownload - state.fPreferredDownload >= 1)) {
-                    // Disconnect a (non-whitelisted) peer if it is our only sync peer,
+                if (nNow > state.nHeadersSyncTimeout && (nPreferredDownload - state.fPreferredDownload >= 1)) {
+                    // Disconnect a (non-whitelisted) peer if it is one of our initial sync peers,
                     // and we have others we could be using instead.
                     // Note: If all our peers are inbound, then we won't
                     // disconnect our sync peer for stalling; we have bigger
@@ -3997,6 +4445,8 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                         state.fSyncStarted = false;
                         nSyncStarted--;
                         state.nHeadersSyncTimeout = 0;
+                        if (nHeadersSyncPeer == pto->GetId())
+                            nHeadersSyncPeer = -1;
                     }
                 }
             } else {
@@ -4014,10 +4464,34 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int nBlockWindow = state.blockDownload.GetWindow(MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlockWindow) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexWaitingFor = nullptr;
+            const unsigned int nCount = nBlockWindow - state.nBlocksInFlight;
+            FindNextBlocksToDownload(pto->GetId(), nCount, vToDownload, staller, pindexWaitingFor, consensusParams);
+            if (pindexWaitingFor) {
+                // The first block we are waiting for is in flight from another peer. If that peer is overdue and
+                // this one is expected to deliver it sooner, request it from this peer instead, ahead of the blocks
+                // further from the validation frontier.
+                auto itInFlight = mapBlocksInFlight.find(pindexWaitingFor->GetBlockHash());
+                const QueuedBlock& queuedBlock = *itInFlight->second.second;
+                CNodeState* stateWaitingFor = State(itInFlight->second.first);
+                if (!queuedBlock.partialBlock && stateWaitingFor->blockDownload.IsStraggling(queuedBlock.nTimeRequested, nNow) &&
+                        state.blockDownload.IsFasterThan(nNow - queuedBlock.nTimeRequested)) {
+                    LogPrint(BCLog::NET, "Block %s (%d) from peer=%d is overdue, requesting it from peer=%d\n", pindexWaitingFor->GetBlockHash().ToString(),
+                        pindexWaitingFor->nHeight, itInFlight->second.first, pto->GetId());
+                    if (vToDownload.size() == nCount) {
+                        vToDownload.pop_back();
+                    }
+                    vToDownload.insert(vToDownload.begin(), pindexWaitingFor);
+                    state.nBlocksReRequested++;
+                    if (staller == itInFlight->second.first) {
+                        staller = -1;
+                    }
+                }
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -18,6 +18,8 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -blockreconstructionrecenttxn, number of transactions removed from the mempool, respectively ISLOCKed transactions, to keep for compact block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_RECENT_TXN = 5000;
 
 /** Headers download timeout expressed in microseconds
  *  Timeout = base + per_header * (expected number of headers) */
@@ -46,6 +48,8 @@ static const unsigned int DEFAULT_HEADER_SPAM_FILTER_MAX_AVG = 10;
 /** Default for -headerspamfilterignoreport, ignore the port in the ip address when looking for header spam,
  multiple nodes on the same ip will be treated as the one when computing the filter*/
 static const unsigned int DEFAULT_HEADER_SPAM_FILTER_IGNORE_PORT = true;
+/** Default for -headerssyncpeers, number of peers kept ready for initial headers sync, headers are requested from one at a time */
+static const int DEFAULT_HEADERS_SYNC_PEERS = 3;
 
 class PeerLogicValidation : public CValidationInterface, public NetEventsInterface {
 private:
@@ -58,6 +62,8 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
     void BlockChecked(const CBlock& block, const CValidationState& state) override;
     void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override;
+    void NotifyTransactionLock(const CTransaction& tx, const llmq::CInstantSendLock& islock) override;
 
 
     void InitializeNode(CNode* pnode) override;
@@ -72,6 +78,8 @@ public:
     * @return                      True if there is more work to be done
     */
     bool SendMessages(CNode* pto, std::atomic<bool>& interrupt) override;
+    /** Process a message handed to the thread of a non-core queue */
+    void ProcessQueuedMessage(CNode* pfrom, NetMsgTypeId nTypeId, const std::string& strCommand, CDataStream& vRecv, std::atomic<bool>& interrupt) override;
 
     void ConsiderEviction(CNode *pto, int64_t time_in_seconds);
     void CheckForStaleTipAndEvictPeers(const Consensus::Params &consensusParams);
@@ -86,10 +94,44 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlockWindow;
+    int nBlockSamples;
+    double dBlockLatency;
+    double dBlockTime;
+    double dBlockBytesPerSecond;
+    int nBlocksReRequested;
 };
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+
+struct CHeadersSyncStats {
+    int nSyncPeers;
+    int nMaxSyncPeers;
+    NodeId nActiveSyncPeer;
+    uint64_t nHeadersReceived;
+    int64_t nHashMicros;
+    int64_t nAcceptMicros;
+};
+
+/** Get statistics on the headers received so far */
+void GetHeadersSyncStats(CHeadersSyncStats& stats);
+
+struct CCompactBlockStats {
+    uint64_t nBlocks = 0;
+    uint64_t nBlocksComplete = 0;
+    uint64_t nTxPrefilled = 0;
+    uint64_t nTxMempool = 0;
+    uint64_t nTxExtra = 0;
+    uint64_t nTxRecent = 0;
+    uint64_t nTxLocked = 0;
+    uint64_t nTxMissing = 0;
+    size_t nRecentTxn = 0;
+    size_t nLockedTxn = 0;
+};
+
+/** Get statistics on where the transactions of compact blocks were found */
+void GetCompactBlockStats(CCompactBlockStats& stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch, const std::string& message="");
 bool IsBanned(NodeId nodeid);
@@ -0,0 +1,327 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_POOLEDHASHMAP_H
+#define LOKAL_POOLEDHASHMAP_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with open addressing, meant as a drop-in replacement for the std::unordered_map subset used by the
+ * coins cache.
+ *
+ * Entries live in pooled nodes, allocated in chunks that grow geometrically up to MAX_CHUNK_NODES and that are
+ * only released by clear() or the destructor. Erased nodes are put on a free list and reused by later inserts.
+ * The hash table itself only holds a pointer to the node and the 32 low bits of its hash, uses linear probing and
+ * erases by shifting the following entries back, so there are no tombstones.
+ *
+ * Compared to std::unordered_map:
+ * - pointers and references to entries stay valid until the entry is erased, but iterators may only be used
+ *   to erase and to advance; erasing never invalidates iterators to other entries, including end().
+ * - iteration order is node order, which is insertion order until erased nodes get reused.
+ * - the hash is reduced to 32 bits, so no more than 2^32 slots are supported.
+ */
+template <typename K, typename T, typename Hash>
+class pooledhashmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+    static const size_t MIN_CHUNK_NODES = 16;
+    static const size_t MAX_CHUNK_NODES = 4096;
+
+private:
+    enum : uint8_t {
+        NODE_FREE = 0,
+        NODE_LIVE = 1,
+        NODE_CHUNK_END = 2, //!< last node of a chunk, points to the first node of the next chunk
+    };
+
+    struct Node {
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+        uint32_t nHash;
+        uint8_t nState;
+
+        value_type& value() { return *reinterpret_cast<value_type*>(&storage); }
+        const value_type& value() const { return *reinterpret_cast<const value_type*>(&storage); }
+        // free and chunk end nodes keep their link in the storage of the value
+        Node*& next() { return *reinterpret_cast<Node**>(&storage); }
+        Node* next() const { return *reinterpret_cast<Node* const*>(&storage); }
+    };
+    static_assert(sizeof(value_type) >= sizeof(Node*), "value_type too small to hold the free list link");
+
+    struct Slot {
+        Node* pNode;
+        uint32_t nHash;
+    };
+
+    std::vector<std::unique_ptr<Node[]>> vChunks;
+    std::vector<size_t> vChunkSizes; //!< nodes per chunk, without the chunk end node
+    std::vector<Slot> vSlots;
+    Node* pFree;
+    size_t nSize;
+    Hash hasher;
+
+    static Node* SkipToLive(Node* p)
+    {
+        while (p && p->nState != NODE_LIVE) {
+            p = p->nState == NODE_CHUNK_END ? p->next() : p + 1;
+        }
+        return p;
+    }
+
+public:
+    class iterator;
+
+    class const_iterator
+    {
+    protected:
+        Node* p;
+        friend class pooledhashmap;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename pooledhashmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        explicit const_iterator(Node* pIn = nullptr) : p(pIn) {}
+
+        const value_type& operator*() const { return p->value(); }
+        const value_type* operator->() const { return &p->value(); }
+        const_iterator& operator++() { p = SkipToLive(p + 1); return *this; }
+        const_iterator operator++(int) { const_iterator copy(*this); ++(*this); return copy; }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.p == b.p; }
+        friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a.p != b.p; }
+    };
+
+    class iterator : public const_iterator
+    {
+    public:
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        explicit iterator(Node* pIn = nullptr) : const_iterator(pIn) {}
+
+        value_type& operator*() const { return this->p->value(); }
+        value_type* operator->() const { return &this->p->value(); }
+        iterator& operator++() { this->p = SkipToLive(this->p + 1); return *this; }
+        iterator operator++(int) { iterator copy(*this); ++(*this); return copy; }
+    };
+
+private:
+    size_t FindSlot(const K& key, uint32_t nHash) const
+    {
+        if (vSlots.empty()) return vSlots.size();
+        const size_t nMask = vSlots.size() - 1;
+        for (size_t i = nHash & nMask; vSlots[i].pNode; i = (i + 1) & nMask) {
+            if (vSlots[i].nHash == nHash && vSlots[i].pNode->value().first == key) return i;
+        }
+        return vSlots.size();
+    }
+
+    void PlaceSlot(Node* pNode)
+    {
+        const size_t nMask = vSlots.size() - 1;
+        size_t i = pNode->nHash & nMask;
+        while (vSlots[i].pNode) i = (i + 1) & nMask;
+        vSlots[i].pNode = pNode;
+        vSlots[i].nHash = pNode->nHash;
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<Slot> vOld(nSlots, Slot{nullptr, 0});
+        vOld.swap(vSlots);
+        for (const Slot& slot : vOld) {
+            if (slot.pNode) PlaceSlot(slot.pNode);
+        }
+    }
+
+    void RemoveSlot(const Node* pNode)
+    {
+        const size_t nMask = vSlots.size() - 1;
+        size_t i = pNode->nHash & nMask;
+        while (vSlots[i].pNode != pNode) i = (i + 1) & nMask;
+        // Shift back every following entry of the cluster whose home slot is not in (i, j]
+        for (size_t j = (i + 1) & nMask; vSlots[j].pNode; j = (j + 1) & nMask) {
+            size_t nHome = vSlots[j].nHash & nMask;
+            if (((j - nHome) & nMask) >= ((j - i) & nMask)) {
+                vSlots[i] = vSlots[j];
+                i = j;
+            }
+        }
+        vSlots[i].pNode = nullptr;
+    }
+
+    Node* AllocNode()
+    {
+        if (!pFree) {
+            size_t nNodes = vChunkSizes.empty() ? (size_t)MIN_CHUNK_NODES : std::min(vChunkSizes.back() * 2, (size_t)MAX_CHUNK_NODES);
+            std::unique_ptr<Node[]> chunk(new Node[nNodes + 1]);
+            for (size_t i = 0; i < nNodes; i++) {
+                chunk[i].nState = NODE_FREE;
+                chunk[i].next() = i + 1 < nNodes ? &chunk[i + 1] : nullptr;
+            }
+            chunk[nNodes].nState = NODE_CHUNK_END;
+            chunk[nNodes].next() = nullptr;
+            if (!vChunks.empty()) {
+                vChunks.back()[vChunkSizes.back()].next() = &chunk[0];
+            }
+            pFree = &chunk[0];
+            vChunks.push_back(std::move(chunk));
+            vChunkSizes.push_back(nNodes);
+        }
+        Node* pNode = pFree;
+        pFree = pNode->next();
+        return pNode;
+    }
+
+    void FreeNode(Node* pNode)
+    {
+        pNode->nState = NODE_FREE;
+        pNode->next() = pFree;
+        pFree = pNode;
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> Insert(Args&&... args)
+    {
+        Node* pNode = AllocNode();
+        try {
+            new (&pNode->storage) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            FreeNode(pNode);
+            throw;
+        }
+        const uint32_t nHash = (uint32_t)hasher(pNode->value().first);
+        size_t nSlot = FindSlot(pNode->value().first, nHash);
+        if (nSlot != vSlots.size()) {
+            pNode->value().~value_type();
+            FreeNode(pNode);
+            return std::make_pair(iterator(vSlots[nSlot].pNode), false);
+        }
+        // keep the load factor at or below 3/4
+        if ((nSize + 1) * 4 > vSlots.size() * 3) {
+            Rehash(std::max((size_t)MIN_CHUNK_NODES, vSlots.size() * 2));
+        }
+        pNode->nHash = nHash;
+        pNode->nState = NODE_LIVE;
+        PlaceSlot(pNode);
+        nSize++;
+        return std::make_pair(iterator(pNode), true);
+    }
+
+public:
+    pooledhashmap() : pFree(nullptr), nSize(0) {}
+    ~pooledhashmap() { clear(); }
+
+    pooledhashmap(const pooledhashmap&) = delete;
+    pooledhashmap& operator=(const pooledhashmap&) = delete;
+
+    iterator begin() { return iterator(vChunks.empty() ? nullptr : SkipToLive(&vChunks[0][0])); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(vChunks.empty() ? nullptr : SkipToLive(&vChunks[0][0])); }
+    const_iterator end() const { return const_iterator(); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return nSize == 0; }
+    size_type size() const { return nSize; }
+    //! Number of nodes allocated, live or free
+    size_t capacity() const
+    {
+        size_t nNodes = 0;
+        for (size_t n : vChunkSizes) nNodes += n;
+        return nNodes;
+    }
+
+    iterator find(const K& key)
+    {
+        size_t nSlot = FindSlot(key, (uint32_t)hasher(key));
+        return nSlot == vSlots.size() ? end() : iterator(vSlots[nSlot].pNode);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        size_t nSlot = FindSlot(key, (uint32_t)hasher(key));
+        return nSlot == vSlots.size() ? end() : const_iterator(vSlots[nSlot].pNode);
+    }
+
+    size_type count(const K& key) const { return find(key) == end() ? 0 : 1; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) { return Insert(std::forward<Args>(args)...); }
+
+    std::pair<iterator, bool> insert(const value_type& value) { return Insert(value); }
+    std::pair<iterator, bool> insert(value_type&& value) { return Insert(std::move(value)); }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it != end()) return it->second;
+        return Insert(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        Node* pNode = pos.p;
+        assert(pNode && pNode->nState == NODE_LIVE);
+        RemoveSlot(pNode);
+        pNode->value().~value_type();
+        FreeNode(pNode);
+        nSize--;
+        return iterator(SkipToLive(pNode + 1));
+    }
+
+    size_type erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    //! Destroy all entries and release all memory
+    void clear()
+    {
+        for (size_t c = 0; c < vChunks.size(); c++) {
+            for (size_t i = 0; i < vChunkSizes[c]; i++) {
+                if (vChunks[c][i].nState == NODE_LIVE) vChunks[c][i].value().~value_type();
+            }
+        }
+        std::vector<std::unique_ptr<Node[]>>().swap(vChunks);
+        std::vector<size_t>().swap(vChunkSizes);
+        std::vector<Slot>().swap(vSlots);
+        pFree = nullptr;
+        nSize = 0;
+    }
+
+    //! Heap memory of the nodes and the slot table, excluding whatever the entries own themselves
+    template <typename MallocUsage>
+    size_t DynamicMemoryUsage(MallocUsage usage) const
+    {
+        size_t nUsage = usage(vChunks.capacity() * sizeof(std::unique_ptr<Node[]>));
+        nUsage += usage(vChunkSizes.capacity() * sizeof(size_t));
+        nUsage += usage(vSlots.capacity() * sizeof(Slot));
+        for (size_t n : vChunkSizes) nUsage += usage((n + 1) * sizeof(Node));
+        return nUsage;
+    }
+};
+
+#endif // LOKAL_POOLEDHASHMAP_H
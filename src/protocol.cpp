@@ -8,6 +8,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <unordered_map>
+
 #ifndef WIN32
 # include <arpa/inet.h>
 #endif
@@ -38,6 +40,12 @@ const char *SENDCMPCT="sendcmpct";
 const char *CMPCTBLOCK="cmpctblock";
 const char *GETBLOCKTXN="getblocktxn";
 const char *BLOCKTXN="blocktxn";
+const char *GETCFILTERS="getcfilters";
+const char *CFILTER="cfilter";
+const char *GETCFHEADERS="getcfheaders";
+const char *CFHEADERS="cfheaders";
+const char *GETCFCHECKPT="getcfcheckpt";
+const char *CFCHECKPT="cfcheckpt";
 // LOKAL_Coin message types
 const char *LEGACYTXLOCKREQUEST="ix";
 const char *SPORK="spork";
@@ -103,6 +111,12 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::CMPCTBLOCK,
     NetMsgType::GETBLOCKTXN,
     NetMsgType::BLOCKTXN,
+    NetMsgType::GETCFILTERS,
+    NetMsgType::CFILTER,
+    NetMsgType::GETCFHEADERS,
+    NetMsgType::CFHEADERS,
+    NetMsgType::GETCFCHECKPT,
+    NetMsgType::CFCHECKPT,
     // LOKAL_Coin message types
     // NOTE: do NOT include non-implmented here, we want them to be "Unknown command" in ProcessMessage()
     NetMsgType::LEGACYTXLOCKREQUEST,
@@ -279,3 +293,16 @@ const std::vector<std::string> &getAllNetMessageTypes()
 {
     return allNetMessageTypesVec;
 }
+
+NetMsgTypeId GetNetMsgTypeId(const std::string& strCommand)
+{
+    static const std::unordered_map<std::string, NetMsgTypeId> mapNetMsgTypeIds = [] {
+        std::unordered_map<std::string, NetMsgTypeId> map;
+        for (size_t i = 0; i < allNetMessageTypesVec.size(); i++) {
+            map.emplace(allNetMessageTypesVec[i], i);
+        }
+        return map;
+    }();
+    auto it = mapNetMsgTypeIds.find(strCommand);
+    return it == mapNetMsgTypeIds.end() ? NET_MSG_TYPE_UNKNOWN : it->second;
+}
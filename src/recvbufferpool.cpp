@@ -0,0 +1,106 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recvbufferpool.h"
+
+CRecvBufferPool recvBufferPool;
+
+//! Index of the smallest size class with at least nSize bytes
+static size_t GetSizeClass(size_t nSize)
+{
+    size_t nClass = 0;
+    while ((RECV_BUFFER_MIN_SIZE << nClass) < nSize)
+        nClass++;
+    return nClass;
+}
+
+CRecvBufferPool::CRecvBufferPool(size_t nMaxCachedBytesIn) :
+    vFree(GetSizeClass(RECV_BUFFER_MAX_SIZE) + 1),
+    nMaxCachedBytes(nMaxCachedBytesIn),
+    nCachedBytes(0),
+    nAllocations(0),
+    nReuses(0)
+{
+}
+
+void CRecvBufferPool::Take(CSerializeData& vch, size_t nSize)
+{
+    CSerializeData vchNew;
+    if (nSize > RECV_BUFFER_MAX_SIZE) {
+        vchNew.reserve(nSize);
+        LOCK(cs);
+        nAllocations++;
+    } else {
+        size_t nClass = GetSizeClass(nSize);
+        LOCK(cs);
+        if (vFree[nClass].empty()) {
+            vchNew.reserve(RECV_BUFFER_MIN_SIZE << nClass);
+            nAllocations++;
+        } else {
+            vchNew.swap(vFree[nClass].back());
+            vFree[nClass].pop_back();
+            nCachedBytes -= vchNew.capacity();
+            nReuses++;
+        }
+    }
+    vch.swap(vchNew);
+}
+
+void CRecvBufferPool::Put(CSerializeData&& vch)
+{
+    size_t nCapacity = vch.capacity();
+    if (nCapacity < RECV_BUFFER_MIN_SIZE || nCapacity > RECV_BUFFER_MAX_SIZE)
+        return;
+    // A buffer is good for the largest size class it can hold
+    size_t nClass = GetSizeClass(nCapacity);
+    if ((RECV_BUFFER_MIN_SIZE << nClass) > nCapacity)
+        nClass--;
+
+    vch.clear();
+    LOCK(cs);
+    if (nCachedBytes + nCapacity > nMaxCachedBytes)
+        return;
+    vFree[nClass].emplace_back(std::move(vch));
+    nCachedBytes += nCapacity;
+}
+
+void CRecvBufferPool::Grow(CDataStream& s, size_t nSize)
+{
+    if (nSize <= s.capacity())
+        return;
+    CSerializeData vch;
+    Take(vch, nSize);
+    vch.insert(vch.end(), s.begin(), s.end());
+    s.swap(vch);
+    Put(std::move(vch));
+}
+
+void CRecvBufferPool::Release(CDataStream& s)
+{
+    CSerializeData vch;
+    s.swap(vch);
+    Put(std::move(vch));
+}
+
+void CRecvBufferPool::SetMaxCachedBytes(size_t nMaxCachedBytesIn)
+{
+    LOCK(cs);
+    nMaxCachedBytes = nMaxCachedBytesIn;
+    for (auto it = vFree.rbegin(); it != vFree.rend() && nCachedBytes > nMaxCachedBytes; ++it) {
+        while (!it->empty() && nCachedBytes > nMaxCachedBytes) {
+            nCachedBytes -= it->back().capacity();
+            it->pop_back();
+        }
+    }
+}
+
+CRecvBufferPoolStats CRecvBufferPool::GetStats() const
+{
+    LOCK(cs);
+    CRecvBufferPoolStats stats;
+    stats.nAllocations = nAllocations;
+    stats.nReuses = nReuses;
+    stats.nCachedBytes = nCachedBytes;
+    return stats;
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_RECVBUFFERPOOL_H
+#define LOKAL_RECVBUFFERPOOL_H
+
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+//! Smallest and largest size class of the pooled receive buffers, larger buffers are not reused
+static const size_t RECV_BUFFER_MIN_SIZE = 4 << 10;
+static const size_t RECV_BUFFER_MAX_SIZE = 4 << 20;
+//! Capacity of the unused receive buffers kept for reuse
+static const size_t DEFAULT_RECV_BUFFER_POOL_SIZE = 32 << 20;
+
+struct CRecvBufferPoolStats
+{
+    //! Buffers that had to be allocated, respectively were reused
+    uint64_t nAllocations;
+    uint64_t nReuses;
+    size_t nCachedBytes;
+};
+
+/**
+ * Buffers for received message payloads, in power of two size classes.
+ *
+ * A payload is read into a pooled buffer that becomes the message's vRecv and is deserialized from there in place.
+ * The buffer goes back to the pool when the message is destroyed, so that receiving further messages neither
+ * allocates nor has the freed buffer zeroed.
+ */
+class CRecvBufferPool
+{
+private:
+    mutable CCriticalSection cs;
+    //! Unused buffers by size class
+    std::vector<std::vector<CSerializeData>> vFree;
+    size_t nMaxCachedBytes;
+    size_t nCachedBytes;
+    uint64_t nAllocations;
+    uint64_t nReuses;
+
+    //! Set vch to an empty buffer with a capacity of at least nSize
+    void Take(CSerializeData& vch, size_t nSize);
+    void Put(CSerializeData&& vch);
+
+public:
+    explicit CRecvBufferPool(size_t nMaxCachedBytesIn = DEFAULT_RECV_BUFFER_POOL_SIZE);
+
+    CRecvBufferPool(const CRecvBufferPool&) = delete;
+    CRecvBufferPool& operator=(const CRecvBufferPool&) = delete;
+
+    //! Move the stream's data to a buffer with a capacity of at least nSize
+    void Grow(CDataStream& s, size_t nSize);
+    //! Take back the stream's buffer, leaving the stream empty
+    void Release(CDataStream& s);
+
+    //! Drop unused buffers above nMaxCachedBytes, 0 disables reuse
+    void SetMaxCachedBytes(size_t nMaxCachedBytesIn);
+    CRecvBufferPoolStats GetStats() const;
+};
+
+extern CRecvBufferPool recvBufferPool;
+
+#endif // LOKAL_RECVBUFFERPOOL_H
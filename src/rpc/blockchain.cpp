@@ -8,12 +8,17 @@
 #include "rpc/blockchain.h"
 
 #include "amount.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinstats.h"
+#include "coinstatsindex.h"
 #include "core_io.h"
 #include "consensus/validation.h"
+#include "dbwrapper.h"
+#include "net_processing.h"
 #include "validation.h"
 #include "core_io.h"
 // #include "index/txindex.h"
@@ -23,10 +28,12 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 #include "hash.h"
 
 #include "evo/specialtx.h"
@@ -777,6 +784,74 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"     (string, required) The hash of the block\n"
+            "2. \"filtertype\"    (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hex\"    (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash = ParseHashV(request.params[0], "blockhash");
+    std::string strFilterType = "basic";
+    if (!request.params[1].isNull()) {
+        strFilterType = request.params[1].get_str();
+    }
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(strFilterType, filterType)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    }
+
+    if (!pblockfilterindex || pblockfilterindex->GetFilterType() != filterType) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + strFilterType);
+    }
+
+    const CBlockIndex* pblockindex;
+    bool fBlockWasConnected;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        pblockindex = it->second;
+        fBlockWasConnected = pblockindex->IsValid(BLOCK_VALID_SCRIPTS);
+    }
+
+    CBlockFilter filter;
+    uint256 filterHeader;
+    if (!pblockfilterindex->LookupFilter(pblockindex, filter) ||
+        !pblockfilterindex->LookupFilterHeader(pblockindex, filterHeader)) {
+        std::string strError = "Filter not found.";
+        if (!fBlockWasConnected) {
+            strError += " Block was not connected to active chain.";
+        } else if (!pblockfilterindex->IsSynced()) {
+            strError += " Block filters are still in the process of being indexed.";
+        } else {
+            strError += " This error is unexpected and indicates index corruption.";
+        }
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", filterHeader.GetHex()));
+    return ret;
+}
+
 UniValue getblockheaders(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
@@ -1046,76 +1121,6 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1167,30 +1172,100 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" hash_or_height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless the coinstats index (-coinstatsindex) can answer it.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"      (string, optional, default=\"hash_serialized_2\") Which UTXO set hash to calculate:\n"
+            "                     \"hash_serialized_2\", \"muhash\" or \"none\". Only \"muhash\" and \"none\" are served by the index.\n"
+            "2. hash_or_height   (string or numeric, optional, default=the tip) The block hash or height of the target\n"
+            "                     UTXO set, requires -coinstatsindex and a hash_type other than \"hash_serialized_2\"\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"height\":n,     (numeric) The block height (index) of the returned statistics\n"
+            "  \"bestblock\": \"hex\",   (string) the hash of the block at which they were calculated\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available from the index)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only with hash_type \"hash_serialized_2\")\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash of the set (only with hash_type \"muhash\")\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (not available from the index)\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"total_unspendable_amount\": x.xxx, (numeric) The total amount sent to unspendable outputs (only from the index)\n"
+            "  \"money_supply\": x.xxx   (numeric) The money supply recorded in the block index (only from the index)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    CCoinsStats stats;
+    const std::string strHashType = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
+    if (strHashType == "hash_serialized_2") {
+        stats.hashType = CoinStatsHashType::HASH_SERIALIZED;
+    } else if (strHashType == "muhash") {
+        stats.hashType = CoinStatsHashType::MUHASH;
+    } else if (strHashType == "none") {
+        stats.hashType = CoinStatsHashType::NONE;
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    }
+
+    const bool fUseIndex = pcoinstatsindex && stats.hashType != CoinStatsHashType::HASH_SERIALIZED;
+    if (!request.params[1].isNull() && !fUseIndex) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "hash_or_height requires -coinstatsindex and hash_type muhash or none");
+    }
+
     UniValue ret(UniValue::VOBJ);
+    if (fUseIndex) {
+        if (!pcoinstatsindex->BlockUntilSyncedToCurrentChain(10 * 1000)) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Coinstats index is still syncing, current height " +
+                               std::to_string(pcoinstatsindex->GetBestBlockIndex() ? pcoinstatsindex->GetBestBlockIndex()->nHeight : -1));
+        }
+
+        const CBlockIndex* pindex;
+        CAmount nMoneySupply;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+            const UniValue& target = request.params[1];
+            if (target.isNum() || (target.isStr() && !target.get_str().empty() && target.get_str().size() < 64 &&
+                                   target.get_str().find_first_not_of("0123456789") == std::string::npos)) {
+                int nHeight = target.isNum() ? target.get_int() : atoi(target.get_str());
+                if (nHeight < 0 || nHeight > chainActive.Height()) {
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+                }
+                pindex = chainActive[nHeight];
+            } else if (!target.isNull()) {
+                uint256 hash = ParseHashV(target, "hash_or_height");
+                BlockMap::const_iterator it = mapBlockIndex.find(hash);
+                if (it == mapBlockIndex.end()) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+                }
+                pindex = it->second;
+            }
+            nMoneySupply = pindex->nMoneySupply;
+        }
+
+        if (!pcoinstatsindex->LookupStats(pindex, stats)) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to read UTXO set statistics of block " + pindex->GetBlockHash().GetHex() + " from the coinstats index");
+        }
+        ret.push_back(Pair("height", (int64_t)stats.nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        if (strHashType == "muhash") {
+            ret.push_back(Pair("muhash", stats.hashSerialized.GetHex()));
+        }
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("total_unspendable_amount", ValueFromAmount(stats.nTotalUnspendable)));
+        ret.push_back(Pair("money_supply", ValueFromAmount(nMoneySupply)));
+        return ret;
+    }
 
-    CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview.get(), stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
@@ -1198,7 +1273,11 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (stats.hashType == CoinStatsHashType::HASH_SERIALIZED) {
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        } else if (stats.hashType == CoinStatsHashType::MUHASH) {
+            ret.push_back(Pair("muhash", stats.hashSerialized.GetHex()));
+        }
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     } else {
@@ -1207,6 +1286,96 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite a snapshot of the UTXO set at the chain tip, together with the block index and evoDB state\n"
+            "needed to continue from it, for loadtxoutset on a new node.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) Path to the output file. Relative paths are relative to the data directory.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,         (numeric) The number of coins written\n"
+            "  \"evodb_entries\": n,         (numeric) The number of evoDB entries written\n"
+            "  \"base_hash\": \"hash\",        (string) The hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n,           (numeric) The height of that block\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the UTXO set, as in gettxoutsetinfo\n"
+            "  \"snapshot_hash\": \"hash\",     (string) The hash of the whole snapshot, to pass to loadtxoutset\n"
+            "  \"path\": \"path\"              (string) The absolute path of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    CUTXOSnapshotMetadata metadata;
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, metadata, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)metadata.nCoins));
+    ret.push_back(Pair("evodb_entries", (int64_t)metadata.nEvoDBEntries));
+    ret.push_back(Pair("base_hash", metadata.hashBaseBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nHeight));
+    ret.push_back(Pair("hash_serialized_2", metadata.hashSerialized.GetHex()));
+    ret.push_back(Pair("snapshot_hash", metadata.GetHash().GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "loadtxoutset \"path\" \"snapshot_hash\"\n"
+            "\nLoad a snapshot written by dumptxoutset into a fresh chainstate and continue the chain from its base block.\n"
+            "Blocks up to the base block are not downloaded or validated, the snapshot is trusted instead. Take\n"
+            "snapshot_hash from the dumptxoutset result of a node you trust, it covers the coins, the block index\n"
+            "and the evoDB entries.\n"
+            "\nArguments:\n"
+            "1. \"path\"              (string, required) Path to the snapshot. Relative paths are relative to the data directory.\n"
+            "2. \"snapshot_hash\"     (string, required) Only load the snapshot if its hash matches\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,          (numeric) The number of coins loaded\n"
+            "  \"evodb_entries\": n,         (numeric) The number of evoDB entries loaded\n"
+            "  \"base_hash\": \"hash\",        (string) The hash of the new chain tip\n"
+            "  \"base_height\": n,           (numeric) The height of the new chain tip\n"
+            "  \"hash_serialized_2\": \"hash\"  (string) The serialized hash of the loaded UTXO set\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"hash\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"hash\"")
+        );
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(request.params[1], "snapshot_hash");
+    CUTXOSnapshotMetadata metadata;
+    std::string strError;
+    if (!LoadUTXOSnapshot(path, hashExpected, metadata, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    // Blocks below the snapshot base were never downloaded, so stop offering to serve them
+    if (g_connman) {
+        g_connman->RemoveLocalServices(NODE_NETWORK);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_loaded", (int64_t)metadata.nCoins));
+    ret.push_back(Pair("evodb_entries", (int64_t)metadata.nEvoDBEntries));
+    ret.push_back(Pair("base_hash", metadata.hashBaseBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nHeight));
+    ret.push_back(Pair("hash_serialized_2", metadata.hashSerialized.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1397,6 +1566,15 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"chain\": \"xxxx\",        (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "  \"blocks\": xxxxxx,         (numeric) the current number of blocks processed in the server\n"
             "  \"headers\": xxxxxx,        (numeric) the current number of headers we have validated\n"
+            "  \"headersprogress\": xxxx,  (numeric) estimate of headers sync progress [0..1]\n"
+            "  \"headerssync\": {          (object) statistics on the headers received from peers\n"
+            "     \"syncpeers\": xx,        (numeric) number of headers sync peers, active or on standby\n"
+            "     \"maxsyncpeers\": xx,     (numeric) maximum number of initial headers sync peers (-headerssyncpeers)\n"
+            "     \"activepeer\": xx,       (numeric) id of the sync peer headers are requested from, -1 if none\n"
+            "     \"received\": xxxxxx,     (numeric) number of headers received in headers messages\n"
+            "     \"hashtime\": xxxx,       (numeric) time spent hashing and linking received headers, in seconds\n"
+            "     \"accepttime\": xxxx,     (numeric) time spent accepting received headers into the block index, in seconds\n"
+            "  },\n"
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"mediantime\": xxxxxx,     (numeric) median time for the current best block\n"
@@ -1441,6 +1619,24 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     obj.push_back(Pair("chain",                 Params().NetworkIDString()));
     obj.push_back(Pair("blocks",                (int)chainActive.Height()));
     obj.push_back(Pair("headers",               pindexBestHeader ? pindexBestHeader->nHeight : -1));
+    double dHeadersProgress = 0.0;
+    if (pindexBestHeader) {
+        // extrapolate the number of headers still to come from the time of the best header
+        const int64_t nSpacing = Params().GetConsensus().nPowTargetSpacing;
+        const double dRemaining = std::max<int64_t>(0, GetAdjustedTime() - pindexBestHeader->GetBlockTime()) / (double)nSpacing;
+        dHeadersProgress = std::min(1.0, (pindexBestHeader->nHeight + 1) / (pindexBestHeader->nHeight + 1 + dRemaining));
+    }
+    obj.push_back(Pair("headersprogress",       dHeadersProgress));
+    CHeadersSyncStats headersSyncStats;
+    GetHeadersSyncStats(headersSyncStats);
+    UniValue headersSync(UniValue::VOBJ);
+    headersSync.push_back(Pair("syncpeers",     headersSyncStats.nSyncPeers));
+    headersSync.push_back(Pair("maxsyncpeers",  headersSyncStats.nMaxSyncPeers));
+    headersSync.push_back(Pair("activepeer",    headersSyncStats.nActiveSyncPeer));
+    headersSync.push_back(Pair("received",      headersSyncStats.nHeadersReceived));
+    headersSync.push_back(Pair("hashtime",      headersSyncStats.nHashMicros * 0.000001));
+    headersSync.push_back(Pair("accepttime",    headersSyncStats.nAcceptMicros * 0.000001));
+    obj.push_back(Pair("headerssync",           headersSync));
     obj.push_back(Pair("bestblockhash",         chainActive.Tip()->GetBlockHash().GetHex()));
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("mediantime",            (int64_t)chainActive.Tip()->GetMedianTimePast()));
@@ -1656,6 +1852,67 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getdbstats ( \"name\" )\n"
+            "\nReturns the LevelDB settings and statistics of the open databases.\n"
+            "\nArguments:\n"
+            "1. \"name\"        (string, optional) Only return the database with this name, see -dbprofile\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",           (string) The name of the database\n"
+            "    \"path\": \"xxxx\",           (string) The directory of the database, empty for in-memory ones\n"
+            "    \"profile\": \"xxxx\",        (string) The option profile the settings are based on\n"
+            "    \"cache_size\": xxxxx,        (numeric) The cache size in bytes, shared by block cache and write buffers\n"
+            "    \"block_cache_percent\": xx,  (numeric) The share of the cache size used for the block cache\n"
+            "    \"bloom_bits\": xx,           (numeric) Bloom filter bits per key, 0 if bloom filters are disabled\n"
+            "    \"block_size\": xxxxx,        (numeric) The block size in bytes\n"
+            "    \"compression\": true|false, (boolean) Whether blocks are compressed\n"
+            "    \"max_open_files\": xxx,      (numeric) The maximum number of open table files\n"
+            "    \"memory_usage\": xxxxx,      (numeric) LevelDB's estimate of the memory used by the database\n"
+            "    \"stats\": \"xxxx\"           (string) LevelDB's statistics of the tables at each level\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleCli("getdbstats", "\"chainstate\"")
+            + HelpExampleRpc("getdbstats", "\"chainstate\"")
+        );
+
+    std::string strName;
+    if (!request.params[0].isNull()) {
+        strName = request.params[0].get_str();
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const CDBStats& stats : GetDBStats()) {
+        if (!strName.empty() && stats.options.strName != strName) {
+            continue;
+        }
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.options.strName));
+        obj.push_back(Pair("path", stats.strPath));
+        obj.push_back(Pair("profile", stats.options.strProfile));
+        obj.push_back(Pair("cache_size", (uint64_t)stats.nCacheSize));
+        obj.push_back(Pair("block_cache_percent", stats.options.nBlockCachePercent));
+        obj.push_back(Pair("bloom_bits", stats.options.nBloomBits));
+        obj.push_back(Pair("block_size", (uint64_t)stats.options.nBlockSize));
+        obj.push_back(Pair("compression", stats.options.fCompression));
+        obj.push_back(Pair("max_open_files", stats.options.nMaxOpenFiles));
+        obj.push_back(Pair("memory_usage", stats.nMemoryUsage));
+        obj.push_back(Pair("stats", stats.strStats));
+        ret.push_back(obj);
+    }
+    if (!strName.empty() && ret.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("No open database named %s", strName));
+    }
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -2198,8 +2455,10 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockheaders",        &getblockheaders,        true,  {"blockhash","count","verbose"} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,  {"blockhash","filtertype"} },
     { "blockchain",         "getmerkleblocks",        &getmerkleblocks,        true,  {"filter","blockhash","count"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {"count","branchlen"} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {"name"} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,  {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
@@ -2208,7 +2467,9 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "getspecialtxes",         &getspecialtxes,         true,  {"blockhash", "type", "count", "skip", "verbosity"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"hash_type","hash_or_height"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           true,  {"path","snapshot_hash"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
@@ -12,6 +12,7 @@
 #include "init.h"
 #include "feerates.h"
 #include "httpserver.h"
+#include "miner.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/blockchain.h"
@@ -40,7 +41,6 @@
 
 #include <univalue.h>
 
-extern int64_t nLastCoinStakeSearchInterval;
 
 /**
  * @note Do not add or change anything in the information returned by this
@@ -1127,6 +1127,18 @@ UniValue getspentinfo(const JSONRPCRequest& request)
     return obj;
 }
 
+static void PushStakeMinterStats(UniValue& obj)
+{
+    int64_t nSearchMicros = stakeMinterStats.nSearchMicros;
+    uint64_t nKernelChecks = stakeMinterStats.nKernelChecks;
+    obj.push_back(Pair("attempts", stakeMinterStats.nAttempts.load()));
+    obj.push_back(Pair("kernelchecks", nKernelChecks));
+    obj.push_back(Pair("kernelcheckspersecond", nSearchMicros > 0 ? 1000000.0 * nKernelChecks / nSearchMicros : 0.0));
+    obj.push_back(Pair("slotscovered", stakeMinterStats.nSlotsCovered.load()));
+    obj.push_back(Pair("kernelsfound", stakeMinterStats.nKernelsFound.load()));
+    obj.push_back(Pair("stalekernels", stakeMinterStats.nStaleKernels.load()));
+}
+
 UniValue getstakingstatus(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -1142,6 +1154,12 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"attempts\": n,                    (numeric) kernel searches since startup, one per new tip or timestamp slot\n"
+            "  \"kernelchecks\": n,                (numeric) kernel hashes computed since startup\n"
+            "  \"kernelcheckspersecond\": n.nnn,   (numeric) kernel hashes per second spent searching\n"
+            "  \"slotscovered\": n,                (numeric) kernel timestamps searched, each at most once per tip\n"
+            "  \"kernelsfound\": n,                (numeric) kernels found\n"
+            "  \"stalekernels\": n,                (numeric) kernels whose block did not become the new tip\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -1165,6 +1183,8 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
 
     obj.push_back(Pair("staking status", nStaking));
 
+    PushStakeMinterStats(obj);
+
     return obj;
 }
 
@@ -1192,6 +1212,8 @@ UniValue setstaking(const JSONRPCRequest& request)
     bool nStaking = IsStakingEnabled();
     obj.push_back(Pair("staking status", nStaking));
 
+    PushStakeMinterStats(obj);
+
     return obj;
 }
 
@@ -107,6 +107,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blockdownload\": {         (object) Block download measurements of this peer\n"
+            "       \"window\": n,             (numeric) The number of blocks we keep in flight from this peer\n"
+            "       \"samples\": n,            (numeric) The number of blocks measured\n"
+            "       \"latency\": n,            (numeric) Average time from requesting a block to receiving it when nothing else was in flight, in seconds\n"
+            "       \"blocktime\": n,          (numeric) Average time the peer takes per block, in seconds\n"
+            "       \"bytespersec\": n,        (numeric) Average download rate of blocks, in bytes per second\n"
+            "       \"rerequested\": n         (numeric) The number of overdue blocks of other peers requested from this peer\n"
+            "    },\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -176,6 +184,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            UniValue blockDownload(UniValue::VOBJ);
+            blockDownload.push_back(Pair("window", statestats.nBlockWindow));
+            blockDownload.push_back(Pair("samples", statestats.nBlockSamples));
+            blockDownload.push_back(Pair("latency", statestats.dBlockLatency));
+            blockDownload.push_back(Pair("blocktime", statestats.dBlockTime));
+            blockDownload.push_back(Pair("bytespersec", statestats.dBlockBytesPerSecond));
+            blockDownload.push_back(Pair("rerequested", statestats.nBlocksReRequested));
+            obj.push_back(Pair("blockdownload", blockDownload));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -402,6 +418,129 @@ UniValue getnettotals(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getmessagequeueinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getmessagequeueinfo\n"
+            "\nReturns information about the queues received messages are processed from.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",           (string) The queue, core messages are processed by the message handler thread\n"
+            "    \"depth\": n,                 (numeric) Messages waiting to be processed\n"
+            "    \"processed\": n,             (numeric) Messages processed\n"
+            "    \"avgwaitmillis\": n,         (numeric) Average time from receiving a message until its processing started\n"
+            "    \"maxwaitmillis\": n,         (numeric) Longest time from receiving a message until its processing started\n"
+            "    \"avgprocessmillis\": n,      (numeric) Average time it took to process a message\n"
+            "    \"maxprocessmillis\": n       (numeric) Longest time it took to process a message\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmessagequeueinfo", "")
+            + HelpExampleRpc("getmessagequeueinfo", "")
+        );
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue ret(UniValue::VARR);
+    for (const CMessageQueueStats& stats : g_connman->GetMessageQueueStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("depth", (uint64_t)stats.nDepth));
+        obj.push_back(Pair("processed", stats.nProcessed));
+        obj.push_back(Pair("avgwaitmillis", stats.nProcessed ? stats.nTotalWaitMicros / stats.nProcessed * 0.001 : 0.0));
+        obj.push_back(Pair("maxwaitmillis", stats.nMaxWaitMicros * 0.001));
+        obj.push_back(Pair("avgprocessmillis", stats.nProcessed ? stats.nTotalProcessMicros / stats.nProcessed * 0.001 : 0.0));
+        obj.push_back(Pair("maxprocessmillis", stats.nMaxProcessMicros * 0.001));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+UniValue getnetmsgstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getnetmsgstats\n"
+            "\nReturns statistics about the processed messages per command.\n"
+            "Commands that are not valid message types are counted as \"*other*\".\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"command\": {              (json object) The command, for each command that was processed\n"
+            "    \"count\": n,              (numeric) Messages processed\n"
+            "    \"bytes\": n,              (numeric) Payload bytes of the processed messages\n"
+            "    \"processmillis\": n,      (numeric) Total time it took to process the messages\n"
+            "    \"avgprocessmicros\": n    (numeric) Average time it took to process a message\n"
+            "  }\n"
+            "  ,...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleRpc("getnetmsgstats", "")
+        );
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue ret(UniValue::VOBJ);
+    for (const CNetMsgTypeStats& stats : g_connman->GetNetMsgTypeStats()) {
+        if (stats.nCount == 0)
+            continue;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("bytes", stats.nBytes));
+        obj.push_back(Pair("processmillis", stats.nProcessMicros * 0.001));
+        obj.push_back(Pair("avgprocessmicros", stats.nProcessMicros / (double)stats.nCount));
+        ret.push_back(Pair(stats.strCommand, obj));
+    }
+    return ret;
+}
+
+UniValue getcompactblockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getcompactblockstats\n"
+            "\nReturns statistics about where the transactions of received compact blocks were found.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": n,              (numeric) Compact blocks reconstruction was attempted for\n"
+            "  \"complete\": n,            (numeric) Compact blocks with all transactions available, without a getblocktxn round trip\n"
+            "  \"hitrate\": n,             (numeric) Fraction of the transactions that were not prefilled and found locally\n"
+            "  \"prefilled\": n,           (numeric) Transactions prefilled by the sender\n"
+            "  \"mempool\": n,             (numeric) Transactions found in the mempool\n"
+            "  \"extra\": n,               (numeric) Transactions found among orphan and rejected transactions (-blockreconstructionextratxn)\n"
+            "  \"recent\": n,              (numeric) Transactions found among transactions recently removed from the mempool\n"
+            "  \"locked\": n,              (numeric) Transactions found among ISLOCKed transactions\n"
+            "  \"missing\": n,             (numeric) Transactions that had to be requested\n"
+            "  \"recentsize\": n,          (numeric) Recently removed transactions kept (-blockreconstructionrecenttxn)\n"
+            "  \"lockedsize\": n           (numeric) ISLOCKed transactions kept that were not mined yet\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcompactblockstats", "")
+            + HelpExampleRpc("getcompactblockstats", "")
+        );
+
+    CCompactBlockStats stats;
+    GetCompactBlockStats(stats);
+    const uint64_t nFound = stats.nTxMempool + stats.nTxExtra + stats.nTxRecent + stats.nTxLocked;
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blocks", stats.nBlocks));
+    ret.push_back(Pair("complete", stats.nBlocksComplete));
+    ret.push_back(Pair("hitrate", nFound + stats.nTxMissing ? nFound / (double)(nFound + stats.nTxMissing) : 0.0));
+    ret.push_back(Pair("prefilled", stats.nTxPrefilled));
+    ret.push_back(Pair("mempool", stats.nTxMempool));
+    ret.push_back(Pair("extra", stats.nTxExtra));
+    ret.push_back(Pair("recent", stats.nTxRecent));
+    ret.push_back(Pair("locked", stats.nTxLocked));
+    ret.push_back(Pair("missing", stats.nTxMissing));
+    ret.push_back(Pair("recentsize", (uint64_t)stats.nRecentTxn));
+    ret.push_back(Pair("lockedsize", (uint64_t)stats.nLockedTxn));
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -645,6 +784,9 @@ static const CRPCCommand commands[] =
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
+    { "network",            "getmessagequeueinfo",    &getmessagequeueinfo,    true,  {} },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true,  {} },
+    { "network",            "getcompactblockstats",   &getcompactblockstats,   true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
     { "network",            "clearbanned",            &clearbanned,            true,  {} },
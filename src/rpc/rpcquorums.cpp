@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "net.h"
 #include "server.h"
 #include "validation.h"
 
@@ -193,6 +194,56 @@ UniValue quorum_dkgstatus(const JSONRPCRequest& request)
     return ret;
 }
 
+void quorum_connections_help()
+{
+    throw std::runtime_error(
+            "quorum connections\n"
+            "Return the masternode connections wanted for quorums and how many of them are up.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"pooled\": n,                (numeric) Members of earlier quorums that are kept connected for later ones\n"
+            "  \"quorums\": [\n"
+            "    {\n"
+            "      \"type\": \"name\",        (string) LLMQ type\n"
+            "      \"quorumHash\": \"hash\",  (string) Block hash of the quorum or DKG\n"
+            "      \"wanted\": n,            (numeric) Members to connect to\n"
+            "      \"connected\": n,         (numeric) Of those, members connected to\n"
+            "      \"verified\": n,          (numeric) Of those, members that authenticated with MNAUTH\n"
+            "      \"ready\": true|false     (boolean) Whether all wanted members authenticated\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+    );
+}
+
+UniValue quorum_connections(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        quorum_connections_help();
+    }
+
+    if (!g_connman) {
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+    }
+
+    UniValue quorums(UniValue::VARR);
+    for (const auto& stats : g_connman->GetMasternodeQuorumConnStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("type", Params().GetConsensus().llmqs.at(stats.llmqType).name));
+        obj.push_back(Pair("quorumHash", stats.quorumHash.ToString()));
+        obj.push_back(Pair("wanted", (int64_t)stats.nWanted));
+        obj.push_back(Pair("connected", (int64_t)stats.nConnected));
+        obj.push_back(Pair("verified", (int64_t)stats.nVerified));
+        obj.push_back(Pair("ready", stats.nVerified == stats.nWanted));
+        quorums.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("pooled", (int64_t)g_connman->GetMasternodePoolSize()));
+    ret.push_back(Pair("quorums", quorums));
+    return ret;
+}
+
 void quorum_memberof_help()
 {
     throw std::runtime_error(
@@ -394,6 +445,7 @@ UniValue quorum_dkgsimerror(const JSONRPCRequest& request)
             "  info              - Return information about a quorum\n"
             "  dkgsimerror       - Simulates DKG errors and malicious behavior\n"
             "  dkgstatus         - Return the status of the current DKG process\n"
+            "  connections       - Return the masternode connections wanted for quorums and how many are up\n"
             "  memberof          - Checks which quorums the given masternode is a member of\n"
             "  sign              - Threshold-sign a message\n"
             "  hasrecsig         - Test if a valid recovered signature is present\n"
@@ -419,6 +471,8 @@ UniValue quorum(const JSONRPCRequest& request)
         return quorum_info(request);
     } else if (command == "dkgstatus") {
         return quorum_dkgstatus(request);
+    } else if (command == "connections") {
+        return quorum_connections(request);
     } else if (command == "memberof") {
         return quorum_memberof(request);
     } else if (command == "sign" || command == "hasrecsig" || command == "getrecsig" || command == "isconflicting") {
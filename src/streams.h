@@ -137,6 +137,54 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from an existing buffer without copying it
+ *
+ * The referenced buffer must outlive the reader
+ */
+class CBufferReader
+{
+ public:
+    CBufferReader(int nTypeIn, int nVersionIn, const char* pchDataIn, size_t nSizeIn) : nType(nTypeIn), nVersion(nVersionIn), pchData(pchDataIn), nSize(nSizeIn), nPos(0) {}
+
+    void read(char* pch, size_t nRead)
+    {
+        if (nRead > nSize - nPos) {
+            throw std::ios_base::failure("CBufferReader::read(): end of data");
+        }
+        memcpy(pch, pchData + nPos, nRead);
+        nPos += nRead;
+    }
+    template<typename T>
+    CBufferReader& operator>>(T&& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const
+    {
+        return nVersion;
+    }
+    int GetType() const
+    {
+        return nType;
+    }
+    size_t size() const
+    {
+        return nSize - nPos;
+    }
+    bool empty() const
+    {
+        return nPos == nSize;
+    }
+private:
+    const int nType;
+    const int nVersion;
+    const char* pchData;
+    size_t nSize;
+    size_t nPos;
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -237,6 +285,7 @@ public:
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
+    size_type capacity() const                       { return vch.capacity() - nReadPos; }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
@@ -407,6 +456,14 @@ public:
         return (*this);
     }
 
+    /** Exchange the underlying buffer with vchOther, e.g. to reuse its allocation. Reading
+     *  starts over at the beginning of the new buffer. */
+    void swap(vector_type& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
+
     void GetAndClear(CSerializeData &d) {
         d.insert(d.end(), begin(), end());
         clear();
@@ -18,6 +18,8 @@ public:
     CAddrManTest(bool makeDeterministic = true)
     {
         state = 1;
+        // Select and GetAddr see every change right away
+        nSnapshotMaxAge = 0;
 
         if (makeDeterministic) {
             //  Set addrman addr placement to be deterministic.
@@ -29,7 +31,6 @@ public:
     void MakeDeterministic()
     {
         nKey.SetNull();
-        insecure_rand = FastRandomContext(true);
     }
 
     int RandomInt(int nMax) override
@@ -52,6 +53,16 @@ public:
     {
         CAddrMan::Delete(nId);
     }
+
+    std::shared_ptr<const CAddrManSnapshot> GetSnapshot()
+    {
+        return CAddrMan::GetSnapshot();
+    }
+
+    void SetSnapshotMaxAge(int64_t nMaxAge)
+    {
+        nSnapshotMaxAge = nMaxAge;
+    }
 };
 
 static CNetAddr ResolveIP(const char* ip)
@@ -403,6 +414,104 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     BOOST_CHECK_EQUAL(addrman.size(), 2006);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_changes)
+{
+    CAddrManTest addrman;
+
+    CNetAddr source = ResolveIP("252.2.2.2");
+
+    // Test: Everything has to be persisted at first.
+    CAddrManChanges changes;
+    addrman.GetChanges(changes);
+    BOOST_CHECK(changes.fAll);
+    BOOST_CHECK(changes.vEntries.empty());
+    BOOST_CHECK(changes.mapNewBuckets.empty());
+
+    CAddress addr1 = CAddress(ResolveService("250.1.1.1", 8333), NODE_NONE);
+    CAddress addr2 = CAddress(ResolveService("250.2.2.2", 8333), NODE_NONE);
+    CAddress addr3 = CAddress(ResolveService("250.3.3.3", 8333), NODE_NONE);
+    addrman.Add(addr1, source);
+    addrman.Add(addr2, source);
+    addrman.Add(addr3, source);
+    addrman.Good(addr2);
+
+    // Test: Only what changed since the last call is included.
+    changes = CAddrManChanges();
+    addrman.GetChanges(changes);
+    BOOST_CHECK(!changes.fAll);
+    BOOST_CHECK_EQUAL(changes.vEntries.size(), 3U);
+    BOOST_CHECK(!changes.mapNewBuckets.empty());
+    BOOST_REQUIRE_EQUAL(changes.mapTriedBuckets.size(), 1U);
+    BOOST_REQUIRE_EQUAL(changes.mapTriedBuckets.begin()->second.size(), 1U);
+    BOOST_CHECK(changes.mapTriedBuckets.begin()->second[0] == addr2);
+
+    // Test: A failed attempt only changes the entry.
+    addrman.Attempt(addr1, true);
+    changes = CAddrManChanges();
+    addrman.GetChanges(changes);
+    BOOST_REQUIRE_EQUAL(changes.vEntries.size(), 1U);
+    BOOST_CHECK(changes.vEntries[0] == addr1);
+    BOOST_CHECK(changes.mapNewBuckets.empty());
+    BOOST_CHECK(changes.mapTriedBuckets.empty());
+
+    // Test: Loading everything gives the same tables, with nothing left to persist.
+    CAddrManChanges stored;
+    addrman.MarkAllDirty();
+    addrman.GetChanges(stored);
+    BOOST_CHECK(stored.fAll);
+    BOOST_CHECK_EQUAL(stored.vEntries.size(), 3U);
+
+    CAddrManTest addrman2;
+    addrman2.Load(stored);
+    BOOST_CHECK_EQUAL(addrman2.size(), 3U);
+    for (int i = 0; i < 20; i++) {
+        BOOST_CHECK(addrman2.Select(true) != addr2);
+    }
+    changes = CAddrManChanges();
+    addrman2.GetChanges(changes);
+    BOOST_CHECK(!changes.fAll);
+    BOOST_CHECK(changes.vEntries.empty());
+    BOOST_CHECK(changes.mapNewBuckets.empty());
+    BOOST_CHECK(changes.mapTriedBuckets.empty());
+}
+
+BOOST_AUTO_TEST_CASE(addrman_snapshot_update)
+{
+    CAddrManTest addrman;
+
+    CNetAddr source = ResolveIP("252.2.2.2");
+    CAddress addr1 = CAddress(ResolveService("250.1.1.1", 8333), NODE_NONE);
+    addrman.Add(addr1, source);
+    std::shared_ptr<const CAddrManSnapshot> snap = addrman.GetSnapshot();
+
+    // Test: Changes to an entry are applied to the current copy of the tables.
+    addrman.Attempt(addr1, true, 1000);
+    addrman.SetServices(addr1, NODE_NETWORK);
+    BOOST_CHECK(addrman.GetSnapshot() == snap);
+    CAddrInfo info = addrman.Select();
+    BOOST_CHECK(info == addr1);
+    BOOST_CHECK(info.nLastTry == 1000);
+    BOOST_CHECK(info.nServices == NODE_NETWORK);
+
+    // Test: Adding an entry keeps the copy until it is too old, changes to the entries it has are still applied.
+    addrman.SetSnapshotMaxAge(60 * 60 * 1000);
+    addrman.Add(CAddress(ResolveService("250.2.2.2", 8333), NODE_NONE), source);
+    addrman.Attempt(addr1, true, 2000);
+    BOOST_CHECK(addrman.GetSnapshot() == snap);
+    BOOST_CHECK(addrman.Select().nLastTry == 2000);
+
+    // Test: An outdated copy is made again once it is too old.
+    addrman.SetSnapshotMaxAge(0);
+    BOOST_CHECK(addrman.GetSnapshot() != snap);
+    BOOST_CHECK_EQUAL(addrman.GetSnapshot()->vInfo.size(), 2U);
+
+    // Test: The first entries are visible right away.
+    addrman.Clear();
+    addrman.SetSnapshotMaxAge(60 * 60 * 1000);
+    BOOST_CHECK(addrman.GetSnapshot()->vInfo.empty());
+    addrman.Add(addr1, source);
+    BOOST_CHECK_EQUAL(addrman.GetSnapshot()->vInfo.size(), 1U);
+}
 
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
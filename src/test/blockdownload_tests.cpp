@@ -0,0 +1,56 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(window_adapts)
+{
+    CBlockDownloadStats fast;
+    CBlockDownloadStats slow;
+    BOOST_CHECK_EQUAL(fast.GetWindow(16), 16);
+    BOOST_CHECK(!fast.IsFasterThan(1000000000));
+
+    // fast: 100ms round trip, then a block every 50ms; slow: 5s per block
+    int64_t nNow = 1000000;
+    fast.Received(nNow, nNow + 100000, 1000000);
+    for (int i = 0; i < 20; i++) {
+        fast.Received(nNow, nNow + 100000 + 50000 * (i + 1), 1000000);
+    }
+    slow.Received(nNow, nNow + 5000000, 1000000);
+    slow.Received(nNow, nNow + 10000000, 1000000);
+
+    BOOST_CHECK_EQUAL(fast.GetSamples(), 21);
+    BOOST_CHECK_EQUAL(fast.GetLatencyMicros(), 100000);
+    BOOST_CHECK(fast.GetBlockMicros() < 60000);
+    BOOST_CHECK(fast.GetBytesPerSecond() > 15000000);
+    BOOST_CHECK(fast.GetWindow(16) > 16);
+    BOOST_CHECK(fast.GetWindow(16) <= MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(slow.GetWindow(16), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(straggler)
+{
+    CBlockDownloadStats slow;
+    CBlockDownloadStats fast;
+    // nothing is overdue before BLOCK_STRAGGLER_MIN_TIME
+    BOOST_CHECK(!slow.IsStraggling(0, BLOCK_STRAGGLER_MIN_TIME));
+    BOOST_CHECK(slow.IsStraggling(0, BLOCK_STRAGGLER_MIN_TIME + 1));
+
+    slow.Received(0, 3000000, 1000000);
+    fast.Received(0, 200000, 1000000);
+    // progress of the peer counts, not the time of the request
+    const int64_t nRequested = 1000000;
+    BOOST_CHECK(!slow.IsStraggling(nRequested, 3000000 + 4 * 3000000));
+    BOOST_CHECK(slow.IsStraggling(nRequested, 3000000 + 3000000 + 4 * 3000000 + 1));
+
+    BOOST_CHECK(fast.IsFasterThan(3000000));
+    BOOST_CHECK(!slow.IsFasterThan(3000000));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -314,6 +314,39 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ReconstructionTxnsTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase());
+    CBlockReconstructionTxns reconstructionTxns(2, 2);
+
+    // the ring keeps the last two recent transactions
+    reconstructionTxns.AddRecent(block.vtx[2]);
+    reconstructionTxns.AddRecent(block.vtx[0]);
+    reconstructionTxns.AddRecent(block.vtx[1]);
+    reconstructionTxns.AddLocked(block.vtx[2]);
+    BOOST_CHECK_EQUAL(reconstructionTxns.RecentSize(), 2U);
+    BOOST_CHECK_EQUAL(reconstructionTxns.LockedSize(), 1U);
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs, extra_txn, &reconstructionTxns) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    BOOST_CHECK_EQUAL(partialBlock.GetPrefilledCount(), 1U);
+    BOOST_CHECK_EQUAL(partialBlock.GetMempoolCount(), 2U);
+    BOOST_CHECK_EQUAL(partialBlock.GetRecentCount(), 1U);
+    BOOST_CHECK_EQUAL(partialBlock.GetLockedCount(), 1U);
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+
+    // mined locked transactions are forgotten
+    reconstructionTxns.RemoveLocked(block.vtx);
+    BOOST_CHECK_EQUAL(reconstructionTxns.LockedSize(), 0U);
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
@@ -0,0 +1,227 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "blockfilterindex.h"
+#include "coins.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    CGCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        CGCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        CGCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    CGCSFilter filter(CGCSFilter::Params(0, 0, 10, 1 << 10), included_elements);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+
+    // Reconstructing from the encoding yields the same filter
+    CGCSFilter filter2(filter.GetParams(), filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), filter.GetN());
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(filter2.MatchAny(included_elements));
+
+    // Truncated encodings are rejected
+    std::vector<unsigned char> vchTruncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 8);
+    BOOST_CHECK_THROW(CGCSFilter(filter.GetParams(), vchTruncated), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    CGCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1);
+    BOOST_CHECK(!filter.Match(CGCSFilter::Element(32)));
+
+    const CGCSFilter::Params& params = filter.GetParams();
+    BOOST_CHECK_EQUAL(params.nSipHashK0, 0);
+    BOOST_CHECK_EQUAL(params.nSipHashK1, 0);
+    BOOST_CHECK_EQUAL(params.nP, 0);
+    BOOST_CHECK_EQUAL(params.nM, 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction
+    included_scripts[0] << std::vector<unsigned char>(65, 0x04) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x01) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on a second transaction
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(33, 0x02) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction
+    included_scripts[3] << OP_HASH160 << std::vector<unsigned char>(20, 0x03) << OP_EQUAL;
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output is an output on the second transaction
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(40, 0x04);
+
+    // This script is not related to the block at all
+    excluded_scripts[1] << std::vector<unsigned char>(33, 0x05) << OP_CHECKSIG;
+
+    // excluded_scripts[2] is empty
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    tx_2.vout.emplace_back(0, excluded_scripts[0]);
+    tx_2.vout.emplace_back(400, excluded_scripts[2]);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 10000, false, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, excluded_scripts[2]), 100000, false, true);
+
+    CBlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    const CGCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(CGCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(CGCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // Serialization round trip, as used by the cfilter message
+    CBlockFilter block_filter2;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK(block_filter.GetFilterType() == block_filter2.GetFilterType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+    BOOST_CHECK(block_filter.GetHash() == block_filter2.GetHash());
+
+    CBlockFilter default_ctor_block_filter_1;
+    CBlockFilter default_ctor_block_filter_2;
+    BOOST_CHECK(default_ctor_block_filter_1.GetFilterType() == BlockFilterType::INVALID);
+    BOOST_CHECK(default_ctor_block_filter_1.GetHash() == default_ctor_block_filter_2.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::INVALID), "");
+
+    BlockFilterType filterType;
+    BOOST_CHECK(BlockFilterTypeByName("basic", filterType));
+    BOOST_CHECK(filterType == BlockFilterType::BASIC);
+    BOOST_CHECK(!BlockFilterTypeByName("unknown", filterType));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(blockfilterindex_tests, TestChain100Setup)
+
+static bool WaitForIndexSync(const CBlockFilterIndex& index)
+{
+    // The tests don't run a scheduler thread, so the index is only ever
+    // brought up to date by its own sync thread
+    int64_t nStart = GetTimeMillis();
+    while (!index.IsSynced()) {
+        if (GetTimeMillis() - nStart > 10000) {
+            return false;
+        }
+        MilliSleep(10);
+    }
+    return true;
+}
+
+static void CheckFilterHeaders(const CBlockFilterIndex& index)
+{
+    uint256 prevHeader;
+    LOCK(cs_main);
+    for (const CBlockIndex* pindex = chainActive.Genesis(); pindex; pindex = chainActive.Next(pindex)) {
+        CBlockFilter filter;
+        uint256 header;
+        BOOST_CHECK(index.LookupFilter(pindex, filter));
+        BOOST_CHECK(index.LookupFilterHeader(pindex, header));
+        BOOST_CHECK(filter.GetBlockHash() == pindex->GetBlockHash());
+        BOOST_CHECK(header == filter.ComputeHeader(prevHeader));
+        prevHeader = header;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_initial_sync)
+{
+    CBlockFilterIndex index(BlockFilterType::BASIC, 1 << 20, true, true);
+    BOOST_CHECK(!index.IsSynced());
+
+    index.Start();
+    BOOST_REQUIRE(WaitForIndexSync(index));
+    BOOST_CHECK(index.GetBestBlockIndex() == chainActive.Tip());
+    CheckFilterHeaders(index);
+
+    // Every coinbase pays to the same key, so all filters match it
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CGCSFilter::Element element(scriptPubKey.begin(), scriptPubKey.end());
+    CBlockFilter filter;
+    BOOST_CHECK(index.LookupFilter(chainActive.Tip(), filter));
+    BOOST_CHECK(filter.GetFilter().Match(element));
+
+    // Range lookups return the filters in chain order
+    std::vector<CBlockFilter> vFilters;
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(index.LookupFilterRange(10, chainActive[20], vFilters));
+    BOOST_CHECK(index.LookupFilterHashRange(10, chainActive[20], vHashes));
+    BOOST_REQUIRE_EQUAL(vFilters.size(), 11);
+    BOOST_REQUIRE_EQUAL(vHashes.size(), 11);
+    for (size_t i = 0; i < vFilters.size(); i++) {
+        BOOST_CHECK(vFilters[i].GetBlockHash() == chainActive[10 + i]->GetBlockHash());
+        BOOST_CHECK(vFilters[i].GetHash() == vHashes[i]);
+    }
+    BOOST_CHECK(!index.LookupFilterRange(21, chainActive[20], vFilters));
+
+    // Blocks connected while the index is stopped are picked up on restart
+    index.Stop();
+    for (int i = 0; i < 10; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+    CBlockFilter missing;
+    BOOST_CHECK(!index.LookupFilter(chainActive.Tip(), missing));
+
+    index.Start();
+    BOOST_REQUIRE(WaitForIndexSync(index));
+    BOOST_CHECK(index.GetBestBlockIndex() == chainActive.Tip());
+    CheckFilterHeaders(index);
+
+    index.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
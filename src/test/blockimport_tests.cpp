@@ -0,0 +1,125 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "fs.h"
+#include "streams.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, BasicTestingSetup)
+
+static CImportedBlock MakeBlock(uint32_t nNonce, const uint256& hashPrev, const CDiskBlockPos& pos = CDiskBlockPos())
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->nNonce = nNonce;
+    pblock->hashPrevBlock = hashPrev;
+
+    CImportedBlock block;
+    block.hash = pblock->GetHash();
+    block.block = std::move(pblock);
+    block.pos = pos;
+    block.nSize = 100;
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(unknown_parent_take)
+{
+    CUnknownParentBlocks blocks(1000);
+    const uint256 hashParent = InsecureRand256();
+    CImportedBlock child1 = MakeBlock(1, hashParent);
+    CImportedBlock child2 = MakeBlock(2, hashParent);
+    CImportedBlock grandchild = MakeBlock(3, child1.hash);
+    blocks.Add(child1);
+    blocks.Add(child2);
+    blocks.Add(grandchild);
+    BOOST_CHECK_EQUAL(blocks.size(), 3U);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 300U);
+
+    BOOST_CHECK(blocks.Take(InsecureRand256()).empty());
+
+    std::vector<CImportedBlock> vTaken = blocks.Take(hashParent);
+    BOOST_CHECK_EQUAL(vTaken.size(), 2U);
+    BOOST_CHECK(vTaken[0].hash == child1.hash && vTaken[0].block == child1.block);
+    BOOST_CHECK(vTaken[1].hash == child2.hash && vTaken[1].block == child2.block);
+    BOOST_CHECK(blocks.Take(hashParent).empty());
+    BOOST_CHECK_EQUAL(blocks.size(), 1U);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 100U);
+
+    vTaken = blocks.Take(child1.hash);
+    BOOST_CHECK_EQUAL(vTaken.size(), 1U);
+    BOOST_CHECK(vTaken[0].hash == grandchild.hash);
+    BOOST_CHECK_EQUAL(blocks.size(), 0U);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(unknown_parent_evict)
+{
+    CUnknownParentBlocks blocks(250);
+    CImportedBlock onDisk = MakeBlock(1, InsecureRand256(), CDiskBlockPos(0, 1234));
+    CImportedBlock external = MakeBlock(2, InsecureRand256());
+    CImportedBlock taken = MakeBlock(3, InsecureRand256());
+    blocks.Add(onDisk);
+    blocks.Add(external);
+    blocks.Add(taken);
+
+    // the oldest block only keeps its position
+    BOOST_CHECK_EQUAL(blocks.size(), 3U);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 200U);
+    std::vector<CImportedBlock> vTaken = blocks.Take(onDisk.block->hashPrevBlock);
+    BOOST_CHECK_EQUAL(vTaken.size(), 1U);
+    BOOST_CHECK(!vTaken[0].block);
+    BOOST_CHECK(vTaken[0].pos == onDisk.pos);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 200U);
+
+    // taken blocks no longer count, external blocks are dropped when evicted
+    BOOST_CHECK_EQUAL(blocks.Take(taken.block->hashPrevBlock).size(), 1U);
+    blocks.Add(MakeBlock(4, InsecureRand256()));
+    blocks.Add(MakeBlock(5, InsecureRand256()));
+    BOOST_CHECK_EQUAL(blocks.size(), 2U);
+    BOOST_CHECK_EQUAL(blocks.InMemorySize(), 200U);
+    BOOST_CHECK(blocks.Take(external.block->hashPrevBlock).empty());
+}
+
+BOOST_AUTO_TEST_CASE(file_reader_order)
+{
+    const CChainParams& chainparams = Params();
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+
+    std::vector<uint256> vHashes;
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        for (uint32_t i = 0; i < 200; i++) {
+            CImportedBlock block = MakeBlock(i, vHashes.empty() ? uint256() : vHashes.back());
+            vHashes.push_back(block.hash);
+            if (i % 50 == 0) {
+                // junk in between blocks is skipped
+                file << (uint8_t)0x42 << FLATDATA(chainparams.MessageStart()) << (uint32_t)1;
+            }
+            file << FLATDATA(chainparams.MessageStart()) << (uint32_t)::GetSerializeSize(*block.block, SER_DISK, CLIENT_VERSION) << *block.block;
+        }
+    }
+
+    for (int nWorkers : {1, 4}) {
+        std::vector<CBlockFileSource> vSources;
+        vSources.emplace_back(fsbridge::fopen(path, "rb"));
+        vSources.emplace_back(fsbridge::fopen(path, "rb"));
+        CBlockFileReader reader(chainparams, std::move(vSources), nWorkers);
+
+        CImportedBlock block;
+        for (size_t i = 0; i < 2 * vHashes.size(); i++) {
+            BOOST_REQUIRE(reader.Next(block));
+            BOOST_CHECK(block.hash == vHashes[i % vHashes.size()]);
+            BOOST_CHECK(block.hash == block.block->GetHash());
+            BOOST_CHECK(block.pos.IsNull());
+        }
+        BOOST_CHECK(!reader.Next(block));
+    }
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockwriter.h"
+#include "clientversion.h"
+#include "fs.h"
+#include "validation.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockwriter_tests, TestingSetup)
+
+static std::vector<char> ReadFile(const std::string& strPrefix, int nFile)
+{
+    std::vector<char> vch;
+    FILE* file = fsbridge::fopen(GetBlockPosFilename(CDiskBlockPos(nFile, 0), strPrefix.c_str()), "rb");
+    if (file) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+            vch.insert(vch.end(), buf, buf + n);
+        }
+        fclose(file);
+    }
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(blockwriter_write_flush)
+{
+    // files the node does not use
+    const int nFirstFile = 1000;
+    std::vector<char> vExpected[2];
+    {
+        CBlockFileWriter writer;
+        for (int i = 0; i < 200; i++) {
+            int nFile = i % 2;
+            CDataStream data(SER_DISK, CLIENT_VERSION);
+            data.resize(1 + InsecureRandRange(5000));
+            for (size_t j = 0; j < data.size(); j++) {
+                data[j] = InsecureRandBits(8);
+            }
+            CDiskBlockPos pos(nFirstFile + nFile, vExpected[nFile].size());
+            vExpected[nFile].insert(vExpected[nFile].end(), data.begin(), data.end());
+            BOOST_CHECK(writer.Write("blk", pos, std::move(data)));
+
+            if (i % 50 == 0) {
+                // pending writes are readable once waited for
+                writer.WaitForWrites("blk", nFirstFile + nFile);
+                BOOST_CHECK(ReadFile("blk", nFirstFile + nFile) == vExpected[nFile]);
+            }
+            if (i % 70 == 0) {
+                BOOST_CHECK(writer.Flush());
+            }
+        }
+
+        // a truncation applies after the writes queued before it
+        CDataStream data(SER_DISK, CLIENT_VERSION);
+        data.resize(1000);
+        BOOST_CHECK(writer.Write("blk", CDiskBlockPos(nFirstFile + 1, vExpected[1].size()), std::move(data)));
+        writer.Truncate("blk", nFirstFile + 1, vExpected[1].size());
+        writer.RequestSync();
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK(ReadFile("blk", nFirstFile) == vExpected[0]);
+        BOOST_CHECK(ReadFile("blk", nFirstFile + 1) == vExpected[1]);
+
+        // the destructor writes what is still queued
+        data.resize(10);
+        CDiskBlockPos pos(nFirstFile, vExpected[0].size());
+        vExpected[0].insert(vExpected[0].end(), data.begin(), data.end());
+        BOOST_CHECK(writer.Write("blk", pos, std::move(data)));
+    }
+    BOOST_CHECK(ReadFile("blk", nFirstFile) == vExpected[0]);
+    BOOST_CHECK(ReadFile("rev", nFirstFile).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "crypto/aes.h"
 #include "crypto/chacha20.h"
 #include "crypto/chacha_poly_aead.h"
+#include "crypto/muhash.h"
 #include "crypto/poly1305.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
@@ -13,6 +14,7 @@
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
 #include "random.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_lokal.h"
 
@@ -783,4 +785,71 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static std::string MuHashHex(MuHash3072 muhash)
+{
+    unsigned char out[32];
+    muhash.Finalize(out);
+    return HexStr(out, out + 32);
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // the empty set is the number 1
+    BOOST_CHECK_EQUAL(MuHashHex(MuHash3072()), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+
+    std::vector<std::vector<unsigned char>> elements;
+    for (int i = 0; i < 16; i++) {
+        std::vector<unsigned char> element(1 + InsecureRandRange(100));
+        for (unsigned char& c : element) {
+            c = InsecureRandBits(8);
+        }
+        elements.push_back(element);
+    }
+
+    MuHash3072 forward, backward, single;
+    for (size_t i = 0; i < elements.size(); i++) {
+        forward.Insert(elements[i].data(), elements[i].size());
+        backward.Insert(elements[elements.size() - 1 - i].data(), elements[elements.size() - 1 - i].size());
+    }
+    BOOST_CHECK_EQUAL(MuHashHex(forward), MuHashHex(backward));
+    BOOST_CHECK(MuHashHex(forward) != MuHashHex(MuHash3072()));
+
+    // removing what was inserted, in any order, leads back to the empty set
+    MuHash3072 muhash = forward;
+    for (const auto& element : elements) {
+        muhash.Remove(element.data(), element.size());
+    }
+    BOOST_CHECK_EQUAL(MuHashHex(muhash), MuHashHex(MuHash3072()));
+
+    // a removal can come before the insert
+    muhash = MuHash3072();
+    muhash.Remove(elements[0].data(), elements[0].size());
+    muhash.Insert(elements[1].data(), elements[1].size());
+    muhash.Insert(elements[0].data(), elements[0].size());
+    BOOST_CHECK_EQUAL(MuHashHex(muhash), MuHashHex(MuHash3072(elements[1].data(), elements[1].size())));
+
+    // union and difference
+    MuHash3072 first, second;
+    for (size_t i = 0; i < elements.size(); i++) {
+        (i < 5 ? first : second).Insert(elements[i].data(), elements[i].size());
+    }
+    muhash = first;
+    muhash *= second;
+    BOOST_CHECK_EQUAL(MuHashHex(muhash), MuHashHex(forward));
+    muhash = forward;
+    muhash /= second;
+    BOOST_CHECK_EQUAL(MuHashHex(muhash), MuHashHex(first));
+
+    // a serialized state with a pending denominator continues where it left off
+    muhash = forward;
+    muhash.Remove(elements[3].data(), elements[3].size());
+    CDataStream ss(SER_DISK, 0);
+    ss << muhash;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 restored;
+    ss >> restored;
+    restored.Insert(elements[3].data(), elements[3].size());
+    BOOST_CHECK_EQUAL(MuHashHex(restored), MuHashHex(forward));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
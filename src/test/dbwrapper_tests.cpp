@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "compat/endian.h"
 #include "dbwrapper.h"
 #include "uint256.h"
 #include "random.h"
@@ -319,4 +320,150 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbtransaction_nested)
+{
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false, true);
+    CDBBatch batch(dbw);
+    typedef CDBTransaction<CDBWrapper, CDBBatch> RootTransaction;
+    typedef CDBTransaction<RootTransaction, RootTransaction> CurTransaction;
+    RootTransaction rootTx(dbw, batch);
+    CurTransaction curTx(rootTx, rootTx);
+
+    // Keys longer than the inline key size end up in the arena
+    auto makeKey = [](uint32_t n) { return std::make_pair(std::string(n % 5 == 0 ? 100 : 1, 'k'), htobe32(n)); };
+    std::map<uint32_t, uint256> expected;
+
+    // Already in the database, some of them will be erased or overwritten by the transactions
+    for (uint32_t n = 0; n < 200; n += 2) {
+        expected[n] = InsecureRand256();
+        BOOST_CHECK(dbw.Write(makeKey(n), expected[n]));
+    }
+
+    // Seeking halfway builds the sorted index, the writes after it then have to be merged into it
+    for (uint32_t n = 0; n < 200; n++) {
+        if (n % 3 == 0) {
+            curTx.Erase(makeKey(n));
+            expected.erase(n);
+        } else {
+            expected[n] = InsecureRand256();
+            curTx.Write(makeKey(n), expected[n]);
+        }
+        if (n == 100) {
+            curTx.Commit();
+        }
+        if (n == 150) {
+            auto it = curTx.NewIteratorUniquePtr();
+            it->SeekToFirst();
+            BOOST_CHECK(it->Valid());
+        }
+    }
+    BOOST_CHECK(!curTx.IsClean());
+    BOOST_CHECK(curTx.GetMemoryUsage() > 0);
+
+    auto check = [&](CurTransaction& tx) {
+        for (uint32_t n = 0; n < 200; n++) {
+            uint256 res;
+            BOOST_CHECK_EQUAL(tx.Read(makeKey(n), res), expected.count(n) != 0);
+            BOOST_CHECK_EQUAL(tx.Exists(makeKey(n)), expected.count(n) != 0);
+            if (expected.count(n)) {
+                BOOST_CHECK(res == expected[n]);
+            }
+        }
+        // Iteration merges all layers in key order, skipping erased keys
+        for (uint32_t len : {1, 100}) {
+            auto it = tx.NewIteratorUniquePtr();
+            it->Seek(std::make_pair(std::string(len, 'k'), htobe32(0)));
+            for (const auto& p : expected) {
+                if (makeKey(p.first).first.size() != len) {
+                    continue;
+                }
+                std::pair<std::string, uint32_t> key;
+                uint256 res;
+                BOOST_REQUIRE(it->Valid());
+                BOOST_CHECK(it->GetKey(key) && key == makeKey(p.first));
+                BOOST_CHECK(it->GetValue(res) && res == p.second);
+                it->Next();
+            }
+        }
+    };
+    check(curTx);
+
+    curTx.Commit();
+    BOOST_CHECK(curTx.IsClean());
+    check(curTx);
+
+    rootTx.Commit();
+    BOOST_CHECK(rootTx.IsClean());
+    BOOST_CHECK(dbw.WriteBatch(batch));
+    check(curTx);
+
+    // Rolling back drops the buffered writes
+    curTx.Write(makeKey(1000), uint256());
+    curTx.Clear();
+    BOOST_CHECK(!curTx.Exists(makeKey(1000)));
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    CDBOptions options = GetDBOptions("chainstate");
+    BOOST_CHECK_EQUAL(options.strName, "chainstate");
+    BOOST_CHECK_EQUAL(options.strProfile, "default");
+    BOOST_CHECK_EQUAL(options.nBloomBits, 10);
+    BOOST_CHECK_EQUAL(GetDBOptions("llmq", "lookup").strProfile, "lookup");
+
+    gArgs.ForceSetMultiArgs("-dbprofile", {"chainstate:scan", "evodb:lookup", "chainstate:lookup"});
+    gArgs.ForceSetMultiArgs("-dboption", {"chainstate:bloombits=12", "chainstate:maxopenfiles=100", "evodb:compression=1"});
+    std::string strError;
+    BOOST_CHECK(CheckDBOptions(strError));
+
+    // the last profile wins, options apply on top of it
+    options = GetDBOptions("chainstate");
+    BOOST_CHECK_EQUAL(options.strProfile, "lookup");
+    BOOST_CHECK_EQUAL(options.nBlockCachePercent, 75);
+    BOOST_CHECK_EQUAL(options.nBloomBits, 12);
+    BOOST_CHECK_EQUAL(options.nMaxOpenFiles, 100);
+    BOOST_CHECK(!options.fCompression);
+    BOOST_CHECK(GetDBOptions("evodb").fCompression);
+    BOOST_CHECK_EQUAL(GetDBOptions("blockindex").strProfile, "default");
+
+    for (const char* strArg : {"chainstate", "chainstate:fast", "utxo:scan", ":scan"}) {
+        gArgs.ForceSetMultiArgs("-dbprofile", {strArg});
+        BOOST_CHECK(!CheckDBOptions(strError));
+    }
+    gArgs.ForceSetMultiArgs("-dbprofile", {});
+    for (const char* strArg : {"chainstate:bloombits", "chainstate:bloombits=x", "chainstate:bloombits=64", "chainstate:cache=10", "utxo:bloombits=10"}) {
+        gArgs.ForceSetMultiArgs("-dboption", {strArg});
+        BOOST_CHECK(!CheckDBOptions(strError));
+    }
+    gArgs.ForceSetMultiArgs("-dboption", {});
+    BOOST_CHECK(CheckDBOptions(strError));
+
+    // the options end up in the database and its stats
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBOptions scan;
+    scan.strName = "test";
+    BOOST_CHECK(GetDBProfile("scan", scan));
+    BOOST_CHECK_EQUAL(scan.strName, "test");
+    BOOST_CHECK(!GetDBProfile("fast", scan));
+    {
+        CDBWrapper dbw(ph, (1 << 20), true, false, false, scan);
+        BOOST_CHECK(dbw.Write('k', uint256()));
+        bool fFound = false;
+        for (const CDBStats& stats : GetDBStats()) {
+            if (stats.options.strName == "test") {
+                fFound = true;
+                BOOST_CHECK_EQUAL(stats.options.strProfile, "scan");
+                BOOST_CHECK_EQUAL(stats.options.nBloomBits, 0);
+                BOOST_CHECK_EQUAL(stats.nCacheSize, 1U << 20);
+                BOOST_CHECK(!stats.strStats.empty());
+            }
+        }
+        BOOST_CHECK(fFound);
+    }
+    for (const CDBStats& stats : GetDBStats()) {
+        BOOST_CHECK(stats.options.strName != "test");
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
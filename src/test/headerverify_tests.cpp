@@ -0,0 +1,36 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/block.h"
+#include "test/test_lokal.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(headerverify_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(header_hashes)
+{
+    std::vector<CBlockHeader> headers;
+    for (size_t i = 0; i < 3 * HEADER_VERIFY_BATCH_SIZE + 7; i++) {
+        CBlockHeader header;
+        header.hashPrevBlock = headers.empty() ? uint256() : headers.back().GetHash();
+        header.nNonce = i;
+        headers.push_back(header);
+    }
+
+    // hashed by the caller only, then in batches by the verification threads
+    for (int nThreads : {0, 2}) {
+        StartHeaderVerifyThreads(nThreads);
+        std::vector<uint256> hashes = GetBlockHeaderHashes(headers);
+        BOOST_REQUIRE_EQUAL(hashes.size(), headers.size());
+        for (size_t i = 0; i < headers.size(); i++) {
+            BOOST_CHECK(hashes[i] == headers[i].GetHash());
+        }
+        BOOST_CHECK(GetBlockHeaderHashes(std::vector<CBlockHeader>()).empty());
+    }
+    StopHeaderVerifyThreads();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+#include "invrelay.h"
+#include "net.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(invrelay_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(relay_log_read)
+{
+    CInvRelayLog log(4);
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 9; i++) {
+        vHashes.push_back(InsecureRand256());
+    }
+
+    uint64_t nSeq = log.GetNextSeq();
+    for (int i = 0; i < 3; i++) {
+        log.Append(CInvRelayEntry(CInv(MSG_TX, vHashes[i]), 0));
+    }
+    std::vector<CInvRelayEntry> vRead;
+    BOOST_CHECK_EQUAL(log.Read(nSeq, vRead), 0U);
+    BOOST_CHECK_EQUAL(nSeq, 3U);
+    BOOST_REQUIRE_EQUAL(vRead.size(), 3U);
+    BOOST_CHECK(vRead[2].inv.hash == vHashes[2]);
+
+    // the two oldest unread entries were overwritten
+    for (int i = 3; i < 9; i++) {
+        log.Append(CInvRelayEntry(CInv(MSG_TX, vHashes[i]), 0));
+    }
+    vRead.clear();
+    BOOST_CHECK_EQUAL(log.Read(nSeq, vRead), 2U);
+    BOOST_CHECK_EQUAL(nSeq, 9U);
+    BOOST_REQUIRE_EQUAL(vRead.size(), 4U);
+    for (size_t i = 0; i < vRead.size(); i++) {
+        BOOST_CHECK(vRead[i].inv.hash == vHashes[5 + i]);
+    }
+    BOOST_CHECK_EQUAL(log.Read(nSeq, vRead), 0U);
+    BOOST_CHECK_EQUAL(vRead.size(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(relay_collect)
+{
+    CInvRelay relay;
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    // announcements made before the peer connected are not collected
+    relay.Relay(CInvRelayEntry(CInv(MSG_TX, InsecureRand256()), 0));
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+    node.nVersion = PROTOCOL_VERSION;
+    relay.InitPeer(&node);
+
+    const uint256 hashTx = InsecureRand256();
+    const uint256 hashKnown = InsecureRand256();
+    const uint256 hashLock = InsecureRand256();
+    const uint256 hashOtherLock = InsecureRand256();
+    const uint256 hashRelated = InsecureRand256();
+    node.AddInventoryKnown(hashKnown);
+    relay.Relay(CInvRelayEntry(CInv(MSG_TX, hashTx), 0));
+    relay.Relay(CInvRelayEntry(CInv(MSG_TX, hashKnown), 0));
+    relay.Relay(CInvRelayEntry(CInv(MSG_ISLOCK, InsecureRand256()), PROTOCOL_VERSION + 1));
+    CInvRelayEntry entry(CInv(MSG_ISLOCK, hashLock), PROTOCOL_VERSION);
+    entry.relatedTxHash = hashRelated;
+    relay.Relay(std::move(entry));
+    entry = CInvRelayEntry(CInv(MSG_ISLOCK, hashOtherLock), PROTOCOL_VERSION);
+    entry.relatedTxHash = InsecureRand256();
+    relay.Relay(std::move(entry));
+
+    node.pfilter.reset(new CBloomFilter(10, 0.000001, 0, BLOOM_UPDATE_NONE));
+    node.pfilter->insert(hashRelated);
+
+    LOCK(node.cs_inventory);
+    // transactions wait for the trickle
+    relay.Collect(&node, false);
+    BOOST_CHECK(node.setInventoryTxToSend.empty());
+    BOOST_REQUIRE_EQUAL(node.vInventoryOtherToSend.size(), 1U);
+    BOOST_CHECK(node.vInventoryOtherToSend[0].hash == hashLock);
+
+    relay.Collect(&node, true);
+    BOOST_CHECK_EQUAL(node.setInventoryTxToSend.size(), 1U);
+    BOOST_CHECK(node.setInventoryTxToSend.count(hashTx));
+    BOOST_CHECK_EQUAL(node.vInventoryOtherToSend.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
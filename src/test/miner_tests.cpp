@@ -13,6 +13,7 @@
 #include "miner.h"
 #include "policy/policy.h"
 #include "pubkey.h"
+#include "script/interpreter.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -531,4 +532,78 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+static CMutableTransaction CreateSignedSpend(const CTransaction& txPrev, const CKey& key, const CScript& scriptPubKey, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(txPrev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+static bool ToMemPool(const CMutableTransaction& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    return AcceptToMemoryPool(mempool, state, MakeTransactionRef(tx), false, nullptr, true, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(block_template_cache, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlockTemplateCache cache(mempool);
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+
+    CMutableTransaction tx1 = CreateSignedSpend(coinbaseTxns[0], coinbaseKey, scriptPubKey, 10000);
+    BOOST_CHECK(ToMemPool(tx1));
+
+    BOOST_CHECK(pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey, nullptr, &cache));
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx1.GetHash());
+
+    // A child of a selected transaction and an unrelated one with a higher fee rate are
+    // appended to the cached selection instead of being sorted in
+    CMutableTransaction tx2 = CreateSignedSpend(tx1, coinbaseKey, scriptPubKey, 20000);
+    CMutableTransaction tx3 = CreateSignedSpend(coinbaseTxns[1], coinbaseKey, scriptPubKey, 100000);
+    BOOST_CHECK(ToMemPool(tx2));
+    BOOST_CHECK(ToMemPool(tx3));
+
+    BOOST_CHECK(pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey, nullptr, &cache));
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx1.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == tx2.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == tx3.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -130000);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplateUncached;
+    BOOST_CHECK(pblocktemplateUncached = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey));
+    BOOST_REQUIRE_EQUAL(pblocktemplateUncached->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplateUncached->block.vtx[1]->GetHash() == tx3.GetHash());
+
+    // Removing a selected transaction from the mempool forces a rebuild
+    mempool.removeRecursive(tx2, MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK(pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey, nullptr, &cache));
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx3.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == tx1.GetHash());
+
+    // So does a new tip
+    CreateAndProcessBlock({tx3}, scriptPubKey);
+    BOOST_CHECK(pblocktemplate = AssemblerForTest(chainparams).CreateNewBlock(scriptPubKey, nullptr, &cache));
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == tx1.GetHash());
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include "addrman.h"
+#include "arith_uint256.h"
 #include "test/test_lokal.h"
 #include <string>
 #include <boost/test/unit_test.hpp>
@@ -10,6 +11,7 @@
 #include "streams.h"
 #include "net.h"
 #include "netbase.h"
+#include "netmessagemaker.h"
 #include "chainparams.h"
 #include "util.h"
 
@@ -22,7 +24,6 @@ public:
     void MakeDeterministic()
     {
         nKey.SetNull();
-        insecure_rand = FastRandomContext(true);
     }
 };
 
@@ -185,4 +186,159 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(netmsg_type_ids)
+{
+    const std::vector<std::string>& vTypes = getAllNetMessageTypes();
+    for (size_t i = 0; i < vTypes.size(); i++) {
+        BOOST_CHECK_EQUAL(GetNetMsgTypeId(vTypes[i]), i);
+    }
+    BOOST_CHECK_EQUAL(GetNetMsgTypeId("unknown"), NET_MSG_TYPE_UNKNOWN);
+    BOOST_CHECK_EQUAL(GetNetMsgTypeId(""), NET_MSG_TYPE_UNKNOWN);
+
+    // the id is set when the header is read
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader(Params().MessageStart(), NetMsgType::QSIGREC, 0);
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(msg.nTypeId, NET_MSG_TYPE_UNKNOWN);
+    BOOST_CHECK_EQUAL(msg.readHeader(ss.data(), ss.size()), (int)ss.size());
+    BOOST_CHECK_EQUAL(msg.nTypeId, GetNetMsgTypeId(NetMsgType::QSIGREC));
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(shared_msg_send)
+{
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+
+    // larger than the socket buffer, so it takes several calls to send
+    std::vector<unsigned char> vchPayload(1 << 20);
+    for (unsigned char& c : vchPayload) {
+        c = InsecureRandBits(8);
+    }
+    const CSharedNetMsg msg(CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::BLOCK, vchPayload));
+    const size_t nMsgSize = msg.header->size() + msg.data->size();
+    const size_t nPingSize = CMessageHeader::HEADER_SIZE + sizeof(uint64_t);
+
+    std::vector<std::unique_ptr<CNode>> vNodes;
+    std::vector<int> vPeerSockets;
+    for (int i = 0; i < 2; i++) {
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        vPeerSockets.push_back(fds[1]);
+        vNodes.emplace_back(new CNode(i, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress(), "", false));
+        connman.PushMessage(vNodes.back().get(), msg, false);
+        connman.PushMessage(vNodes.back().get(), CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::PING, (uint64_t)i), false);
+
+        // the payload is queued without a copy and counts for every peer it is queued for
+        BOOST_CHECK(vNodes.back()->vSendMsg[1] == msg.data);
+        BOOST_CHECK_EQUAL(vNodes.back()->nSendSize, nMsgSize + nPingSize);
+    }
+    BOOST_CHECK_EQUAL(msg.data.use_count(), 3);
+
+    for (size_t i = 0; i < vNodes.size(); i++) {
+        CNode& node = *vNodes[i];
+        std::vector<unsigned char> vchReceived;
+        while (true) {
+            CConnmanTest::SocketSendData(connman, node);
+            unsigned char buf[1 << 16];
+            ssize_t nBytes = recv(vPeerSockets[i], buf, sizeof(buf), MSG_DONTWAIT);
+            if (nBytes > 0) {
+                vchReceived.insert(vchReceived.end(), buf, buf + nBytes);
+            } else if (node.vSendMsg.empty()) {
+                break;
+            }
+        }
+        close(vPeerSockets[i]);
+
+        // both messages arrive whole and in order
+        BOOST_REQUIRE_EQUAL(vchReceived.size(), nMsgSize + nPingSize);
+        BOOST_CHECK(std::equal(msg.header->begin(), msg.header->end(), vchReceived.begin()));
+        BOOST_CHECK(std::equal(msg.data->begin(), msg.data->end(), vchReceived.begin() + msg.header->size()));
+        BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+        BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+        BOOST_CHECK_EQUAL(node.nSendBytes, nMsgSize + nPingSize);
+    }
+    BOOST_CHECK_EQUAL(msg.data.use_count(), 1);
+}
+#endif
+
+BOOST_FIXTURE_TEST_CASE(masternode_pool, TestingSetup)
+{
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    auto makeMembers = [](int nFirst, int nCount) {
+        std::set<uint256> proTxHashes;
+        for (int i = nFirst; i < nFirst + nCount; i++) {
+            proTxHashes.emplace(ArithToUint256(i));
+        }
+        return proTxHashes;
+    };
+    // inbound, so that they are only known as masternodes once they authenticated
+    auto makeNode = [](NodeId id, int nProTxHash) {
+        CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+        CNode* pnode = new CNode(id, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", true);
+        pnode->verifiedProRegTxHash = ArithToUint256(nProTxHash);
+        return std::unique_ptr<CNode>(pnode);
+    };
+    uint256 quorumHash1 = ArithToUint256(1000);
+    uint256 quorumHash2 = ArithToUint256(2000);
+
+    std::unique_ptr<CNode> member1 = makeNode(0, 1);
+    std::unique_ptr<CNode> member2 = makeNode(1, 100);
+    std::unique_ptr<CNode> other = makeNode(2, 500);
+    std::unique_ptr<CNode> unverified = makeNode(3, 0);
+    for (const auto& pnode : {member1.get(), member2.get(), other.get(), unverified.get()}) {
+        CConnmanTest::AddNode(*pnode);
+    }
+
+    BOOST_CHECK(connman->AddMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash1, makeMembers(1, 50)));
+    BOOST_CHECK(!connman->AddMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash1, makeMembers(1, 50)));
+    BOOST_CHECK(connman->IsMasternodeQuorumNode(member1.get()));
+    BOOST_CHECK(!connman->IsMasternodeQuorumNode(member2.get()));
+    BOOST_CHECK(!connman->IsMasternodeQuorumNode(other.get()));
+    BOOST_CHECK(!connman->IsMasternodeQuorumNode(unverified.get()));
+
+    auto vStats = connman->GetMasternodeQuorumConnStats();
+    BOOST_REQUIRE_EQUAL(vStats.size(), 1U);
+    BOOST_CHECK(vStats[0].llmqType == Consensus::LLMQ_50_60);
+    BOOST_CHECK(vStats[0].quorumHash == quorumHash1);
+    BOOST_CHECK_EQUAL(vStats[0].nWanted, 50U);
+    BOOST_CHECK_EQUAL(vStats[0].nConnected, 1U);
+    BOOST_CHECK_EQUAL(vStats[0].nVerified, 1U);
+
+    // Test: The members of a removed quorum are pooled and still count as quorum nodes
+    connman->RemoveMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash1);
+    BOOST_CHECK(!connman->HasMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash1));
+    BOOST_CHECK(connman->GetMasternodeQuorumConnStats().empty());
+    BOOST_CHECK_EQUAL(connman->GetMasternodePoolSize(), 50U);
+    BOOST_CHECK(connman->IsMasternodeQuorumNode(member1.get()));
+
+    // Test: Beyond MAX_MASTERNODE_POOL_SIZE, the members pooled the longest ago are evicted
+    SetMockTime(nStartTime + 60 * 60);
+    BOOST_CHECK(connman->AddMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash2, makeMembers(100, 30)));
+    connman->RemoveMasternodeQuorumNodes(Consensus::LLMQ_50_60, quorumHash2);
+    BOOST_CHECK_EQUAL(connman->GetMasternodePoolSize(), MAX_MASTERNODE_POOL_SIZE);
+    BOOST_CHECK(connman->IsMasternodeQuorumNode(member2.get()));
+    size_t nFirstQuorumPooled = 0;
+    for (int i = 1; i <= 50; i++) {
+        nFirstQuorumPooled += connman->IsMasternodeQuorumNode(makeNode(10, i).get());
+    }
+    BOOST_CHECK_EQUAL(nFirstQuorumPooled, MAX_MASTERNODE_POOL_SIZE - 30);
+
+    // Test: Pooled members expire after MASTERNODE_POOL_KEEP_TIME
+    SetMockTime(nStartTime + MASTERNODE_POOL_KEEP_TIME + 1);
+    BOOST_CHECK(!connman->IsMasternodeQuorumNode(member1.get()));
+    BOOST_CHECK(connman->IsMasternodeQuorumNode(member2.get()));
+    BOOST_CHECK_EQUAL(connman->GetMasternodePoolSize(), 30U);
+    SetMockTime(nStartTime + 60 * 60 + MASTERNODE_POOL_KEEP_TIME + 1);
+    BOOST_CHECK(!connman->IsMasternodeQuorumNode(member2.get()));
+    BOOST_CHECK_EQUAL(connman->GetMasternodePoolSize(), 0U);
+
+    CConnmanTest::ClearNodes();
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
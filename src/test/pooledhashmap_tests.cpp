@@ -0,0 +1,111 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pooledhashmap.h"
+
+#include "test/test_lokal.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+// Few distinct hashes, so that the tests exercise long probe sequences and the backward shift on erase
+struct CollidingHasher {
+    size_t operator()(uint32_t n) const { return n % 61; }
+};
+
+typedef pooledhashmap<uint32_t, std::string, CollidingHasher> TestMap;
+
+void CheckEqual(const TestMap& map, const std::unordered_map<uint32_t, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t nIterated = 0;
+    for (const auto& entry : map) {
+        auto it = expected.find(entry.first);
+        BOOST_CHECK(it != expected.end() && it->second == entry.second);
+        nIterated++;
+    }
+    BOOST_CHECK_EQUAL(nIterated, expected.size());
+    for (const auto& entry : expected) {
+        auto it = map.find(entry.first);
+        BOOST_CHECK(it != map.end() && it->second == entry.second);
+    }
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(pooledhashmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pooledhashmap_random)
+{
+    TestMap map;
+    std::unordered_map<uint32_t, std::string> expected;
+
+    for (int i = 0; i < 20000; i++) {
+        uint32_t nKey = InsecureRandRange(1000);
+        switch (InsecureRandRange(5)) {
+        case 0: {
+            auto ret = map.emplace(nKey, std::string(InsecureRandRange(40), 'a' + nKey % 26));
+            auto retExpected = expected.emplace(nKey, ret.first->second);
+            BOOST_CHECK_EQUAL(ret.second, retExpected.second);
+            BOOST_CHECK(ret.first->second == retExpected.first->second);
+            break;
+        }
+        case 1:
+            map[nKey] = std::to_string(i);
+            expected[nKey] = std::to_string(i);
+            break;
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(nKey), expected.erase(nKey));
+            break;
+        case 3: {
+            // erase a range of entries while iterating, like BatchWrite does
+            for (auto it = map.begin(); it != map.end();) {
+                if (it->first % 7 == nKey % 7) {
+                    expected.erase(it->first);
+                    map.erase(it++);
+                } else {
+                    ++it;
+                }
+            }
+            break;
+        }
+        case 4:
+            BOOST_CHECK_EQUAL(map.count(nKey), expected.count(nKey));
+            break;
+        }
+        if (i % 1000 == 0) CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+
+    map.clear();
+    expected.clear();
+    CheckEqual(map, expected);
+    BOOST_CHECK_EQUAL(map.capacity(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pooledhashmap_stable_references)
+{
+    TestMap map;
+    std::map<uint32_t, const std::string*> refs;
+    for (uint32_t i = 0; i < 5000; i++) {
+        refs[i] = &map.emplace(i, std::to_string(i)).first->second;
+    }
+    // growing the slot table and adding chunks never moves an entry
+    for (const auto& ref : refs) {
+        BOOST_CHECK(&map.find(ref.first)->second == ref.second);
+        BOOST_CHECK(*ref.second == std::to_string(ref.first));
+    }
+
+    // erased nodes are reused before new chunks get allocated
+    size_t nCapacity = map.capacity();
+    for (uint32_t i = 0; i < 5000; i += 2) map.erase(i);
+    for (uint32_t i = 0; i < 2500; i++) map.emplace(10000 + i, std::string());
+    BOOST_CHECK_EQUAL(map.capacity(), nCapacity);
+    BOOST_CHECK_EQUAL(map.size(), 5000U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
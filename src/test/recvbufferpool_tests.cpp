@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recvbufferpool.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_lokal.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(recvbufferpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(recvbufferpool_reuse)
+{
+    CRecvBufferPool pool(1 << 20);
+    CDataStream s(SER_NETWORK, PROTOCOL_VERSION);
+
+    // growing keeps the data
+    pool.Grow(s, 100);
+    BOOST_CHECK_EQUAL(s.capacity(), RECV_BUFFER_MIN_SIZE);
+    s << (uint32_t)42;
+    pool.Grow(s, RECV_BUFFER_MIN_SIZE + 1);
+    BOOST_CHECK_EQUAL(s.capacity(), 2 * RECV_BUFFER_MIN_SIZE);
+    uint32_t n;
+    s >> n;
+    BOOST_CHECK_EQUAL(n, 42U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nAllocations, 2U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nReuses, 0U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, RECV_BUFFER_MIN_SIZE);
+
+    // released buffers are reused for their size class
+    pool.Release(s);
+    BOOST_CHECK_EQUAL(s.capacity(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, 3 * RECV_BUFFER_MIN_SIZE);
+    CDataStream s2(SER_NETWORK, PROTOCOL_VERSION);
+    pool.Grow(s2, RECV_BUFFER_MIN_SIZE + 1);
+    BOOST_CHECK(s2.empty());
+    BOOST_CHECK_EQUAL(s2.capacity(), 2 * RECV_BUFFER_MIN_SIZE);
+    pool.Grow(s, 1);
+    BOOST_CHECK_EQUAL(s.capacity(), RECV_BUFFER_MIN_SIZE);
+    BOOST_CHECK_EQUAL(pool.GetStats().nAllocations, 2U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nReuses, 2U);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, 0U);
+
+    // buffers above the largest size class and beyond the pool's size are freed
+    CDataStream s3(SER_NETWORK, PROTOCOL_VERSION);
+    pool.Grow(s3, RECV_BUFFER_MAX_SIZE + 1);
+    pool.Release(s3);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, 0U);
+    pool.SetMaxCachedBytes(RECV_BUFFER_MIN_SIZE);
+    pool.Release(s2);
+    pool.Release(s);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, RECV_BUFFER_MIN_SIZE);
+    pool.SetMaxCachedBytes(0);
+    BOOST_CHECK_EQUAL(pool.GetStats().nCachedBytes, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
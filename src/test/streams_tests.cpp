@@ -71,6 +71,27 @@ BOOST_AUTO_TEST_CASE(streams_vector_writer)
     vch.clear();
 }
 
+BOOST_AUTO_TEST_CASE(streams_buffer_reader)
+{
+    const char bytes[] = { 1, 2, 3, 4, 5, 6 };
+    CBufferReader reader(SER_NETWORK, INIT_PROTO_VERSION, bytes, sizeof(bytes));
+    BOOST_CHECK_EQUAL(reader.size(), 6U);
+
+    unsigned char a;
+    uint32_t b;
+    reader >> a >> b;
+    BOOST_CHECK_EQUAL(a, 1);
+    BOOST_CHECK_EQUAL(b, 0x05040302U);
+    BOOST_CHECK_EQUAL(reader.size(), 1U);
+    BOOST_CHECK(!reader.empty());
+
+    // reading past the end throws
+    BOOST_CHECK_THROW(reader >> b, std::ios_base::failure);
+    reader >> a;
+    BOOST_CHECK_EQUAL(a, 6);
+    BOOST_CHECK(reader.empty());
+}
+
 BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
 {
     std::vector<char> in;
@@ -16,6 +16,7 @@
 #include "init.h"
 
 #include <stdint.h>
+#include <thread>
 
 #include <boost/thread.hpp>
 
@@ -34,6 +35,8 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
+static const char DB_UTXO_SNAPSHOT_BASE = 'U';
 
 namespace {
 
@@ -59,7 +62,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, GetDBOptions("chainstate")) 
 {
 }
 
@@ -87,22 +90,38 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
-    size_t count = 0;
-    size_t changed = 0;
-    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
-    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
-    assert(!hashBlock.IsNull());
+    return WriteCoins(mapCoins, hashBlock, true);
+}
 
+uint256 CCoinsViewDB::GetTransitionBase(const uint256 &hashBlock) const {
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
-        // We may be in the middle of replaying.
+        // We may be in the middle of replaying, or WriteHeadBlocks marked the transition already.
         std::vector<uint256> old_heads = GetHeadBlocks();
         if (old_heads.size() == 2) {
             assert(old_heads[0] == hashBlock);
             old_tip = old_heads[1];
         }
     }
+    return old_tip;
+}
+
+bool CCoinsViewDB::WriteHeadBlocks(const uint256 &hashBlock) {
+    CDBBatch batch(db);
+    batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, GetTransitionBase(hashBlock)});
+    batch.Erase(DB_BEST_BLOCK);
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fEraseWritten) {
+    CDBBatch batch(db);
+    size_t count = 0;
+    size_t changed = 0;
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+    assert(!hashBlock.IsNull());
+
+    uint256 old_tip = GetTransitionBase(hashBlock);
 
     // In the first batch, mark the database as being in the middle of a
     // transition from old_tip to hashBlock.
@@ -121,8 +140,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fEraseWritten) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -147,12 +170,172 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::BeginSnapshotLoad(const uint256 &hashBase) {
+    CDBBatch batch(db);
+    batch.Erase(DB_BEST_BLOCK);
+    batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBase, GetBestBlock()});
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin>> &vCoins) {
+    CDBBatch batch(db);
+    for (const auto& coin : vCoins) {
+        batch.Write(CoinEntry(&coin.first), coin.second);
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::FinishSnapshotLoad(const uint256 &hashBase) {
+    CDBBatch batch(db);
+    batch.Erase(DB_HEAD_BLOCKS);
+    batch.Write(DB_BEST_BLOCK, hashBase);
+    return db.WriteBatch(batch, true);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewDBWriteBehind::CCoinsViewDBWriteBehind(CCoinsViewDB* dbIn) : db(dbIn), fWriteFailed(false), fStop(false)
+{
+    writerThread = std::thread(&TraceThread<std::function<void()>>, "coinsflush", std::function<void()>(std::bind(&CCoinsViewDBWriteBehind::ThreadWriter, this)));
+}
+
+CCoinsViewDBWriteBehind::~CCoinsViewDBWriteBehind()
+{
+    {
+        WaitableLock lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    writerThread.join();
+}
+
+void CCoinsViewDBWriteBehind::ThreadWriter()
+{
+    while (true) {
+        CCoinsMap* pCoins;
+        uint256 hashBlock;
+        {
+            WaitableLock lock(cs);
+            // a pending snapshot is always written, also when stopping
+            cond.wait(lock, [this] { return pSnapshot != nullptr || fStop; });
+            if (!pSnapshot) return;
+            pCoins = pSnapshot.get();
+            hashBlock = hashSnapshotBlock;
+        }
+
+        // Nobody modifies the snapshot until it is released below, readers only look entries up
+        int64_t nStart = GetTimeMicros();
+        size_t nEntries = pCoins->size();
+        bool fOk;
+        try {
+            fOk = db->WriteCoins(*pCoins, hashBlock, false);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            fOk = false;
+        }
+        LogPrint(BCLog::COINDB, "%s: wrote %u entries for %s in %.2fms\n", __func__, nEntries, hashBlock.ToString(), (GetTimeMicros() - nStart) * 0.001);
+        if (!fOk) {
+            LogPrintf("%s: failed to write the coins of %s to the coin database\n", __func__, hashBlock.ToString());
+        }
+
+        {
+            WaitableLock lock(cs);
+            fWriteFailed |= !fOk;
+            pSnapshot.reset();
+        }
+        cond.notify_all();
+    }
+}
+
+bool CCoinsViewDBWriteBehind::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        WaitableLock lock(cs);
+        if (pSnapshot) {
+            CCoinsMap::const_iterator it = pSnapshot->find(outpoint);
+            if (it != pSnapshot->end()) {
+                if (it->second.coin.IsSpent()) return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    return db->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewDBWriteBehind::HaveCoin(const COutPoint &outpoint) const
+{
+    {
+        WaitableLock lock(cs);
+        if (pSnapshot) {
+            CCoinsMap::const_iterator it = pSnapshot->find(outpoint);
+            if (it != pSnapshot->end()) return !it->second.coin.IsSpent();
+        }
+    }
+    return db->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewDBWriteBehind::GetBestBlock() const
+{
+    {
+        WaitableLock lock(cs);
+        if (pSnapshot) return hashSnapshotBlock;
+    }
+    return db->GetBestBlock();
+}
+
+std::vector<uint256> CCoinsViewDBWriteBehind::GetHeadBlocks() const
+{
+    Sync();
+    return db->GetHeadBlocks();
+}
+
+bool CCoinsViewDBWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    // Moving the entries is much cheaper than serializing them, so this is all the caller waits for,
+    // unless the previous snapshot is still being written.
+    std::unique_ptr<CCoinsMap> pCoins(new CCoinsMap());
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            pCoins->emplace(it->first, std::move(it->second));
+        }
+        CCoinsMap::iterator itOld = it++;
+        mapCoins.erase(itOld);
+    }
+
+    WaitableLock lock(cs);
+    cond.wait(lock, [this] { return pSnapshot == nullptr; });
+    if (fWriteFailed) return false;
+    if (!db->WriteHeadBlocks(hashBlock)) return false;
+    pSnapshot = std::move(pCoins);
+    hashSnapshotBlock = hashBlock;
+    lock.unlock();
+    cond.notify_all();
+    return true;
+}
+
+CCoinsViewCursor *CCoinsViewDBWriteBehind::Cursor() const
+{
+    Sync();
+    return db->Cursor();
+}
+
+size_t CCoinsViewDBWriteBehind::EstimateSize() const
+{
+    return db->EstimateSize();
+}
+
+bool CCoinsViewDBWriteBehind::Sync() const
+{
+    WaitableLock lock(cs);
+    cond.wait(lock, [this] { return pSnapshot == nullptr; });
+    return !fWriteFailed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, GetDBOptions("blockindex")) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -396,6 +579,36 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshotInfo(const uint256& hashBestBlock, const uint256& checksum) {
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, std::make_pair(hashBestBlock, checksum), true);
+}
+
+bool CBlockTreeDB::ReadBlockIndexSnapshotInfo(uint256& hashBestBlock, uint256& checksum) {
+    std::pair<uint256, uint256> info;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, info))
+        return false;
+    hashBestBlock = info.first;
+    checksum = info.second;
+    return true;
+}
+
+bool CBlockTreeDB::EraseBlockIndexSnapshotInfo() {
+    return Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+}
+
+bool CBlockTreeDB::WriteUTXOSnapshotBase(const uint256& hashBase, unsigned int nChainTx) {
+    return Write(DB_UTXO_SNAPSHOT_BASE, std::make_pair(hashBase, nChainTx), true);
+}
+
+bool CBlockTreeDB::ReadUTXOSnapshotBase(uint256& hashBase, unsigned int& nChainTx) {
+    std::pair<uint256, unsigned int> base;
+    if (!Read(DB_UTXO_SNAPSHOT_BASE, base))
+        return false;
+    hashBase = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxPos(const uint256 &txid, CDiskTxPos& pos) const
 {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
@@ -430,56 +643,58 @@ bool CBlockTreeDB::FindTx(const uint256& tx_hash, uint256& block_hash, CTransact
 }
 
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::vector<std::vector<CDiskBlockIndex>>& vRanges, int nThreads)
 {
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
-
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-    
-                // Construct block index object
-                CBlockIndex* pindexNew      = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev            = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight          = diskindex.nHeight;
-                pindexNew->nFile            = diskindex.nFile;
-                pindexNew->nDataPos         = diskindex.nDataPos;
-                pindexNew->nUndoPos         = diskindex.nUndoPos;
-                pindexNew->nVersion         = diskindex.nVersion;
-                pindexNew->hashMerkleRoot   = diskindex.hashMerkleRoot;
-                pindexNew->nTime            = diskindex.nTime;
-                pindexNew->nBits            = diskindex.nBits;
-                pindexNew->nNonce           = diskindex.nNonce;
-                pindexNew->nStatus          = diskindex.nStatus;
-                pindexNew->nTx              = diskindex.nTx;
-
-                //Proof Of Stake
-                pindexNew->nMint            = diskindex.nMint;
-                pindexNew->nMoneySupply     = diskindex.nMoneySupply;
-                pindexNew->nFlags           = diskindex.nFlags;
-                pindexNew->nStakeModifier   = diskindex.nStakeModifier;
-                pindexNew->prevoutStake     = diskindex.prevoutStake;
-                pindexNew->nStakeTime       = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (diskindex.nNonce && !CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
+    nThreads = std::max(1, std::min(nThreads, 256));
+    vRanges.clear();
+    vRanges.resize(nThreads);
+    std::vector<std::string> vErrors(nThreads);
+
+    // Block hashes are uniformly distributed, so splitting the keyspace by the first byte of the hash gives
+    // every thread about the same number of entries. Each range is read through its own iterator.
+    auto readRange = [&](int nRange) {
+        unsigned int nBegin = nRange * 256 / nThreads;
+        unsigned int nEnd = (nRange + 1) * 256 / nThreads;
+        std::vector<CDiskBlockIndex>& vEntries = vRanges[nRange];
+
+        uint256 hashBegin;
+        *hashBegin.begin() = (unsigned char)nBegin;
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, hashBegin));
+
+        while (pcursor->Valid()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd) {
+                break;
             }
-        } else {
-            break;
+            vEntries.emplace_back();
+            CDiskBlockIndex& diskindex = vEntries.back();
+            if (!pcursor->GetValue(diskindex)) {
+                vErrors[nRange] = "failed to read value";
+                return;
+            }
+            if (diskindex.nNonce && !CheckProofOfWork(diskindex.GetBlockHash(), diskindex.nBits, consensusParams)) {
+                vErrors[nRange] = strprintf("CheckProofOfWork failed: %s", diskindex.ToString());
+                return;
+            }
+            pcursor->Next();
         }
+    };
+
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(readRange, i);
+    }
+    readRange(0);
+    for (auto& thread : vThreads) {
+        thread.join();
     }
 
+    for (const auto& strError : vErrors) {
+        if (!strError.empty()) {
+            return error("%s: %s", __func__, strError);
+        }
+    }
     return true;
 }
 
@@ -10,9 +10,12 @@
 #include "dbwrapper.h"
 #include "chain.h"
 #include "spentindex.h"
+#include "sync.h"
 
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -26,6 +29,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 128;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbwritebehind default
+static const bool DEFAULT_DB_WRITE_BEHIND = false;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -69,6 +74,9 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    //! The block a write to hashBlock starts from, also when an earlier write to it was interrupted
+    uint256 GetTransitionBase(const uint256 &hashBlock) const;
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -80,11 +88,78 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Write the dirty entries of mapCoins in -dbbatchsize chunks, with DB_HEAD_BLOCKS marking the transition
+     * until the last chunk. BatchWrite erases the entries as they are written, otherwise mapCoins is left
+     * untouched so that it can be read concurrently.
+     */
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fEraseWritten);
+
+    //! Durably mark the database as being in transition to hashBlock, as the first chunk of WriteCoins does
+    bool WriteHeadBlocks(const uint256 &hashBlock);
+
+    /**
+     * Bulk load of a UTXO snapshot taken at hashBase. Until FinishSnapshotLoad, DB_HEAD_BLOCKS marks the
+     * database as being in transition to hashBase, so that an interrupted load is caught by ReplayBlocks.
+     * WriteSnapshotCoins may be called from several threads at once.
+     */
+    bool BeginSnapshotLoad(const uint256 &hashBase);
+    bool WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin>> &vCoins);
+    bool FinishSnapshotLoad(const uint256 &hashBase);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
 };
 
+/**
+ * Write-behind layer on top of a CCoinsViewDB (-dbwritebehind).
+ *
+ * BatchWrite moves the dirty entries into an immutable snapshot and returns, a background thread then writes
+ * the snapshot with CCoinsViewDB::WriteCoins. Until that is done, reads are answered from the snapshot first.
+ * DB_HEAD_BLOCKS is written synchronously before BatchWrite returns, so that an interrupted write is replayed at
+ * startup like any other partial flush and the coin database never appears to be behind state committed after it
+ * (evoDB).
+ *
+ * Only one snapshot is written at a time, a BatchWrite while the previous one is in flight waits for it.
+ * A failed write is reported by the next BatchWrite or Sync.
+ */
+class CCoinsViewDBWriteBehind final : public CCoinsView
+{
+private:
+    CCoinsViewDB* db;
+
+    mutable CWaitableCriticalSection cs;
+    mutable CConditionVariable cond;
+    //! dirty entries that are not fully written to db yet, only modified by the writer once it is done
+    std::unique_ptr<CCoinsMap> pSnapshot;
+    uint256 hashSnapshotBlock;
+    bool fWriteFailed;
+    bool fStop;
+    std::thread writerThread;
+
+    void ThreadWriter();
+
+public:
+    explicit CCoinsViewDBWriteBehind(CCoinsViewDB* dbIn);
+    ~CCoinsViewDBWriteBehind();
+
+    CCoinsViewDBWriteBehind(const CCoinsViewDBWriteBehind&) = delete;
+    CCoinsViewDBWriteBehind& operator=(const CCoinsViewDBWriteBehind&) = delete;
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    //! Waits for the snapshot, so that the cursor sees every write
+    CCoinsViewCursor *Cursor() const override;
+    size_t EstimateSize() const override;
+
+    //! Wait until the snapshot in flight, if any, is written. Returns false if a write failed.
+    bool Sync() const;
+};
+
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
 class CCoinsViewDBCursor: public CCoinsViewCursor
 {
@@ -137,9 +212,18 @@ public:
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteBlockIndexSnapshotInfo(const uint256& hashBestBlock, const uint256& checksum);
+    bool ReadBlockIndexSnapshotInfo(uint256& hashBestBlock, uint256& checksum);
+    bool EraseBlockIndexSnapshotInfo();
+    bool WriteUTXOSnapshotBase(const uint256& hashBase, unsigned int nChainTx);
+    bool ReadUTXOSnapshotBase(uint256& hashBase, unsigned int& nChainTx);
     bool ReadTxPos(const uint256 &txid, CDiskTxPos& pos) const;
     bool FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRef& tx) const;
-    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /**
+     * Read all block index entries. The keyspace is partitioned into nThreads ranges which are read and PoW
+     * checked in parallel, vRanges receives the entries of each range.
+     */
+    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::vector<std::vector<CDiskBlockIndex>>& vRanges, int nThreads);
 };
 
 #endif // BITCOIN_TXDB_H
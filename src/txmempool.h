@@ -331,6 +331,7 @@ enum class MemPoolRemovalReason {
     REORG,       //! Removed for reorganization
     BLOCK,       //! Removed for block
     CONFLICT,    //! Removed for conflict with in-block transaction
+    ISLOCK,      //! Removed for conflict with an ISLOCKed transaction
 };
 
 class SaltedTxidHasher
@@ -0,0 +1,407 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "coinstats.h"
+#include "hash.h"
+#include "streams.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include "evo/evodb.h"
+
+#include <atomic>
+#include <thread>
+
+#include <boost/thread/thread.hpp> // boost::thread::interrupt
+
+enum : uint8_t {
+    SNAPSHOT_CHUNK_END = 0,
+    SNAPSHOT_CHUNK_BLOCK_INDEX = 1,
+    SNAPSHOT_CHUNK_EVODB = 2,
+    SNAPSHOT_CHUNK_COINS = 3,
+};
+
+static uint256 ChunkChecksum(uint8_t nType, const std::vector<unsigned char>& vchData)
+{
+    CHashWriter hw(SER_GETHASH, 0);
+    hw << nType << vchData;
+    return hw.GetHash();
+}
+
+//! Write out a chunk, adding its checksum to hwContents unless it holds coins
+static void WriteChunk(CAutoFile& file, uint8_t nType, CDataStream& ssChunk, CHashWriter& hwContents)
+{
+    std::vector<unsigned char> vchData(ssChunk.begin(), ssChunk.end());
+    uint256 checksum = ChunkChecksum(nType, vchData);
+    file << nType << vchData << checksum;
+    if (nType == SNAPSHOT_CHUNK_BLOCK_INDEX || nType == SNAPSHOT_CHUNK_EVODB) hwContents << checksum;
+    ssChunk.clear();
+}
+
+//! Read the next chunk, returns false if its checksum does not match. Throws on read errors.
+static bool ReadChunk(CAutoFile& file, uint8_t& nType, std::vector<unsigned char>& vchData, uint256& checksum)
+{
+    file >> nType >> vchData >> checksum;
+    return ChunkChecksum(nType, vchData) == checksum;
+}
+
+static bool ReadChunk(CAutoFile& file, uint8_t& nType, std::vector<unsigned char>& vchData)
+{
+    uint256 checksum;
+    return ReadChunk(file, nType, vchData, checksum);
+}
+
+bool DumpUTXOSnapshot(const fs::path& path, CUTXOSnapshotMetadata& metadata, std::string& strError)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    if (fs::exists(path)) {
+        strError = path.string() + " already exists";
+        return false;
+    }
+    CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = "Unable to open " + pathTmp.string() + " for writing";
+        return false;
+    }
+
+    // Leveldb iterators read from an implicit snapshot, so once created after the flush they keep returning
+    // the state at the base block while the chain moves on.
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::unique_ptr<CDBIterator> pitEvo;
+    std::vector<CDiskBlockIndex> vBlockIndex;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        pitEvo.reset(evoDb->GetRawDB().NewIterator());
+
+        const CBlockIndex* pindexBase = chainActive.Tip();
+        if (pcursor->GetBestBlock() != pindexBase->GetBlockHash()) {
+            strError = "Chainstate is not at the chain tip";
+            file.fclose();
+            fs::remove(pathTmp);
+            return false;
+        }
+        vBlockIndex.reserve(pindexBase->nHeight + 1);
+        for (int nHeight = 0; nHeight <= pindexBase->nHeight; nHeight++) {
+            vBlockIndex.emplace_back(chainActive[nHeight]);
+        }
+        metadata = CUTXOSnapshotMetadata();
+        memcpy(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart));
+        metadata.hashBaseBlock = pindexBase->GetBlockHash();
+        metadata.nHeight = pindexBase->nHeight;
+        metadata.nChainTx = pindexBase->nChainTx;
+        metadata.nBlockIndexEntries = vBlockIndex.size();
+    }
+
+    try {
+        // The header is rewritten with the counts and the hash once everything else is written
+        file << metadata;
+
+        CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+        CHashWriter hwContents(SER_GETHASH, 0);
+        for (const CDiskBlockIndex& diskindex : vBlockIndex) {
+            ssChunk << diskindex;
+            if (ssChunk.size() >= UTXO_SNAPSHOT_CHUNK_SIZE) WriteChunk(file, SNAPSHOT_CHUNK_BLOCK_INDEX, ssChunk, hwContents);
+        }
+        if (!ssChunk.empty()) WriteChunk(file, SNAPSHOT_CHUNK_BLOCK_INDEX, ssChunk, hwContents);
+
+        // evoDB is not obfuscated, so the raw keys and values are copied as they are
+        for (pitEvo->SeekToFirst(); pitEvo->Valid(); pitEvo->Next()) {
+            CDataStream ssKey = pitEvo->GetKey();
+            CDataStream ssValue = pitEvo->GetValue();
+            ssChunk << std::vector<unsigned char>(ssKey.begin(), ssKey.end()) << std::vector<unsigned char>(ssValue.begin(), ssValue.end());
+            metadata.nEvoDBEntries++;
+            if (ssChunk.size() >= UTXO_SNAPSHOT_CHUNK_SIZE) WriteChunk(file, SNAPSHOT_CHUNK_EVODB, ssChunk, hwContents);
+        }
+        if (!ssChunk.empty()) WriteChunk(file, SNAPSHOT_CHUNK_EVODB, ssChunk, hwContents);
+
+        CCoinsStatsBuilder stats(metadata.hashBaseBlock);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                throw std::runtime_error("unable to read the UTXO set");
+            }
+            ssChunk << key << coin;
+            stats.Add(key, std::move(coin));
+            metadata.nCoins++;
+            if (ssChunk.size() >= UTXO_SNAPSHOT_CHUNK_SIZE) WriteChunk(file, SNAPSHOT_CHUNK_COINS, ssChunk, hwContents);
+            pcursor->Next();
+        }
+        if (!ssChunk.empty()) WriteChunk(file, SNAPSHOT_CHUNK_COINS, ssChunk, hwContents);
+        WriteChunk(file, SNAPSHOT_CHUNK_END, ssChunk, hwContents);
+        metadata.hashSerialized = stats.Finalize().hashSerialized;
+        metadata.hashContents = hwContents.GetHash();
+
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            strError = "Unable to rewrite the snapshot header";
+        } else {
+            file << metadata;
+            FileCommit(file.Get());
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to write the snapshot: %s", e.what());
+    }
+    file.fclose();
+    if (strError.empty() && !RenameOver(pathTmp, path)) {
+        strError = "Unable to rename " + pathTmp.string();
+    }
+    if (!strError.empty()) {
+        fs::remove(pathTmp);
+        return false;
+    }
+
+    LogPrintf("%s: wrote %u coins and %u evoDB entries at %s to %s in %.2fs\n", __func__, metadata.nCoins, metadata.nEvoDBEntries,
+        metadata.hashBaseBlock.ToString(), path.string(), (GetTimeMicros() - nTimeStart) * 0.000001);
+    return true;
+}
+
+namespace {
+struct CSnapshotContents {
+    std::vector<CDiskBlockIndex> vBlockIndex;
+    std::vector<long> vEvoDBChunks; //!< file positions
+    std::vector<long> vCoinsChunks; //!< file positions
+};
+} // namespace
+
+//! Read and check the whole file without writing anything, collecting the positions of the chunks to load
+static bool VerifySnapshot(const fs::path& path, const uint256& hashExpected, CUTXOSnapshotMetadata& metadata, CSnapshotContents& contents, std::string& strError)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = "Unable to open " + path.string();
+        return false;
+    }
+
+    try {
+        file >> metadata;
+        if (metadata.nVersion != UTXO_SNAPSHOT_VERSION) {
+            strError = strprintf("Unsupported snapshot version %u", metadata.nVersion);
+            return false;
+        }
+        if (memcmp(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart)) != 0) {
+            strError = "Snapshot is for a different network";
+            return false;
+        }
+        if (metadata.GetHash() != hashExpected) {
+            strError = strprintf("Snapshot hash is %s, expected %s", metadata.GetHash().ToString(), hashExpected.ToString());
+            return false;
+        }
+
+        CCoinsStatsBuilder stats(metadata.hashBaseBlock);
+        CHashWriter hwContents(SER_GETHASH, 0);
+        uint64_t nEvoDBEntries = 0;
+        uint64_t nCoins = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            long nPos = ftell(file.Get());
+            uint8_t nType;
+            std::vector<unsigned char> vchData;
+            uint256 checksum;
+            if (!ReadChunk(file, nType, vchData, checksum)) {
+                strError = strprintf("Snapshot chunk at offset %d is corrupted", nPos);
+                return false;
+            }
+            if (nType == SNAPSHOT_CHUNK_END) break;
+            if (nType == SNAPSHOT_CHUNK_BLOCK_INDEX || nType == SNAPSHOT_CHUNK_EVODB) hwContents << checksum;
+
+            CDataStream ssChunk(vchData, SER_DISK, CLIENT_VERSION);
+            if (nType == SNAPSHOT_CHUNK_BLOCK_INDEX) {
+                while (!ssChunk.empty()) {
+                    CDiskBlockIndex diskindex;
+                    ssChunk >> diskindex;
+                    contents.vBlockIndex.push_back(diskindex);
+                }
+            } else if (nType == SNAPSHOT_CHUNK_EVODB) {
+                while (!ssChunk.empty()) {
+                    std::vector<unsigned char> vchKey, vchValue;
+                    ssChunk >> vchKey >> vchValue;
+                    nEvoDBEntries++;
+                }
+                contents.vEvoDBChunks.push_back(nPos);
+            } else if (nType == SNAPSHOT_CHUNK_COINS) {
+                while (!ssChunk.empty()) {
+                    COutPoint key;
+                    Coin coin;
+                    ssChunk >> key >> coin;
+                    stats.Add(key, std::move(coin));
+                    nCoins++;
+                }
+                contents.vCoinsChunks.push_back(nPos);
+            } else {
+                strError = strprintf("Unknown snapshot chunk type %d", nType);
+                return false;
+            }
+        }
+
+        if (contents.vBlockIndex.size() != metadata.nBlockIndexEntries || contents.vBlockIndex.size() != (size_t)metadata.nHeight + 1 ||
+            contents.vBlockIndex.back().GetBlockHash() != metadata.hashBaseBlock) {
+            strError = "Snapshot block index does not match its base block";
+            return false;
+        }
+        if (nEvoDBEntries != metadata.nEvoDBEntries || nCoins != metadata.nCoins) {
+            strError = "Snapshot is truncated";
+            return false;
+        }
+        if (stats.Finalize().hashSerialized != metadata.hashSerialized) {
+            strError = "Snapshot coins do not match its hash_serialized_2";
+            return false;
+        }
+        if (hwContents.GetHash() != metadata.hashContents) {
+            strError = "Snapshot block index and evoDB entries do not match its hash";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to read the snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+//! Write the coin chunks at the given positions on several threads, each with its own file handle
+static bool LoadSnapshotCoins(const fs::path& path, const std::vector<long>& vChunks, std::string& strError)
+{
+    std::atomic<size_t> nNextChunk(0);
+    std::atomic<bool> fFailed(false);
+    auto loadChunks = [&]() {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            fFailed = true;
+            return;
+        }
+        std::vector<std::pair<COutPoint, Coin>> vCoins;
+        for (size_t i = nNextChunk++; i < vChunks.size() && !fFailed; i = nNextChunk++) {
+            try {
+                uint8_t nType;
+                std::vector<unsigned char> vchData;
+                if (fseek(file.Get(), vChunks[i], SEEK_SET) != 0 || !ReadChunk(file, nType, vchData) || nType != SNAPSHOT_CHUNK_COINS) {
+                    fFailed = true;
+                    return;
+                }
+                CDataStream ssChunk(vchData, SER_DISK, CLIENT_VERSION);
+                vCoins.clear();
+                while (!ssChunk.empty()) {
+                    vCoins.emplace_back();
+                    ssChunk >> vCoins.back().first >> vCoins.back().second;
+                }
+                if (!pcoinsdbview->WriteSnapshotCoins(vCoins)) {
+                    fFailed = true;
+                }
+            } catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+                fFailed = true;
+            }
+        }
+    };
+
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_UTXO_SNAPSHOT_LOAD_THREADS));
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(loadChunks);
+    }
+    loadChunks();
+    for (auto& thread : vThreads) {
+        thread.join();
+    }
+    if (fFailed) {
+        strError = "Failed to write the snapshot coins";
+        return false;
+    }
+    return true;
+}
+
+static bool LoadSnapshotEvoDB(const fs::path& path, const std::vector<long>& vChunks, std::string& strError)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = "Unable to open " + path.string();
+        return false;
+    }
+    CDBWrapper& db = evoDb->GetRawDB();
+    try {
+        for (long nPos : vChunks) {
+            uint8_t nType;
+            std::vector<unsigned char> vchData;
+            if (fseek(file.Get(), nPos, SEEK_SET) != 0 || !ReadChunk(file, nType, vchData) || nType != SNAPSHOT_CHUNK_EVODB) {
+                strError = strprintf("Snapshot chunk at offset %d changed while loading", nPos);
+                return false;
+            }
+            CDataStream ssChunk(vchData, SER_DISK, CLIENT_VERSION);
+            CDBBatch batch(db);
+            while (!ssChunk.empty()) {
+                std::vector<unsigned char> vchKey, vchValue;
+                ssChunk >> vchKey >> vchValue;
+                batch.WriteSerialized((const char*)vchKey.data(), vchKey.size(), (const char*)vchValue.data(), vchValue.size());
+            }
+            db.WriteBatch(batch);
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to load the evoDB entries: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadUTXOSnapshot(const fs::path& path, const uint256& hashExpected, CUTXOSnapshotMetadata& metadata, std::string& strError)
+{
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0) {
+            strError = "A UTXO snapshot can only be loaded into a fresh chainstate";
+            return false;
+        }
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    CSnapshotContents contents;
+    if (!VerifySnapshot(path, hashExpected, metadata, contents, strError)) {
+        return false;
+    }
+    int64_t nTimeVerify = GetTimeMicros();
+
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        strError = "A UTXO snapshot can only be loaded into a fresh chainstate";
+        return false;
+    }
+    FlushStateToDisk();
+    mempool.clear();
+
+    if (!LoadSnapshotEvoDB(path, contents.vEvoDBChunks, strError)) {
+        return false;
+    }
+    int64_t nTimeEvoDB = GetTimeMicros();
+
+    // An interrupted load leaves DB_HEAD_BLOCKS behind, which makes the next startup ask for -reindex-chainstate
+    if (!pcoinsdbview->BeginSnapshotLoad(metadata.hashBaseBlock) ||
+        !LoadSnapshotCoins(path, contents.vCoinsChunks, strError) ||
+        !pcoinsdbview->FinishSnapshotLoad(metadata.hashBaseBlock)) {
+        if (strError.empty()) strError = "Failed to write the snapshot coins";
+        strError += ", restart with -reindex-chainstate";
+        return false;
+    }
+    int64_t nTimeCoins = GetTimeMicros();
+
+    if (!ActivateUTXOSnapshotChain(Params(), contents.vBlockIndex, metadata.nChainTx)) {
+        strError = "Failed to activate the snapshot chain, restart with -reindex-chainstate";
+        return false;
+    }
+
+    LogPrintf("%s: loaded %u coins and %u evoDB entries at %s height=%d in %.2fs (verify %.2fs, evoDB %.2fs, coins %.2fs)\n", __func__,
+        metadata.nCoins, metadata.nEvoDBEntries, metadata.hashBaseBlock.ToString(), metadata.nHeight, (GetTimeMicros() - nTimeStart) * 0.000001,
+        (nTimeVerify - nTimeStart) * 0.000001, (nTimeEvoDB - nTimeVerify) * 0.000001, (nTimeCoins - nTimeEvoDB) * 0.000001);
+    return true;
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2021 The Lokal Coin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LOKAL_UTXOSNAPSHOT_H
+#define LOKAL_UTXOSNAPSHOT_H
+
+#include "fs.h"
+#include "hash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+static const uint32_t UTXO_SNAPSHOT_VERSION = 1;
+//! Serialized size after which a chunk of the snapshot file is written out
+static const size_t UTXO_SNAPSHOT_CHUNK_SIZE = 4 << 20;
+//! Maximum number of threads writing the coins of a snapshot into the chainstate
+static const int MAX_UTXO_SNAPSHOT_LOAD_THREADS = 8;
+
+/**
+ * Header of a UTXO snapshot file, as written by dumptxoutset.
+ *
+ * It is followed by checksummed chunks holding the block index entries of the active chain up to the base block
+ * (with the PoS fields needed to validate the blocks after it), all evoDB entries (the deterministic MN lists and
+ * quorum commitments) and finally the coins in chainstate order. The coins are committed to by hashSerialized, the
+ * other entries by hashContents, and the hash of the header covers both.
+ */
+class CUTXOSnapshotMetadata
+{
+public:
+    uint32_t nVersion;
+    unsigned char pchMessageStart[4];
+    uint256 hashBaseBlock;
+    int32_t nHeight;
+    uint32_t nChainTx;
+    uint64_t nBlockIndexEntries;
+    uint64_t nEvoDBEntries;
+    uint64_t nCoins;
+    //! hash_serialized_2 of gettxoutsetinfo at the base block
+    uint256 hashSerialized;
+    //! hash of the checksums of the block index and evoDB chunks, in file order
+    uint256 hashContents;
+
+    CUTXOSnapshotMetadata() : nVersion(UTXO_SNAPSHOT_VERSION), pchMessageStart(), nHeight(0), nChainTx(0),
+                              nBlockIndexEntries(0), nEvoDBEntries(0), nCoins(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBaseBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(nBlockIndexEntries);
+        READWRITE(nEvoDBEntries);
+        READWRITE(nCoins);
+        READWRITE(hashSerialized);
+        READWRITE(hashContents);
+    }
+
+    //! The hash loadtxoutset expects, which commits to the whole snapshot
+    uint256 GetHash() const { return SerializeHash(*this); }
+};
+
+/**
+ * Write a snapshot of the chainstate at the current tip to path. The state is flushed first, the file is then
+ * written from database snapshots without holding cs_main. Nothing is left behind on failure.
+ */
+bool DumpUTXOSnapshot(const fs::path& path, CUTXOSnapshotMetadata& metadata, std::string& strError);
+
+/**
+ * Load a snapshot written by DumpUTXOSnapshot into a fresh chainstate, which only contains the genesis block,
+ * and make its base block the tip. The whole file is verified against hashExpected, the GetHash() of its
+ * metadata, before anything is written. The coins are written on several threads.
+ */
+bool LoadUTXOSnapshot(const fs::path& path, const uint256& hashExpected, CUTXOSnapshotMetadata& metadata, std::string& strError);
+
+#endif // LOKAL_UTXOSNAPSHOT_H
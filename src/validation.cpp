@@ -10,6 +10,9 @@
 #include "arith_uint256.h"
 #include "banned.h"
 #include "blockencodings.h"
+#include "blockimport.h"
+#include "blockindexsnapshot.h"
+#include "blockwriter.h"
 #include "blocksigner.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -61,7 +64,9 @@
 #include "llmq/quorums_chainlocks.h"
 
 #include <atomic>
+#include <future>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -81,9 +86,12 @@ CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
 PrevBlockMap mapPrevBlockIndex;
+/** Block index entries loaded from disk at startup are allocated in one block each, only entries added afterwards are owned individually */
+static std::vector<std::pair<std::unique_ptr<CBlockIndex[]>, size_t>> vBlockIndexArenas;
 CChain chainActive;
 std::set<std::pair<uint256, unsigned int>> setStakeSeen;
 CBlockIndex *pindexBestHeader = nullptr;
+CBlockIndex *pindexUTXOSnapshotBase = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
@@ -231,6 +239,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewDBWriteBehind> pcoinswritebehind;
+std::unique_ptr<CBlockFileWriter> pblockwriter;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -931,6 +941,17 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
+    if (pblockwriter) {
+        CDataStream data(SER_DISK, CLIENT_VERSION);
+        unsigned int nSize = GetSerializeSize(data, block);
+        data.reserve(nSize + 8);
+        data << FLATDATA(messageStart) << nSize << block;
+        if (!pblockwriter->Write("blk", pos, std::move(data)))
+            return error("WriteBlockToDisk: an earlier block or undo write failed");
+        pos.nPos += 8;
+        return true;
+    }
+
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
@@ -1429,6 +1450,23 @@ namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
+    if (pblockwriter) {
+        CDataStream data(SER_DISK, CLIENT_VERSION);
+        unsigned int nSize = GetSerializeSize(data, blockundo);
+        data.reserve(nSize + 40);
+        data << FLATDATA(messageStart) << nSize << blockundo;
+
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << hashBlock;
+        hasher << blockundo;
+        data << hasher.GetHash();
+
+        if (!pblockwriter->Write("rev", pos, std::move(data)))
+            return error("%s: an earlier block or undo write failed", __func__);
+        pos.nPos += 8;
+        return true;
+    }
+
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
@@ -1454,6 +1492,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1480,6 +1520,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1717,10 +1759,26 @@ static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex*
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+/**
+ * Flush the last block and undo file to disk, and truncate them to their size when leaving them. With
+ * -asyncblockwrites everything queued is synced, either now or in the background when fWait is false.
+ */
+static bool FlushBlockFile(bool fFinalize = false, bool fWait = true)
 {
     LOCK(cs_LastBlockFile);
 
+    if (pblockwriter) {
+        if (fFinalize) {
+            pblockwriter->Truncate("blk", nLastBlockFile, vinfoBlockFile[nLastBlockFile].nSize);
+            pblockwriter->Truncate("rev", nLastBlockFile, vinfoBlockFile[nLastBlockFile].nUndoSize);
+        }
+        if (!fWait) {
+            pblockwriter->RequestSync();
+            return true;
+        }
+        return pblockwriter->Flush();
+    }
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
@@ -1738,6 +1796,7 @@ void static FlushBlockFile(bool fFinalize = false)
         FileCommit(fileOld);
         fclose(fileOld);
     }
+    return true;
 }
 
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
@@ -2386,7 +2445,8 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(0))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
+            if (!FlushBlockFile())
+                return AbortNode(state, "Failed to write block and undo files");
             // Then update all block file information (which may refer to block and undo files).
             {
                 std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -2422,6 +2482,11 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // With -dbwritebehind the coins are still being written, only explicit flushes wait for that. The
+            // transition to the new tip is already on disk though, so after a crash ReplayBlocks brings the coins
+            // up to the evoDB state committed below.
+            if (mode == FLUSH_STATE_ALWAYS && pcoinswritebehind && !pcoinswritebehind->Sync())
+                return AbortNode(state, "Failed to write to coin database");
         if (!evoDb->CommitRootTransaction()) {
             return AbortNode(state, "Failed to commit EvoDB");
         }
@@ -3110,10 +3175,9 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, enum BlockStatus nStatus = BLOCK_VALID_TREE)
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash, enum BlockStatus nStatus = BLOCK_VALID_TREE)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -3185,6 +3249,11 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, enum BlockStatus
     return pindexNew;
 }
 
+static CBlockIndex* AddToBlockIndex(const CBlockHeader& block, enum BlockStatus nStatus = BLOCK_VALID_TREE)
+{
+    return AddToBlockIndex(block, block.GetHash(), nStatus);
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
@@ -3255,7 +3324,7 @@ static bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned i
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nLastBlockFile, vinfoBlockFile[nLastBlockFile].ToString());
         }
-        FlushBlockFile(!fKnown);
+        FlushBlockFile(!fKnown, false);
         nLastBlockFile = nFile;
     }
 
@@ -3532,11 +3601,10 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
 
@@ -3591,13 +3659,13 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 
         if (llmq::chainLocksHandler->HasConflictingChainLock(pindexPrev->nHeight + 1, hash)) {
             if (pindex == nullptr) {
-                AddToBlockIndex(block, BLOCK_CONFLICT_CHAINLOCK);
+                AddToBlockIndex(block, hash, BLOCK_CONFLICT_CHAINLOCK);
             }
             return state.DoS(10, error("%s: header %s conflicts with chainlock", __func__, hash.ToString()), REJECT_INVALID, "bad-chainlock");
         }
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3610,15 +3678,68 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    return AcceptBlockHeader(block, block.GetHash(), state, chainparams, ppindex);
+}
+
+// Hashes received headers; the X11 hashes are most of the cost of accepting headers, and need no lock
+static ctpl::thread_pool headerVerifyPool;
+
+void StartHeaderVerifyThreads(int nThreads)
+{
+    if (nThreads <= 0)
+        return;
+    headerVerifyPool.resize(nThreads);
+    RenameThreadPool(headerVerifyPool, "lokal_coin-hdrverify");
+}
+
+void StopHeaderVerifyThreads()
+{
+    headerVerifyPool.clear_queue();
+    headerVerifyPool.stop(true);
+}
+
+std::vector<uint256> GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers)
+{
+    std::vector<uint256> hashes(headers.size());
+    auto hashRange = [&headers, &hashes](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            hashes[i] = headers[i].GetHash();
+        }
+    };
+
+    // The caller hashes the first batch while the threads hash the others
+    std::vector<std::future<void>> vFutures;
+    if (headerVerifyPool.size() > 0) {
+        for (size_t nBegin = HEADER_VERIFY_BATCH_SIZE; nBegin < headers.size(); nBegin += HEADER_VERIFY_BATCH_SIZE) {
+            size_t nEnd = std::min(headers.size(), nBegin + HEADER_VERIFY_BATCH_SIZE);
+            vFutures.emplace_back(headerVerifyPool.push([&hashRange, nBegin, nEnd](int) { hashRange(nBegin, nEnd); }));
+        }
+    }
+    hashRange(0, vFutures.empty() ? headers.size() : HEADER_VERIFY_BATCH_SIZE);
+    for (auto& future : vFutures) {
+        future.get();
+    }
+    return hashes;
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
+    return ProcessNewBlockHeaders(headers, GetBlockHeaderHashes(headers), state, chainparams, ppindex, first_invalid);
+}
+
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, const std::vector<uint256>& hashes, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
+{
+    assert(hashes.size() == headers.size());
     if (first_invalid != nullptr) first_invalid->SetNull();
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(header, hashes[i], state, chainparams, &pindex)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3975,6 +4096,9 @@ static FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fRe
 {
     if (pos.IsNull())
         return nullptr;
+    if (fReadOnly && pblockwriter) {
+        pblockwriter->WaitForWrites(prefix, pos.nFile);
+    }
     fs::path path = GetBlockPosFilename(pos, prefix);
     fs::create_directories(path.parent_path());
     FILE* file = fsbridge::fopen(path, "rb+");
@@ -4028,12 +4152,131 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+static void FreeBlockIndexEntry(CBlockIndex* pindex)
+{
+    for (const auto& arena : vBlockIndexArenas) {
+        if (!std::less<const CBlockIndex*>()(pindex, arena.first.get()) && std::less<const CBlockIndex*>()(pindex, arena.first.get() + arena.second)) {
+            return;
+        }
+    }
+    delete pindex;
+}
+
+static void FreeBlockIndex()
+{
+    for (BlockMap::value_type& entry : mapBlockIndex) {
+        FreeBlockIndexEntry(entry.second);
+    }
+    mapBlockIndex.clear();
+    vBlockIndexArenas.clear();
+}
+
+/**
+ * Read the block index from disk into mapBlockIndex. The entries are read and PoW checked by
+ * CBlockTreeDB::LoadBlockIndexGuts on several threads, copied into one preallocated array of CBlockIndex
+ * objects, and linked to their predecessors in parallel once all of them are in mapBlockIndex.
+ */
+static bool LoadBlockIndexEntries(const CChainParams& chainparams)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::unique_ptr<CBlockIndex[]> snapshotArena;
+    size_t nSnapshotEntries = 0;
+    if (LoadBlockIndexSnapshot(snapshotArena, nSnapshotEntries)) {
+        vBlockIndexArenas.emplace_back(std::move(snapshotArena), nSnapshotEntries);
+        LogPrintf("%s: loaded block index from %s\n", __func__, BLOCK_INDEX_SNAPSHOT_FILENAME);
+        return true;
+    }
+
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+
+    std::vector<std::vector<CDiskBlockIndex>> vRanges;
+    if (!pblocktree->LoadBlockIndexGuts(chainparams.GetConsensus(), vRanges, nThreads))
+        return false;
+
+    boost::this_thread::interruption_point();
+    int64_t nTimeRead = GetTimeMicros();
+
+    std::vector<size_t> vRangeOffsets;
+    size_t nEntries = 0;
+    for (const auto& vEntries : vRanges) {
+        vRangeOffsets.emplace_back(nEntries);
+        nEntries += vEntries.size();
+    }
+    CBlockIndex* arena = new CBlockIndex[nEntries];
+    vBlockIndexArenas.emplace_back(std::unique_ptr<CBlockIndex[]>(arena), nEntries);
+
+    mapBlockIndex.reserve(mapBlockIndex.size() + nEntries);
+    for (size_t nRange = 0; nRange < vRanges.size(); nRange++) {
+        CBlockIndex* pindex = arena + vRangeOffsets[nRange];
+        for (const CDiskBlockIndex& diskindex : vRanges[nRange]) {
+            if (!mapBlockIndex.emplace(diskindex.GetBlockHash(), pindex++).second) {
+                return error("%s: duplicate block index entry %s", __func__, diskindex.GetBlockHash().ToString());
+            }
+        }
+    }
+    int64_t nTimeInsert = GetTimeMicros();
+
+    // mapBlockIndex is not modified below, so it can be read concurrently. Predecessors which are not in the
+    // block index themselves are collected and added afterwards.
+    std::vector<std::vector<std::pair<CBlockIndex*, uint256>>> vMissingPrev(vRanges.size());
+    auto linkRange = [&](size_t nRange) {
+        CBlockIndex* pindex = arena + vRangeOffsets[nRange];
+        for (const CDiskBlockIndex& diskindex : vRanges[nRange]) {
+            *pindex = diskindex;
+            pindex->phashBlock = &mapBlockIndex.find(diskindex.GetBlockHash())->first;
+            pindex->pprev = nullptr;
+            pindex->pskip = nullptr;
+            if (!diskindex.hashPrev.IsNull()) {
+                BlockMap::const_iterator mi = mapBlockIndex.find(diskindex.hashPrev);
+                if (mi != mapBlockIndex.end()) {
+                    pindex->pprev = mi->second;
+                } else {
+                    vMissingPrev[nRange].emplace_back(pindex, diskindex.hashPrev);
+                }
+            }
+            pindex++;
+        }
+        std::vector<CDiskBlockIndex>().swap(vRanges[nRange]);
+    };
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < vRanges.size(); i++) {
+        vThreads.emplace_back(linkRange, i);
+    }
+    linkRange(0);
+    for (auto& thread : vThreads) {
+        thread.join();
+    }
+    for (const auto& vMissing : vMissingPrev) {
+        for (const auto& p : vMissing) {
+            p.first->pprev = InsertBlockIndex(p.second);
+        }
+    }
+    int64_t nTimeLink = GetTimeMicros();
+
+    LogPrint(BCLog::BENCHMARK, "%s: loaded %u block index entries using %d threads in %.2fms (read %.2fms, insert %.2fms, link %.2fms)\n", __func__,
+        nEntries, nThreads, 0.001 * (nTimeLink - nTimeStart), 0.001 * (nTimeRead - nTimeStart), 0.001 * (nTimeInsert - nTimeRead), 0.001 * (nTimeLink - nTimeInsert));
+    return true;
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
-    if (!pblocktree->LoadBlockIndexGuts(chainparams.GetConsensus(), InsertBlockIndex))
+    if (!LoadBlockIndexEntries(chainparams))
         return false;
 
     boost::this_thread::interruption_point();
+    int64_t nTimeStart = GetTimeMicros();
+
+    // The chain below a loaded UTXO snapshot has no transactions, the snapshot base gets the stored count
+    uint256 hashUTXOSnapshotBase;
+    unsigned int nUTXOSnapshotChainTx = 0;
+    if (pblocktree->ReadUTXOSnapshotBase(hashUTXOSnapshotBase, nUTXOSnapshotChainTx)) {
+        BlockMap::iterator it = mapBlockIndex.find(hashUTXOSnapshotBase);
+        if (it == mapBlockIndex.end())
+            return error("%s: UTXO snapshot base block %s not found", __func__, hashUTXOSnapshotBase.ToString());
+        pindexUTXOSnapshotBase = it->second;
+        LogPrintf("%s: chainstate was loaded from a UTXO snapshot at height %d\n", __func__, pindexUTXOSnapshotBase->nHeight);
+    }
 
     // Calculate nChainTrust
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
@@ -4056,7 +4299,9 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
+        if (pindex == pindexUTXOSnapshotBase) {
+            pindex->nChainTx = nUTXOSnapshotChainTx;
+        } else if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -4081,6 +4326,7 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrint(BCLog::BENCHMARK, "%s: computed chain trust of %u block index entries in %.2fms\n", __func__, vSortedByHeight.size(), 0.001 * (GetTimeMicros() - nTimeStart));
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4218,6 +4464,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks up to a loaded UTXO snapshot were never downloaded
+        if (pindexUTXOSnapshotBase && pindex->nHeight <= pindexUTXOSnapshotBase->nHeight && !(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -4364,6 +4613,74 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view)
 }
 
 
+bool ActivateUTXOSnapshotChain(const CChainParams& chainparams, const std::vector<CDiskBlockIndex>& vBlockIndex, unsigned int nChainTx)
+{
+    AssertLockHeld(cs_main);
+    assert(chainActive.Height() == 0);
+    if (vBlockIndex.empty() || vBlockIndex[0].GetBlockHash() != chainActive.Genesis()->GetBlockHash())
+        return error("%s: block index does not start at the genesis block", __func__);
+
+    CBlockIndex* pindexPrev = chainActive.Genesis();
+    for (size_t i = 1; i < vBlockIndex.size(); i++) {
+        const CDiskBlockIndex& diskindex = vBlockIndex[i];
+        if (diskindex.hashPrev != pindexPrev->GetBlockHash() || diskindex.nHeight != pindexPrev->nHeight + 1)
+            return error("%s: block index entry %s does not extend %s", __func__, diskindex.GetBlockHash().ToString(), pindexPrev->GetBlockHash().ToString());
+
+        // Entries may already exist from headers sync, they are overwritten with the (PoS) fields of the snapshot
+        CBlockIndex* pindex = InsertBlockIndex(diskindex.GetBlockHash());
+        if (pindex->nStatus & BLOCK_HAVE_DATA)
+            return error("%s: already have block %s", __func__, diskindex.GetBlockHash().ToString());
+        const uint256* phashBlock = pindex->phashBlock;
+        bool fNew = pindex->pprev == nullptr;
+        *pindex = diskindex;
+        pindex->phashBlock = phashBlock;
+        pindex->pprev = pindexPrev;
+        pindex->nFile = 0;
+        pindex->nDataPos = 0;
+        pindex->nUndoPos = 0;
+        pindex->nStatus = BLOCK_VALID_TREE;
+        pindex->nChainTx = 0;
+        pindex->nSequenceId = 0;
+        pindex->nChainTrust = pindexPrev->nChainTrust + GetBlockTrust(*pindex);
+        pindex->nTimeMax = std::max(pindexPrev->nTimeMax, pindex->nTime);
+        pindex->BuildSkip();
+        if (fNew) {
+            mapPrevBlockIndex.emplace(pindexPrev->GetBlockHash(), pindex);
+        }
+        setDirtyBlockIndex.insert(pindex);
+        pindexPrev = pindex;
+    }
+
+    CBlockIndex* pindexBase = pindexPrev;
+    pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+    pindexBase->nChainTx = nChainTx;
+    {
+        LOCK(cs_nBlockSequenceId);
+        pindexBase->nSequenceId = nBlockSequenceId++;
+    }
+    // Recorded before the block index is flushed, so that the base is never loaded without its nChainTx
+    if (!pblocktree->WriteUTXOSnapshotBase(pindexBase->GetBlockHash(), nChainTx))
+        return error("%s: failed to write the UTXO snapshot base", __func__);
+    pindexUTXOSnapshotBase = pindexBase;
+
+    pcoinsTip->SetBestBlock(pindexBase->GetBlockHash());
+    chainActive.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    if (pindexBestHeader == nullptr || pindexBestHeader->nChainTrust < pindexBase->nChainTrust)
+        pindexBestHeader = pindexBase;
+
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS))
+        return error("%s: %s", __func__, FormatStateMessage(state));
+
+    LogPrintf("%s: new best=%s height=%d tx=%u\n", __func__, pindexBase->GetBlockHash().ToString(), pindexBase->nHeight, pindexBase->nChainTx);
+    GetMainSignals().SynchronousUpdatedBlockTip(pindexBase, nullptr, IsInitialBlockDownload());
+    GetMainSignals().UpdatedBlockTip(pindexBase, nullptr, IsInitialBlockDownload());
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindexBase);
+    return true;
+}
+
 // May NOT be used after any connections are up as much
 // of the peer-processing logic assumes a consistent
 // block index state
@@ -4374,6 +4691,7 @@ void UnloadBlockIndex()
     chainActive.SetTip(nullptr);
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
+    pindexUTXOSnapshotBase = nullptr;
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4387,10 +4705,7 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
-    mapBlockIndex.clear();
+    FreeBlockIndex();
     fHavePruned = false;
 }
 
@@ -4479,114 +4794,80 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+bool LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<CBlockFileSource>& vSources)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
-        unsigned int nMaxBlockSize = MaxBlockSize(true);
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*nMaxBlockSize, nMaxBlockSize+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > nMaxBlockSize)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
+        CBlockFileReader reader(chainparams, vSources, std::max(1, std::min(GetNumCores() - 1, MAX_BLOCK_IMPORT_WORKERS)));
+        // Blocks with unknown parent, only our own block files let those be re-read once they no longer fit in memory
+        CUnknownParentBlocks unknownParent(BLOCK_IMPORT_UNKNOWN_PARENT_SIZE);
+
+        CImportedBlock imported;
+        while (reader.Next(imported)) {
+            const uint256& hash = imported.hash;
+            const CDiskBlockPos* dbp = imported.pos.IsNull() ? nullptr : &imported.pos;
+            {
+                LOCK(cs_main);
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(imported.block->hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                            imported.block->hashPrevBlock.ToString());
+                    unknownParent.Add(imported);
                     continue;
                 }
 
                 // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
+                BlockMap::iterator it = mapBlockIndex.find(hash);
+                if (it == mapBlockIndex.end() || (it->second->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
-                    if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+                    if (AcceptBlock(imported.block, state, chainparams, nullptr, true, dbp, nullptr))
                         nLoaded++;
                     if (state.IsError())
                         break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && it->second->nHeight % 1000 == 0) {
+                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), it->second->nHeight);
                 }
+            }
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
+            // Activate the genesis block so normal node progress can continue
+            if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+                CValidationState state;
+                if (!ActivateBestChain(state, chainparams)) {
+                    break;
                 }
+            }
+
+            NotifyHeaderTip();
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            // Recursively process earlier encountered successors of this block
+            std::deque<uint256> queue;
+            queue.push_back(hash);
+            while (!queue.empty()) {
+                uint256 head = queue.front();
+                queue.pop_front();
+                for (CImportedBlock& child : unknownParent.Take(head)) {
+                    if (!child.block) {
                         std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+                        if (!ReadBlockFromDisk(*pblockrecursive, child.pos, chainparams.GetConsensus()))
+                            continue;
+                        child.hash = pblockrecursive->GetHash();
+                        child.block = std::move(pblockrecursive);
+                    }
+                    LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, child.hash.ToString(),
+                            head.ToString());
+                    {
+                        LOCK(cs_main);
+                        CValidationState dummy;
+                        if (AcceptBlock(child.block, dummy, chainparams, nullptr, true, child.pos.IsNull() ? nullptr : &child.pos, nullptr))
                         {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
+                            nLoaded++;
+                            queue.push_back(child.hash);
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
                     }
+                    NotifyHeaderTip();
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -4613,6 +4894,12 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         return;
     }
 
+    // The chain below a loaded UTXO snapshot has neither data nor transaction counts, which the checks
+    // below do not account for.
+    if (pindexUTXOSnapshotBase) {
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
@@ -4974,9 +5261,6 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
+        FreeBlockIndex();
     }
 } instance_of_cmaincleanup;
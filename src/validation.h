@@ -33,10 +33,13 @@
 
 #include <atomic>
 
+class CBlockFileWriter;
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
+class CCoinsViewDBWriteBehind;
 class CInv;
 class CConnman;
 class CScriptCheck;
@@ -44,6 +47,7 @@ class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
 class PrecomputedTransactionData;
+struct CBlockFileSource;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -88,7 +92,11 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of threads used to read the block index at startup */
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+/** Headers hashed per task on the header verification threads, smaller batches are hashed by the caller */
+static const size_t HEADER_VERIFY_BATCH_SIZE = 250;
+/** Number of blocks that can be requested at any given time from a single peer before its download speed is known. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
@@ -102,8 +110,8 @@ static const int MAX_CMPCTBLOCK_DEPTH = 5;
 static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
- *  degree of disordering of blocks on disk (which make reindexing and pruning harder). We'll probably
- *  want to make this a per-peer adaptive value at some point. */
+ *  degree of disordering of blocks on disk (which make reindexing and pruning harder). The number of
+ *  blocks in flight from each peer within it adapts to the peer's speed, see blockdownload.h. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
@@ -208,6 +216,9 @@ extern arith_uint256 nMinimumChainWork;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/** Base block of the UTXO snapshot the chainstate was loaded from, if any. Blocks up to it have no data. */
+extern CBlockIndex *pindexUTXOSnapshotBase;
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -269,6 +280,13 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  * @param[out] first_invalid First header that fails validation, if one exists
  */
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+/** Same as above, with the hashes of the headers from GetBlockHeaderHashes() */
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, const std::vector<uint256>& hashes, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+/** Hash block headers, in parallel on the header verification threads for large batches */
+std::vector<uint256> GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers);
+/** Start, respectively stop the threads that hash received headers before they are accepted under cs_main */
+void StartHeaderVerifyThreads(int nThreads);
+void StopHeaderVerifyThreads();
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -276,8 +294,8 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
-/** Import blocks from an external file */
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import blocks from our own block files (-reindex) or external ones, reading ahead on background threads */
+bool LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<CBlockFileSource>& vSources);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -285,6 +303,13 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams);
 /** Update the chain tip based on database information. */
 bool LoadChainTip(const CChainParams& chainparams);
+/**
+ * Make the base block of a loaded UTXO snapshot the chain tip. vBlockIndex holds the active chain of the node
+ * that dumped the snapshot, from genesis to the base block, and nChainTx the number of transactions up to it.
+ * The entries are added without block data. The coins database must already be at the base block and
+ * chainActive must only contain the genesis block. Requires cs_main.
+ */
+bool ActivateUTXOSnapshotChain(const CChainParams& chainparams, const std::vector<CDiskBlockIndex>& vBlockIndex, unsigned int nChainTx);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
@@ -428,6 +453,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -468,6 +494,12 @@ extern CChain chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Write-behind layer between pcoinsTip and pcoinsdbview, only set with -dbwritebehind (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewDBWriteBehind> pcoinswritebehind;
+
+/** Background writer of block and undo files, only set with -asyncblockwrites (set while no other threads access block files) */
+extern std::unique_ptr<CBlockFileWriter> pblockwriter;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -9,8 +9,12 @@
 #include <utility>
 #include <vector>
 
+#include "base58.h"
 #include "consensus/validation.h"
+#include "llmq/quorums_instantsend.h"
 #include "rpc/server.h"
+#include "script/sign.h"
+#include "spork.h"
 #include "test/test_lokal.h"
 #include "validation.h"
 #include "wallet/coincontrol.h"
@@ -527,6 +531,111 @@ BOOST_FIXTURE_TEST_CASE(coin_mark_dirty_immature_credit, TestChain100Setup)
     BOOST_CHECK_EQUAL(wtx.GetImmatureCredit(), 500*COIN);
 }
 
+// Check every bucket of the wallet-wide balance ledger across an ISLOCK and a
+// block connect. The wallet is not registered for notifications, so they are
+// delivered by hand.
+BOOST_FIXTURE_TEST_CASE(balance_tally_buckets, TestChain100Setup)
+{
+    CWallet wallet;
+    AddKey(wallet, coinbaseKey);
+    CKey watchKey;
+    watchKey.MakeNewKey(true);
+    const CScript watchScript = GetScriptForRawPubKey(watchKey.GetPubKey());
+    const CScript coinbaseScript = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.AddWatchOnly(watchScript, 0);
+        wallet.ScanForWalletTransactions(chainActive.Genesis());
+    }
+
+    auto checkBalances = [&](CAmount nTrusted, CAmount nUnconfirmed, CAmount nImmature, CAmount nWatchOnlyTrusted, CAmount nWatchOnlyUnconfirmed) {
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), nTrusted);
+        BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nUnconfirmed);
+        BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+        BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), nWatchOnlyTrusted);
+        BOOST_CHECK_EQUAL(wallet.GetUnconfirmedWatchOnlyBalance(), nWatchOnlyUnconfirmed);
+        BOOST_CHECK_EQUAL(wallet.GetImmatureWatchOnlyBalance(), 0);
+    };
+
+    // coinbaseTxns[i] has a depth of 100 - i
+    const int nMaturity = ConfirmationsPerNetwork() + 1;
+    const size_t nNextMaturing = coinbaseTxns.size() + 1 - nMaturity;
+    CAmount nTrusted = 0;
+    CAmount nImmature = 0;
+    for (size_t i = 0; i < coinbaseTxns.size(); i++) {
+        if (i < nNextMaturing) {
+            nTrusted += wallet.GetCredit(coinbaseTxns[i], ISMINE_SPENDABLE);
+        } else {
+            nImmature += wallet.GetCredit(coinbaseTxns[i], ISMINE_SPENDABLE);
+        }
+    }
+    checkBalances(nTrusted, 0, nImmature, 0, 0);
+
+    // txA sends part of a mature coinbase to two watch-only outputs, txB spends
+    // the first of them back to us and is therefore not trusted while unconfirmed
+    const CAmount nFee = CENT;
+    const CAmount nWatched = 100 * COIN;
+    const CAmount nSpent = coinbaseTxns[0].vout[0].nValue;
+    CMutableTransaction txA;
+    txA.vin.emplace_back(COutPoint(coinbaseTxns[0].GetHash(), 0));
+    txA.vout.emplace_back(nWatched, watchScript);
+    txA.vout.emplace_back(nWatched, watchScript);
+    txA.vout.emplace_back(nSpent - 2 * nWatched - nFee, coinbaseScript);
+    BOOST_CHECK(SignSignature(wallet, coinbaseTxns[0], txA, 0, SIGHASH_ALL));
+
+    CBasicKeyStore watchKeystore;
+    watchKeystore.AddKey(watchKey);
+    CMutableTransaction txB;
+    txB.vin.emplace_back(COutPoint(txA.GetHash(), 0));
+    txB.vout.emplace_back(nWatched - nFee, coinbaseScript);
+    BOOST_CHECK(SignSignature(watchKeystore, CTransaction(txA), txB, 0, SIGHASH_ALL));
+
+    for (const CMutableTransaction& mtx : {txA, txB}) {
+        CTransactionRef ptx = MakeTransactionRef(mtx);
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(AcceptToMemoryPool(mempool, state, ptx, false, nullptr, true, 0));
+        }
+        wallet.TransactionAddedToMempool(ptx, GetTime());
+    }
+    nTrusted -= 2 * nWatched + nFee;
+    checkBalances(nTrusted, nWatched - nFee, nImmature, nWatched, 0);
+
+    // The ISLOCK makes txB trusted
+    CKey sporkKey;
+    sporkKey.MakeNewKey(false);
+    CBitcoinAddress sporkAddress;
+    sporkAddress.Set(sporkKey.GetPubKey().GetID());
+    BOOST_CHECK(sporkManager.SetSporkAddress(sporkAddress.ToString()));
+    BOOST_CHECK(sporkManager.SetMinSporkKeys(1));
+    BOOST_CHECK(sporkManager.SetPrivKey(CBitcoinSecret(sporkKey).ToString()));
+    BOOST_CHECK(sporkManager.UpdateSpork(SPORK_2_INSTANTSEND_ENABLED, 0, *connman));
+
+    llmq::CInstantSendLock islock;
+    islock.txid = txB.GetHash();
+    islock.inputs.emplace_back(txB.vin[0].prevout);
+    llmq::quorumInstantSendManager->ProcessInstantSendLock(-1, ::SerializeHash(islock), islock);
+    wallet.NotifyTransactionLock(CTransaction(txB), islock);
+    nTrusted += nWatched - nFee;
+    checkBalances(nTrusted, 0, nImmature, nWatched, 0);
+
+    // Mining both moves the next coinbase from immature to trusted and adds the
+    // new one as immature, txA and txB stay trusted
+    CBlock block = CreateAndProcessBlock({txA, txB}, coinbaseScript);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+        wallet.BlockConnected(std::make_shared<const CBlock>(block), chainActive.Tip(), {});
+    }
+    const CAmount nMatured = wallet.GetCredit(coinbaseTxns[nNextMaturing], ISMINE_SPENDABLE);
+    nTrusted += nMatured;
+    nImmature += wallet.GetCredit(*block.vtx[0], ISMINE_SPENDABLE) - nMatured;
+    checkBalances(nTrusted, 0, nImmature, nWatched, 0);
+
+    sporkManager.Clear();
+}
+
 static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64_t blockTime)
 {
     CMutableTransaction tx;
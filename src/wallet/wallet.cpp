@@ -8,6 +8,7 @@
 #include "wallet/wallet.h"
 
 #include "base58.h"
+#include "blockfilterindex.h"
 #include "checkpoints.h"
 #include "chain.h"
 #include "wallet/coincontrol.h"
@@ -49,6 +50,8 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
 
+#include <condition_variable>
+
 std::vector<CWalletRef> vpwallets;
 /** Transaction fee set by the user */
 CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
@@ -795,6 +798,7 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
     setWalletUTXO.erase(outpoint);
+    MarkBalanceDirty(outpoint.hash);
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -1436,6 +1440,7 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
 
     fAnonymizableTallyCached = false;
     fAnonymizableTallyCachedNonDenom = false;
+    MarkBalanceDirty(tx.GetHash());
 }
 
 void CWallet::TransactionAddedToMempool(const CTransactionRef& ptx, int64_t nAcceptTime) {
@@ -1443,6 +1448,14 @@ void CWallet::TransactionAddedToMempool(const CTransactionRef& ptx, int64_t nAcc
     SyncTransaction(ptx);
 }
 
+void CWallet::TransactionRemovedFromMempool(const CTransactionRef& ptx) {
+    LOCK(cs_wallet);
+    // Trust of unconfirmed transactions depends on mempool membership
+    if (mapWallet.count(ptx->GetHash())) {
+        MarkBalanceDirty(ptx->GetHash());
+    }
+}
+
 void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) {
     LOCK2(cs_main, cs_wallet);
     // TODO: Temporarily ensure that mempool removals are notified before
@@ -2006,6 +2019,15 @@ int64_t CWallet::RescanFromTime(int64_t startTime, bool update)
  */
 CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    int nThreads = gArgs.GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0) {
+        nThreads = GetNumCores();
+    }
+    nThreads = std::min(nThreads, MAX_RESCAN_THREADS);
+    if (nThreads > 1) {
+        return ScanForWalletTransactionsParallel(pindexStart, fUpdate, nThreads);
+    }
+
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
@@ -2016,6 +2038,15 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
         fAbortRescan = false;
         fScanningWallet = true;
 
+        // Blocks whose compact filter matches none of our scripts neither pay to
+        // nor spend from this wallet and don't need to be read at all
+        size_t nKeyStoreSize = GetScanKeyStoreSize();
+        CGCSFilter::ElementSet filterElements;
+        if (pblockfilterindex) {
+            filterElements = GetBlockFilterElements();
+        }
+        uint64_t nBlocksSkipped = 0;
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
         double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
@@ -2028,11 +2059,22 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
             }
 
+            CBlockFilter filter;
+            if (pblockfilterindex && pblockfilterindex->LookupFilter(pindex, filter) && !filter.GetFilter().MatchAny(filterElements)) {
+                nBlocksSkipped++;
+                pindex = chainActive.Next(pindex);
+                continue;
+            }
+
             CBlock block;
             if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
                     AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
                 }
+                if (pblockfilterindex && GetScanKeyStoreSize() != nKeyStoreSize) {
+                    nKeyStoreSize = GetScanKeyStoreSize();
+                    filterElements = GetBlockFilterElements();
+                }
             } else {
                 ret = pindex;
             }
@@ -2041,6 +2083,9 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
         if (pindex && fAbortRescan) {
             LogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
         }
+        if (nBlocksSkipped > 0) {
+            LogPrintf("Rescan skipped %u blocks using compact block filters\n", nBlocksSkipped);
+        }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
 
         fScanningWallet = false;
@@ -2048,6 +2093,389 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
     return ret;
 }
 
+size_t CWallet::GetScanKeyStoreSize() const
+{
+    LOCK(cs_KeyStore);
+    return (size_t)m_max_keypool_index + mapKeys.size() + mapHdPubKeys.size() + mapScripts.size() + setWatchOnly.size();
+}
+
+/**
+ * Note that compact block filters only contain output scripts and the scripts of
+ * spent outputs, so blocks that merely conflict with a wallet transaction by
+ * spending one of its foreign inputs are not detected through them.
+ */
+CGCSFilter::ElementSet CWallet::GetBlockFilterElements() const
+{
+    CGCSFilter::ElementSet elements;
+    auto addScript = [&](const CScript& script) {
+        elements.emplace(script.begin(), script.end());
+    };
+    auto addKey = [&](const CPubKey& pubkey) {
+        addScript(GetScriptForDestination(pubkey.GetID()));
+        addScript(GetScriptForRawPubKey(pubkey));
+    };
+
+    std::set<CKeyID> setKeyIds;
+    GetKeys(setKeyIds);
+    for (const CKeyID& keyId : setKeyIds) {
+        CPubKey pubkey;
+        if (GetPubKey(keyId, pubkey)) {
+            addKey(pubkey);
+        }
+    }
+
+    LOCK(cs_KeyStore);
+    for (const auto& p : mapHdPubKeys) {
+        addKey(p.second.extPubKey.pubkey);
+    }
+    for (const auto& p : mapScripts) {
+        addScript(GetScriptForDestination(CScriptID(p.second)));
+        addScript(p.second);
+    }
+    for (const CScript& script : setWatchOnly) {
+        addScript(script);
+    }
+    return elements;
+}
+
+namespace {
+
+/** Read-only copy of everything ::IsMine() needs, so outputs can be matched without cs_wallet */
+class CWalletScanKeyStore : public CBasicKeyStore
+{
+private:
+    std::set<CKeyID> setKeyIds;
+
+public:
+    CWalletScanKeyStore(std::set<CKeyID>&& setKeyIdsIn, const ScriptMap& mapScriptsIn, const WatchOnlySet& setWatchOnlyIn) :
+        setKeyIds(std::move(setKeyIdsIn))
+    {
+        mapScripts = mapScriptsIn;
+        setWatchOnly = setWatchOnlyIn;
+    }
+
+    bool HaveKey(const CKeyID& address) const override
+    {
+        return setKeyIds.count(address) > 0;
+    }
+};
+
+/** A block travelling through the rescan pipeline */
+struct CWalletScanSlot
+{
+    std::shared_ptr<CBlock> pblock;
+    bool fRead{false};
+    //! some output matched the key store snapshot
+    bool fMatched{false};
+    //! the compact filter of the block matched no wallet script, the block was not read
+    bool fSkipped{false};
+    //! generation of the key store snapshot used for matching
+    uint64_t nGeneration{0};
+    bool fDone{false};
+};
+
+/**
+ * Reader thread + matcher pool feeding an in-order committer. Blocks are read
+ * sequentially, at most nWindow blocks ahead of the last committed one, and are
+ * then matched against the current key store snapshot on the matcher pool.
+ */
+class CWalletScanPipeline
+{
+private:
+    const std::vector<CBlockIndex*>& vBlocks;
+    const size_t nWindow;
+
+    std::mutex cs;
+    std::condition_variable cv;
+    std::vector<CWalletScanSlot> vSlots;
+    size_t nCommitted{0};
+    bool fStop{false};
+    std::shared_ptr<const CKeyStore> keystore;
+    std::shared_ptr<const CGCSFilter::ElementSet> filterElements;
+    uint64_t nGeneration{0};
+
+    const CBlockFilterIndex* filterIndex;
+    std::atomic<uint64_t> nBytesRead{0};
+    ctpl::thread_pool matcherPool;
+    std::thread readerThread;
+
+public:
+    CWalletScanPipeline(const std::vector<CBlockIndex*>& _vBlocks, int nThreads, std::shared_ptr<const CKeyStore> _keystore,
+                        const CBlockFilterIndex* _filterIndex, std::shared_ptr<const CGCSFilter::ElementSet> _filterElements) :
+        vBlocks(_vBlocks),
+        nWindow((size_t)nThreads * RESCAN_BLOCKS_PER_THREAD),
+        vSlots(nWindow),
+        keystore(std::move(_keystore)),
+        filterElements(std::move(_filterElements)),
+        filterIndex(_filterIndex),
+        matcherPool(nThreads)
+    {
+        RenameThreadPool(matcherPool, "lokal_coin-rescan");
+        readerThread = std::thread(&CWalletScanPipeline::ReaderThread, this);
+    }
+
+    ~CWalletScanPipeline()
+    {
+        {
+            std::unique_lock<std::mutex> l(cs);
+            fStop = true;
+        }
+        cv.notify_all();
+        readerThread.join();
+        matcherPool.stop(true);
+    }
+
+    uint64_t GetBytesRead() const { return nBytesRead; }
+
+    //! Replace the key store snapshot, blocks matched against older snapshots must be rechecked
+    uint64_t UpdateKeyStore(std::shared_ptr<const CKeyStore> _keystore, std::shared_ptr<const CGCSFilter::ElementSet> _filterElements)
+    {
+        std::unique_lock<std::mutex> l(cs);
+        keystore = std::move(_keystore);
+        filterElements = std::move(_filterElements);
+        return ++nGeneration;
+    }
+
+    //! Wait for block i to be read and matched, the slot is released for block i + nWindow
+    CWalletScanSlot Take(size_t i)
+    {
+        CWalletScanSlot slot;
+        {
+            std::unique_lock<std::mutex> l(cs);
+            CWalletScanSlot& s = vSlots[i % nWindow];
+            cv.wait(l, [&] { return s.fDone; });
+            slot = std::move(s);
+            s = CWalletScanSlot();
+            nCommitted = i + 1;
+        }
+        cv.notify_all();
+        return slot;
+    }
+
+private:
+    void ReaderThread()
+    {
+        RenameThread("lokal_coin-rescan-rd");
+
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            std::shared_ptr<const CGCSFilter::ElementSet> matchElements;
+            uint64_t nMatchGeneration;
+            {
+                std::unique_lock<std::mutex> l(cs);
+                cv.wait(l, [&] { return fStop || i < nCommitted + nWindow; });
+                if (fStop) {
+                    return;
+                }
+                matchElements = filterElements;
+                nMatchGeneration = nGeneration;
+            }
+
+            CBlockFilter filter;
+            if (filterIndex && matchElements && filterIndex->LookupFilter(vBlocks[i], filter) && !filter.GetFilter().MatchAny(*matchElements)) {
+                {
+                    std::unique_lock<std::mutex> l(cs);
+                    CWalletScanSlot& slot = vSlots[i % nWindow];
+                    slot.fSkipped = true;
+                    slot.nGeneration = nMatchGeneration;
+                    slot.fDone = true;
+                }
+                cv.notify_all();
+                continue;
+            }
+
+            // Blocks in the active chain were fully validated when connected, so
+            // skip the IBD header checks of ReadBlockFromDisk, they need cs_main
+            // which is held by the committing thread.
+            auto pblock = std::make_shared<CBlock>();
+            bool fRead = false;
+            CAutoFile filein(OpenBlockFile(vBlocks[i]->GetBlockPos(), true), SER_DISK, CLIENT_VERSION);
+            if (!filein.IsNull()) {
+                try {
+                    filein >> *pblock;
+                    fRead = true;
+                    nBytesRead += ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s at %s\n", __func__, e.what(), vBlocks[i]->GetBlockPos().ToString());
+                }
+            } else {
+                LogPrintf("%s: OpenBlockFile failed for %s\n", __func__, vBlocks[i]->GetBlockPos().ToString());
+            }
+
+            matcherPool.push([this, i, pblock, fRead](int) {
+                Match(i, pblock, fRead);
+            });
+        }
+    }
+
+    void Match(size_t i, const std::shared_ptr<CBlock>& pblock, bool fRead)
+    {
+        std::shared_ptr<const CKeyStore> matchKeyStore;
+        uint64_t nMatchGeneration;
+        {
+            std::unique_lock<std::mutex> l(cs);
+            matchKeyStore = keystore;
+            nMatchGeneration = nGeneration;
+        }
+
+        if (fRead && pblock->GetHash() != vBlocks[i]->GetBlockHash()) {
+            LogPrintf("%s: GetHash() doesn't match index for %s at %s\n", __func__,
+                      vBlocks[i]->ToString(), vBlocks[i]->GetBlockPos().ToString());
+            fRead = false;
+        }
+
+        bool fMatched = false;
+        if (fRead) {
+            for (const auto& tx : pblock->vtx) {
+                for (const CTxOut& txout : tx->vout) {
+                    if (::IsMine(*matchKeyStore, txout.scriptPubKey) != ISMINE_NO) {
+                        fMatched = true;
+                        break;
+                    }
+                }
+                if (fMatched) {
+                    break;
+                }
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> l(cs);
+            CWalletScanSlot& slot = vSlots[i % nWindow];
+            slot.pblock = pblock;
+            slot.fRead = fRead;
+            slot.fMatched = fMatched;
+            slot.nGeneration = nMatchGeneration;
+            slot.fDone = true;
+        }
+        cv.notify_all();
+    }
+};
+
+} // namespace
+
+CBlockIndex* CWallet::ScanForWalletTransactionsParallel(CBlockIndex* pindexStart, bool fUpdate, int nThreads)
+{
+    int64_t nNow = GetTime();
+    int64_t nTimeStart = GetTimeMicros();
+    const CChainParams& chainParams = Params();
+
+    CBlockIndex* ret = nullptr;
+    {
+        LOCK2(cs_main, cs_wallet);
+        fAbortRescan = false;
+        fScanningWallet = true;
+
+        // chainActive can't change while we hold cs_main
+        std::vector<CBlockIndex*> vBlocks;
+        for (CBlockIndex* pindex = pindexStart; pindex; pindex = chainActive.Next(pindex)) {
+            vBlocks.push_back(pindex);
+        }
+
+        auto makeFilterElements = [&]() -> std::shared_ptr<const CGCSFilter::ElementSet> {
+            if (!pblockfilterindex) {
+                return nullptr;
+            }
+            return std::make_shared<const CGCSFilter::ElementSet>(GetBlockFilterElements());
+        };
+        auto makeKeyStore = [&]() {
+            std::set<CKeyID> setKeyIds;
+            GetKeys(setKeyIds);
+            for (const auto& p : mapHdPubKeys) {
+                setKeyIds.insert(p.first);
+            }
+            LOCK(cs_KeyStore);
+            return std::make_shared<const CWalletScanKeyStore>(std::move(setKeyIds), mapScripts, setWatchOnly);
+        };
+
+        size_t nKeyStoreSize = GetScanKeyStoreSize();
+        uint64_t nGeneration = 0;
+        uint64_t nTxScanned = 0;
+        uint64_t nBlocksProcessed = 0;
+        uint64_t nBlocksSkipped = 0;
+
+        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+        double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindexStart);
+        double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
+
+        LogPrintf("Rescanning %u blocks from height %d using %d threads\n", vBlocks.size(), pindexStart ? pindexStart->nHeight : -1, nThreads);
+
+        CWalletScanPipeline pipeline(vBlocks, nThreads, makeKeyStore(), pblockfilterindex.get(), makeFilterElements());
+        size_t i = 0;
+        for (; i < vBlocks.size() && !fAbortRescan; i++) {
+            CBlockIndex* pindex = vBlocks[i];
+            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            if (GetTime() >= nNow + 60) {
+                nNow = GetTime();
+                double dElapsed = (GetTimeMicros() - nTimeStart) * 0.000001;
+                LogPrintf("Still rescanning. At block %d. Progress=%f (%.1f blocks/s, %.2f MB/s, %u blocks processed)\n", pindex->nHeight,
+                          GuessVerificationProgress(chainParams.TxData(), pindex), i / dElapsed, pipeline.GetBytesRead() / dElapsed / 1000000, nBlocksProcessed);
+            }
+
+            CWalletScanSlot slot = pipeline.Take(i);
+            if (slot.fSkipped) {
+                if (slot.nGeneration == nGeneration) {
+                    nBlocksSkipped++;
+                    continue;
+                }
+                // keys were added after the filter was checked, the block has to be looked at after all
+                slot.pblock = std::make_shared<CBlock>();
+                slot.fRead = ReadBlockFromDisk(*slot.pblock, pindex, chainParams.GetConsensus());
+            }
+            if (!slot.fRead) {
+                ret = pindex;
+                continue;
+            }
+            const CBlock& block = *slot.pblock;
+            nTxScanned += block.vtx.size();
+
+            // Outputs were matched by the pipeline, inputs and already known
+            // transactions are checked against the live wallet state as they
+            // may refer to transactions added earlier in this rescan
+            bool fRelevant = slot.fMatched || slot.nGeneration != nGeneration;
+            for (size_t posInBlock = 0; posInBlock < block.vtx.size() && !fRelevant; ++posInBlock) {
+                const CTransaction& tx = *block.vtx[posInBlock];
+                if (mapWallet.count(tx.GetHash())) {
+                    fRelevant = true;
+                    break;
+                }
+                for (const CTxIn& txin : tx.vin) {
+                    if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout)) {
+                        fRelevant = true;
+                        break;
+                    }
+                }
+            }
+            if (!fRelevant) {
+                continue;
+            }
+
+            nBlocksProcessed++;
+            for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
+                AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+            }
+
+            size_t nNewKeyStoreSize = GetScanKeyStoreSize();
+            if (nNewKeyStoreSize != nKeyStoreSize) {
+                nKeyStoreSize = nNewKeyStoreSize;
+                nGeneration = pipeline.UpdateKeyStore(makeKeyStore(), makeFilterElements());
+            }
+        }
+        if (i < vBlocks.size() && fAbortRescan) {
+            LogPrintf("Rescan aborted at block %d. Progress=%f\n", vBlocks[i]->nHeight, GuessVerificationProgress(chainParams.TxData(), vBlocks[i]));
+        }
+        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        double dElapsed = (GetTimeMicros() - nTimeStart) * 0.000001;
+        LogPrintf("Rescan of %u blocks (%u transactions, %u blocks processed by wallet, %u blocks skipped by filter) done in %.2fs (%.1f blocks/s, %.2f MB/s)\n",
+                  i, nTxScanned, nBlocksProcessed, nBlocksSkipped, dElapsed, dElapsed > 0 ? i / dElapsed : 0.0,
+                  dElapsed > 0 ? pipeline.GetBytesRead() / dElapsed / 1000000 : 0.0);
+
+        fScanningWallet = false;
+    }
+    return ret;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2113,6 +2541,25 @@ std::set<uint256> CWalletTx::GetConflicts() const
     return result;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fAnonymizedCreditCached = false;
+    fDenomUnconfCreditCached = false;
+    fDenomConfCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet) {
+        pwallet->MarkBalanceDirty(GetHash());
+    }
+}
+
 CAmount CWalletTx::GetDebit(const isminefilter& filter) const
 {
     if (tx->vin.empty())
@@ -2480,18 +2927,149 @@ std::unordered_set<const CWalletTx*, WalletTxHasher> CWallet::GetSpendableTXs()
     return ret;
 }
 
-CAmount CWallet::GetBalance() const
+CWalletBalanceTally& CWalletBalanceTally::operator+=(const CWalletBalanceTally& other)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    nTrusted += other.nTrusted;
+    nUnconfirmed += other.nUnconfirmed;
+    nImmature += other.nImmature;
+    nWatchOnlyTrusted += other.nWatchOnlyTrusted;
+    nWatchOnlyUnconfirmed += other.nWatchOnlyUnconfirmed;
+    nWatchOnlyImmature += other.nWatchOnlyImmature;
+    nAnonymized += other.nAnonymized;
+    nDenominatedConfirmed += other.nDenominatedConfirmed;
+    nDenominatedUnconfirmed += other.nDenominatedUnconfirmed;
+    return *this;
+}
+
+CWalletBalanceTally& CWalletBalanceTally::operator-=(const CWalletBalanceTally& other)
+{
+    nTrusted -= other.nTrusted;
+    nUnconfirmed -= other.nUnconfirmed;
+    nImmature -= other.nImmature;
+    nWatchOnlyTrusted -= other.nWatchOnlyTrusted;
+    nWatchOnlyUnconfirmed -= other.nWatchOnlyUnconfirmed;
+    nWatchOnlyImmature -= other.nWatchOnlyImmature;
+    nAnonymized -= other.nAnonymized;
+    nDenominatedConfirmed -= other.nDenominatedConfirmed;
+    nDenominatedUnconfirmed -= other.nDenominatedUnconfirmed;
+    return *this;
+}
+
+void CWallet::MarkBalanceDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    setBalanceDirty.insert(hash);
+}
+
+CWalletBalanceEntry CWallet::GetBalanceEntry(const CWalletTx& wtx) const
+{
+    CWalletBalanceEntry entry;
+    CWalletBalanceTally& tally = entry.contribution;
+
+    const int nDepth = wtx.GetDepthInMainChain();
+    const bool fTrusted = wtx.IsTrusted();
+    const bool fUnconfirmed = !fTrusted && nDepth == 0 && !wtx.IsLockedByInstaLOKAL() && wtx.InMempool();
+    if (fTrusted) {
+        tally.nTrusted = wtx.GetAvailableCredit();
+        tally.nWatchOnlyTrusted = wtx.GetAvailableWatchOnlyCredit();
+    } else if (fUnconfirmed) {
+        tally.nUnconfirmed = wtx.GetAvailableCredit();
+        tally.nWatchOnlyUnconfirmed = wtx.GetAvailableWatchOnlyCredit();
+    }
+    tally.nImmature = wtx.GetImmatureCredit();
+    tally.nWatchOnlyImmature = wtx.GetImmatureWatchOnlyCredit();
+    if (balanceTally.fPrivateSendTallied) {
+        tally.nAnonymized = wtx.GetAnonymizedCredit();
+        tally.nDenominatedConfirmed = wtx.GetDenominatedCredit(false);
+        tally.nDenominatedUnconfirmed = wtx.GetDenominatedCredit(true);
+    }
+
+    // Deeper confirmations change nothing else, only maturity has to be followed
+    entry.fUnconfirmed = nDepth == 0;
+    const int nBlocksToMaturity = nDepth > 0 ? wtx.GetBlocksToMaturity() : 0;
+    if (nBlocksToMaturity > 0) {
+        entry.nMaturityHeight = chainActive.Height() + nBlocksToMaturity;
+    }
+    return entry;
+}
+
+void CWallet::RecountBalance(const uint256& hash) const
+{
+    auto it = mapBalanceEntries.find(hash);
+    if (it != mapBalanceEntries.end()) {
+        const CWalletBalanceEntry& entry = it->second;
+        balanceTally -= entry.contribution;
+        if (entry.fUnconfirmed) {
+            setBalanceUnconfirmed.erase(hash);
+        }
+        auto range = mapBalanceMaturity.equal_range(entry.nMaturityHeight);
+        for (auto jt = range.first; jt != range.second; ++jt) {
+            if (jt->second == hash) {
+                mapBalanceMaturity.erase(jt);
+                break;
+            }
         }
+        mapBalanceEntries.erase(it);
     }
 
-    return nTotal;
+    // Transactions removed from the wallet just drop out of the tally
+    const auto jt = mapWallet.find(hash);
+    if (jt == mapWallet.end()) {
+        return;
+    }
+
+    CWalletBalanceEntry entry = GetBalanceEntry(jt->second);
+    balanceTally += entry.contribution;
+    if (entry.fUnconfirmed) {
+        setBalanceUnconfirmed.insert(hash);
+    }
+    if (entry.nMaturityHeight >= 0) {
+        mapBalanceMaturity.emplace(entry.nMaturityHeight, hash);
+    }
+    mapBalanceEntries.emplace(hash, std::move(entry));
+}
+
+const CWalletBalanceTally& CWallet::GetBalanceTally() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    const bool fTallyPrivateSend = privateSendClient.fEnablePrivateSend;
+    if (pindexBalanceTally == nullptr || pindexTip == nullptr ||
+        balanceTally.fPrivateSendTallied != fTallyPrivateSend ||
+        pindexTip->GetAncestor(pindexBalanceTally->nHeight) != pindexBalanceTally) {
+        // Nothing counted yet, a reorg or PrivateSend toggled: count every transaction again
+        balanceTally = CWalletBalanceTally();
+        balanceTally.fPrivateSendTallied = fTallyPrivateSend;
+        mapBalanceEntries.clear();
+        setBalanceUnconfirmed.clear();
+        mapBalanceMaturity.clear();
+        setBalanceDirty.clear();
+        for (const auto& item : mapWallet) {
+            setBalanceDirty.insert(item.first);
+        }
+    } else if (pindexTip != pindexBalanceTally) {
+        // BlockConnected is delivered asynchronously, so follow the tip here rather
+        // than in the notification to never report balances for a stale depth
+        for (auto it = mapBalanceMaturity.begin(); it != mapBalanceMaturity.end() && it->first <= pindexTip->nHeight; ++it) {
+            setBalanceDirty.insert(it->second);
+        }
+        setBalanceDirty.insert(setBalanceUnconfirmed.begin(), setBalanceUnconfirmed.end());
+    }
+    pindexBalanceTally = pindexTip;
+
+    for (const uint256& hash : setBalanceDirty) {
+        RecountBalance(hash);
+    }
+    setBalanceDirty.clear();
+    return balanceTally;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nTrusted;
 }
 
 CAmount CWallet::GetAnonymizableBalance(bool fSkipDenominated, bool fSkipUnconfirmed) const
@@ -2520,15 +3098,8 @@ CAmount CWallet::GetAnonymizedBalance() const
 {
     if(!privateSendClient.fEnablePrivateSend) return 0;
 
-    CAmount nTotal = 0;
-
     LOCK2(cs_main, cs_wallet);
-
-    for (auto pcoin : GetSpendableTXs()) {
-        nTotal += pcoin->GetAnonymizedCredit();
-    }
-
-    return nTotal;
+    return GetBalanceTally().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -2581,79 +3152,39 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(!privateSendClient.fEnablePrivateSend) return 0;
 
-    CAmount nTotal = 0;
-
     LOCK2(cs_main, cs_wallet);
-
-    for (auto pcoin : GetSpendableTXs()) {
-        nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-    }
-
-    return nTotal;
+    const CWalletBalanceTally& tally = GetBalanceTally();
+    return unconfirmed ? tally.nDenominatedUnconfirmed : tally.nDenominatedConfirmed;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && !pcoin->IsLockedByInstaLOKAL() && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && !pcoin->IsLockedByInstaLOKAL() && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto pcoin : GetSpendableTXs()) {
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceTally().nWatchOnlyImmature;
 }
 
 // Calculate total balance in a different way from GetBalance. The biggest
@@ -4037,7 +4568,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
     return true;
 }
 
-bool CWallet::CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript, unsigned int nBits, const CBlock &blockFrom, unsigned int nTxPrevOffset, const CTransactionRef &txPrev, const COutPoint &prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const
+bool CWallet::CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript, unsigned int nBits, const CBlockHeader &blockFrom, unsigned int nTxPrevOffset, const CTransactionRef &txPrev, const COutPoint &prevout, unsigned int &nTimeTx, bool fPrintProofOfStake, unsigned int nSearchFrom, uint64_t* pnKernelChecks) const
 {
     unsigned int nTryTime = 0;
     uint256 hashProofOfStake = uint256();
@@ -4048,7 +4579,12 @@ bool CWallet::CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeS
     for(unsigned int i = 0; i < nHashDrift; ++i)
     {
         nTryTime = nTimeTx - i;
-        if (CheckStakeKernelHash(nBits, chainActive.Tip(), blockFrom, nTxPrevOffset, txPrev, prevout, nTryTime, hashProofOfStake, true, false))
+        // Timestamps up to nSearchFrom were already tried against this tip
+        if (nTryTime <= nSearchFrom)
+            break;
+        if (pnKernelChecks)
+            ++*pnKernelChecks;
+        if (CheckStakeKernelHash(nBits, chainActive.Tip(), blockFrom, nTxPrevOffset, txPrev->vout[prevout.n], prevout, nTryTime, hashProofOfStake, true, false))
         {
             //Double check that this will pass time requirements
             if (nTryTime <= chainActive.Tip()->GetMedianTimePast()) {
@@ -4163,7 +4699,7 @@ void CWallet::FillCoinStakePayments(CMutableTransaction &transaction,
 }
 
 typedef std::vector<unsigned char> valtype;
-bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAmount blockReward, CMutableTransaction &txNew, unsigned int &nTxNewTime, std::vector<const CWalletTx*> &vwtxPrev)
+bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAmount blockReward, CMutableTransaction &txNew, unsigned int &nTxNewTime, std::vector<const CWalletTx*> &vwtxPrev, unsigned int nSearchFrom, uint64_t* pnKernelChecks)
 {
     // The following split & combine thresholds are important to security
     // Should not be adjusted if you don't understand the consequences
@@ -4202,6 +4738,9 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAm
     // if (GetAdjustedTime() <= chainActive.Tip()->nTime)
     //     MilliSleep(10000);
 
+    // All coins are searched over the same timestamps
+    const unsigned int nSearchTime = nTxNewTime;
+
     bool fKernelFound = false;
     for(const std::pair<const CWalletTx*, unsigned int> &pcoin : setStakeCoins)
     {
@@ -4218,11 +4757,11 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAm
         // Read block header
         CBlockHeader block = pindex->GetBlockHeader();
         COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+        nTxNewTime = nSearchTime;
         //iterates each utxo inside of CheckStakeKernelHash()
         CScript kernelScript;
         auto stakeScript = pcoin.first->tx->vout[pcoin.second].scriptPubKey;
-        fKernelFound = CreateCoinStakeKernel(kernelScript, stakeScript, nBits, block, sizeof(CBlock), pcoin.first->tx, prevoutStake, nTxNewTime, false);
+        fKernelFound = CreateCoinStakeKernel(kernelScript, stakeScript, nBits, block, sizeof(CBlock), pcoin.first->tx, prevoutStake, nTxNewTime, false, nSearchFrom, pnKernelChecks);
         if(fKernelFound) {
             FillCoinStakePayments(txNew, kernelScript, prevoutStake, blockReward);
             break;
@@ -4436,8 +4975,10 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
     AssertLockHeld(cs_wallet); // mapWallet
     vchDefaultKey = CPubKey();
     DBErrors nZapSelectTxRet = CWalletDB(*dbw,"cr+").ZapSelectTx(vHashIn, vHashOut);
-    for (uint256 hash : vHashOut)
+    for (uint256 hash : vHashOut) {
         mapWallet.erase(hash);
+        MarkBalanceDirty(hash);
+    }
 
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -5259,6 +5800,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
+    strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf(_("Number of threads used to match blocks during a rescan (1 = serial, 0 = auto, max: %d, default: %d)"), MAX_RESCAN_THREADS, DEFAULT_RESCAN_THREADS));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
@@ -5791,6 +6333,8 @@ void CWallet::NotifyTransactionLock(const CTransaction &tx, const llmq::CInstant
     uint256 txHash = tx.GetHash();
     std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txHash);
     if (mi != mapWallet.end()){
+        // locked transactions become trusted
+        MarkBalanceDirty(txHash);
         NotifyTransactionChanged(this, txHash, CT_UPDATED);
         NotifyISLockReceived();
         // notify an external script
@@ -5804,6 +6348,8 @@ void CWallet::NotifyTransactionLock(const CTransaction &tx, const llmq::CInstant
 
 void CWallet::NotifyChainLock(const CBlockIndex* pindexChainLock, const llmq::CChainLockSig& clsig)
 {
+    // A ChainLock does not move funds between balance buckets, the reorgs it can
+    // cause are picked up from the tip by GetBalanceTally
     NotifyChainLockReceived(pindexChainLock->nHeight);
 }
 
@@ -10,6 +10,7 @@
 
 #include "amount.h"
 #include "base58.h"
+#include "blockfilter.h"
 #include "policy/feerate.h"
 #include "saltedhasher.h"
 #include "streams.h"
@@ -73,6 +74,12 @@ static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
+//! -rescanthreads default (0 = auto, 1 = serial rescan)
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of matcher threads used by a parallel rescan
+static const int MAX_RESCAN_THREADS = 16;
+//! Number of blocks per matcher thread that may be read ahead of the committed height
+static const int RESCAN_BLOCKS_PER_THREAD = 32;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -128,6 +135,35 @@ struct CompactTallyItem
     }
 };
 
+/** Wallet-wide balance totals, or the contribution of a single transaction to them */
+struct CWalletBalanceTally
+{
+    CAmount nTrusted{0};
+    CAmount nUnconfirmed{0};
+    CAmount nImmature{0};
+    CAmount nWatchOnlyTrusted{0};
+    CAmount nWatchOnlyUnconfirmed{0};
+    CAmount nWatchOnlyImmature{0};
+    // PrivateSend totals are only tallied while mixing is enabled
+    bool fPrivateSendTallied{false};
+    CAmount nAnonymized{0};
+    CAmount nDenominatedConfirmed{0};
+    CAmount nDenominatedUnconfirmed{0};
+
+    CWalletBalanceTally& operator+=(const CWalletBalanceTally& other);
+    CWalletBalanceTally& operator-=(const CWalletBalanceTally& other);
+};
+
+/** How a transaction was last counted in the wallet-wide balance tally */
+struct CWalletBalanceEntry
+{
+    CWalletBalanceTally contribution;
+    //! Tip height at which an immature coinbase or coinstake matures, -1 if it is not immature
+    int nMaturityHeight{-1};
+    //! Unconfirmed transactions change buckets with the tip and the mempool, not only on wallet events
+    bool fUnconfirmed{false};
+};
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -468,21 +504,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fAnonymizedCreditCached = false;
-        fDenomUnconfCreditCached = false;
-        fDenomConfCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -752,6 +774,34 @@ private:
     mutable bool fAnonymizableTallyCachedNonDenom;
     mutable std::vector<CompactTallyItem> vecAnonymizableTallyCachedNonDenom;
 
+    /**
+     * Wallet-wide balances kept as a ledger: balanceTally is the sum of the
+     * contributions in mapBalanceEntries. Wallet events queue the transactions
+     * they touch (see MarkBalanceDirty) and a new tip only queues the unconfirmed
+     * transactions and the coinbases and coinstakes maturing on the way, so a
+     * balance query recounts just those. Everything is counted again after a
+     * reorg or when PrivateSend is toggled.
+     */
+    mutable CWalletBalanceTally balanceTally;
+    mutable std::map<uint256, CWalletBalanceEntry> mapBalanceEntries;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalanceUnconfirmed;
+    mutable std::multimap<int, uint256> mapBalanceMaturity;
+    mutable const CBlockIndex* pindexBalanceTally;
+
+    CWalletBalanceEntry GetBalanceEntry(const CWalletTx& wtx) const;
+    void RecountBalance(const uint256& hash) const;
+    const CWalletBalanceTally& GetBalanceTally() const;
+
+    /**
+     * Keys are only ever added during a rescan (keypool top-ups), so the keypool
+     * index plus the number of keys and scripts tells whether a snapshot of the
+     * key store taken for a rescan is outdated.
+     */
+    size_t GetScanKeyStoreSize() const;
+    /** Every script this wallet can be paid to, to be matched against compact block filters */
+    CGCSFilter::ElementSet GetBlockFilterElements() const;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -771,10 +821,12 @@ private:
 
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
+    /* Search the kernel timestamps in (nSearchFrom, nTimeTx] within the hash drift window, counting the hashes in pnKernelChecks */
     bool CreateCoinStakeKernel(CScript &kernelScript, const CScript &stakeScript,
-                               unsigned int nBits, const CBlock& blockFrom,
+                               unsigned int nBits, const CBlockHeader& blockFrom,
                                unsigned int nTxPrevOffset, const CTransactionRef &txPrev,
-                               const COutPoint& prevout, unsigned int &nTimeTx, bool fPrintProofOfStake) const;
+                               const COutPoint& prevout, unsigned int &nTimeTx, bool fPrintProofOfStake,
+                               unsigned int nSearchFrom = 0, uint64_t* pnKernelChecks = nullptr) const;
     void FillCoinStakePayments(CMutableTransaction &transaction,
                                const CScript &kernelScript,
                                const COutPoint &stakePrevout, CAmount blockReward) const;
@@ -889,6 +941,7 @@ public:
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        pindexBalanceTally = nullptr;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -1052,14 +1105,24 @@ public:
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    //! recount a transaction in the wallet-wide balance tally on the next balance query
+    void MarkBalanceDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     bool LoadToWallet(const CWalletTx& wtxIn);
     void TransactionAddedToMempool(const CTransactionRef& tx, int64_t nAcceptTime) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx) override;
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexDisconnected) override;
     bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
     int64_t RescanFromTime(int64_t startTime, bool update);
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /**
+     * Pipelined variant of the rescan loop: a reader thread prefetches blocks, a pool
+     * of matcher threads tests them against a snapshot of the wallet's scripts and
+     * only blocks that may be relevant are handed to AddToWalletIfInvolvingMe, in
+     * chain order, on the calling thread. Produces the same result as the serial scan.
+     */
+    CBlockIndex* ScanForWalletTransactionsParallel(CBlockIndex* pindexStart, bool fUpdate, int nThreads);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     // ResendWalletTransactionsBefore may only be called if fBroadcastTransactions!
@@ -1094,7 +1157,12 @@ public:
      * @note passing nChangePosInOut as -1 will result in setting a random position
      */
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosInOut, std::string& strFailReason, const CCoinControl& coin_control, bool sign = true, int nExtraPayloadSize = 0);
-    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAmount blockReward, CMutableTransaction& txNew, unsigned int& nTxNewTime, std::vector<const CWalletTx *> &vwtxPrev);
+    /**
+     * Search the stake coins for a kernel with a timestamp in (nSearchFrom, nTxNewTime] and create
+     * the coinstake for it. nTxNewTime is set to the kernel timestamp on success.
+     */
+    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, CAmount blockReward, CMutableTransaction& txNew, unsigned int& nTxNewTime, std::vector<const CWalletTx *> &vwtxPrev,
+                         unsigned int nSearchFrom = 0, uint64_t* pnKernelChecks = nullptr);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state);
 
     bool CreateCollateralTransaction(CMutableTransaction& txCollateral, std::string& strReason);
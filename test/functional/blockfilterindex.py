@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Lokal Coin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the compact block filter index.
+
+Node 0 and 1 run with -blockfilterindex, node 2 without. Checks that the
+filters and the filter header chain served by getblockfilter are consistent,
+and that a wallet rescan which skips blocks using the filters finds exactly
+the same transactions as a full rescan.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, connect_nodes_bi, hash256, hex_str_to_bytes, sync_blocks, wait_until
+
+from decimal import Decimal
+
+class BlockFilterIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [['-blockfilterindex'], ['-blockfilterindex'], []]
+
+    def setup_network(self):
+        self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+
+    def wallet_state(self, node):
+        txs = node.listtransactions("*", 1000, 0, True)
+        txs = sorted((tx['txid'], tx['category'], tx.get('vout', -1), tx['amount'], tx['confirmations']) for tx in txs)
+        utxos = sorted((u['txid'], u['vout'], u['amount']) for u in node.listunspent(0))
+        return node.getbalance("*", 0), txs, utxos
+
+    def wait_for_index(self, node):
+        tip = node.getbestblockhash()
+        def synced():
+            try:
+                node.getblockfilter(tip)
+                return True
+            except Exception:
+                return False
+        wait_until(synced, timeout=60)
+
+    def run_test(self):
+        self.nodes[0].generate(110)
+
+        self.log.info("Fund and spend a set of addresses over many blocks")
+        addresses = [self.nodes[0].getnewaddress() for _ in range(5)]
+        for i in range(20):
+            self.nodes[0].sendtoaddress(addresses[i % len(addresses)], Decimal("2.5") + i)
+            self.nodes[0].generate(1)
+            if i % 6 == 5:
+                self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), self.nodes[0].getbalance() - 1)
+                self.nodes[0].generate(1)
+        self.nodes[0].generate(30)
+        sync_blocks(self.nodes)
+
+        self.log.info("Check the filter header chain")
+        for node in self.nodes[:2]:
+            self.wait_for_index(node)
+        prev_header = b'\x00' * 32
+        for height in range(self.nodes[0].getblockcount() + 1):
+            blockhash = self.nodes[0].getblockhash(height)
+            result = self.nodes[0].getblockfilter(blockhash, "basic")
+            filter_hash = hash256(hex_str_to_bytes(result['filter']))[::-1]
+            header = hash256(filter_hash + prev_header)
+            assert_equal(result['header'], header.hex())
+            assert_equal(self.nodes[1].getblockfilter(blockhash), result)
+            prev_header = header[::-1]
+
+        assert_raises_rpc_error(-1, "Index is not enabled for filtertype basic", self.nodes[2].getblockfilter, self.nodes[2].getbestblockhash())
+        assert_raises_rpc_error(-5, "Unknown filtertype", self.nodes[0].getblockfilter, self.nodes[0].getbestblockhash(), "unknown")
+        assert_raises_rpc_error(-5, "Block not found", self.nodes[0].getblockfilter, "00" * 32)
+
+        self.log.info("Import the keys with and without filter assisted rescans")
+        keys = [self.nodes[0].dumpprivkey(address) for address in addresses]
+        for node in self.nodes[1:]:
+            for key in keys[:-1]:
+                node.importprivkey(key, "", False)
+            node.importprivkey(keys[-1], "", True)
+
+        filtered = self.wallet_state(self.nodes[1])
+        full = self.wallet_state(self.nodes[2])
+        assert len(full[1]) > 0
+        assert_equal(filtered, full)
+
+        self.log.info("Restart with -rescan and compare again")
+        self.stop_node(1)
+        self.start_node(1, self.extra_args[1] + ['-rescan'])
+        assert_equal(self.wallet_state(self.nodes[1]), full)
+
+if __name__ == '__main__':
+    BlockFilterIndexTest().main()
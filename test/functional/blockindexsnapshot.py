@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Lokal Coin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the -blockindexsnapshot startup path.
+
+- Restart a node with -blockindexsnapshot and check it loads the same block index from the snapshot.
+- A corrupted snapshot, or one written before the node ran without the option, is ignored and the
+  block index is loaded from the database instead.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal
+
+import os
+
+SNAPSHOT_LOADED = "loaded block index from blockindex.snapshot"
+
+class BlockIndexSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [['-blockindexsnapshot', '-checkblockindex=1']]
+
+    def snapshot_path(self):
+        return os.path.join(self.nodes[0].datadir, 'regtest', 'blockindex.snapshot')
+
+    def debug_log_size(self):
+        return os.path.getsize(os.path.join(self.nodes[0].datadir, 'regtest', 'debug.log'))
+
+    def start(self, extra_args):
+        log_start = self.debug_log_size()
+        self.start_node(0, extra_args)
+        with open(os.path.join(self.nodes[0].datadir, 'regtest', 'debug.log'), encoding='utf-8') as f:
+            f.seek(log_start)
+            return SNAPSHOT_LOADED in f.read()
+
+    def restart(self, extra_args):
+        self.stop_node(0)
+        return self.start(extra_args)
+
+    def chain_state(self):
+        node = self.nodes[0]
+        headers = [node.getblockheader(node.getblockhash(h)) for h in range(node.getblockcount() + 1)]
+        return node.getbestblockhash(), node.getchaintips(), headers
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(50)
+        # A stale fork, so that the snapshot holds more than the active chain
+        node.invalidateblock(node.getblockhash(45))
+        node.generate(10)
+        node.reconsiderblock(node.getblockhash(45))
+        state = self.chain_state()
+
+        self.log.info("Load the block index from the snapshot")
+        assert self.restart(self.extra_args[0])
+        assert_equal(self.chain_state(), state)
+
+        node = self.nodes[0]
+        node.generate(5)
+        state = self.chain_state()
+        assert self.restart(self.extra_args[0])
+        assert_equal(self.chain_state(), state)
+
+        self.log.info("Ignore a corrupted snapshot")
+        self.stop_node(0)
+        with open(self.snapshot_path(), 'r+b') as f:
+            f.seek(-10, os.SEEK_END)
+            f.write(b'\xff' * 4)
+        assert not self.start(self.extra_args[0])
+        assert_equal(self.chain_state(), state)
+
+        self.log.info("Ignore a snapshot after running without -blockindexsnapshot")
+        assert self.restart(self.extra_args[0])
+        assert not self.restart(['-checkblockindex=1'])
+        self.nodes[0].generate(5)
+        state = self.chain_state()
+        assert not os.path.exists(self.snapshot_path())
+        assert not self.restart(self.extra_args[0])
+        assert_equal(self.chain_state(), state)
+
+if __name__ == '__main__':
+    BlockIndexSnapshotTest().main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Lokal Coin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the coinstats index.
+
+Node 0 runs with -coinstatsindex, node 1 without. Checks that the statistics
+served from the index match a full scan of the UTXO set, including the MuHash,
+that they stay available for past heights, survive reorgs and restarts, and that
+they account for the money supply recorded in the block index.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, connect_nodes_bi, sync_blocks, wait_until
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-coinstatsindex'], []]
+
+    def setup_network(self):
+        self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+
+    def wait_for_index(self):
+        node = self.nodes[0]
+        def synced():
+            try:
+                return node.gettxoutsetinfo('muhash')['bestblock'] == node.getbestblockhash()
+            except Exception:
+                return False
+        wait_until(synced, timeout=60)
+
+    def check_against_scan(self):
+        index = self.nodes[0].gettxoutsetinfo('muhash')
+        scan = self.nodes[1].gettxoutsetinfo('muhash')
+        for key in ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']:
+            assert_equal(index[key], scan[key])
+        assert_equal(index['total_amount'] + index['total_unspendable_amount'], index['money_supply'])
+        return index
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(110)
+        self.wait_for_index()
+
+        self.log.info("Compare the index with a full scan")
+        address = node.getnewaddress()
+        for i in range(10):
+            node.sendtoaddress(address, 1 + i)
+            if i % 3 == 2:
+                node.generate(1)
+        node.generate(2)
+        sync_blocks(self.nodes)
+        self.wait_for_index()
+        stats = self.check_against_scan()
+        assert 'transactions' not in stats
+        assert 'hash_serialized_2' in node.gettxoutsetinfo()
+
+        self.log.info("Look up past heights")
+        history = {}
+        for height in [0, 1, 100, stats['height']]:
+            history[height] = node.gettxoutsetinfo('muhash', height)
+            assert_equal(history[height]['height'], height)
+            assert_equal(history[height]['bestblock'], node.getblockhash(height))
+            assert_equal(node.gettxoutsetinfo('muhash', node.getblockhash(height)), history[height])
+        assert_equal(history[stats['height']], stats)
+        assert_equal(history[0]['txouts'], 0)
+        assert_equal(node.gettxoutsetinfo('none', 100)['txouts'], history[100]['txouts'])
+        assert 'muhash' not in node.gettxoutsetinfo('none')
+
+        assert_raises_rpc_error(-8, "Block height out of range", node.gettxoutsetinfo, 'muhash', 1000)
+        assert_raises_rpc_error(-5, "Block not found", node.gettxoutsetinfo, 'muhash', '00' * 32)
+        assert_raises_rpc_error(-8, "Unknown hash_type", node.gettxoutsetinfo, 'sha1')
+        assert_raises_rpc_error(-8, "requires -coinstatsindex", node.gettxoutsetinfo, 'hash_serialized_2', 100)
+        assert_raises_rpc_error(-8, "requires -coinstatsindex", self.nodes[1].gettxoutsetinfo, 'muhash', 100)
+
+        self.log.info("Revert blocks in a reorg")
+        tip_height = stats['height']
+        node.invalidateblock(node.getblockhash(tip_height - 2))
+        self.wait_for_index()
+        reverted = node.gettxoutsetinfo('muhash')
+        assert_equal(reverted['height'], tip_height - 3)
+        assert_equal(reverted, node.gettxoutsetinfo('muhash', tip_height - 3))
+        node.generate(4)
+        self.wait_for_index()
+        sync_blocks(self.nodes)
+        self.check_against_scan()
+
+        self.log.info("Keep the index across a restart")
+        self.stop_node(0)
+        self.nodes[1].generate(3)
+        self.start_node(0, self.extra_args[0])
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        self.wait_for_index()
+        self.check_against_scan()
+        assert_equal(node.gettxoutsetinfo('muhash', 100), history[100])
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
@@ -21,6 +21,7 @@ Test structure:
 - 4 nodes
   * node0, node1, and node2 will have different dbcrash ratios, and different
     dbcache sizes
+  * node1 writes the chainstate in the background with -dbwritebehind
   * node3 will be a regular node, with no crashing.
   * The nodes will not connect to each other.
 
@@ -54,7 +55,7 @@ class ChainstateWriteCrashTest(BitcoinTestFramework):
         # Set different crash ratios and cache sizes.  Note that not all of
         # -dbcache goes to pcoinsTip.
         self.node0_args = ["-dbcrashratio=8", "-dbcache=4", "-dbbatchsize=200000"] + self.base_args
-        self.node1_args = ["-dbcrashratio=16", "-dbcache=8", "-dbbatchsize=200000"] + self.base_args
+        self.node1_args = ["-dbcrashratio=16", "-dbcache=8", "-dbbatchsize=200000", "-dbwritebehind"] + self.base_args
         self.node2_args = ["-dbcrashratio=24", "-dbcache=16", "-dbbatchsize=200000"] + self.base_args
 
         # Node3 is a normal node with default args, except will mine full blocks
@@ -21,12 +21,42 @@ class LLMQSigningTest(LokalTestFramework):
     def set_test_params(self):
         self.set_lokal_test_params(6, 5, fast_dip3_enforcement=True)
 
+    def check_quorum_connections(self, quorumHash):
+        # Only the members want connections for the quorum, and they all authenticate with each other
+        members = [m["proTxHash"] for m in self.nodes[0].quorum("info", 100, quorumHash)["members"]]
+
+        def get_stats(mn):
+            stats = [q for q in mn.node.quorum("connections")["quorums"] if q["quorumHash"] == quorumHash]
+            assert len(stats) <= 1
+            return stats[0] if stats else None
+
+        def all_ready():
+            for mn in self.mninfo:
+                if mn.proTxHash in members:
+                    stats = get_stats(mn)
+                    if stats is None or not stats["ready"]:
+                        return False
+            return True
+
+        wait_until(all_ready, timeout=30)
+        for mn in self.mninfo:
+            stats = get_stats(mn)
+            if mn.proTxHash not in members:
+                assert stats is None
+                continue
+            assert_equal(stats["type"], "llmq_5_60")
+            assert stats["wanted"] > 0
+            assert_equal(stats["connected"], stats["wanted"])
+            assert_equal(stats["verified"], stats["wanted"])
+        assert_equal(self.nodes[0].quorum("connections")["quorums"], [])
+
     def run_test(self):
 
         self.nodes[0].spork("SPORK_17_QUORUM_DKG_ENABLED", 0)
         self.wait_for_sporks_same()
 
-        self.mine_quorum()
+        qh = self.mine_quorum()
+        self.check_quorum_connections(qh)
 
         id = "0000000000000000000000000000000000000000000000000000000000000001"
         msgHash = "0000000000000000000000000000000000000000000000000000000000000002"
@@ -77,6 +107,14 @@ class LLMQSigningTest(LokalTestFramework):
         self.mine_quorum()
         assert_sigs_nochange(True, False, True, 3)
 
+        # The members of the first quorum dropped its connections, but keep the links pooled
+        members = [m["proTxHash"] for m in self.nodes[0].quorum("info", 100, qh)["members"]]
+        for mn in self.mninfo:
+            if mn.proTxHash in members:
+                conns = mn.node.quorum("connections")
+                assert qh not in [q["quorumHash"] for q in conns["quorums"]]
+                assert conns["pooled"] > 0
+
         # fast forward 6.5 days, recovered sig should still be valid
         self.bump_mocktime(int(60 * 60 * 24 * 6.5))
         set_node_times(self.nodes, self.mocktime)
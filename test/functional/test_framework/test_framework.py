@@ -450,7 +450,7 @@ class BitcoinTestFramework(object):
             for i in range(MAX_NODES):
                 os.remove(log_filename(self.options.cachedir, i, "debug.log"))
                 os.remove(log_filename(self.options.cachedir, i, "db.log"))
-                os.remove(log_filename(self.options.cachedir, i, "peers.dat"))
+                shutil.rmtree(log_filename(self.options.cachedir, i, "peers"))
                 os.remove(log_filename(self.options.cachedir, i, "fee_estimates.dat"))
 
         for i in range(self.num_nodes):
@@ -88,6 +88,11 @@ BASE_SCRIPTS= [
     'reindex.py',
     # vv Tests less than 30s vv
     'keypool-topup.py',
+    'wallet-rescan-parallel.py',
+    'blockfilterindex.py',
+    'blockindexsnapshot.py',
+    'utxosnapshot.py',
+    'coinstatsindex.py',
     'zmq_test.py',
     'bitcoin_cli.py',
     'mempool_resurrect_test.py',
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Lokal Coin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and loadtxoutset.
+
+Node 0 builds a chain with some transactions and dumps its UTXO set. Node 1 starts
+from an empty chainstate, loads the snapshot, must report the same UTXO set and tip,
+keep them across a restart, and then follow node 0 by validating the blocks after
+the snapshot base, including a proof-of-stake block whose kernel is a coin created
+below the base, for which node 1 has neither block data nor a txindex entry.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_greater_than, assert_raises_rpc_error, connect_nodes_bi, force_finish_mnsync, set_node_times, sync_blocks, wait_until
+
+import os
+import shutil
+import time
+
+NODE_NETWORK = 1
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # node 1 must not sync any blocks before it loads the snapshot
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        mocktime = int(time.time())
+        set_node_times(self.nodes, mocktime)
+        # coins staked at the end must be mature and come from below the snapshot base
+        node0.generate(70)
+        address = node0.getnewaddress()
+        for _ in range(10):
+            node0.sendtoaddress(address, 1)
+        node0.generate(5)
+        stats = node0.gettxoutsetinfo()
+
+        self.log.info("Dump the UTXO set")
+        dump = node0.dumptxoutset('utxo.dat')
+        assert_equal(dump['base_hash'], node0.getbestblockhash())
+        assert_equal(dump['base_height'], 75)
+        assert_equal(dump['coins_written'], stats['txouts'])
+        assert_equal(dump['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_raises_rpc_error(-1, "already exists", node0.dumptxoutset, 'utxo.dat')
+        assert not os.path.exists(dump['path'] + '.incomplete')
+
+        snapshot = os.path.join(node1.datadir, 'utxo.dat')
+        shutil.copyfile(dump['path'], snapshot)
+
+        self.log.info("Reject a corrupted snapshot or an unexpected hash")
+        corrupted = os.path.join(node1.datadir, 'corrupted.dat')
+        shutil.copyfile(snapshot, corrupted)
+        with open(corrupted, 'r+b') as f:
+            f.seek(-100, os.SEEK_END)
+            f.write(b'\xff' * 4)
+        assert_raises_rpc_error(-1, "corrupted", node1.loadtxoutset, 'corrupted.dat', dump['snapshot_hash'])
+        assert_raises_rpc_error(-1, "expected", node1.loadtxoutset, 'utxo.dat', '00' * 32)
+        assert_equal(node1.getblockcount(), 0)
+
+        self.log.info("Load the snapshot into node 1")
+        load = node1.loadtxoutset('utxo.dat', dump['snapshot_hash'])
+        assert_equal(load['coins_loaded'], stats['txouts'])
+        assert_equal(node1.getbestblockhash(), dump['base_hash'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_raises_rpc_error(-1, "fresh chainstate", node1.loadtxoutset, 'utxo.dat', dump['snapshot_hash'])
+        assert_equal(int(node1.getnetworkinfo()['localservices'], 16) & NODE_NETWORK, 0)
+
+        self.restart_node(1)
+        node1.setmocktime(mocktime)
+        assert_equal(node1.getbestblockhash(), dump['base_hash'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_equal(int(node1.getnetworkinfo()['localservices'], 16) & NODE_NETWORK, 0)
+
+        self.log.info("Validate new blocks on top of the snapshot")
+        connect_nodes_bi(self.nodes, 0, 1)
+        node0.sendtoaddress(node1.getnewaddress(), 1)
+        node0.generate(10)
+        sync_blocks(self.nodes)
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("Validate a block staking a coin from below the snapshot base")
+        # finish the proof-of-work phase; the coinbases above the base are still immature
+        node0.generate(100 - node0.getblockcount())
+        sync_blocks(self.nodes)
+        set_node_times(self.nodes, mocktime + 60 * 60)
+        force_finish_mnsync(node0)
+        node0.setstaking("true")
+        wait_until(lambda: node0.getblockcount() > 100, timeout=120)
+        node0.setstaking("false")
+        sync_blocks(self.nodes)
+        stake_hash = node0.getblockhash(101)
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+        coinstake = node0.getrawtransaction(node0.getblock(stake_hash)['tx'][1], True)
+        kernel = node0.getrawtransaction(coinstake['vin'][0]['txid'], True)
+        assert_greater_than(dump['base_height'] + 1, node0.getblock(kernel['blockhash'])['height'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
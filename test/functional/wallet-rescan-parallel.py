@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Lokal Coin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test that the parallel wallet rescan matches the serial rescan.
+
+Node 0 creates a set of addresses, funds them over many blocks and spends
+some of those outputs again (so inputs must be matched against transactions
+found earlier in the same rescan). Node 1 (-rescanthreads=1) and node 2
+(-rescanthreads=4) then import the same keys with a rescan and must end up
+with identical wallets.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, sync_blocks
+
+from decimal import Decimal
+
+class WalletRescanParallelTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+        self.extra_args = [[], ['-rescanthreads=1'], ['-rescanthreads=4']]
+
+    def setup_network(self):
+        self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+
+    def wallet_state(self, node):
+        txs = node.listtransactions("*", 1000, 0, True)
+        txs = sorted((tx['txid'], tx['category'], tx.get('vout', -1), tx['amount'], tx['confirmations']) for tx in txs)
+        utxos = sorted((u['txid'], u['vout'], u['amount']) for u in node.listunspent(0))
+        return node.getbalance("*", 0), txs, utxos
+
+    def run_test(self):
+        self.nodes[0].generate(110)
+
+        self.log.info("Fund and spend a set of addresses over many blocks")
+        addresses = [self.nodes[0].getnewaddress() for _ in range(10)]
+        for i in range(30):
+            self.nodes[0].sendtoaddress(addresses[i % len(addresses)], Decimal("1.5") + i)
+            self.nodes[0].generate(1)
+            if i % 7 == 6:
+                # sweep most of the wallet, spending outputs of the imported keys
+                self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), self.nodes[0].getbalance() - 1)
+                self.nodes[0].generate(1)
+        # some empty blocks, so most of the chain does not match
+        self.nodes[0].generate(50)
+        sync_blocks(self.nodes)
+
+        self.log.info("Import the keys with serial and parallel rescans")
+        keys = [self.nodes[0].dumpprivkey(address) for address in addresses]
+        for node in self.nodes[1:]:
+            for key in keys[:-1]:
+                node.importprivkey(key, "", False)
+            node.importprivkey(keys[-1], "", True)
+
+        serial = self.wallet_state(self.nodes[1])
+        parallel = self.wallet_state(self.nodes[2])
+        assert len(serial[1]) > 0
+        assert_equal(serial, parallel)
+
+        self.log.info("Restart with -rescan and compare again")
+        self.stop_node(1)
+        self.stop_node(2)
+        self.start_node(1, self.extra_args[1] + ['-rescan'])
+        self.start_node(2, self.extra_args[2] + ['-rescan'])
+        assert_equal(self.wallet_state(self.nodes[1]), self.wallet_state(self.nodes[2]))
+        assert_equal(self.wallet_state(self.nodes[2]), parallel)
+
+if __name__ == '__main__':
+    WalletRescanParallelTest().main()